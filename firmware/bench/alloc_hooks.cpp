@@ -0,0 +1,49 @@
+// Counts every heap allocation made by the process by interposing glibc's
+// malloc family. operator new goes through malloc, so C++ allocations and
+// the Arduino String shim are both covered.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "bench.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void  __libc_free(void* ptr);
+}
+
+static std::atomic<uint64_t> allocCount{0};
+static std::atomic<uint64_t> allocBytes{0};
+
+static inline void countAlloc(size_t size) {
+  allocCount.fetch_add(1, std::memory_order_relaxed);
+  allocBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+extern "C" {
+
+void* malloc(size_t size) {
+  countAlloc(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  countAlloc(count * size);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  countAlloc(size);
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) { __libc_free(ptr); }
+
+}  // extern "C"
+
+uint64_t benchAllocCount() { return allocCount.load(std::memory_order_relaxed); }
+uint64_t benchAllocBytes() { return allocBytes.load(std::memory_order_relaxed); }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Micro-benchmark harness (native env) =========
+// Each case runs its body `iterations` times; the runner scales iterations
+// until the timed run is long enough, then reports ns/op and heap
+// allocations per op. A case whose allocs/op exceeds its budget fails the run,
+// so heap regressions on the hot paths break CI even when timings are noisy.
+
+typedef void (*BenchFn)(uint32_t iterations);
+
+struct BenchCase {
+  const char* name;
+  BenchFn     fn;
+  double      maxAllocsPerOp;
+};
+
+struct BenchRegistrar {
+  BenchRegistrar(const char* name, BenchFn fn, double maxAllocsPerOp);
+};
+
+#define BENCH(ident, label, maxAllocsPerOp)                                   \
+  static void bench_##ident(uint32_t iterations);                             \
+  static BenchRegistrar benchRegistrar_##ident(label, bench_##ident, maxAllocsPerOp); \
+  static void bench_##ident(uint32_t iterations)
+
+// Heap counters maintained by the malloc hooks in alloc_hooks.cpp.
+uint64_t benchAllocCount();
+uint64_t benchAllocBytes();
+
+// Extra line printed under the case's row (last run wins), for figures that
+// ns/op does not capture: NVS lookups, latency percentiles, drop counts.
+void benchNote(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Seed corpus root for the fuzz cases ("bench/corpus" unless --corpus is given).
+const char* benchCorpusDir();
+
+// Resets the HAL fakes and firmware globals to a freshly booted unit
+// (empty NVS, MQTT disabled, fan off, log muted).
+void benchResetFirmware();
+
+template <typename T>
+inline void benchKeep(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
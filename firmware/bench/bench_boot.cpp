@@ -0,0 +1,53 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "boot.h"
+#include "hal_native.h"
+
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+// ========= Fast boot =========
+// /boot and the retained MQTT copy; phases render in order, unreached ones
+// are left out.
+BENCH(boot_timeline, "boot/render timeline", 0) {
+  bootSetInfo("software", "cached");
+  BootPhase phases[] = {BootPhase::Setup, BootPhase::ConfigLoaded, BootPhase::FanApplied,
+                        BootPhase::WifiStart, BootPhase::HttpUp, BootPhase::LinkUp};
+  for (BootPhase phase : phases) {
+    simClock.nowMs += 37;
+    bootMark(phase);
+  }
+  bootMark(BootPhase::Setup);  // a second mark must not move the first
+  char body[256];
+  size_t len = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    len = bootRenderTimeline(body, sizeof(body));
+    benchKeep(body);
+  }
+  static const char kExpected[] =
+      "{\"reset\":\"software\",\"wifi\":\"cached\",\"phases_ms\":{\"setup\":37,\"config\":74,"
+      "\"fan\":111,\"wifi_start\":148,\"http\":185,\"link\":222}}";
+  if (len != sizeof(kExpected) - 1 || strcmp(body, kExpected) != 0) fail("boot/render timeline", body);
+}
+
+// Runs on every link-up; unchanged association parameters must not touch flash.
+BENCH(boot_wifi_cache, "boot/store wifi cache unchanged", 0) {
+  WifiFastCache cache = {{0x24, 0x0a, 0xc4, 0x12, 0x34, 0x56}, 6};
+  bootStoreWifiCache(cache);
+  uint32_t writes0 = memNvs.writes;
+  for (uint32_t i = 0; i < iterations; i++) {
+    bootStoreWifiCache(cache);
+  }
+  WifiFastCache loaded;
+  if (!bootLoadWifiCache(loaded) || memcmp(loaded.bssid, cache.bssid, 6) != 0 || loaded.channel != 6) {
+    fail("boot/wifi cache", "round trip");
+  }
+  if (memNvs.writes != writes0) fail("boot/wifi cache", "rewrote an unchanged cache");
+  bootClearWifiCache();
+  if (bootLoadWifiCache(loaded)) fail("boot/wifi cache", "still there after clear");
+}
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "config.h"
+#include "hal_native.h"
+#include "scheduler.h"
+
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+// ========= Config I/O =========
+BENCH(load_config, "config/loadConfig", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    loadConfig();
+  }
+}
+
+// Boot read: one blob lookup plus the CRC. Aborts if it takes more NVS
+// lookups than that.
+BENCH(read_config_record, "config/boot read (record)", 0) {
+  Config config;
+  uint32_t reads0 = memNvs.reads;
+  for (uint32_t i = 0; i < iterations; i++) {
+    if (!configReadRecord(*hal.nvs, config)) fail("config/boot read", "no record");
+  }
+  if (memNvs.reads - reads0 != iterations) fail("config/boot read", "more than one NVS read per boot");
+  benchNote("1 NVS lookup per boot");
+}
+
+// What the same read cost before the record: ten key lookups plus defaults.
+// In-memory lookups are nearly free, so on the host the two cases time about
+// the same; on the device each NVS lookup searches the namespace's flash
+// pages, and the lookup count in the notes is what boot time follows.
+BENCH(read_config_legacy, "config/boot read (legacy keys)", 0) {
+  NvsStore& nvs = *hal.nvs;
+  nvs.putBool("mqtt_enabled", true);
+  nvs.putString("mqtt_host", "broker.lan");
+  nvs.putInt("mqtt_port", 1883);
+  nvs.putString("mqtt_user", "fan");
+  nvs.putString("mqtt_pass", "secret");
+  nvs.putString("cmd_topic", "bambu/p1s/fan/cmd");
+  nvs.putString("state_topic", "bambu/p1s/fan/state");
+  nvs.putString("status_topic", "bambu/p1s/fan/status");
+  nvs.putInt("fan_def_spd", 60);
+  nvs.putBool("fan_def_on", true);
+  Config config;
+  uint32_t reads0 = memNvs.reads;
+  for (uint32_t i = 0; i < iterations; i++) {
+    configReadLegacy(nvs, config);
+  }
+  benchNote("%u NVS lookups per boot", (unsigned)((memNvs.reads - reads0) / iterations));
+}
+
+BENCH(save_config, "config/saveConfig unchanged", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    saveConfig();
+  }
+}
+
+BENCH(save_config_speed, "config/saveConfig speed change", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    currentConfig.fan_default_speed[0] = (i & 1) ? 4000 : 6000;
+    saveConfig();
+  }
+}
+
+// The web UI sends speed= every 80 ms while the slider is dragged. With the
+// write-behind cache a whole drag is one record write once it goes quiet;
+// the case aborts if the last value is not in flash afterwards or if more
+// than the drag's end and the max-defer flushes hit NVS.
+BENCH(config_slider_drag, "config/slider drag (write-behind)", 0) {
+  uint32_t writes0 = memNvs.writes;
+  int speed = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    speed = 3000 + (int)(i * 37 % 7000);  // sub-percent steps must survive the record
+    currentConfig.fan_default_speed[0] = speed;
+    configMarkDirty(CFG_FAN_DEF_SPD);
+    simClock.nowMs += 80;
+    schedulerRunOnce();
+  }
+  simClock.nowMs += CONFIG_SAVE_QUIET_MS + SCHED_TICK_MS;
+  schedulerRunOnce();
+
+  uint32_t maxFlushes = iterations * 80 / CONFIG_SAVE_MAX_DEFER_MS + 1;
+  if (configDirtyFields() != 0) fail("config/slider drag", "still dirty after the quiet period");
+  if (memNvs.writes - writes0 > 2 * maxFlushes) {
+    fprintf(stderr, "config/slider drag: %u NVS writes for %u changes\n",
+            (unsigned)(memNvs.writes - writes0), (unsigned)iterations);
+    abort();
+  }
+  loadConfig();
+  if (currentConfig.fan_default_speed[0] != speed) fail("config/slider drag", "last setpoint not in flash");
+}
+
+// Legacy keys migrate into the record once; power cut at every write of a
+// save must boot with either the old or the new config, never defaults.
+BENCH(config_migrate_torn, "config/migrate + torn write", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    memNvs.clear();
+    hal.nvs->putString("mqtt_host", "broker.lan");
+    hal.nvs->putInt("fan_def_spd", 70);
+    loadConfig();
+    if (strcmp(configBootSource(), "legacy") != 0 || currentConfig.fan_default_speed[0] != 7000 ||
+        strcmp(currentConfig.mqtt_host, "broker.lan") != 0) {
+      fail("config/migrate", "legacy keys not migrated");
+    }
+    char host[8];
+    if (hal.nvs->getString("mqtt_host", host, sizeof(host)) != 0) fail("config/migrate", "legacy key left behind");
+    loadConfig();
+    if (strcmp(configBootSource(), "record") != 0) fail("config/migrate", "second boot not from the record");
+
+    int cutAt = (int)(i % 2);  // tear the backup write, then the primary
+    memNvs.cutPowerAfter(cutAt);
+    currentConfig.fan_default_speed[0] = 4025;
+    saveConfig();
+    if (!memNvs.powerCut()) fail("config/torn", "power cut not simulated");
+    memNvs.restorePower();
+    loadConfig();  // reboot on whatever survived
+    int expected = cutAt == 0 ? 7000 : 4025;  // torn backup: old primary; torn primary: new backup
+    const char* source = cutAt == 0 ? "record" : "backup";
+    if (currentConfig.fan_default_speed[0] != expected || strcmp(configBootSource(), source) != 0) {
+      fail("config/torn", "did not fall back to the last good copy");
+    }
+  }
+}
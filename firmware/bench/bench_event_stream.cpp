@@ -0,0 +1,207 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <lwip/sockets.h>
+
+#include "bench.h"
+#include "event_stream.h"
+#include "fan_control.h"
+#include "fan_state.h"
+#include "hal_native.h"
+
+// ========= Event stream (loopback sockets) =========
+// The real stream on 127.0.0.1, serviced from this thread like the "events"
+// task would; subscribers are non-blocking client sockets.
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+namespace {
+
+// `rcvbuf` > 0 shrinks the receive window, so a subscriber that never reads
+// backs the server up after a few events instead of a few megabytes.
+int subscribe(uint16_t port, int rcvbuf = 0) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return -1;
+  if (rcvbuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  static const char kRequest[] = "GET /events HTTP/1.1\r\nAccept: text/event-stream\r\n\r\n";
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || send(fd, kRequest, sizeof(kRequest) - 1, MSG_NOSIGNAL) < 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
+
+// Stream text read so far by one subscriber.
+struct Reader {
+  int    fd;
+  size_t len;
+  char   buf[4096];
+};
+
+// Services the stream until `text` has arrived on `r` and drops everything
+// up to and including it; false if it never comes or the stream ends.
+bool await(Reader& r, const char* text) {
+  size_t textLen = strlen(text);
+  for (int spin = 0; spin < 20000; spin++) {
+    eventStreamService();
+    ssize_t n = recv(r.fd, r.buf + r.len, sizeof(r.buf) - 1 - r.len, MSG_DONTWAIT);
+    if (n == 0) return false;
+    if (n > 0) {
+      r.len += (size_t)n;
+      r.buf[r.len] = '\0';
+    }
+    const char* at = strstr(r.buf, text);
+    if (at) {
+      size_t used = (size_t)(at - r.buf) + textLen;
+      memmove(r.buf, r.buf + used, r.len - used + 1);
+      r.len -= used;
+      return true;
+    }
+    if (r.len + 1 == sizeof(r.buf)) {  // keep the tail, where a split match starts
+      memmove(r.buf, r.buf + r.len - textLen, textLen + 1);
+      r.len = textLen;
+    }
+  }
+  return false;
+}
+
+// True once the server has closed `fd`.
+bool closedByServer(int fd) {
+  char scratch[4096];
+  for (int spin = 0; spin < 20000; spin++) {
+    eventStreamService();
+    ssize_t n = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+    if (n == 0) return true;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return true;
+  }
+  return false;
+}
+
+void nextState(uint32_t i) {
+  handleFanSpeed(fanChannels[0], 3000 + (int)(i % 2000));
+}
+
+}  // namespace
+
+// One subscriber follows state changes event by event (each op is one change
+// and the event that carries it). Then a subscriber that never reads: the
+// stream writes what its socket takes and moves on, so the passes stay short
+// while it backs up, the write timeout closes it, and with every slot taken
+// the stalled one makes room for a newcomer once it has been stalled for
+// EVENT_STREAM_STALL_MS; with none stalled a fifth gets a 503, also when two
+// arrive in the same pass. The note has the longest pass seen with the stalled subscriber.
+BENCH(events_stream, "events/stream + stalled subscriber (sockets)", 0) {
+  if (!eventStreamBegin(0)) fail("events/stream", "cannot listen");
+  uint16_t port = eventStreamPort();
+
+  static Reader live;
+  live.fd = subscribe(port);
+  live.len = 0;
+  char expect[32];
+  snprintf(expect, sizeof(expect), "id: %lu\ndata: {", (unsigned long)fanStateSnapshot().version);
+  if (live.fd < 0 || !await(live, "text/event-stream") || !await(live, expect)) {
+    fail("events/stream", "no headers and current state for a new subscriber");
+  }
+  for (uint32_t i = 0; i < iterations; i++) {
+    nextState(i);
+    snprintf(expect, sizeof(expect), "id: %lu\n", (unsigned long)fanStateSnapshot().version);
+    if (!await(live, expect)) fail("events/stream", "state change not pushed");
+  }
+
+  // Three slots taken and two browsers arriving in one pass: the first takes
+  // the last slot, the second gets a 503. The first still has its headers
+  // queued, which does not make it stalled.
+  int reading[EVENT_STREAM_MAX_CLIENTS] = {live.fd};
+  size_t readingCount = 1;
+  while (readingCount < EVENT_STREAM_MAX_CLIENTS - 1) reading[readingCount++] = subscribe(port);
+  eventStreamService();
+  int first = subscribe(port);
+  static Reader second;
+  second.fd = subscribe(port);
+  second.len = 0;
+  eventStreamService();
+  if (eventStreamStats().open != EVENT_STREAM_MAX_CLIENTS || eventStreamStats().evicted != 0 ||
+      eventStreamStats().refused != 1 || !await(second, "503 Service Unavailable")) {
+    fail("events/stream", "a subscriber from the same pass evicted for another");
+  }
+  close(second.fd);
+  close(first);
+  for (int spin = 0; spin < 20000 && eventStreamStats().open == EVENT_STREAM_MAX_CLIENTS; spin++) eventStreamService();
+
+  // Backs up a subscriber that never reads; the others are read throughout.
+  uint32_t maxPassUs = 0;
+  auto stall = [&]() {
+    char scratch[4096];
+    for (uint32_t i = 0; i < 200000; i++) {
+      uint32_t before = eventStreamStats().events;
+      nextState(i);
+      auto t0 = std::chrono::steady_clock::now();
+      eventStreamService();
+      auto t1 = std::chrono::steady_clock::now();
+      uint32_t us = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+      if (us > maxPassUs) maxPassUs = us;
+      for (size_t r = 0; r < readingCount; r++) {
+        while (recv(reading[r], scratch, sizeof(scratch), MSG_DONTWAIT) > 0) {
+        }
+      }
+      // Every reader took the change, the silent one did not.
+      if (i > 0 && eventStreamStats().events - before == readingCount) return;
+    }
+    fail("events/stream", "silent subscriber never backed up");
+  };
+  int silent = subscribe(port, 1024);
+  if (silent < 0) fail("events/stream", "cannot connect");
+  stall();
+  simClock.advance(EVENT_STREAM_WRITE_TIMEOUT_MS);
+  if (!closedByServer(silent) || eventStreamStats().timedOut != 1) fail("events/stream", "stalled subscriber kept");
+  close(silent);
+  live.len = 0;
+  nextState(1);
+  snprintf(expect, sizeof(expect), "id: %lu\n", (unsigned long)fanStateSnapshot().version);
+  if (!await(live, expect)) fail("events/stream", "live subscriber lost with the stalled one");
+
+  // Every slot taken, one of them backed up: not for long enough, so a
+  // newcomer is turned away; past the stall threshold it takes that place.
+  silent = subscribe(port, 1024);
+  stall();
+  static Reader early;
+  early.fd = subscribe(port);
+  early.len = 0;
+  if (early.fd < 0 || !await(early, "503 Service Unavailable") || eventStreamStats().evicted != 0) {
+    fail("events/stream", "briefly backed-up subscriber evicted");
+  }
+  close(early.fd);
+  simClock.advance(EVENT_STREAM_STALL_MS);
+  static Reader late;
+  late.fd = subscribe(port);
+  late.len = 0;
+  if (late.fd < 0 || !await(late, "text/event-stream") || !closedByServer(silent) ||
+      eventStreamStats().evicted != 1) {
+    fail("events/stream", "stalled subscriber not evicted for a new one");
+  }
+  close(silent);
+
+  // None stalled: the next one is turned away, the others stay.
+  static Reader refused;
+  refused.fd = subscribe(port);
+  refused.len = 0;
+  if (refused.fd < 0 || !await(refused, "503 Service Unavailable") || eventStreamStats().refused != 3 ||
+      eventStreamStats().open != EVENT_STREAM_MAX_CLIENTS) {
+    fail("events/stream", "subscriber past the slots not refused");
+  }
+  close(refused.fd);
+  close(late.fd);
+  for (size_t r = 0; r < readingCount; r++) close(reading[r]);
+  benchNote("%lu events queued; longest pass with a stalled subscriber %lu us", (unsigned long)eventStreamStats().events,
+            (unsigned long)maxPassUs);
+}
@@ -0,0 +1,179 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_state.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "mqtt_link.h"
+
+// ========= PWM helpers =========
+BENCH(speed_to_duty, "fan/speedToDuty", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    benchKeep(speedToDuty((int)(i % (SPEED_FULL + 1))));
+  }
+}
+
+// ========= Actuation =========
+BENCH(fan_speed_offline, "fan/handleFanSpeed mqtt-off", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleFanSpeed(fanChannels[0], (i & 1) ? 4000 : 6000);
+  }
+}
+
+BENCH(fan_speed_publish, "fan/handleFanSpeed mqtt-on", 0) {
+  currentConfig.mqtt_enabled = true;
+  fakeMqtt.isConnected = true;
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleFanSpeed(fanChannels[0], (i & 1) ? 4000 : 6000);
+  }
+}
+
+// Off -> 20 % request: kick to PCT_MIN_START, settle, then drop to the target.
+BENCH(soft_start, "fan/soft-start cycle", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleFanSpeed(fanChannels[0], 0);
+    handleFanSpeed(fanChannels[0], 2000);
+    simClock.advance(FAN_RAMP_UP_MS_DEFAULT + SOFT_START_SETTLE_MS);  // ramp to the kick, then settle
+    fanTaskService();
+    if (fanChannels[0].speed != 2000) {
+      fprintf(stderr, "fan/soft-start: settled at %d, expected 2000 (20 %%)\n", fanChannels[0].speed);
+      abort();
+    }
+  }
+}
+
+BENCH(mqtt_command, "mqtt/callback -> handleFanSpeed", 0) {
+  static const char kTopic[] = "bambu/p1s/fan/cmd";
+  static const uint8_t kPayloads[2][8] = {{'4', '0'}, {'6', '0'}};
+  currentConfig.mqtt_enabled = true;
+  fakeMqtt.isConnected = true;
+  for (uint32_t i = 0; i < iterations; i++) {
+    mqttCallback((char*)kTopic, (uint8_t*)kPayloads[i & 1], 2);
+  }
+}
+
+// ========= Ramp =========
+// 0 -> 100 % at the default limits, retargeted to 30 % half-way up: the
+// output must never move faster than the configured slew, must continue from
+// where it was when retargeted, and the state payload must show the in-flight
+// output next to the target until the ramp arrives (state window off, so
+// the payload is the one the command produced).
+BENCH(ramp, "fan/ramp slew + retarget", 0) {
+  const int upPerMs = DUTY_MAX / FAN_RAMP_UP_MS_DEFAULT + 1;
+  const int downPerMs = DUTY_MAX / FAN_RAMP_DOWN_MS_DEFAULT + 1;
+  currentConfig.mqtt_enabled = true;
+  currentConfig.mqtt_state_window_ms = 0;
+  fakeMqtt.isConnected = true;
+  uint32_t tookMs = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    writeDutyActiveLow(fanChannels[0], 0);
+    handleFanSpeed(fanChannels[0], SPEED_FULL);
+    if (fanStatus().fans[0].duty != DUTY_MAX || fanStatus().fans[0].outputDuty != 0 || !strstr(fakeMqtt.lastPayload, "\"output_duty\":0")) {
+      fprintf(stderr, "fan/ramp: start reported duty %d, output %d\n", fanStatus().fans[0].duty, fanStatus().fans[0].outputDuty);
+      abort();
+    }
+    int prev = invertDuty((int)nativePwm[0].dutyNow());
+    uint32_t startMs = simClock.nowMs;
+    for (uint32_t t = 1; fanStatus().fans[0].outputDuty != fanStatus().fans[0].duty || t <= FAN_RAMP_UP_MS_DEFAULT / 2; t++) {
+      if (t == FAN_RAMP_UP_MS_DEFAULT / 2) handleFanSpeed(fanChannels[0], 3000);
+      simClock.advance(1);
+      fanTaskService();
+      int now = invertDuty((int)nativePwm[0].dutyNow());
+      if (now - prev > upPerMs || prev - now > downPerMs || t > 10000) {
+        fprintf(stderr, "fan/ramp: output moved %d -> %d in 1 ms at t=%u\n", prev, now, t);
+        abort();
+      }
+      prev = now;
+    }
+    tookMs = simClock.nowMs - startMs;
+    if (prev != speedToDuty(3000) || fanStatus().fans[0].outputDuty != speedToDuty(3000)) {
+      fprintf(stderr, "fan/ramp: ended at %d, expected %d\n", prev, speedToDuty(3000));
+      abort();
+    }
+  }
+  benchNote("0 -> 100 %% retargeted to 30 %% half-way: arrived after %u ms", tookMs);
+}
+
+// ========= Fixed point =========
+// Speeds are 0.01 % units from the parser to /status and the MQTT state: a
+// sub-percent command must come back out verbatim, and across the usable
+// range every 0.25 % step must still move the duty at PWM_RES_BITS.
+BENCH(sub_percent, "fan/sub-percent setpoint", 0) {
+  static const char kTopic[] = "bambu/p1s/fan/cmd";
+  static const uint8_t kPayload[] = {'4', '2', '.', '7', '5'};
+  currentConfig.mqtt_enabled = true;
+  fakeMqtt.isConnected = true;
+  int steps = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    mqttCallback((char*)kTopic, (uint8_t*)kPayload, sizeof(kPayload));
+    fanStateRefresh();
+    if (fanChannels[0].speed != 4275 || !strstr(fanStateSnapshot().json, "\"speed\":42.75") ||
+        !strstr(fakeMqtt.lastPayload, "\"setpoint\":42.75")) {
+      fprintf(stderr, "fan/sub-percent: speed %d, status %s, mqtt %s\n", fanChannels[0].speed, fanStateSnapshot().json,
+              fakeMqtt.lastPayload);
+      abort();
+    }
+    steps = 0;
+    for (int speed = 30 * SPEED_SCALE; speed < SPEED_FULL; speed += SPEED_SCALE / 4) {
+      if (speedToDuty(speed + SPEED_SCALE / 4) <= speedToDuty(speed)) {
+        fprintf(stderr, "fan/sub-percent: %d and %d map to the same duty\n", speed, speed + SPEED_SCALE / 4);
+        abort();
+      }
+      steps++;
+    }
+  }
+  benchNote("%d-bit duty at %u Hz; %d distinct 0.25 %% steps from 30 %% up", PWM_RES_BITS, (unsigned)PWM_FREQ_HZ, steps);
+}
+
+// ========= Channels =========
+// Built with FAN_CHANNELS >= 2 (the native env is): a batch sets every
+// channel from one message with a single state publish, "<cmd>/1" moves
+// channel 1 alone, and each channel drives its own PWM output. The state
+// window is off so the publish count is the batch's own.
+BENCH(multi_channel, "fan/multi-channel batch", 0) {
+  if (FAN_CHANNEL_COUNT < 2) {
+    benchNote("single-channel build, skipped");
+    return;
+  }
+  static const char kTopic[] = "bambu/p1s/fan/cmd";
+  static const char kTopic1[] = "bambu/p1s/fan/cmd/1";
+  static const char kStop[] = "{\"speed\":[0,0]}";
+  static const char kBatch[] = "{\"speed\":[60,42.5]}";
+  static const uint8_t kThirty[] = {'3', '0'};
+  currentConfig.mqtt_enabled = true;
+  currentConfig.mqtt_state_window_ms = 0;
+  fakeMqtt.isConnected = true;
+  uint32_t batchPublishes = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    mqttCallback((char*)kTopic, (uint8_t*)kStop, sizeof(kStop) - 1);
+    simClock.advance(FAN_RAMP_DOWN_MS_DEFAULT);
+    fanTaskService();
+    uint32_t before = fakeMqtt.publishes;
+    mqttCallback((char*)kTopic, (uint8_t*)kBatch, sizeof(kBatch) - 1);
+    batchPublishes = fakeMqtt.publishes - before;
+    if (batchPublishes != 1 || fanStatus().fans[0].setpoint != 6000 || fanStatus().fans[1].setpoint != 4250 ||
+        !strstr(fakeMqtt.lastPayload, "\"fans\":[")) {
+      fprintf(stderr, "fan/multi-channel: batch gave %u publishes, setpoints %d/%d, mqtt %s\n", batchPublishes,
+              fanStatus().fans[0].setpoint, fanStatus().fans[1].setpoint, fakeMqtt.lastPayload);
+      abort();
+    }
+    simClock.advance(FAN_RAMP_UP_MS_DEFAULT + SOFT_START_SETTLE_MS);
+    fanTaskService();
+    mqttCallback((char*)kTopic1, (uint8_t*)kThirty, sizeof(kThirty));
+    simClock.advance(FAN_RAMP_DOWN_MS_DEFAULT);
+    fanTaskService();
+    fanStateRefresh();
+    if (fanChannels[0].speed != 6000 || fanChannels[1].speed != 3000 ||
+        nativePwm[0].lastDuty == nativePwm[1].lastDuty || !strstr(fanStateSnapshot().json, "\"fans\":[")) {
+      fprintf(stderr, "fan/multi-channel: speeds %d/%d, pwm %u/%u, status %s\n", fanChannels[0].speed,
+              fanChannels[1].speed, nativePwm[0].lastDuty, nativePwm[1].lastDuty, fanStateSnapshot().json);
+      abort();
+    }
+  }
+  benchNote("%u channels; batch of %u setpoints -> %u state publish", (unsigned)FAN_CHANNEL_COUNT,
+            (unsigned)FAN_CHANNEL_COUNT, batchPublishes);
+}
@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_profile.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "mqtt_link.h"
+#include "web_api.h"
+
+// ========= Speed profiles =========
+namespace {
+
+void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+// Runs the fan side and the status drain for `ms`, a second at a time.
+void runFor(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += 1000) {
+    simClock.advance(1000);
+    fanTaskService();
+    fanStatusDrain();
+  }
+}
+
+}  // namespace
+
+BENCH(profile_parse, "profile/parse", 0) {
+  static const char kPurge[] = "300:100; 1200:60:5000 ;0:0";
+  FanProfile profile;
+  for (uint32_t i = 0; i < iterations; i++) {
+    if (!fanProfileParse(kPurge, sizeof(kPurge) - 1, profile) || profile.count != 3 ||
+        profile.steps[1].speed != 6000 || profile.steps[1].rampMs != 5000 ||
+        profile.steps[0].rampMs != FAN_PROFILE_RAMP_RATE) {
+      fail("profile/parse", "purge profile misread");
+    }
+  }
+  static const char* const kBad[] = {"", ";", "300", "300:", ":60", "x:60", "300:60:", "300:60:70000",
+                                     "90000:60", "300:abc", "1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1;1:1"};
+  for (const char* bad : kBad) {
+    if (fanProfileParse(bad, strlen(bad), profile)) {
+      fprintf(stderr, "profile/parse: accepted \"%s\"\n", bad);
+      abort();
+    }
+  }
+}
+
+// The purge sequence uploaded once over HTTP: every step must arrive on the
+// device's own clock with no further requests, progress must show in the
+// MQTT state, and a manual command must take over from a running profile.
+BENCH(profile_purge, "profile/purge run + pre-empt", 0) {
+  currentConfig.mqtt_enabled = true;
+  currentConfig.mqtt_state_window_ms = 0;
+  fakeMqtt.isConnected = true;
+  for (uint32_t i = 0; i < iterations; i++) {
+    fakeHttp.setQuery("steps=300:100;1200:60;0:0");
+    handleProfileApi();
+    if (fakeHttp.lastCode != 200 || fanChannels[0].speed != SPEED_FULL ||
+        !strstr(fakeMqtt.lastPayload, "\"profile\":{\"step\":1,\"steps\":3,\"left_s\":1500}")) {
+      fprintf(stderr, "profile/purge: start gave %d, mqtt %s\n", fanChannels[0].speed, fakeMqtt.lastPayload);
+      abort();
+    }
+    runFor(299000);
+    if (fanChannels[0].speed != SPEED_FULL) fail("profile/purge", "first step ended early");
+    runFor(2000);
+    if (fanChannels[FAN_CHANNEL_COUNT - 1].speed != 6000 || !strstr(fakeMqtt.lastPayload, "\"step\":2")) {
+      fail("profile/purge", "second step missing");
+    }
+    runFor(1200000);
+    if (fanChannels[0].duty != 0 || fanStatus().profileStep != 0 || strstr(fakeMqtt.lastPayload, "\"profile\"")) {
+      fail("profile/purge", "profile did not end off");
+    }
+
+    // Manual command ten seconds in: the profile stops and stays stopped.
+    handleProfileApi();  // same query: runs it again
+    runFor(10000);
+    static uint8_t manual[] = {'4', '0'};
+    mqttCallback(currentConfig.mqtt_command_topic, manual, sizeof(manual));
+    runFor(400000);
+    if (fanChannels[0].speed != 4000 || fanStatus().profileStep != 0) fail("profile/purge", "not pre-empted");
+    if (FAN_CHANNEL_COUNT > 1 && fanChannels[1].speed != SPEED_FULL) {
+      fail("profile/purge", "pre-empting channel 0 moved the others");
+    }
+  }
+
+  // The same over MQTT, then "stop", which leaves the fan where it was.
+  char topic[sizeof(currentConfig.mqtt_command_topic) + 8];
+  snprintf(topic, sizeof(topic), "%s/profile", currentConfig.mqtt_command_topic);
+  static uint8_t kMqttProfile[] = {'6', '0', ':', '8', '0', ';', '0', ':', '0'};
+  static uint8_t kStop[] = {'s', 't', 'o', 'p'};
+  mqttCallback(topic, kMqttProfile, sizeof(kMqttProfile));
+  runFor(10000);
+  if (fanChannels[0].speed != 8000 || fanStatus().profileStep != 1) fail("profile/purge", "MQTT upload not run");
+  mqttCallback(topic, kStop, sizeof(kStop));
+  runFor(60000);
+  if (fanChannels[0].speed != 8000 || fanStatus().profileStep != 0) fail("profile/purge", "MQTT stop ignored");
+
+  // An upload the full command queue refuses: a 503, the last upload still
+  // shown, and nothing runs once the queue drains; the retry does.
+  fanCommandsHold();
+  while (fanCommandPost(FanCommandKind::Report, 0)) {
+  }
+  fakeHttp.setQuery("steps=120:30;0:0");
+  handleProfileApi();
+  if (fakeHttp.lastCode != 503 || !strstr(fakeHttp.lastBody, "\"error\"")) fail("profile/purge", "refused upload answered 200");
+  fanCommandsRelease();
+  runFor(10000);
+  fakeHttp.setQuery("");
+  handleProfileApi();
+  if (fanChannels[0].speed != 8000 || fanStatus().profileStep != 0 || !strstr(fakeHttp.lastBody, "60:80")) {
+    fail("profile/purge", "refused upload staged");
+  }
+  fakeHttp.setQuery("steps=120:30;0:0");
+  handleProfileApi();
+  runFor(10000);
+  if (fakeHttp.lastCode != 200 || fanChannels[0].speed != 3000 || fanStatus().profileStep != 1) {
+    fail("profile/purge", "retried upload not run");
+  }
+
+  fakeHttp.setQuery("steps=300:banana");
+  handleProfileApi();
+  if (fakeHttp.lastCode != 400) fail("profile/purge", "bad upload accepted");
+  fakeHttp.setQuery("");
+  handleProfileApi();
+  benchNote("%s", fakeHttp.lastBody);
+}
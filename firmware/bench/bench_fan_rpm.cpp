@@ -0,0 +1,218 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "fan_rpm.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "scheduler.h"
+#include "sim_fan.h"
+#include "speed_command.h"
+
+namespace {
+
+// Fan at rest with the simulated plant bound as the tach.
+void closeLoop() {
+  handleFanSpeed(fanChannels[0], 0);
+  fanRpmReset();
+  simFan.reset();
+  hal.tach = &simFan;
+}
+
+// Steps the clock 1 ms at a time, servicing the fan task like its wake-ups would.
+// Returns the last time (ms from the start) the plant was outside +-band of target.
+uint32_t runFor(uint32_t ms, int target, float band, float& peak) {
+  uint32_t lastOut = 0;
+  for (uint32_t t = 1; t <= ms; t++) {
+    simClock.advance(1);
+    fanTaskService();
+    float rpm = simFan.rpm();
+    if (rpm > peak) peak = rpm;
+    float err = rpm - target;
+    if (err > band * target || err < -band * target) lastOut = t;
+  }
+  return lastOut;
+}
+
+}  // namespace
+
+// ========= Parsing =========
+BENCH(parse_rpm, "parse/rpm command", 0) {
+  static const char* const kPayloads[] = {"RPM:9000", "{\"rpm\": 12000}", "60", "{\"speed\":40}"};
+  static const int kExpected[] = {9000, 12000, -1, -1};
+  for (uint32_t i = 0; i < iterations; i++) {
+    size_t k = i & 3;
+    int rpm = -1;
+    bool ok = parseRpmCommand((const uint8_t*)kPayloads[k], strlen(kPayloads[k]), rpm);
+    if (ok != (kExpected[k] >= 0) || (ok && rpm != kExpected[k])) {
+      fprintf(stderr, "parse/rpm: \"%s\" -> %d (ok=%d)\n", kPayloads[k], rpm, ok);
+      abort();
+    }
+  }
+}
+
+// ========= Closed loop =========
+// 0 -> 9000 rpm on the simulated plant, then the filter loads up (-20 % airflow
+// per duty). The loop must settle within +-3 % without overshooting past 8 %,
+// and win the speed back after the load step.
+BENCH(rpm_step, "rpm/step + load change (sim plant)", 0) {
+  const int kTarget = 9000;
+  const float kBand = 0.03f;
+  uint32_t settle = 0, recover = 0;
+  float peak = 0;
+
+  // Without a tach an RPM command falls back to the equivalent speed share.
+  fanCommandPost(FanCommandKind::Rpm, kTarget);
+  if (fanTargetRpm() != 0 || fanChannels[0].speed != 50 * SPEED_SCALE) {
+    fprintf(stderr, "rpm/step: no-tach fallback ran at %d (target %d)\n", fanChannels[0].speed, fanTargetRpm());
+    abort();
+  }
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    closeLoop();
+    peak = 0;
+    fanCommandPost(FanCommandKind::Rpm, kTarget);
+    settle = runFor(3000, kTarget, kBand, peak);
+    float stepPeak = peak;
+    simFan.load = 0.8f;
+    recover = runFor(3000, kTarget, kBand, peak);
+    if (settle > 2500 || stepPeak > kTarget * 1.08f || recover > 2000) {
+      fprintf(stderr, "rpm/step: settled after %u ms, peak %.0f rpm, load recovery %u ms\n",
+              settle, stepPeak, recover);
+      abort();
+    }
+    peak = stepPeak;
+  }
+  benchNote("settle %u ms, overshoot %.1f %%, load-step recovery %u ms, final %d rpm at %d.%02d%%",
+            settle, 100.0f * (peak - kTarget) / kTarget, recover, fanMeasuredRpm(),
+            fanChannels[0].speed / SPEED_SCALE, fanChannels[0].speed % SPEED_SCALE);
+}
+
+namespace {
+
+// Runs with the rotor held until the stall is flagged; aborts unless that
+// took exactly FAN_STALL_MAX_KICKS kicks. Returns ms to the flag.
+uint32_t holdUntilFlagged(const char* bench) {
+  simFan.blocked = true;
+  int kicks = 0;
+  bool atFull = false;
+  uint32_t flaggedAfter = 0;
+  for (uint32_t t = 1; t <= 8000 && !flaggedAfter; t++) {
+    simClock.advance(1);
+    fanTaskService();
+    if (fanChannels[0].duty == DUTY_MAX && !atFull) kicks++;
+    atFull = fanChannels[0].duty == DUTY_MAX;
+    if (fanStalled()) flaggedAfter = t;
+  }
+  if (kicks != FAN_STALL_MAX_KICKS || !flaggedAfter || !fanStatus().stalled) {
+    fprintf(stderr, "%s: %d kicks, flagged after %u ms\n", bench, kicks, flaggedAfter);
+    abort();
+  }
+  return flaggedAfter;
+}
+
+// Released: the next retry kick gets it turning and clears the flag.
+void releaseAndRecover(const char* bench) {
+  simFan.blocked = false;
+  float peak = 0;
+  runFor(FAN_STALL_RETRY_MS + 2000, 0, 0, peak);
+  if (fanStalled() || fanChannels[0].speed != 60 * SPEED_SCALE || fanMeasuredRpm() < 5000) {
+    fprintf(stderr, "%s: after release stalled=%d at %d%%, %d rpm\n", bench, fanStalled(), fanChannels[0].speed,
+            fanMeasuredRpm());
+    abort();
+  }
+}
+
+}  // namespace
+
+// Rotor held while running at 60 %: the unit kicks it FAN_STALL_MAX_KICKS times,
+// flags the stall, and clears the flag once a retry kick gets it turning again.
+BENCH(rpm_stall, "rpm/stall kick-start (sim plant)", 0) {
+  uint32_t flaggedAfter = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    closeLoop();
+    handleFanSpeed(fanChannels[0], 60 * SPEED_SCALE);
+    float peak = 0;
+    runFor(2000, 0, 0, peak);
+    flaggedAfter = holdUntilFlagged("rpm/stall");
+    releaseAndRecover("rpm/stall");
+  }
+  benchNote("stall flagged %u ms after the rotor was held", flaggedAfter);
+}
+
+// Jammed at power-on: the rotor is held before the fan is first driven, so
+// the tach has never produced an edge. It gets the same kicks and flag.
+BENCH(rpm_stall_from_rest, "rpm/stall from rest (sim plant)", 0) {
+  uint32_t flaggedAfter = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    closeLoop();
+    simFan.blocked = true;
+    handleFanSpeed(fanChannels[0], 60 * SPEED_SCALE);
+    flaggedAfter = holdUntilFlagged("rpm/stall from rest");
+    releaseAndRecover("rpm/stall from rest");
+  }
+  benchNote("stall flagged %u ms after the first drive", flaggedAfter);
+}
+
+// ========= Calibration =========
+// Full sweep on a simulated fan behind a restrictive filter: the table must
+// come out monotonic with thresholds just above the plant's real ones, the
+// previous speed must come back, percentages must then land within 4 points
+// of the same share of the measured top speed, and the table must survive a
+// reboot through NVS.
+BENCH(calibration, "curve/calibration sweep (sim plant)", 0) {
+  uint32_t tookMs = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    benchResetFirmware();
+    closeLoop();
+    simFan.load = 0.85f;
+    handleFanSpeed(fanChannels[0], 40 * SPEED_SCALE);
+    uint32_t startMs = simClock.nowMs;
+    fanCommandPost(FanCommandKind::Calibrate, 0);
+    while (fanCalibrationState() == FanCalState::Running && simClock.nowMs - startMs < 300000) {
+      simClock.advance(1);
+      fanTaskService();
+    }
+    tookMs = simClock.nowMs - startMs;
+    const FanCurve& curve = fanCurve();
+    float run = (float)curve.minRunDuty / DUTY_MAX;
+    float start = (float)curve.minStartDuty / DUTY_MAX;
+    if (fanCalibrationState() != FanCalState::Done || strcmp(fanCurveSource(), "calibrated") != 0 ||
+        run < SimFan::kStallDuty || run > SimFan::kStallDuty + 0.05f ||
+        start < SimFan::kStartDuty || start > SimFan::kStartDuty + 0.06f || fanChannels[0].speed != 40 * SPEED_SCALE) {
+      fprintf(stderr, "curve/calibration: state %d, run %.3f, start %.3f, back at %d%%\n",
+              (int)fanCalibrationState(), run, start, fanChannels[0].speed);
+      abort();
+    }
+
+    int top = curve.rpm[FAN_CURVE_POINTS - 1];
+    static const int kChecks[] = {30, 50, 80};
+    for (int pct : kChecks) {
+      float peak = 0;
+      handleFanSpeed(fanChannels[0], pct * SPEED_SCALE);
+      runFor(4000, 0, 0, peak);
+      float share = 100.0f * simFan.rpm() / top;
+      if (share < pct - 4 || share > pct + 4) {
+        fprintf(stderr, "curve/calibration: %d%% ran at %.1f%% of %d rpm\n", pct, share, top);
+        abort();
+      }
+    }
+
+    FanCurve saved = curve;
+    schedulerRunOnce();  // the loop() side writes it to NVS
+    fanCurveReset();
+    fanCurveBegin();
+    if (strcmp(fanCurveSource(), "nvs") != 0 || memcmp(&saved.rpm, &fanCurve().rpm, sizeof(saved.rpm)) != 0 ||
+        fanCurve().minRunDuty != saved.minRunDuty || fanCurve().minStartDuty != saved.minStartDuty) {
+      fprintf(stderr, "curve/calibration: table not restored from NVS (source %s)\n", fanCurveSource());
+      abort();
+    }
+  }
+  const FanCurve& curve = fanCurve();
+  benchNote("sweep %.1f s, top %u rpm, run %.1f %% duty, start %.1f %% duty", tookMs / 1000.0f,
+            curve.rpm[FAN_CURVE_POINTS - 1], 100.0f * curve.minRunDuty / DUTY_MAX,
+            100.0f * curve.minStartDuty / DUTY_MAX);
+}
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+#include "bench.h"
+#include "fan_control.h"
+#include "fan_task.h"
+#include "mpsc_queue.h"
+
+// ========= Fan task / queues =========
+// Thread-backed runs (native/rtos_native.cpp). Creating the threads costs a
+// handful of allocations per run, hence the non-zero budgets.
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+BENCH(command_post_inline, "fan/command post (inline)", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    fanCommandPost(FanCommandKind::Speed, (i & 1) ? 4000 : 6000);
+  }
+}
+
+// A replayed burst filling the queue: the setpoints between ordering-sensitive
+// commands collapse to the newest, while off, a different kind and a profile
+// stop are applied where they were sent and nothing merges across them.
+BENCH(command_mailbox, "fan/mailbox burst of 16", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint32_t applied = fanCommandsApplied(), merged = fanCommandsMerged();
+    int base = 3000 + (int)(i % 8) * 100;
+    fanCommandsHold();
+    for (int n = 0; n < 5; n++) fanCommandPost(FanCommandKind::Speed, base + n);
+    fanCommandPost(FanCommandKind::Speed, 0);
+    for (int n = 5; n < 9; n++) fanCommandPost(FanCommandKind::Speed, base + n);
+    fanCommandPost(FanCommandKind::Setpoint, 4500);
+    for (int n = 9; n < 11; n++) fanCommandPost(FanCommandKind::Speed, base + n);
+    fanCommandPost(FanCommandKind::Profile, 0);
+    for (int n = 11; n < 13; n++) fanCommandPost(FanCommandKind::Speed, base + n);
+    if (fanCommandsApplied() != applied) fail("fan/mailbox", "held command ran before the release");
+    fanCommandsRelease();
+
+    if (fanCommandDrops() != 0) fail("fan/mailbox", "burst did not fit the queue");
+    if (fanCommandsApplied() - applied != 7 || fanCommandsMerged() - merged != 9) {
+      fail("fan/mailbox", "merged across an ordering-sensitive command");
+    }
+    if (fanChannels[0].lastUserSpeed != base + 12) fail("fan/mailbox", "setpoint is not the last command");
+  }
+}
+
+// Four producers, one consumer: every value arrives exactly once and each
+// producer's values arrive in the order it pushed them.
+BENCH(mpsc_threads, "queue/mpsc 4 producers (threads)", 0.01) {
+  static MpscQueue<uint32_t, 64> queue;
+  constexpr uint32_t kProducers = 4;
+  uint32_t perProducer = iterations / kProducers + 1;
+  queue.reset();
+
+  std::thread producers[kProducers];
+  for (uint32_t p = 0; p < kProducers; p++) {
+    producers[p] = std::thread([p, perProducer] {
+      for (uint32_t seq = 0; seq < perProducer; seq++) {
+        while (!queue.push((p << 24) | seq)) std::this_thread::yield();
+      }
+    });
+  }
+  uint32_t next[kProducers] = {};
+  for (uint32_t received = 0; received < perProducer * kProducers;) {
+    uint32_t value;
+    if (!queue.pop(value)) continue;
+    uint32_t p = value >> 24;
+    if (p >= kProducers || (value & 0xFFFFFF) != next[p]) fail("queue/mpsc", "lost, duplicated or reordered value");
+    next[p]++;
+    received++;
+  }
+  for (std::thread& t : producers) t.join();
+  if (!queue.empty()) fail("queue/mpsc", "extra values");
+}
+
+// MQTT/HTTP stand-ins hammer the running fan task while this thread drains
+// status records like loop() would. Nothing may go missing: every post is
+// applied, merged into a newer one or counted as dropped, and the last
+// command wins.
+BENCH(fan_task_threads, "fan/task 3 producers (threads)", 0.01) {
+  constexpr uint32_t kProducers = 3;
+  uint32_t perProducer = iterations / kProducers + 1;
+  fanTaskBegin();
+
+  std::atomic<uint32_t> attempts{0};
+  std::atomic<uint32_t> accepted{0};
+  std::thread producers[kProducers];
+  for (uint32_t p = 0; p < kProducers; p++) {
+    producers[p] = std::thread([p, perProducer, &attempts, &accepted] {
+      for (uint32_t i = 0; i < perProducer; i++) {
+        int speed = 3000 + (int)((i * 7 + p * 13) % 7000);
+        attempts++;
+        if (fanCommandPost(FanCommandKind::Speed, speed)) accepted++;
+      }
+    });
+  }
+  std::atomic<bool> producing{true};
+  std::thread joiner([&] {
+    for (std::thread& t : producers) t.join();
+    while (!fanCommandPost(FanCommandKind::Speed, 3725)) {
+      attempts++;
+      std::this_thread::yield();
+    }
+    attempts++;
+    accepted++;
+    producing = false;
+  });
+  while (producing.load()) fanStatusDrain();
+  joiner.join();
+  fanTaskStop();
+  while (fanStatusDrain()) {}
+
+  if (accepted.load() + fanCommandDrops() != attempts.load()) fail("fan/task", "post accounting off");
+  if (fanCommandsApplied() + fanCommandsMerged() != accepted.load()) {
+    fail("fan/task", "accepted command neither applied nor merged");
+  }
+  if (fanStatus().fans[0].speed != 3725) fail("fan/task", "final status is not the last command");
+  if (fanChannels[0].speed != 3725) fail("fan/task", "fan not at the last command");
+}
@@ -0,0 +1,222 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <lwip/sockets.h>
+
+#include "bench.h"
+#include "config.h"
+#include "event_stream.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "heap_watch.h"
+#include "http_server.h"
+#include "mqtt_link.h"
+#include "printer_report.h"
+#include "scheduler.h"
+#include "web_api.h"
+
+// ========= No heap after boot =========
+// The memory policy: setup() may allocate (WiFi, lwip, library singletons),
+// nothing after it does. The fixture leaves the core as setup() would; this
+// case then drives every request and control path in turn and checks the
+// allocation counter after each, so a path that allocates fails the run by
+// name. First calls are held to the same rule: a buffer created lazily on the
+// first request fragments the heap just the same. Handlers are called
+// directly for breadth; the socket paths (accept, parse, keep-alive, a body
+// too big to copy, the event stream) go over loopback to the real servers.
+namespace {
+
+char topic[sizeof(Config::mqtt_command_topic) + 16];
+
+void mqtt(const char* suffix, const char* payload) {
+  snprintf(topic, sizeof(topic), "%s%s", currentConfig.mqtt_command_topic, suffix);
+  fakeMqtt.deliver(topic, (const uint8_t*)payload, strlen(payload));
+}
+
+void http(void (*handler)(), const char* query) {
+  fakeHttp.setQuery(query);
+  handler();
+}
+
+// ---- loopback ----
+int client = -1;      // HTTP connection, kept alive across requests
+int subscriber = -1;  // event stream
+
+int dial(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "heap/after boot: cannot connect to port %u\n", (unsigned)port);
+    abort();
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
+
+void sendText(int fd, const char* text) {
+  if (send(fd, text, strlen(text), MSG_NOSIGNAL) != (ssize_t)strlen(text)) {
+    fprintf(stderr, "heap/after boot: request not sent\n");
+    abort();
+  }
+}
+
+// Services both servers until `done` says what arrived on `fd` is complete.
+// Only the start of it is kept; bodies are counted, not stored. Handlers
+// answer through the server here, through fakeHttp everywhere else.
+char rx[512];
+size_t rxLen, rxTotal;
+
+void pumpUntil(int fd, bool (*done)(), const char* what) {
+  rxLen = rxTotal = 0;
+  rx[0] = '\0';
+  char scratch[1024];
+  HttpServer* direct = hal.http;
+  hal.http = &httpServerRequest();
+  for (int spin = 0; spin < 20000; spin++) {
+    httpServerService();
+    eventStreamService();
+    ssize_t n = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+    if (n > 0) {
+      size_t keep = (size_t)n < sizeof(rx) - 1 - rxLen ? (size_t)n : sizeof(rx) - 1 - rxLen;
+      memcpy(rx + rxLen, scratch, keep);
+      rxLen += keep;
+      rx[rxLen] = '\0';
+      rxTotal += (size_t)n;
+    }
+    if (done()) {
+      hal.http = direct;
+      return;
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) break;
+  }
+  fprintf(stderr, "heap/after boot: %s never arrived\n", what);
+  abort();
+}
+
+bool responseDone() {
+  const char* end = strstr(rx, "\r\n\r\n");
+  const char* length = strstr(rx, "Content-Length: ");
+  return end && length && strncmp(rx, "HTTP/1.1 200", 12) == 0 &&
+         rxTotal >= (size_t)(end + 4 - rx) + strtoul(length + 16, nullptr, 10);
+}
+
+void request(const char* text) {
+  sendText(client, text);
+  pumpUntil(client, responseDone, text);
+}
+
+// Passes 2 ms apart with the fan task serviced after each, as on the device.
+void run(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += 2) {
+    simClock.advance(2);
+    schedulerRunOnce();
+    fanTaskService();
+  }
+}
+
+struct Path {
+  const char* name;
+  void (*fn)();
+};
+
+const Path kPaths[] = {
+  {"mqtt connect + subscribe", [] { run(100); }},
+  {"mqtt percent", [] { mqtt("", "60"); }},
+  {"mqtt fractional percent", [] { mqtt("", "42.75"); }},
+  {"mqtt RAW:", [] { mqtt("", "RAW:512"); }},
+  {"mqtt JSON", [] { mqtt("", "{\"speed\":75}"); }},
+  {"mqtt batch", [] { mqtt("", "{\"speed\":[60,40]}"); }},
+  {"mqtt RPM:", [] { mqtt("", "RPM:9000"); }},
+  {"mqtt off", [] { mqtt("", "0"); }},
+  {"mqtt profile", [] { mqtt("/profile", "300:100;1200:60;0:0"); }},
+  {"mqtt profile stop", [] { mqtt("/profile", "stop"); }},
+  {"mqtt printer report", [] {
+     fakeMqtt.deliver(currentConfig.report_topic, (const uint8_t*)"{\"print\":{\"gcode_state\":\"RUNNING\"}}", 36);
+   }},
+  {"GET /", [] { http(handleRoot, ""); }},
+  {"GET /fan?speed", [] { http(handleFanApi, "speed=40"); }},
+  {"GET /fan?state=off", [] { http(handleFanApi, "state=off"); }},
+  {"GET /fan?state=on", [] { http(handleFanApi, "state=on"); }},
+  {"GET /fan?rpm", [] { http(handleFanApi, "rpm=9000"); }},
+  {"GET /fan config change", [] { http(handleFanApi, "default_on=1&ramp_up=1000&ramp_down=2000"); }},
+  {"GET /fan bad channel", [] { http(handleFanApi, "ch=9&speed=1"); }},
+  {"GET /status", [] { http(handleStatusApi, ""); }},
+  {"GET /tasks", [] { http(handleTasksApi, ""); }},
+  {"GET /nvs", [] { http(handleNvsApi, ""); }},
+  {"GET /boot", [] { http(handleBootApi, ""); }},
+  {"GET /printer", [] { http(handlePrinterApi, ""); }},
+  {"GET /profile", [] { http(handleProfileApi, "steps=300:100;0:0"); }},
+  {"GET /profile?stop", [] { http(handleProfileApi, "stop=1"); }},
+  {"GET /metrics", [] { http(handleMetricsApi, ""); }},
+  {"GET /log", [] { http(handleLogApi, "since=0"); }},
+  {"GET /calibrate?start", [] { http(handleCalibrateApi, "start=1"); }},
+  {"GET unknown route", [] { http(notFound, ""); }},
+  {"HTTP accept + GET /status over loopback", [] {
+     client = dial(httpServerPort());
+     request("GET /status HTTP/1.1\r\nHost: fan\r\n\r\n");
+   }},
+  {"HTTP keep-alive GET /fan?speed over loopback", [] { request("GET /fan?speed=35 HTTP/1.1\r\n\r\n"); }},
+  {"HTTP GET / over loopback (body past the buffer)", [] { request("GET / HTTP/1.1\r\n\r\n"); }},
+  {"HTTP hang-up", [] {
+     close(client);
+     pumpUntil(client = -1, [] { return httpServerStats().open == 0; }, "HTTP close");
+   }},
+  {"event stream subscribe over loopback", [] {
+     subscriber = dial(eventStreamPort());
+     sendText(subscriber, "GET /events HTTP/1.1\r\nAccept: text/event-stream\r\n\r\n");
+     pumpUntil(subscriber, [] { return strstr(rx, "\ndata: {") != nullptr; }, "first event");
+   }},
+  {"event stream broadcast", [] {
+     mqtt("", "45");
+     fanTaskService();
+     pumpUntil(subscriber, [] { return strstr(rx, "\"setpoint\":45.00") != nullptr; }, "state event");
+   }},
+  {"event stream hang-up", [] {
+     close(subscriber);
+     pumpUntil(subscriber = -1, [] { return eventStreamStats().open == 0; }, "subscriber close");
+   }},
+  {"calibration, ramps, state publishes, config save, log", [] { run(30000); }},
+  {"heap watchdog", [] { heapWatchCheck(); heapWatchCheck(); }},
+};
+
+// What setup() leaves on top of the fixture: MQTT on, both servers listening.
+void boot() {
+  currentConfig.mqtt_enabled = true;
+  snprintf(currentConfig.report_topic, sizeof(currentConfig.report_topic), "device/01S00C000000000/report");
+  httpServerOn("/", handleRoot);
+  httpServerOn("/fan", handleFanApi);
+  httpServerOn("/status", handleStatusApi);
+  httpServerOnNotFound(notFound);
+  if (!httpServerBegin(0) || !eventStreamBegin(0)) {
+    fprintf(stderr, "heap/after boot: cannot listen\n");
+    abort();
+  }
+}
+
+}  // namespace
+
+BENCH(heap_after_boot, "heap/no allocation after boot", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    if (i > 0) benchResetFirmware();
+    boot();
+    for (const Path& path : kPaths) {
+      uint64_t before = benchAllocCount();
+      path.fn();
+      uint64_t allocs = benchAllocCount() - before;
+      if (allocs != 0) {
+        fprintf(stderr, "heap/after boot: \"%s\" made %llu allocations\n", path.name, (unsigned long long)allocs);
+        abort();
+      }
+    }
+    if (mqttLinkPhase() != MqttPhase::Connected) {
+      fprintf(stderr, "heap/after boot: MQTT not connected, the network paths did not run\n");
+      abort();
+    }
+  }
+  benchNote("%zu request and control paths, none allocated", sizeof(kPaths) / sizeof(kPaths[0]));
+}
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <lwip/sockets.h>
+#include <thread>
+
+#include "bench.h"
+#include "fan_state.h"
+#include "hal_native.h"
+#include "http_server.h"
+#include "web_api.h"
+
+// ========= HTTP server (loopback sockets) =========
+// The real server on 127.0.0.1, serviced from this thread like the "http"
+// task would; clients are plain blocking sockets.
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+namespace {
+
+struct Response {
+  int    code;
+  size_t length;    // whole response, head and body
+  char   etag[32];
+  char   body[64];  // start of the body
+};
+
+// One complete response at the front of `buf`, or false if more is needed.
+// `head` answers a HEAD request: the Content-Length is there, the body is not.
+bool parseResponse(const char* buf, size_t len, bool head, Response& out) {
+  const char* end = nullptr;
+  for (size_t i = 0; i + 4 <= len; i++) {
+    if (memcmp(buf + i, "\r\n\r\n", 4) == 0) {
+      end = buf + i + 4;
+      break;
+    }
+  }
+  if (!end || len < 12) return false;
+  out.code = atoi(buf + 9);
+  size_t bodyLen = 0;
+  const char* cl = strstr(buf, "Content-Length: ");
+  if (cl && cl < end && !head && out.code != 304) bodyLen = strtoul(cl + 16, nullptr, 10);
+  size_t headLen = (size_t)(end - buf);
+  if (len < headLen + bodyLen) return false;
+  out.length = headLen + bodyLen;
+  out.etag[0] = '\0';
+  const char* etag = strstr(buf, "ETag: ");
+  if (etag && etag < end) {
+    size_t n = strcspn(etag + 6, "\r");
+    if (n < sizeof(out.etag)) {
+      memcpy(out.etag, etag + 6, n);
+      out.etag[n] = '\0';
+    }
+  }
+  size_t copy = bodyLen < sizeof(out.body) - 1 ? bodyLen : sizeof(out.body) - 1;
+  memcpy(out.body, end, copy);
+  out.body[copy] = '\0';
+  return true;
+}
+
+int dial(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return -1;
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  timeval limit = {2, 0};  // a wedged server fails the case instead of hanging it
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool sendAll(int fd, const char* text) {
+  size_t len = strlen(text);
+  while (len > 0) {
+    ssize_t n = send(fd, text, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    text += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// Blocking read of one response; false if the connection ended first.
+bool readResponse(int fd, char* buf, size_t size, Response& out) {
+  size_t len = 0;
+  while (!parseResponse(buf, len, false, out)) {
+    if (len + 1 >= size) return false;
+    ssize_t n = recv(fd, buf + len, size - 1 - len, 0);
+    if (n <= 0) return false;
+    len += (size_t)n;
+    buf[len] = '\0';
+  }
+  return true;
+}
+
+// Services the server from this thread until `count` responses are in on
+// the non-blocking client `fd`; false if they never arrive.
+bool pump(int fd, char* buf, size_t size, size_t& len, const bool* head, Response* out, size_t count) {
+  size_t got = 0;
+  size_t at = 0;
+  for (int spin = 0; spin < 20000 && got < count; spin++) {
+    httpServerService();
+    ssize_t n = recv(fd, buf + len, size - 1 - len, MSG_DONTWAIT);
+    if (n > 0) {
+      len += (size_t)n;
+      buf[len] = '\0';
+    }
+    while (got < count && parseResponse(buf + at, len - at, head && head[got], out[got])) at += out[got++].length;
+    if (n == 0) break;
+  }
+  return got == count;
+}
+
+// True once the server has closed `fd` (recv sees the end of the stream).
+bool closedByServer(int fd) {
+  char c;
+  for (int spin = 0; spin < 20000; spin++) {
+    httpServerService();
+    ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT);
+    if (n == 0) return true;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return true;
+  }
+  return false;
+}
+
+int dialNonBlocking(uint16_t port) {
+  int fd = dial(port);
+  if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
+
+void echoArg() {
+  char value[32];
+  size_t n = hal.http->arg("v", value, sizeof(value));
+  hal.http->sendHeader("X-Has-W", hal.http->hasArg("w") ? "1" : "0");
+  hal.http->send(200, "text/plain", value, n);
+}
+
+constexpr size_t kMaxSamples = 1 << 16;
+uint32_t samples[kMaxSamples];  // request latencies, µs
+
+struct PollResult {
+  uint32_t answered;
+  uint32_t reconnects;
+  uint32_t evicted;
+  uint32_t p50Us, p99Us, maxUs;
+};
+
+// `pollers` dashboards poll /status back to back on keep-alive connections
+// (every other poll revalidates with If-None-Match), while a half-open client
+// sits on a partial request. A poller whose connection was evicted between
+// polls dials again, like a browser; every poll must be answered, and the
+// half-open client must last until the request timeout and no longer.
+PollResult pollLoad(const char* bench, uint32_t pollerCount, uint32_t iterations) {
+  constexpr uint32_t kMaxPollers = 16;
+  if (pollerCount > kMaxPollers) fail(bench, "too many pollers");
+  uint32_t perPoller = iterations / pollerCount + 1;
+  httpServerReset();
+  hal.http = &httpServerRequest();
+  httpServerOn("/status", handleStatusApi);
+  if (!httpServerBegin(0)) fail(bench, "cannot listen");
+  uint16_t port = httpServerPort();
+
+  int halfOpen = dial(port);
+  if (halfOpen < 0 || !sendAll(halfOpen, "GET /status HTTP/1.1\r\nHost: fan")) fail(bench, "cannot connect");
+  httpServerService();
+
+  std::atomic<uint32_t> sampleCount{0};
+  std::atomic<uint32_t> answered{0};
+  std::atomic<uint32_t> reconnects{0};
+  std::atomic<uint32_t> errors{0};
+  std::atomic<uint32_t> done{0};
+  // Dialled one at a time: many SYNs at once would overrun the listen backlog
+  // before this thread gets to accept, and a dropped SYN costs a 1 s retry.
+  int first[kMaxPollers];
+  for (uint32_t p = 0; p < pollerCount; p++) {
+    first[p] = dial(port);
+    httpServerService();
+  }
+  std::thread pollers[kMaxPollers];
+  for (uint32_t p = 0; p < pollerCount; p++) {
+    pollers[p] = std::thread([&, p, perPoller] {
+      char buf[1024];
+      char request[160];
+      char etag[32] = "";
+      int fd = first[p];
+      for (uint32_t i = 0; i < perPoller && errors.load() == 0; i++) {
+        if ((i & 1) && etag[0]) {
+          snprintf(request, sizeof(request), "GET /status HTTP/1.1\r\nHost: fan\r\nIf-None-Match: %s\r\n\r\n", etag);
+        } else {
+          snprintf(request, sizeof(request), "GET /status HTTP/1.1\r\nHost: fan\r\n\r\n");
+        }
+        Response r;
+        bool ok = false;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int attempt = 0; attempt < 5 && !ok; attempt++) {
+          if (fd < 0 || attempt > 0) {  // evicted between polls: dial again, like a browser
+            if (fd >= 0) close(fd);
+            fd = dial(port);
+            if (attempt > 0) reconnects++;
+          }
+          ok = fd >= 0 && sendAll(fd, request) && readResponse(fd, buf, sizeof(buf), r);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        if (!ok || (r.code != 200 && r.code != 304)) {
+          errors++;
+          break;
+        }
+        if (r.etag[0]) strcpy(etag, r.etag);
+        answered++;
+        uint32_t at = sampleCount.fetch_add(1);
+        if (at < kMaxSamples) {
+          samples[at] = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+        }
+      }
+      if (fd >= 0) close(fd);
+      done++;
+    });
+  }
+  while (done.load() < pollerCount) httpServerService();
+  for (uint32_t p = 0; p < pollerCount; p++) pollers[p].join();
+
+  if (errors.load() || answered.load() != pollerCount * perPoller) fail(bench, "a poll went unanswered");
+  if (httpServerStats().requests < answered.load()) fail(bench, "request count off");
+
+  // The half-open client is dropped by the request timeout, not before.
+  Response r;
+  char buf[256];
+  timeval brief = {0, 1000};
+  setsockopt(halfOpen, SOL_SOCKET, SO_RCVTIMEO, &brief, sizeof(brief));
+  if (readResponse(halfOpen, buf, sizeof(buf), r)) fail(bench, "partial request answered");
+  simClock.advance(HTTP_REQUEST_TIMEOUT_MS);
+  fcntl(halfOpen, F_SETFL, fcntl(halfOpen, F_GETFL, 0) | O_NONBLOCK);
+  if (!closedByServer(halfOpen) || httpServerStats().timedOut == 0) fail(bench, "half-open client kept");
+  close(halfOpen);
+
+  uint32_t n = std::min<uint32_t>(sampleCount.load(), kMaxSamples);
+  std::sort(samples, samples + n);
+  PollResult result = {answered.load(), reconnects.load(), httpServerStats().evicted,
+                       samples[n / 2], samples[n * 99 / 100], samples[n - 1]};
+  httpServerReset();
+  return result;
+}
+
+}  // namespace
+
+// The supported load: one poller per slot, less the one the half-open client
+// holds. Every poller keeps its connection, so nothing is evicted and nobody
+// reconnects; a dashboard more than that needs -D HTTP_MAX_CONNECTIONS.
+BENCH(httpd_pollers, "httpd/pollers at slot count (sockets)", 0.05) {
+  PollResult r = pollLoad("httpd/pollers", HTTP_MAX_CONNECTIONS - 1, iterations);
+  if (r.evicted != 0 || r.reconnects != 0) fail("httpd/pollers", "connection churn within the slot count");
+  benchNote("%u pollers, %lu polls: p50 %lu us, p99 %lu us, max %lu us; 0 evictions (expected 0)",
+            (unsigned)(HTTP_MAX_CONNECTIONS - 1), (unsigned long)r.answered, (unsigned long)r.p50Us,
+            (unsigned long)r.p99Us, (unsigned long)r.maxUs);
+}
+
+// Past the slot count: ten pollers share the slots, so a poller often finds
+// its idle connection evicted for another and dials again. Every poll is
+// still answered; the note has what the overload costs.
+BENCH(httpd_pollers_over, "httpd/10 pollers, over the slot count (sockets)", 0.05) {
+  PollResult r = pollLoad("httpd/pollers over", 10, iterations);
+  benchNote("%lu polls: p50 %lu us, p99 %lu us, max %lu us; %lu evictions (%.2f per poll), %lu reconnects",
+            (unsigned long)r.answered, (unsigned long)r.p50Us, (unsigned long)r.p99Us, (unsigned long)r.maxUs,
+            (unsigned long)r.evicted, (double)r.evicted / r.answered, (unsigned long)r.reconnects);
+}
+
+// Pipelining, HEAD, query decoding, refusals and the keep-alive timeouts.
+BENCH(httpd_protocol, "httpd/protocol (sockets)", 0) {
+  httpServerReset();
+  hal.http = &httpServerRequest();
+  httpServerOn("/status", handleStatusApi);
+  httpServerOn("/echo", echoArg);
+  if (!httpServerBegin(0)) fail("httpd/protocol", "cannot listen");
+  uint16_t port = httpServerPort();
+
+  static char buf[4096];
+  Response r[3];
+  for (uint32_t i = 0; i < iterations; i++) {
+    int fd = dialNonBlocking(port);
+    size_t len = 0;
+    const bool head[3] = {false, true, false};
+    if (!sendAll(fd, "GET /status HTTP/1.1\r\n\r\nHEAD /status HTTP/1.1\r\n\r\nGET /nope HTTP/1.1\r\n\r\n") ||
+        !pump(fd, buf, sizeof(buf), len, head, r, 3)) {
+      fail("httpd/protocol", "pipelined requests not all answered");
+    }
+    if (r[0].code != 200 || strncmp(r[0].body, fanStateSnapshot().json, sizeof(r[0].body) - 1) != 0 || r[1].code != 200 ||
+        r[1].length >= r[0].length || r[2].code != 404) {
+      fail("httpd/protocol", "wrong pipelined responses");
+    }
+
+    len = 0;
+    if (!sendAll(fd, "GET /echo?v=a%20b+c%2C&w HTTP/1.1\r\n\r\n") || !pump(fd, buf, sizeof(buf), len, nullptr, r, 1) ||
+        strcmp(r[0].body, "a b c,") != 0 || !strstr(buf, "X-Has-W: 1")) {
+      fail("httpd/protocol", "query not decoded");
+    }
+
+    len = 0;
+    if (!sendAll(fd, "POST /status HTTP/1.1\r\n\r\n") || !pump(fd, buf, sizeof(buf), len, nullptr, r, 1) ||
+        r[0].code != 405 || !strstr(buf, "Connection: keep-alive")) {
+      fail("httpd/protocol", "POST not refused on a kept connection");
+    }
+
+    // Idle past the timeout: closed by the server.
+    simClock.advance(HTTP_IDLE_TIMEOUT_MS);
+    if (!closedByServer(fd)) fail("httpd/protocol", "idle connection kept");
+    close(fd);
+
+    fd = dialNonBlocking(port);
+    len = 0;
+    if (!sendAll(fd, "GET /status HTTP/1.0\r\n\r\n") || !pump(fd, buf, sizeof(buf), len, nullptr, r, 1) ||
+        !strstr(buf, "Connection: close") || !closedByServer(fd)) {
+      fail("httpd/protocol", "HTTP/1.0 connection kept open");
+    }
+    close(fd);
+
+    fd = dialNonBlocking(port);
+    len = 0;
+    char big[HTTP_REQUEST_BYTES + 64];
+    snprintf(big, sizeof(big), "GET /status HTTP/1.1\r\nX-Pad: %0*d", (int)HTTP_REQUEST_BYTES, 0);
+    big[HTTP_REQUEST_BYTES] = '\0';  // exactly a full buffer, so nothing is left unread at the close
+    if (!sendAll(fd, big) || !pump(fd, buf, sizeof(buf), len, nullptr, r, 1) || r[0].code != 431 ||
+        !closedByServer(fd)) {
+      fail("httpd/protocol", "oversized request not refused");
+    }
+    close(fd);
+  }
+  httpServerReset();
+}
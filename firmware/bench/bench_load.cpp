@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <lwip/sockets.h>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "http_server.h"
+#include "mqtt_link.h"
+#include "scheduler.h"
+#include "speed_command.h"
+#include "web_api.h"
+
+// ========= Load generator =========
+// Home Assistant-style traffic against the whole firmware: a broker publishes
+// speed commands on the command topic at a set rate and payload mix (FakeMqtt's
+// inbox, drained one message per loop() like PubSubClient), HTTP clients send
+// /fan?speed= and poll /status through the real server on loopback, and the
+// scheduler runs as loop() would, with the fan task serviced after each pass.
+// Time is simClock and the traffic comes from a fixed seed, so the report
+// (the note under each case) is the same on every machine and every run.
+//
+// A command "reaches the PWM" in the pass where the fan's duty target becomes
+// its value and NativePwm sees a write or a ramp; its latency runs from the
+// publish, which falls between passes, to the start of that pass. Every
+// command gets a duty no other command in flight has, so the target says
+// which one landed. A command replaced in the fan task's mailbox is counted
+// as merged; one applied and then replaced in the same pass never reaches the
+// pin either and is counted as overtaken.
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+namespace {
+
+enum Format : uint8_t { kPlain = 1, kRaw = 2, kJson = 4 };
+
+struct Scenario {
+  const char* bench;
+  uint32_t    mqttPerSecond;
+  uint8_t     formats;        // Format bits, used in turn
+  uint32_t    burst;          // extra messages back to back at the top of every second
+  uint32_t    httpPerSecond;  // /fan?speed= from one keep-alive client
+  uint32_t    pollers;        // /status every kPollMs, one connection each
+  uint32_t    seconds;
+};
+
+struct Report {
+  uint32_t sent;         // MQTT published + HTTP /fan requests written
+  uint32_t brokerDrops;  // broker backlog full, never reached the device
+  uint32_t queueDrops;   // fan command queue full
+  uint32_t merged;       // replaced in the fan task's mailbox before they ran
+  uint32_t reached;      // seen on the PWM
+  uint32_t publishes;    // MQTT state publishes
+  uint32_t polls;        // /status answered
+  uint32_t p50, p99, max;  // publish -> PWM, sim ms
+};
+
+constexpr uint32_t kPollMs       = 250;
+constexpr uint32_t kDrainLimitMs = 60000;
+constexpr size_t   kMaxSamples   = 16384;
+constexpr int      kNone         = -1;
+
+uint32_t samples[kMaxSamples];
+size_t   sampleCount;
+uint32_t sentAt[DUTY_MAX + 1];  // in-flight commands by duty target
+bool     inFlight[DUTY_MAX + 1];
+uint8_t  sourceOf[DUTY_MAX + 1];
+uint32_t rng;
+
+// One source's commands in flight, oldest first. A source's commands run in
+// the order it sent them, so once one lands, every older one still listed
+// was merged or overtaken and will never show on the pin.
+struct Pending {
+  static constexpr size_t kLen = 512;
+  int    duties[kLen];
+  size_t head, count;
+
+  bool add(int duty) {
+    if (count == kLen) return false;
+    duties[(head + count++) % kLen] = duty;
+    inFlight[duty] = true;
+    return true;
+  }
+  void landed(int duty) {
+    while (count > 0) {
+      int oldest = duties[head];
+      head = (head + 1) % kLen;
+      count--;
+      inFlight[oldest] = false;
+      if (oldest == duty) break;
+    }
+  }
+};
+
+Pending pending[2];  // [0] MQTT, [1] HTTP
+
+uint32_t nextRandom() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+uint32_t pwmActions() { return nativePwm[0].writes + nativePwm[0].ramps; }
+
+// A command in `format` for a fresh duty: none in flight, not the last one,
+// not on the pin now. Returns the duty it will set, or kNone if the payload
+// does not parse (it always should).
+int makeCommand(uint8_t format, char* out, size_t size, int lastDuty) {
+  for (int attempt = 0; attempt < 64; attempt++) {
+    int speed = 3000 + (int)(nextRandom() % 7001);  // 30.00 .. 100.00 %
+    int whole = speed / SPEED_SCALE, frac = speed % SPEED_SCALE;
+    if (format == kRaw) snprintf(out, size, "RAW:%d", speedToDuty(speed));
+    else if (format == kJson) snprintf(out, size, "{\"speed\":%d.%02d}", whole, frac);
+    else snprintf(out, size, "%d.%02d", whole, frac);
+    int expected = 0;
+    if (!parseSpeedCommand((const uint8_t*)out, strlen(out), expected)) return kNone;
+    int duty = speedToDuty(expected);
+    if (inFlight[duty] || duty == lastDuty || duty == fanChannels[0].duty) continue;
+    return duty;
+  }
+  return kNone;
+}
+
+struct Client {
+  int      fd = -1;
+  bool     waiting = false;  // request out, response not complete
+  uint32_t dueMs = 0;
+  size_t   len = 0;
+  char     buf[4096];
+};
+
+int dial(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return -1;
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {  // the kernel completes it; accept() comes later
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
+
+// Writes a GET on a keep-alive connection, redialling one the server closed.
+bool request(Client& c, uint16_t port, const char* path) {
+  char req[96];
+  int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: fan\r\n\r\n", path);
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (c.fd < 0) c.fd = dial(port);
+    if (c.fd < 0) return false;
+    if (send(c.fd, req, (size_t)n, MSG_NOSIGNAL) == n) {
+      c.waiting = true;
+      c.len = 0;
+      return true;
+    }
+    close(c.fd);
+    c.fd = -1;
+  }
+  return false;
+}
+
+// Reads what has arrived; true once a whole response is in. A connection the
+// server closed (evicted or timed out) is dropped and the request counts as
+// answered, so the client moves on to its next one.
+bool collect(Client& c) {
+  if (!c.waiting) return false;
+  ssize_t n = recv(c.fd, c.buf + c.len, sizeof(c.buf) - 1 - c.len, 0);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    close(c.fd);
+    c.fd = -1;
+    c.waiting = false;
+    return false;
+  }
+  if (n > 0) c.len += (size_t)n;
+  c.buf[c.len] = '\0';
+  const char* end = strstr(c.buf, "\r\n\r\n");
+  if (!end) return false;
+  const char* cl = strstr(c.buf, "Content-Length: ");
+  size_t body = (cl && cl < end) ? strtoul(cl + 16, nullptr, 10) : 0;
+  if (c.len < (size_t)(end + 4 - c.buf) + body) return false;
+  c.waiting = false;
+  return true;
+}
+
+void hangUp(Client& c) {
+  if (c.fd >= 0) close(c.fd);
+  c.fd = -1;
+  c.waiting = false;
+}
+
+uint32_t percentile(size_t pct) {
+  if (sampleCount == 0) return 0;
+  return samples[std::min(sampleCount - 1, sampleCount * pct / 100)];
+}
+
+Report run(const Scenario& s) {
+  rng = 0x2545f491u;
+  sampleCount = 0;
+  memset(inFlight, 0, sizeof(inFlight));
+  pending[0] = pending[1] = Pending{};
+
+  currentConfig.mqtt_enabled = true;
+  for (uint32_t pass = 0; mqttLinkPhase() != MqttPhase::Connected; pass++) {
+    if (pass == 100) fail(s.bench, "MQTT never connected");
+    simClock.advance(1);
+    schedulerRunOnce();
+  }
+  httpServerOn("/fan", handleFanApi);
+  httpServerOn("/status", handleStatusApi);
+  if (!httpServerBegin(0)) fail(s.bench, "listener did not open");
+  hal.http = &httpServerRequest();
+  schedulerAddReady("http", [](void*) { return true; }, [](void*) { httpServerService(); });
+  const uint16_t port = httpServerPort();
+
+  // Running at 50 % and settled, so no command below meets a soft-start.
+  fanCommandPost(FanCommandKind::Speed, 5000);
+  for (uint32_t t = 0; t < FAN_RAMP_UP_MS_DEFAULT + SOFT_START_SETTLE_MS + MQTT_STATE_WINDOW_MS_DEFAULT * 2; t++) {
+    simClock.advance(1);
+    fanTaskService();
+    schedulerRunOnce();
+  }
+
+  static Client fanClient;
+  static Client pollers[HTTP_MAX_CONNECTIONS];
+  if (s.pollers >= HTTP_MAX_CONNECTIONS) fail(s.bench, "more pollers than server slots");
+  fanClient = Client();
+  for (uint32_t p = 0; p < s.pollers; p++) {
+    pollers[p] = Client();
+    pollers[p].dueMs = simClock.nowMs + p * kPollMs / s.pollers;
+  }
+
+  uint8_t formats[3];
+  size_t formatCount = 0;
+  for (uint8_t f : {kPlain, kRaw, kJson}) {
+    if (s.formats & f) formats[formatCount++] = f;
+  }
+
+  const uint32_t drops0 = fanCommandDrops(), merged0 = fanCommandsMerged();
+  const MqttStateStats state0 = mqttStateStats();
+  const uint32_t start = simClock.nowMs, end = start + s.seconds * 1000;
+  Report r = {};
+  uint64_t nextMqttUs = (uint64_t)start * 1000, nextHttpUs = nextMqttUs;
+  const uint64_t mqttPeriodUs = s.mqttPerSecond ? 1000000 / s.mqttPerSecond : 0;
+  const uint64_t httpPeriodUs = s.httpPerSecond ? 1000000 / s.httpPerSecond : 0;
+  uint32_t nextBurstMs = start + 1000;
+  int lastDuty = kNone, lastMqttDuty = kNone;
+  bool lastMqttQueued = false;
+  char payload[48], path[48];
+
+  auto publish = [&](uint32_t sentMs) {
+    uint8_t format = formats[r.sent % formatCount];
+    int duty = makeCommand(format, payload, sizeof(payload), lastDuty);
+    if (duty == kNone) fail(s.bench, "no fresh duty for a command");
+    r.sent++;
+    lastDuty = lastMqttDuty = duty;
+    lastMqttQueued = fakeMqtt.publishInbound(currentConfig.mqtt_command_topic, payload, sentMs);
+    if (!lastMqttQueued) return;
+    if (!pending[0].add(duty)) fail(s.bench, "too many commands in flight");
+    sourceOf[duty] = 0;
+    sentAt[duty] = sentMs;
+  };
+
+  for (;;) {
+    uint32_t now = simClock.nowMs;
+    bool sending = now < end;
+    if (sending) {
+      while (mqttPeriodUs && nextMqttUs <= (uint64_t)now * 1000) {
+        publish((uint32_t)(nextMqttUs / 1000));
+        nextMqttUs += mqttPeriodUs / 2 + nextRandom() % mqttPeriodUs;  // +-50 % jitter
+      }
+      if (s.burst && now >= nextBurstMs) {
+        for (uint32_t b = 0; b < s.burst; b++) publish(nextBurstMs);
+        nextBurstMs += 1000;
+      }
+      if (httpPeriodUs && !fanClient.waiting && nextHttpUs <= (uint64_t)now * 1000) {
+        int speed = 3000 + (int)(nextRandom() % 7001);
+        int duty = speedToDuty(speed);
+        if (!inFlight[duty] && duty != lastDuty && duty != fanChannels[0].duty) {
+          snprintf(path, sizeof(path), "/fan?speed=%d.%02d", speed / SPEED_SCALE, speed % SPEED_SCALE);
+          if (!request(fanClient, port, path)) fail(s.bench, "HTTP client could not connect");
+          r.sent++;
+          lastDuty = duty;
+          if (!pending[1].add(duty)) fail(s.bench, "too many commands in flight");
+          sourceOf[duty] = 1;
+          sentAt[duty] = (uint32_t)(nextHttpUs / 1000);
+        }
+        nextHttpUs += httpPeriodUs;
+      }
+      for (uint32_t p = 0; p < s.pollers; p++) {
+        Client& c = pollers[p];
+        if (c.waiting || now < c.dueMs) continue;
+        if (!request(c, port, "/status")) fail(s.bench, "HTTP poller could not connect");
+        c.dueMs = now + kPollMs;
+      }
+    } else {
+      bool busy = fakeMqtt.inboxWaiting() > 0 || fanClient.waiting;
+      for (uint32_t p = 0; p < s.pollers; p++) busy = busy || pollers[p].waiting;
+      if (!busy && now >= end + MQTT_STATE_WINDOW_MS_DEFAULT * 2) break;
+      if (now >= end + kDrainLimitMs) fail(s.bench, "traffic never drained");
+    }
+
+    uint32_t actions = pwmActions();
+    uint32_t sleep = schedulerRunOnce();
+    fanTaskService();
+    if (pwmActions() != actions) {
+      int duty = fanChannels[0].duty;
+      if (inFlight[duty]) {
+        pending[sourceOf[duty]].landed(duty);
+        if (sampleCount < kMaxSamples) samples[sampleCount++] = now - sentAt[duty];
+        r.reached++;
+      }
+    }
+    collect(fanClient);
+    for (uint32_t p = 0; p < s.pollers; p++) {
+      if (collect(pollers[p])) r.polls++;
+    }
+    simClock.advance(sleep ? sleep : 1);
+  }
+
+  // Nothing sent last is left behind: the fan ends on the newest command.
+  if (s.httpPerSecond == 0 && lastMqttQueued && fanChannels[0].duty != lastMqttDuty) {
+    fail(s.bench, "fan did not settle on the last command");
+  }
+
+  hangUp(fanClient);
+  for (uint32_t p = 0; p < s.pollers; p++) hangUp(pollers[p]);
+  httpServerStop();
+
+  std::sort(samples, samples + sampleCount);
+  const MqttStateStats& state = mqttStateStats();
+  r.brokerDrops = fakeMqtt.inboxDropped;
+  r.queueDrops = fanCommandDrops() - drops0;
+  r.merged = fanCommandsMerged() - merged0;
+  r.publishes = state.published - state0.published;
+  r.p50 = percentile(50);
+  r.p99 = percentile(99);
+  r.max = sampleCount ? samples[sampleCount - 1] : 0;
+  return r;
+}
+
+void runBench(const Scenario& s, uint32_t iterations) {
+  Report r = {};
+  for (uint32_t i = 0; i < iterations; i++) {
+    if (i > 0) benchResetFirmware();
+    r = run(s);
+  }
+  uint32_t overtaken = r.sent - r.brokerDrops - r.queueDrops - r.merged - r.reached;
+  double perCommand = r.sent ? (double)r.publishes / r.sent : 0.0;
+  benchNote("%u sent: %u on PWM, %u merged, %u overtaken, %u dropped; p50/p99/max %u/%u/%u ms; %u publishes (%.2f/cmd); "
+            "%u polls", r.sent, r.reached, r.merged, overtaken, r.brokerDrops + r.queueDrops, r.p50, r.p99, r.max,
+            r.publishes, perCommand, r.polls);
+  benchKeep(r);
+}
+
+}  // namespace
+
+BENCH(load_mqtt_plain, "load/mqtt 20/s plain", 0) {
+  runBench({"load/mqtt 20/s plain", 20, kPlain, 0, 0, 0, 5}, iterations);
+}
+
+BENCH(load_mqtt_raw, "load/mqtt 200/s RAW:", 0) {
+  runBench({"load/mqtt 200/s RAW:", 200, kRaw, 0, 0, 0, 5}, iterations);
+}
+
+BENCH(load_mqtt_json, "load/mqtt 1000/s JSON", 0) {
+  runBench({"load/mqtt 1000/s JSON", 1000, kJson, 0, 0, 0, 5}, iterations);
+}
+
+BENCH(load_mqtt_burst, "load/mqtt bursts of 50, mixed", 0) {
+  runBench({"load/mqtt bursts of 50, mixed", 2, kPlain | kRaw | kJson, 50, 0, 0, 5}, iterations);
+}
+
+BENCH(load_mixed, "load/mqtt 100/s + http fan + 4 pollers", 0) {
+  runBench({"load/mqtt 100/s + http fan + 4 pollers", 100, kPlain | kRaw | kJson, 0, 10, 4, 5}, iterations);
+}
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "hal_native.h"
+#include "logging.h"
+#include "scheduler.h"
+#include "web_api.h"
+
+// ========= Deferred logging =========
+namespace {
+
+char history[LOG_HISTORY_BYTES + 1];
+
+void expectHistory(const char* bench, const char* text) {
+  logRenderHistory(history, sizeof(history));
+  if (!strstr(history, text)) {
+    fprintf(stderr, "%s: \"%s\" not in the log:\n%s\n", bench, text, history);
+    abort();
+  }
+}
+
+}  // namespace
+
+// What the control path pays per line: the entry is recorded, not formatted.
+// The ring is emptied every LOG_QUEUE_LEN posts so none of them is a drop.
+BENCH(log_post, "log/post (deferred)", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    LOG_INFO("Attempting MQTT connect. Host: %s, Port: %d, User: '%s' (len: %d), Pass len: %d", "broker.local",
+             1883, "fan", 3, (int)(i & 7));
+    if (i % LOG_QUEUE_LEN == LOG_QUEUE_LEN - 1) logReset();
+  }
+  if (logDrops() != 0) {
+    fprintf(stderr, "log/post: %lu entries dropped\n", (unsigned long)logDrops());
+    abort();
+  }
+}
+
+// Entries are formatted by the scheduler's "log" task, as vsnprintf would
+// have, with %s text copied at the call; a full ring drops and says so.
+BENCH(log_drain, "log/drain + /log", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    logReset();
+    simClock.nowMs = 1234;
+    char transient[16] = "stack";
+    LOG_INFO("MQTT retry in %lu ms (attempt %u)", 1500ul, 3u);
+    LOG_WARN("printer %s: fan %d.%02d %% [%-6s|%5.1f|%zu|%lld|%x]", transient, 60, 5, "ab", 2.25, (size_t)42, -7ll,
+             255u);
+    strcpy(transient, "gone");
+    LOG_DEBUG("compiled out: %d", 1);  // unless built with -D LOG_LEVEL=4
+    schedulerRunOnce();
+    for (size_t n = 0; n < LOG_QUEUE_LEN + 5; n++) LOG_ERROR("burst %u", (unsigned)n);
+    logFlush();
+  }
+  expectHistory("log/drain", "[1234 ms] I MQTT retry in 1500 ms (attempt 3)\n");
+  expectHistory("log/drain", "[1234 ms] W printer stack: fan 60.05 % [ab    |  2.2|42|-7|ff]\n");
+  expectHistory("log/drain", "(5 log entries dropped)\n");
+  expectHistory("log/drain", "E burst 31\n");
+  bool debugShown = LOG_LEVEL >= LOG_LEVEL_DEBUG;
+  if ((strstr(history, "compiled out") != nullptr) != debugShown || strstr(history, "burst 32")) {
+    fprintf(stderr, "log/drain: unexpected line in the log:\n%s\n", history);
+    abort();
+  }
+  handleLogApi();
+  if (fakeHttp.lastCode != 200 || fakeHttp.lastLength != strlen(history)) {
+    fprintf(stderr, "log/drain: /log answered %d with %zu bytes\n", fakeHttp.lastCode, fakeHttp.lastLength);
+    abort();
+  }
+  benchNote("%zu-byte entries, %zu-entry ring, %zu bytes of /log history", sizeof(LogEntry), LOG_QUEUE_LEN,
+            strlen(history));
+}
@@ -0,0 +1,143 @@
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "boot.h"
+#include "config.h"
+#include "event_stream.h"
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "fan_profile.h"
+#include "fan_rpm.h"
+#include "fan_state.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "heap_watch.h"
+#include "http_server.h"
+#include "logging.h"
+#include "metrics.h"
+#include "mqtt_link.h"
+#include "printer_report.h"
+#include "scheduler.h"
+
+// ========= Registry =========
+static constexpr size_t kMaxCases = 64;
+static BenchCase cases[kMaxCases];
+static size_t caseCount = 0;
+
+BenchRegistrar::BenchRegistrar(const char* name, BenchFn fn, double maxAllocsPerOp) {
+  if (caseCount < kMaxCases) cases[caseCount++] = BenchCase{name, fn, maxAllocsPerOp};
+}
+
+// ========= Fixture =========
+static const char* corpusDir = "bench/corpus";
+static char note[160];
+
+void benchNote(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(note, sizeof(note), fmt, args);
+  va_end(args);
+}
+
+const char* benchCorpusDir() { return corpusDir; }
+
+void benchResetFirmware() {
+  halNativeBegin();
+  stdoutLog.muted = true;
+  memNvs.clear();
+  simClock.nowMs = 0;
+  fakeMqtt = FakeMqtt();
+  fakeNetwork.up = true;
+  fakeHttp.setQuery("");
+  fakeSystem = FakeSystem();
+
+  fanChannelsReset();
+  mqttStateDirty = false;
+  pendingDutyActiveHigh = 0;
+
+  bootReset();
+  metricsReset();
+  heapWatchReset();
+  loadConfig();
+  fanStateBegin(1);
+  schedulerReset();
+  configCacheBegin();
+  fanCurveReset();
+  fanCurveBegin();
+  fanSetRampTimes(currentConfig.fan_ramp_up_ms, currentConfig.fan_ramp_down_ms);
+  fanTaskReset();
+  fanProfileReset();
+  httpServerReset();
+  eventStreamReset();
+  fanRpmReset();
+  printerReportReset();
+  printerReportBegin();
+  mqttLinkBegin();
+  logReset();
+  logBegin();
+}
+
+// ========= Runner =========
+static constexpr double kMinRunNs = 50e6;  // scale each case up to >= 50 ms
+
+struct Measurement {
+  uint32_t iterations;
+  double   ns;
+  uint64_t allocs;
+  uint64_t bytes;
+};
+
+static Measurement runOnce(const BenchCase& c, uint32_t iterations) {
+  benchResetFirmware();
+  note[0] = '\0';
+  uint64_t allocs0 = benchAllocCount();
+  uint64_t bytes0 = benchAllocBytes();
+  auto t0 = std::chrono::steady_clock::now();
+  c.fn(iterations);
+  auto t1 = std::chrono::steady_clock::now();
+  return Measurement{iterations,
+                     (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count(),
+                     benchAllocCount() - allocs0, benchAllocBytes() - bytes0};
+}
+
+int main(int argc, char** argv) {
+  const char* filter = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+    else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) corpusDir = argv[++i];
+  }
+
+  printf("%-40s %12s %12s %10s %8s\n", "benchmark", "ns/op", "allocs/op", "bytes/op", "budget");
+  int failures = 0;
+  for (size_t i = 0; i < caseCount; i++) {
+    const BenchCase& c = cases[i];
+    if (filter && !strstr(c.name, filter)) continue;
+
+    runOnce(c, 1);  // warm-up: first-touch allocations (stdio buffers etc.)
+    Measurement m = runOnce(c, 16);
+    while (m.ns < kMinRunNs && m.iterations < (1u << 28)) {
+      double scale = m.ns > 0 ? kMinRunNs / m.ns * 1.2 : 16.0;
+      if (scale < 2.0) scale = 2.0;
+      if (scale > 64.0) scale = 64.0;
+      m = runOnce(c, (uint32_t)(m.iterations * scale));
+    }
+
+    double allocsPerOp = (double)m.allocs / m.iterations;
+    double bytesPerOp = (double)m.bytes / m.iterations;
+    bool over = allocsPerOp > c.maxAllocsPerOp + 1e-9;
+    if (over) failures++;
+    printf("%-40s %12.1f %12.2f %10.0f %8.2f%s\n", c.name, m.ns / m.iterations, allocsPerOp,
+           bytesPerOp, c.maxAllocsPerOp, over ? "  OVER BUDGET" : "");
+    if (note[0]) printf("    %s\n", note);
+  }
+
+  if (failures) {
+    printf("\n%d benchmark(s) exceeded their allocation budget\n", failures);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
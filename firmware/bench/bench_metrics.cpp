@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "hal_native.h"
+#include "metrics.h"
+#include "mqtt_link.h"
+#include "scheduler.h"
+#include "web_api.h"
+
+// ========= Metrics =========
+namespace {
+
+char page[METRICS_RENDER_BYTES];
+
+void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+// `line` must appear as a whole line of the rendered page.
+void expectLine(const char* bench, const char* line) {
+  size_t n = strlen(line);
+  for (const char* p = strstr(page, line); p; p = strstr(p + 1, line)) {
+    if ((p == page || p[-1] == '\n') && p[n] == '\n') return;
+  }
+  fprintf(stderr, "%s: missing line \"%s\" in\n%s\n", bench, line, page);
+  abort();
+}
+
+}  // namespace
+
+// The cost every instrumented hot path pays per sample.
+BENCH(metrics_observe, "metrics/observe", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    metricsObserve(MetricHist::Loop, (i * 37) & 0x3ffff);
+  }
+  const MetricsHistogram& loop = metricsHistogram(MetricHist::Loop);
+  if (loop.count() < iterations) fail("metrics/observe", "samples lost");
+
+  // The µs sum carries into sumWraps rather than wrapping silently.
+  metricsReset();
+  metricsObserve(MetricHist::Loop, 0xfffffff0u);
+  metricsObserve(MetricHist::Loop, 0x20u);
+  if (loop.sumWraps.load() != 1 || loop.sumUs.load() != 0x10u || loop.maxUs.load() != 0xfffffff0u) {
+    fail("metrics/observe", "sum did not carry");
+  }
+}
+
+// MQTT commands, timed HTTP requests and NVS writes, then a scrape: every
+// hook must have counted exactly what went through it.
+BENCH(metrics_scrape, "metrics/traffic + scrape", 0) {
+  currentConfig.mqtt_enabled = true;
+  strcpy(currentConfig.mqtt_host, "192.168.1.10");
+  for (int pass = 0; mqttLinkPhase() != MqttPhase::Connected; pass++) {
+    if (pass == 100) fail("metrics/scrape", "MQTT did not connect");
+    simClock.advance(1);
+    schedulerRunOnce();
+  }
+  static const uint8_t kOn[] = "60";
+  static const uint8_t kOff[] = "20";
+  for (uint32_t i = 0; i < iterations; i++) {
+    fakeMqtt.deliver(currentConfig.mqtt_command_topic, (i & 1) ? kOff : kOn, 2);
+    fakeHttp.setQuery((i & 1) ? "speed=40" : "speed=60");
+    metricsTimed<HttpRoute::Fan, handleFanApi>();
+    hal.nvs->putInt("bench", (int)i);
+    simClock.advance(1);
+    schedulerRunOnce();
+  }
+  size_t len = metricsRender(page, sizeof(page));
+  metricsTimed<HttpRoute::Metrics, handleMetricsApi>();
+
+  char line[96];
+  snprintf(line, sizeof(line), "bambufilter_fan_command_seconds_count %lu", (unsigned long)(2 * iterations));
+  expectLine("metrics/scrape", line);
+  snprintf(line, sizeof(line), "bambufilter_http_request_seconds_count{route=\"/fan\"} %lu", (unsigned long)iterations);
+  expectLine("metrics/scrape", line);
+  snprintf(line, sizeof(line), "bambufilter_nvs_writes_total %lu", (unsigned long)memNvs.writes);  // config saves too
+  expectLine("metrics/scrape", line);
+  expectLine("metrics/scrape", "bambufilter_mqtt_connect_attempts_total 1");
+  expectLine("metrics/scrape", "bambufilter_mqtt_connect_failures_total 0");
+  expectLine("metrics/scrape", "bambufilter_heap_largest_block_bytes 110000");
+  if (metricsHistogram(MetricHist::MqttPublish).count() == 0) fail("metrics/scrape", "no publish timed");
+  if (metricsHttpHistogram(HttpRoute::Metrics).count() != 1) fail("metrics/scrape", "/metrics not timed");
+  if (len == 0 || page[len - 1] != '\n' || fakeHttp.lastCode != 200) fail("metrics/scrape", "bad page");
+
+  // A page that does not fit keeps the counters and gauges and only loses
+  // whole histograms.
+  size_t cut = metricsRender(page, 4608);
+  expectLine("metrics/scrape", "bambufilter_heap_largest_block_bytes 110000");
+  if (cut == 0 || page[cut - 1] != '\n' || !strstr(page, "_count ") || strstr(page, "route=")) {
+    fail("metrics/scrape", "short buffer cut a histogram");
+  }
+
+  char summary[METRICS_SUMMARY_BYTES];
+  size_t summaryLen = metricsRenderSummary(summary, sizeof(summary));
+  if (summaryLen + 1 >= sizeof(summary) || summary[summaryLen - 1] != '}') {
+    fail("metrics/scrape", "MQTT summary cut");
+  }
+  benchNote("%zu-byte page, %zu-byte MQTT summary", len, summaryLen);
+}
@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "mqtt_link.h"
+#include "mqtt_packet.h"
+#include "scheduler.h"
+
+// ========= Connect state machine =========
+static void fail(const char* bench, const char* what) {
+  fprintf(stderr, "%s: %s\n", bench, what);
+  abort();
+}
+
+// Runs scheduler passes 1 ms apart until the link reaches `phase`.
+static void runUntil(MqttPhase phase, uint32_t maxPasses, const char* bench) {
+  for (uint32_t pass = 0; mqttLinkPhase() != phase; pass++) {
+    if (pass == maxPasses) fail(bench, "state machine stuck");
+    simClock.advance(1);
+    schedulerRunOnce();
+  }
+}
+
+BENCH(mqtt_backoff, "mqtt/backoff delay", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint8_t failures = (uint8_t)(i % 24);
+    uint32_t ceiling = MQTT_BACKOFF_MIN_MS;
+    for (uint8_t f = 0; f < failures && ceiling < MQTT_BACKOFF_MAX_MS; f++) ceiling *= 2;
+    if (ceiling > MQTT_BACKOFF_MAX_MS) ceiling = MQTT_BACKOFF_MAX_MS;
+    uint32_t delay = mqttBackoffMs(failures, i * 2654435761u);
+    if (delay < ceiling / 2 || delay > ceiling) fail("mqtt/backoff", "delay outside [step/2, step]");
+    benchKeep(delay);
+  }
+}
+
+// Broker unreachable and retrying in the background: fan commands must not
+// resolve, connect or handshake on the caller's stack.
+BENCH(mqtt_fan_broker_down, "mqtt/handleFanSpeed broker down", 0) {
+  currentConfig.mqtt_enabled = true;
+  fakeMqtt.acceptTcp = false;
+  runUntil(MqttPhase::Backoff, 100, "mqtt/broker down");
+  uint32_t resolves = fakeMqtt.resolveCalls, tcps = fakeMqtt.tcpCalls;
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleFanSpeed(fanChannels[0], (i & 1) ? 4000 : 6000);
+  }
+  if (fakeMqtt.resolveCalls != resolves || fakeMqtt.tcpCalls != tcps) {
+    fail("mqtt/broker down", "fan command touched the network");
+  }
+  if (!mqttStateDirty) fail("mqtt/broker down", "state not parked for the reconnect");
+}
+
+// Full connect through DNS with every step taking a few passes, then a drop
+// and the reconnect, which must come from the DNS cache.
+BENCH(mqtt_connect_cycle, "mqtt/connect + reconnect (cached DNS)", 0) {
+  currentConfig.mqtt_enabled = true;
+  strcpy(currentConfig.mqtt_host, "broker.local");
+  fakeMqtt.pendingPolls = 3;
+  for (uint32_t i = 0; i < iterations; i++) {
+    runUntil(MqttPhase::Connected, 64, "mqtt/connect");
+    fakeMqtt.isConnected = false;
+    runUntil(MqttPhase::Backoff, 4, "mqtt/connect");
+    simClock.advance(MQTT_BACKOFF_MIN_MS);
+  }
+  if (fakeMqtt.resolveCalls > 4 * (1 + simClock.nowMs / MQTT_DNS_TTL_MS)) {
+    fail("mqtt/connect", "broker address not cached");
+  }
+}
+
+// CONNECT must match what PubSubClient 2.8 would have sent for the same call.
+BENCH(mqtt_encode_connect, "mqtt/encode CONNECT", 0) {
+  static const uint8_t kExpected[] = {
+    0x10, 0x2d, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0xee, 0x00, 0x2d,
+    0x00, 0x04, 'x', 'i', 'a', 'o', 0x00, 0x06, 's', 't', 'a', 't', 'u', 's',
+    0x00, 0x07, 'o', 'f', 'f', 'l', 'i', 'n', 'e', 0x00, 0x04, 'u', 's', 'e', 'r',
+    0x00, 0x04, 'p', 'a', 's', 's'};
+  MqttConnectRequest request = {"xiao", "user", "pass", "status", 1, true, "offline", MQTT_KEEPALIVE_S};
+  uint8_t packet[128];
+  for (uint32_t i = 0; i < iterations; i++) {
+    size_t len = mqttEncodeConnect(request, packet, sizeof(packet));
+    if (len != sizeof(kExpected) || memcmp(packet, kExpected, len) != 0) fail("mqtt/encode", "CONNECT bytes differ");
+  }
+  if (mqttEncodeConnect(request, packet, 16) != 0) fail("mqtt/encode", "overflow not reported");
+}
+
+// ========= State publishing =========
+// A slider drag (a step every 80 ms for 3 s) on a live session: the window
+// must fold the steps into a handful of publishes, the settled value must be
+// the last one sent, a repeat of it must not go out again, and a change made
+// while the link is down must be the first thing a reconnect publishes.
+BENCH(mqtt_state_coalesce, "mqtt/state drag (coalesced)", 0) {
+  static const char kTopic[] = "bambu/p1s/fan/cmd";
+  currentConfig.mqtt_enabled = true;
+  currentConfig.mqtt_state_window_ms = MQTT_STATE_WINDOW_MS_DEFAULT;
+  runUntil(MqttPhase::Connected, 100, "mqtt/state");
+  auto settle = [](uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t++) {
+      simClock.advance(1);
+      fanTaskService();
+      schedulerRunOnce();
+    }
+  };
+  const uint32_t kSteps = 38, kStepMs = 80;
+  uint32_t dragPublishes = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint32_t before = fakeMqtt.publishes;
+    char payload[8];
+    for (uint32_t step = 0; step < kSteps; step++) {
+      int n = snprintf(payload, sizeof(payload), "%u", (unsigned)(20 + step * 2 + (i & 1)));
+      fakeMqtt.deliver(kTopic, (const uint8_t*)payload, (size_t)n);
+      settle(kStepMs);
+    }
+    settle(FAN_RAMP_DOWN_MS_DEFAULT + MQTT_STATE_WINDOW_MS_DEFAULT);
+    dragPublishes = fakeMqtt.publishes - before;
+    char expected[24];
+    snprintf(expected, sizeof(expected), "\"setpoint\":%s.00", payload);
+    if (mqttStateDirty || !strstr(fakeMqtt.lastPayload, expected) ||
+        dragPublishes > kSteps * kStepMs / MQTT_STATE_WINDOW_MS_DEFAULT + 4) {
+      fprintf(stderr, "mqtt/state: %u publishes for %u steps, last %s\n", dragPublishes, kSteps, fakeMqtt.lastPayload);
+      abort();
+    }
+
+    // The settled value again: nothing visible changed.
+    before = fakeMqtt.publishes;
+    fakeMqtt.deliver(kTopic, (const uint8_t*)payload, strlen(payload));
+    settle(MQTT_STATE_WINDOW_MS_DEFAULT * 2);
+    if (fakeMqtt.publishes != before) fail("mqtt/state", "unchanged state published again");
+  }
+
+  // Link down: the change is parked, and the reconnect delivers it.
+  fakeMqtt.isConnected = false;
+  fakeMqtt.acceptTcp = false;
+  runUntil(MqttPhase::Backoff, 4, "mqtt/state");
+  fakeMqtt.deliver(kTopic, (const uint8_t*)"33", 2);
+  settle(FAN_RAMP_DOWN_MS_DEFAULT);
+  if (!mqttStateDirty || strstr(fakeMqtt.lastPayload, "\"setpoint\":33.00")) {
+    fail("mqtt/state", "offline change not parked");
+  }
+  fakeMqtt.acceptTcp = true;
+  runUntil(MqttPhase::Connected, MQTT_BACKOFF_MAX_MS, "mqtt/state");
+  if (mqttStateDirty || !strstr(fakeMqtt.lastPayload, "\"setpoint\":33.00")) {
+    fail("mqtt/state", "reconnect did not deliver the parked state");
+  }
+  const MqttStateStats& stats = mqttStateStats();
+  benchNote("%u steps -> %u publishes; %lu changes, %lu coalesced, %lu suppressed", kSteps, dragPublishes,
+            (unsigned long)stats.changes, (unsigned long)stats.coalesced, (unsigned long)stats.suppressed);
+}
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "json_stream.h"
+#include "mqtt_link.h"
+#include "printer_report.h"
+#include "scheduler.h"
+
+// ========= Recorded reports =========
+// bench/corpus/printer_report holds a print as a P1S reports it, one message
+// per file, replayed in file name order: the full push_status of an idle
+// printer (~3.5 KB, far past the MQTT client buffer), the incremental
+// reports of a print, a get_version reply with a nested "print" key that
+// must be ignored, and the finish. scripts/replay_reports.py publishes the
+// same files to a real broker.
+namespace {
+
+constexpr size_t kMaxReports = 16;
+constexpr size_t kMaxReportLen = 8192;
+constexpr char   kReportTopic[] = "device/01P00A000000000/report";
+
+struct Report {
+  char    name[256];
+  uint8_t bytes[kMaxReportLen];
+  size_t  length;
+};
+
+Report reports[kMaxReports];
+size_t reportCount = 0;
+bool   reportsLoaded = false;
+
+void loadReports() {
+  if (reportsLoaded) return;
+  reportsLoaded = true;
+  char dirPath[256];
+  snprintf(dirPath, sizeof(dirPath), "%s/printer_report", benchCorpusDir());
+  DIR* dir = opendir(dirPath);
+  if (!dir) {
+    fprintf(stderr, "report/replay: no corpus at %s\n", dirPath);
+    abort();
+  }
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] == '.' || reportCount == kMaxReports) continue;
+    Report& r = reports[reportCount];
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+    FILE* f = fopen(path, "rb");
+    if (!f) continue;
+    r.length = fread(r.bytes, 1, sizeof(r.bytes), f);
+    fclose(f);
+    snprintf(r.name, sizeof(r.name), "%s", entry->d_name);
+    reportCount++;
+  }
+  closedir(dir);
+  std::sort(reports, reports + reportCount,
+            [](const Report& a, const Report& b) { return strcmp(a.name, b.name) < 0; });
+}
+
+const Report& largestReport() {
+  const Report* big = &reports[0];
+  for (size_t i = 1; i < reportCount; i++) {
+    if (reports[i].length > big->length) big = &reports[i];
+  }
+  return *big;
+}
+
+class CountingHandler : public JsonHandler {
+public:
+  void key(uint8_t, const char*) override { keys++; }
+  void value(uint8_t, JsonType, const char*) override { values++; }
+  uint32_t keys = 0;
+  uint32_t values = 0;
+};
+
+// Holds the fan task and fills its queue, so the next command is dropped.
+void fillFanQueue() {
+  fanCommandsHold();
+  while (fanCommandPost(FanCommandKind::Report, 0)) {
+  }
+}
+
+bool runningOn() {
+  char body[384];
+  printerReportRender(body, sizeof(body));
+  return strstr(body, "\"run_on\":true") != nullptr;
+}
+
+void enableReports() {
+  currentConfig.mqtt_enabled = true;
+  snprintf(currentConfig.report_topic, sizeof(currentConfig.report_topic), "%s", kReportTopic);
+  fakeMqtt.isConnected = true;
+  fakeMqtt.setCallback(mqttCallback);
+  fakeMqtt.setPayloadSink(&printerReportSink());
+}
+
+// Every channel heads for `speed`.
+void expectSpeed(const char* step, int speed) {
+  for (const FanChannel& ch : fanChannels) {
+    if (fanPublishDuty(ch) != speedToDuty(speed)) {
+      fprintf(stderr, "report/replay: after %s channel %zu heads for duty %d, expected %d (%d)\n", step,
+              fanChannelIndex(ch), fanPublishDuty(ch), speedToDuty(speed), speed);
+      abort();
+    }
+  }
+}
+
+}  // namespace
+
+// The whole push_status through the tokenizer in TCP-sized pieces.
+BENCH(report_tokenize, "report/tokenize push_status", 0) {
+  loadReports();
+  const Report& r = largestReport();
+  JsonStream stream;
+  CountingHandler counts;
+  for (uint32_t i = 0; i < iterations; i++) {
+    stream.reset();
+    for (size_t at = 0; at < r.length; at += 1460) {
+      stream.feed(r.bytes + at, std::min<size_t>(1460, r.length - at), counts);
+    }
+    if (!stream.complete()) {
+      fprintf(stderr, "report/tokenize: %s did not parse to the end\n", r.name);
+      abort();
+    }
+  }
+  benchNote("%zu-byte report, %zu-byte tokenizer, %u keys / %u values per pass", r.length, sizeof(JsonStream),
+            counts.keys / (iterations ? iterations : 1), counts.values / (iterations ? iterations : 1));
+}
+
+// A print replayed through the MQTT callback path, in 61-byte segments so
+// tokens straddle segment boundaries: PREPARE/RUNNING start the fan at 60 %,
+// the hot chamber raises it to 80 %, FINISH runs it on for report_runon_s
+// and the run-on timer stops it.
+BENCH(report_replay, "report/replay print (corpus)", 0) {
+  loadReports();
+  enableReports();
+  fakeMqtt.segmentBytes = 61;
+  static const int kExpected[] = {0, 60, 60, 60, 80, 60, 60};  // after each file, % (run-on after FINISH)
+  if (reportCount != sizeof(kExpected) / sizeof(kExpected[0])) {
+    fprintf(stderr, "report/replay: corpus has %zu reports, expected %zu\n", reportCount,
+            sizeof(kExpected) / sizeof(kExpected[0]));
+    abort();
+  }
+  for (uint32_t i = 0; i < iterations; i++) {
+    for (size_t n = 0; n < reportCount; n++) {
+      fakeMqtt.deliver(kReportTopic, reports[n].bytes, reports[n].length);
+      expectSpeed(reports[n].name, kExpected[n] * SPEED_SCALE);
+    }
+    simClock.advance((uint32_t)currentConfig.report_runon_s * 1000 + SCHED_TICK_MS);
+    schedulerRunOnce();
+    expectSpeed("the run-on", 0);
+  }
+  // Each print ends where the next starts (idle, cool chamber), so the
+  // counters simply scale with the iterations.
+  const ReportStats& stats = printerReportStats();
+  if (stats.cut != 0 || stats.reports != reportCount * iterations || stats.commands != 5 * iterations) {
+    fprintf(stderr, "report/replay: %lu reports, %lu cut, %lu commands\n", (unsigned long)stats.reports,
+            (unsigned long)stats.cut, (unsigned long)stats.commands);
+    abort();
+  }
+  benchNote("%zu reports, %lu bytes streamed, %lu fan commands per print", reportCount,
+            (unsigned long)(stats.bytes / iterations), (unsigned long)(stats.commands / iterations));
+}
+
+// The same print with the fan queue full at each edge: the rule speed, the
+// run-on and the run-on stop are each dropped once, and each goes out on the
+// next report or run-on retry instead of being taken as sent.
+BENCH(report_dropped, "report/dropped command retried", 0) {
+  loadReports();
+  enableReports();
+  fakeMqtt.segmentBytes = 61;
+  auto deliver = [](size_t n) { fakeMqtt.deliver(kReportTopic, reports[n].bytes, reports[n].length); };
+  for (uint32_t i = 0; i < iterations; i++) {
+    deliver(0);
+    fillFanQueue();
+    deliver(1);  // PREPARE: 60 %
+    fanCommandsRelease();
+    expectSpeed("a dropped rule speed", 0);
+    deliver(2);
+    expectSpeed("the next report", 60 * SPEED_SCALE);
+
+    fillFanQueue();
+    deliver(6);  // FINISH: run-on
+    fanCommandsRelease();
+    if (runningOn()) {
+      fprintf(stderr, "report/dropped: run-on taken as started\n");
+      abort();
+    }
+    deliver(6);
+    if (!runningOn()) {
+      fprintf(stderr, "report/dropped: run-on not retried\n");
+      abort();
+    }
+
+    fillFanQueue();
+    simClock.advance((uint32_t)currentConfig.report_runon_s * 1000 + SCHED_TICK_MS);
+    schedulerRunOnce();
+    fanCommandsRelease();
+    expectSpeed("a dropped run-on stop", 60 * SPEED_SCALE);
+    simClock.advance(REPORT_RUNON_RETRY_MS + SCHED_TICK_MS);
+    schedulerRunOnce();
+    expectSpeed("the run-on retry", 0);
+    if (runningOn()) {
+      fprintf(stderr, "report/dropped: run-on still shown after the stop\n");
+      abort();
+    }
+  }
+  if (printerReportStats().commands != 3 * iterations) {
+    fprintf(stderr, "report/dropped: %lu commands counted\n", (unsigned long)printerReportStats().commands);
+    abort();
+  }
+}
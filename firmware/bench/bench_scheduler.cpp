@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "bench.h"
+#include "hal_native.h"
+#include "scheduler.h"
+
+// ========= Scheduler =========
+// One loop() pass with the firmware's own tasks registered (fixture) and the
+// clock moving 1 ms per pass, so the periodic timers come due now and then.
+BENCH(sched_pass, "sched/runOnce firmware tasks", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    simClock.advance(1);
+    benchKeep(schedulerRunOnce());
+  }
+}
+
+BENCH(sched_arm_cancel, "sched/arm+cancel one-shot", 0) {
+  TaskId id = schedulerAddOneShot("bench", [](void*) {});
+  for (uint32_t i = 0; i < iterations; i++) {
+    schedulerArm(id, 1 + (i & 1023));
+    schedulerCancel(id);
+  }
+}
+
+// Random delays and clock steps across a millis() wrap: no timer may run
+// early, and a one-shot no later than the step that crossed its deadline
+// plus one tick.
+namespace {
+
+struct Probe {
+  TaskId   id;
+  uint32_t periodMs;   // 0 = one-shot, re-armed with a random delay when it fires
+  uint32_t armMs;
+  uint32_t dueMs;      // one-shots only
+  uint32_t fired;
+};
+
+Probe probes[6];
+uint32_t rng = 0x2545F491u;
+uint32_t lastStepMs = 0;
+
+uint32_t nextRandom() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+void probeFired(void* ctx) {
+  Probe& p = *static_cast<Probe*>(ctx);
+  uint32_t now = simClock.nowMs;
+  bool bad;
+  if (p.periodMs) {
+    // Late passes may skip periods, but the k-th run never comes before k periods.
+    bad = now - p.armMs < (p.fired + 1) * p.periodMs;
+  } else {
+    bad = (int32_t)(p.dueMs - now) > 0 || now - p.dueMs > lastStepMs + SCHED_TICK_MS;
+  }
+  if (bad) {
+    fprintf(stderr, "sched/timing: task %d armed %lu run %lu at %lu\n", (int)p.id,
+            (unsigned long)p.armMs, (unsigned long)p.fired + 1, (unsigned long)now);
+    abort();
+  }
+  p.fired++;
+  if (!p.periodMs) {
+    uint32_t delay = nextRandom() % 700;
+    p.armMs = now;
+    p.dueMs = now + delay;
+    schedulerArm(p.id, delay);
+  }
+}
+
+}  // namespace
+
+BENCH(sched_timing, "sched/timing check (wrap)", 0) {
+  static const uint32_t kPeriods[] = {5, 20, 250, 1000, 0, 0};
+  schedulerReset();
+  simClock.nowMs = 0xFFFFFFFFu - 30000;  // wraps a few seconds in
+  for (size_t i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+    Probe& p = probes[i];
+    p = Probe{-1, kPeriods[i], simClock.nowMs, simClock.nowMs + 100 * (uint32_t)i, 0};
+    if (p.periodMs) {
+      p.id = schedulerAddPeriodic("probe", p.periodMs, probeFired, &p);
+    } else {
+      p.id = schedulerAddOneShot("probe", probeFired, &p);
+      schedulerArm(p.id, 100 * i);
+    }
+  }
+  for (uint32_t i = 0; i < iterations; i++) {
+    lastStepMs = nextRandom() % 8;
+    simClock.advance(lastStepMs);
+    schedulerRunOnce();
+  }
+}
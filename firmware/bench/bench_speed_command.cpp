@@ -0,0 +1,155 @@
+#include <dirent.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "fan_control.h"
+#include "speed_command.h"
+
+// ========= Command parsing =========
+static void runParse(uint32_t iterations, const char* payload) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(payload);
+  size_t length = strlen(payload);
+  int speed = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    benchKeep(parseSpeedCommand(bytes, length, speed));
+    benchKeep(speed);
+  }
+}
+
+BENCH(parse_plain, "parse/plain", 0) { runParse(iterations, " 60 "); }
+BENCH(parse_raw,   "parse/raw",   0) { runParse(iterations, "RAW:512"); }
+BENCH(parse_json,  "parse/json",  0) { runParse(iterations, "{\"speed\": 75.5}"); }
+
+// Fixed-point results, 0.01 % units.
+BENCH(parse_fixed, "parse/fixed point", 0) {
+  static const struct { const char* payload; int speed; } kCases[] = {
+    {"60", 6000}, {"42.75", 4275}, {"42.5", 4250}, {"0.125", 13}, {"99.994", 9999},
+    {"{\"speed\":75.5}", 7550}, {"{\"percent\":\"33.33\"}", 3333}, {"{\"speed\":.5}", 50},
+    {"{\"speed\":-5}", 0}, {"101.5", SPEED_FULL},
+  };
+  for (uint32_t i = 0; i < iterations; i++) {
+    for (const auto& c : kCases) {
+      int speed = -1;
+      if (!parseSpeedCommand(reinterpret_cast<const uint8_t*>(c.payload), strlen(c.payload), speed) ||
+          speed != c.speed) {
+        fprintf(stderr, "parse/fixed: '%s' gave %d, expected %d\n", c.payload, speed, c.speed);
+        abort();
+      }
+    }
+  }
+}
+
+// ========= Fuzzing =========
+// Seeds come from bench/corpus/speed_cmd (one payload per file); every
+// iteration parses a deterministic mutation of one seed. Seeds are loaded
+// once during the warm-up run, so the timed runs must stay at zero allocs.
+namespace {
+
+constexpr size_t kMaxSeeds = 64;
+constexpr size_t kMaxSeedLen = 128;
+
+struct Seed {
+  uint8_t bytes[kMaxSeedLen];
+  size_t  length;
+};
+
+Seed   seeds[kMaxSeeds];
+size_t seedCount = 0;
+bool   seedsLoaded = false;
+
+void addSeed(const uint8_t* bytes, size_t length) {
+  if (seedCount == kMaxSeeds) return;
+  if (length > kMaxSeedLen) length = kMaxSeedLen;
+  memcpy(seeds[seedCount].bytes, bytes, length);
+  seeds[seedCount].length = length;
+  seedCount++;
+}
+
+void loadSeeds() {
+  if (seedsLoaded) return;
+  seedsLoaded = true;
+
+  char dirPath[256];
+  snprintf(dirPath, sizeof(dirPath), "%s/speed_cmd", benchCorpusDir());
+  DIR* dir = opendir(dirPath);
+  if (dir) {
+    while (struct dirent* entry = readdir(dir)) {
+      if (entry->d_name[0] == '.') continue;
+      char path[512];
+      snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+      FILE* f = fopen(path, "rb");
+      if (!f) continue;
+      uint8_t buf[kMaxSeedLen];
+      size_t n = fread(buf, 1, sizeof(buf), f);
+      fclose(f);
+      addSeed(buf, n);
+    }
+    closedir(dir);
+  }
+  if (seedCount == 0) {
+    fprintf(stderr, "parse/fuzz: no corpus at %s, using built-in seeds\n", dirPath);
+    static const char* const kBuiltin[] = {"60", "RAW:512", "{\"speed\":75}", "{\"percent\":42.5}"};
+    for (const char* s : kBuiltin) addSeed(reinterpret_cast<const uint8_t*>(s), strlen(s));
+  }
+}
+
+inline uint32_t xorshift(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+size_t mutate(const Seed& seed, uint32_t iteration, uint8_t* out, size_t cap) {
+  static const char kAlphabet[] = "0123456789{}:\".,+- \tRAWrawspedrcnt\xff";
+  uint32_t rng = iteration * 2654435761u + 1;
+  size_t len = seed.length < cap ? seed.length : cap;
+  memcpy(out, seed.bytes, len);
+  uint32_t edits = xorshift(rng) % 4;
+  for (uint32_t e = 0; e < edits; e++) {
+    uint32_t r = xorshift(rng);
+    size_t pos = len ? r % (len + 1) : 0;
+    uint8_t c = (uint8_t)kAlphabet[(r >> 8) % (sizeof(kAlphabet) - 1)];
+    switch ((r >> 16) % 4) {
+      case 0:  // overwrite
+        if (pos < len) out[pos] = c;
+        break;
+      case 1:  // insert
+        if (len < cap) {
+          memmove(out + pos + 1, out + pos, len - pos);
+          out[pos] = c;
+          len++;
+        }
+        break;
+      case 2:  // delete
+        if (pos < len) {
+          memmove(out + pos, out + pos + 1, len - pos - 1);
+          len--;
+        }
+        break;
+      default:  // truncate
+        len = pos < len ? pos : len;
+        break;
+    }
+  }
+  return len;
+}
+
+}  // namespace
+
+BENCH(parse_fuzz, "parse/fuzz corpus", 0) {
+  loadSeeds();
+  uint8_t work[kMaxSeedLen + 8];
+  for (uint32_t i = 0; i < iterations; i++) {
+    const Seed& seed = seeds[i % seedCount];
+    size_t len = mutate(seed, i, work, sizeof(work));
+    int speed = -1;
+    if (parseSpeedCommand(work, len, speed) && (speed < 0 || speed > SPEED_FULL)) {
+      fprintf(stderr, "parse/fuzz: out-of-range speed %d for '%.*s'\n", speed, (int)len, work);
+      abort();
+    }
+  }
+}
@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "bench.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_state.h"
+#include "fan_task.h"
+#include "hal_native.h"
+#include "web_api.h"
+
+// ========= HTTP handlers =========
+BENCH(http_status, "http/status", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleStatusApi();
+  }
+}
+
+BENCH(http_status_unchanged, "http/status 304 (If-None-Match)", 0) {
+  fakeHttp.setRequestHeader("If-None-Match", fanStateSnapshot().etag);
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleStatusApi();
+  }
+  if (fakeHttp.lastCode != 304) {
+    fprintf(stderr, "http/status: unchanged poll answered %d\n", fakeHttp.lastCode);
+    abort();
+  }
+}
+
+BENCH(http_fan_speed, "http/fan?speed", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    fakeHttp.setQuery((i & 1) ? "speed=40" : "speed=60");
+    handleFanApi();
+  }
+}
+
+// A channel that does not exist, or is not a number, is refused before the
+// request changes any config or posts a command.
+BENCH(http_fan_bad_channel, "http/fan bad channel", 0) {
+  static const char* const kQueries[] = {"ch=9&ramp_up=100&default_on=0", "ch=x&speed=90", "ch=1x&state=off"};
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint32_t applied = fanCommandsApplied();
+    fakeHttp.setQuery(kQueries[i % 3]);
+    handleFanApi();
+    if (fakeHttp.lastCode != 400 || configDirtyFields() != 0 || fanCommandsApplied() != applied ||
+        currentConfig.fan_ramp_up_ms != FAN_RAMP_UP_MS_DEFAULT || !currentConfig.fan_default_on) {
+      fprintf(stderr, "http/fan: \"%s\" answered %d and changed state\n", kQueries[i % 3], fakeHttp.lastCode);
+      abort();
+    }
+  }
+}
+
+BENCH(http_root, "http/root page", 0) {
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleRoot();
+  }
+}
+
+BENCH(http_root_revalidate, "http/root page 304", 0) {
+  handleRoot();
+  fakeHttp.setRequestHeader("If-None-Match", fakeHttp.responseHeader("ETag"));
+  for (uint32_t i = 0; i < iterations; i++) {
+    handleRoot();
+  }
+  if (fakeHttp.lastCode != 304 || fakeHttp.lastLength != 0) {
+    fprintf(stderr, "http/root: revalidation answered %d with %zu bytes\n", fakeHttp.lastCode, fakeHttp.lastLength);
+    abort();
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Fast boot =========
+// setup() no longer waits for a serial monitor or for WiFi before the fan and
+// the HTTP endpoints come up: the station re-associates with the BSSID and
+// channel cached from the last good connection (no scan), optionally with a
+// static IP (no DHCP), while everything else starts. The portal path of
+// WiFiManager only runs when that fails. Each boot phase is timestamped;
+// /boot serves the timeline and it is published once per boot on
+// <status topic>/boot.
+#ifndef BOOT_SERIAL_WAIT_MS
+#define BOOT_SERIAL_WAIT_MS 0  // -D BOOT_SERIAL_WAIT_MS=5000 to catch early logs on a monitor
+#endif
+constexpr uint32_t BOOT_FAST_CONNECT_TIMEOUT_MS = 4000;  // then fall back to scan / portal
+
+enum class BootPhase : uint8_t {
+  Setup,         // setup() entered
+  ConfigLoaded,
+  FanApplied,    // power-on policy written to the PWM
+  WifiStart,     // association started
+  HttpUp,        // routes registered and listening
+  LinkUp,        // associated, IP assigned
+  MqttUp,        // first broker session
+  Count
+};
+
+void bootMark(BootPhase phase);  // first mark of a phase wins
+bool bootReached(BootPhase phase);
+uint32_t bootPhaseMs(BootPhase phase);  // millis() at the mark
+void bootSetInfo(const char* resetReason, const char* wifiPath);  // e.g. "SW", "cached"
+size_t bootRenderTimeline(char* out, size_t size);  // JSON for /boot and MQTT
+void bootReset();
+
+// Association parameters of the last good connection, kept in NVS.
+struct WifiFastCache {
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
+bool bootLoadWifiCache(WifiFastCache& out);
+void bootStoreWifiCache(const WifiFastCache& cache);  // no write if unchanged
+void bootClearWifiCache();
+
+bool parseIpv4(const char* text, uint32_t& ip);  // dotted quad, network order in memory
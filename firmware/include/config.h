@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= Config & Parameters =========
+struct Config {
+  bool mqtt_enabled;                 // NEW: master toggle (default false)
+  char mqtt_host[40];
+  int  mqtt_port;
+  char mqtt_user[40];
+  char mqtt_pass[40];
+  char mqtt_command_topic[100];
+  char mqtt_state_topic[100];
+  char mqtt_status_topic[100];
+  int  fan_default_speed[FAN_CHANNEL_MAX];  // 0.01 % (fan_control.h), per channel
+  bool fan_default_on;
+  char static_ip[16];                // optional; empty = DHCP
+  char static_gateway[16];
+  char static_subnet[16];
+  int  fan_ramp_up_ms;               // full 0 -> 100 % swing; 0 = step (fan_control.h)
+  int  fan_ramp_down_ms;
+  char report_topic[64];             // printer report topic; empty = off (printer_report.h)
+  char report_rules[128];            // blank = REPORT_RULES_DEFAULT
+  int  report_runon_s;               // run-on after the last rule stops matching
+  int  report_runon_speed;           // 0.01 %; 0 = the last rule speed
+  int  mqtt_state_window_ms;         // state publish coalescing window; 0 = every change (mqtt_link.h)
+};
+
+extern Config currentConfig;
+
+// ========= Write-behind cache =========
+// NVS keeps what was last written; callers change currentConfig, mark the
+// fields they touched and leave the write to a quiet-period timer, so a
+// dragged slider costs one flash write instead of one per request. A flush
+// only writes if a marked field really differs from flash.
+constexpr uint32_t CONFIG_SAVE_QUIET_MS     = 2000;   // flush this long after the last change
+constexpr uint32_t CONFIG_SAVE_MAX_DEFER_MS = 10000;  // ...but never later than this after the first
+
+enum ConfigField : uint32_t {
+  CFG_MQTT_ENABLED  = 1u << 0,
+  CFG_MQTT_HOST     = 1u << 1,
+  CFG_MQTT_PORT     = 1u << 2,
+  CFG_MQTT_USER     = 1u << 3,
+  CFG_MQTT_PASS     = 1u << 4,
+  CFG_CMD_TOPIC     = 1u << 5,
+  CFG_STATE_TOPIC   = 1u << 6,
+  CFG_STATUS_TOPIC  = 1u << 7,
+  CFG_FAN_DEF_SPD   = 1u << 8,
+  CFG_FAN_DEF_ON    = 1u << 9,
+  CFG_STATIC_IP     = 1u << 10,
+  CFG_STATIC_GW     = 1u << 11,
+  CFG_STATIC_SUBNET = 1u << 12,
+  CFG_RAMP_UP       = 1u << 13,
+  CFG_RAMP_DOWN     = 1u << 14,
+  CFG_FAN_DEF_SPD1  = 1u << 15,  // fan_default_speed of channels 1..3
+  CFG_FAN_DEF_SPD2  = 1u << 16,
+  CFG_FAN_DEF_SPD3  = 1u << 17,
+  CFG_REPORT_TOPIC  = 1u << 18,
+  CFG_REPORT_RULES  = 1u << 19,
+  CFG_RUNON_S       = 1u << 20,
+  CFG_RUNON_SPEED   = 1u << 21,
+  CFG_STATE_WINDOW  = 1u << 22,
+  CFG_ALL           = (1u << 23) - 1,
+};
+
+// CFG_FAN_DEF_SPD bit of fan channel `ch`.
+inline uint32_t configFanSpeedField(size_t ch) {
+  return ch == 0 ? (uint32_t)CFG_FAN_DEF_SPD : (uint32_t)CFG_FAN_DEF_SPD1 << (ch - 1);
+}
+
+struct ConfigStats {
+  uint32_t saveRequests;      // configMarkDirty()/saveConfig() calls
+  uint32_t flushes;           // flushes that wrote the record
+  uint32_t nvsWrites;         // NVS put calls actually made (two per flush)
+  uint32_t nvsWritesAvoided;  // vs. rewriting every key on every request
+};
+
+class NvsStore;
+
+// Config lives in one versioned, CRC-checked NVS blob (plus a backup copy);
+// boot reads just that. See config.cpp for the layout.
+void loadConfig();
+const char* configBootSource();  // "record", "backup" or "legacy" (migrated/blank)
+// The two boot-time readers behind loadConfig(), without its side effects.
+const char* configReadRecord(NvsStore& preferences, Config& config);  // source, or nullptr if no valid copy
+void configReadLegacy(NvsStore& preferences, Config& config);         // pre-record key-per-field layout
+void saveConfig();                      // marks everything and flushes now (portal save)
+void configCacheBegin();                // registers the deferred-flush timer task
+void configMarkDirty(uint32_t fields);  // write-behind: flushes after CONFIG_SAVE_QUIET_MS
+bool configFlush();                     // writes pending keys now (reboot, OTA, reconfig); true if any
+uint32_t configDirtyFields();
+const ConfigStats& configStats();
+size_t configRenderStats(char* out, size_t size);  // JSON for /nvs
+bool parseBoolParam(const char* value);
+uint32_t configCrc32(const void* data, size_t len);  // CRC-32 (IEEE), also used by other NVS blobs
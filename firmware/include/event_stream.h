@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= State event stream (SSE) =========
+// text/event-stream on its own port: a stream never ends, and would hold one
+// of the HTTP server's connection slots for good. Each change of the fan
+// state snapshot is pushed to every subscriber as one `data:` event.
+//
+// Non-blocking sockets stepped by the scheduler's "events" task, as in
+// http_server: each subscriber owns a fixed slot with room for one event and
+// its socket is written as far as it takes. A subscriber still sending an
+// older event skips straight to the newest state when it is done, one that
+// stops reading is closed by the write timeout, and a hang-up is seen by the
+// read each pass. Nothing is allocated per subscriber or per event.
+constexpr uint16_t EVENT_STREAM_PORT             = 81;
+constexpr size_t   EVENT_STREAM_MAX_CLIENTS      = 4;
+constexpr uint32_t EVENT_STREAM_HEARTBEAT_MS     = 30000;  // also how dead peers get noticed
+constexpr uint32_t EVENT_STREAM_WRITE_TIMEOUT_MS = 5000;   // event stalled by a subscriber not reading
+constexpr uint32_t EVENT_STREAM_STALL_MS         = 1000;   // unsent that long: may be evicted for a newcomer
+
+// All slots taken with a browser waiting: the subscriber whose unsent bytes
+// have waited the longest, and at least EVENT_STREAM_STALL_MS, is closed to
+// make room; with none stalled that long the newcomer gets a 503. A send
+// buffer that is only briefly full, or a subscriber accepted in the same
+// pass with its headers still queued, does not count as stalled.
+struct EventStreamStats {
+  uint32_t accepted;  // subscribers taken
+  uint32_t evicted;   // stalled subscribers closed for a waiting one
+  uint32_t timedOut;  // closed by the write timeout
+  uint32_t refused;   // answered 503, every slot busy
+  uint32_t events;    // state events queued, all subscribers
+  uint8_t  open;      // subscribers now
+};
+
+bool eventStreamBegin(uint16_t port);  // false if the listener could not be opened; 0 picks a port
+void eventStreamService();             // one pass; cheap when idle: an accept, a recv per subscriber
+void eventStreamStop();
+uint16_t eventStreamPort();            // bound port (0 when stopped)
+const EventStreamStats& eventStreamStats();
+
+void eventStreamReset();  // stopped, zeroed stats (native bench fixture)
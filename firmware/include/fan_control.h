@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= PWM / Fan runtime =========
+constexpr uint32_t PWM_FREQ_HZ = 25000;
+// constexpr uint32_t PWM_FREQ_HZ = 200;
+
+// The LEDC timer divides its source clock by (freq << bits) with an integer
+// part of at least 1, so the resolution is picked as the widest that still
+// divides at PWM_FREQ_HZ: 80 MHz / 25 kHz = 3200 counts -> 11 bits.
+constexpr uint32_t LEDC_SRC_CLK_HZ  = 80000000;  // APB clock
+constexpr uint8_t  LEDC_MAX_RES_BITS = 14;       // timer width on the C3
+
+constexpr uint8_t pwmMaxResBits(uint32_t srcClkHz, uint32_t freqHz, uint8_t bits = LEDC_MAX_RES_BITS) {
+  return bits == 0 || srcClkHz / freqHz >= (1u << bits) ? bits : pwmMaxResBits(srcClkHz, freqHz, bits - 1);
+}
+
+constexpr uint8_t  PWM_RES_BITS = pwmMaxResBits(LEDC_SRC_CLK_HZ, PWM_FREQ_HZ);
+constexpr int      DUTY_MAX = (1 << PWM_RES_BITS) - 1;
+static_assert(PWM_RES_BITS >= 8, "PWM_FREQ_HZ too high for 8-bit duty resolution");
+
+// Speeds and setpoints are fixed point in 0.01 % of top speed (0 .. SPEED_FULL)
+// from the command parsers through to /status and the MQTT state; the control
+// path has no float in it.
+constexpr int SPEED_SCALE = 100;                // units per percent
+constexpr int SPEED_FULL  = 100 * SPEED_SCALE;
+
+constexpr int PCT_MIN_START = 25;  // stock fan curve thresholds (fan_curve.h); a calibration replaces them
+constexpr int PCT_MIN_RUN   = 15;  // ...but this stays the smallest setpoint
+constexpr int SPEED_MIN_RUN = PCT_MIN_RUN * SPEED_SCALE;
+constexpr uint32_t SOFT_START_SETTLE_MS = 800;  // at the kick duty, once the ramp has reached it
+
+// ========= Ramp =========
+// Speed commands slew the duty instead of stepping it, so a change no longer
+// pulls a current spike from the shared 24 V supply or jumps audibly. Limits
+// are the time for a full 0 -> 100 % swing (config fan_ramp_up_ms /
+// fan_ramp_down_ms, 0 = step). The PWM sink steps the ramp from a hardware
+// timer (hal.h), so loop() or fan task jitter does not stretch it. Kicks, the
+// RPM loop and the calibration sweep still write directly.
+constexpr int      FAN_RAMP_UP_MS_DEFAULT   = 1500;
+constexpr int      FAN_RAMP_DOWN_MS_DEFAULT = 3000;
+constexpr int      FAN_RAMP_MAX_MS          = 60000;
+constexpr uint32_t FAN_RAMP_STEP_MS         = 10;  // timer period on the device
+
+// ========= Channels =========
+// One FanChannel per fan output (FAN_CHANNEL_COUNT, hal.h), each with its own
+// PWM sink (pin and LEDC channel/timer), setpoint, ramp and soft-start. All
+// channels share the fan curve (fan_curve.h). RPM control, the stall kick and
+// the calibration sweep drive channel 0, the one the tach input belongs to.
+struct FanChannel {
+  int      duty;                    // commanded, active-high (the ramp target while one runs)
+  int      speed;                   // 0.01 %
+  int      lastUserSpeed;           // 0.01 %
+  int      pendingSpeedAfterStart;  // 0.01 %
+  bool     softStartArmed;
+  uint32_t softStartAtMs;           // when the kick duty is reached (may lie ahead)
+  int      rampFrom;                // active-high; the line runs to `duty`
+  uint32_t rampStartMs;
+  uint32_t rampMs;                  // 0 = no ramp running
+};
+
+// Owned by the fan task (fan_task.h); the network side reads fanStatus() instead.
+extern FanChannel fanChannels[FAN_CHANNEL_COUNT];
+
+inline size_t fanChannelIndex(const FanChannel& ch) { return (size_t)(&ch - fanChannels); }
+
+int  speedToDuty(int speed);   // share of top speed (0.01 %) -> duty, via the fan curve
+int  dutyToSpeed(int duty);    // inverse; 1..SPEED_FULL for any duty > 0
+int  invertDuty(int duty);
+void writeDutyActiveLow(FanChannel& ch, int dutyActiveHigh);  // immediate; cancels a running ramp
+// Slews at the configured rate, or over `rampMs` for the whole change if >= 0.
+void rampDutyActiveLow(FanChannel& ch, int dutyActiveHigh, int rampMs = -1);
+int  fanOutputDuty(const FanChannel& ch);                      // on the pin right now, mid-ramp included
+int  fanPublishDuty(const FanChannel& ch);                     // the soft-start target while kicking
+void fanSetRampTimes(int upMs, int downMs);   // any task
+void handleFanSpeed(FanChannel& ch, int speed, int rampMs = -1);  // 0.01 %; on channel 0 also ends RPM control (fan_rpm.h)
+void fanReportStatus();  // posts all channels' state to the network side
+// A batch holds back the status records of the commands in it and posts one
+// at the end if anything changed, so it reaches MQTT as a single publish.
+void fanReportHold();
+void fanReportRelease();
+void fanChannelsReset();  // all channels stopped, nothing armed (boot, native bench fixture)
+
+// Fan task only. Return ms until the next soft-start drop / ramp end is due (UINT32_MAX if none).
+uint32_t fanSoftStartService();
+uint32_t fanRampService();  // posts a status record once a ramp has arrived
+void fanSoftStartCancel(FanChannel& ch);  // drops a pending soft-start target
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Fan curve =========
+// Steady-state RPM at FAN_CURVE_POINTS evenly spaced duties (0 .. DUTY_MAX),
+// plus the measured start and stall thresholds. speedToDuty() treats a
+// percentage as a share of the top speed and inverts this table, so 50 % is
+// half the airflow rather than half the duty. Units without a calibration
+// use kStockFanCurve, generated at compile time from the stock fan's
+// response; a calibration sweep (fanCalibrationStart) measures the unit's own
+// fan and keeps the result in NVS.
+constexpr size_t   FAN_CURVE_POINTS      = 17;     // every 1/16 of full duty
+constexpr uint32_t FAN_CAL_SETTLE_MS     = 2000;   // per sweep point
+constexpr uint32_t FAN_CAL_SAMPLE_MS     = 500;    // averaged at the end of each point
+constexpr uint32_t FAN_CAL_STALL_HOLD_MS = 3000;   // probe held after spinning up
+constexpr uint32_t FAN_CAL_START_HOLD_MS = 1500;   // probe held from rest
+constexpr uint32_t FAN_CAL_STOP_MAX_MS   = 8000;   // wait for the rotor to stop between start probes
+constexpr int      FAN_CAL_TURNING_RPM   = 300;    // below this the rotor counts as stopped
+
+struct FanCurve {
+  uint16_t rpm[FAN_CURVE_POINTS];  // non-decreasing; rpm[0] == 0
+  uint16_t minRunDuty;             // lowest duty that keeps a turning rotor going (with margin)
+  uint16_t minStartDuty;           // lowest duty that starts it from rest (with margin)
+};
+
+const FanCurve& fanCurve();          // active table; any task
+const char* fanCurveSource();        // "stock", "nvs" or "calibrated"
+int  fanCurveDuty(size_t point);     // duty of table point `point`
+int  fanCurveDutyForRpm(int rpm);    // inverse lookup, interpolated
+int  fanCurveRpmForDuty(int duty);
+bool fanCurveValid(const FanCurve& curve);
+
+void fanCurveBegin();  // loads the calibrated table from NVS and registers its save task
+void fanCurveReset();  // back to the stock table, calibration idle (native bench fixture)
+
+// Calibration sweep, driven from the fan task's control tick (fan_rpm.h).
+// Needs a tach; takes about a minute, then restores the previous speed.
+enum class FanCalState : uint8_t { Idle, Running, Done, Failed };
+bool fanCalibrationStart();  // fan task; sweeps channel 0 (the tach fan), false without a tach
+void fanCalibrationCancel(); // fan task; any speed command cancels a running sweep
+bool fanCalibrationStep(int rpm);  // fan task, per control tick; true while it owns the fan
+FanCalState fanCalibrationState();
+size_t fanCurveRender(char* out, size_t size);  // JSON for /calibrate
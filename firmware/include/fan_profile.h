@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Speed profiles =========
+// A profile is a short list of timed steps, uploaded once (GET
+// /profile?steps=... or MQTT on "<command topic>/profile") and then run by
+// the fan task from its own deadlines, so a purge after a print needs
+// neither the controller nor the network once it has started. Text form,
+// ';' separated:
+//   <hold s>:<speed %>[:<ramp ms>]
+// e.g. "300:100;1200:60;0:0" = 100 % for 5 min, 60 % for 20 min, then off.
+// Each step sets every channel, ramping over <ramp ms> (default: the
+// configured ramp rate), and holds for <hold s> from the start of the step;
+// the last step's speed stays once the profile ends. Any speed, on/off, RPM
+// or calibration command pre-empts a running profile. Profiles live in RAM
+// only; a restart drops them.
+constexpr size_t   FAN_PROFILE_MAX_STEPS  = 16;
+constexpr uint32_t FAN_PROFILE_MAX_HOLD_S = 86400;  // per step
+constexpr size_t   FAN_PROFILE_TEXT_BYTES = 256;    // longest accepted upload
+constexpr int32_t  FAN_PROFILE_RAMP_RATE  = -1;     // step ramp: the configured rate
+
+struct FanProfileStep {
+  uint32_t holdS;
+  int32_t  rampMs;  // whole transition into the step; FAN_PROFILE_RAMP_RATE = configured rate
+  int16_t  speed;   // 0.01 %
+};
+
+struct FanProfile {
+  FanProfileStep steps[FAN_PROFILE_MAX_STEPS];
+  uint8_t        count;
+};
+
+// False (and `out` unusable) for an empty or malformed text, or one with
+// more than FAN_PROFILE_MAX_STEPS steps.
+bool fanProfileParse(const char* text, size_t length, FanProfile& out);
+
+// Network side. Start hands the profile to the fan task (commands run in
+// order, so the newest upload wins); stop leaves the fan where the profile
+// had it. False if the command queue was full: nothing is staged and the
+// last upload shown stays as it was.
+bool fanProfileStart(const FanProfile& profile);
+bool fanProfileStop();
+size_t fanProfileRender(char* out, size_t size);  // JSON for /profile: progress and the last upload
+
+// Fan task (fan_task.cpp).
+void fanProfileRun(int slot);  // starts the upload a Profile command names
+void fanProfileCancel();  // pre-emption; no-op when idle
+uint32_t fanProfileService();  // advances steps; ms to the next step (UINT32_MAX if idle)
+// Running step (1-based, 0 = idle), step count and seconds until the profile ends.
+void fanProfileProgress(uint8_t& step, uint8_t& steps, uint32_t& leftS);
+
+void fanProfileReset();  // idle, nothing staged (native bench fixture)
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+// ========= Closed-loop RPM control =========
+// With a tach input bound (hal.tach) the fan task runs a control tick every
+// FAN_CONTROL_PERIOD_MS: it estimates RPM from the tach edges, and in RPM
+// mode a PI(D) loop with a duty feed-forward holds the commanded speed as the
+// filter loads up. Percent commands leave RPM mode and drive the duty
+// open-loop as before. In either mode a fan that is driven but reports 0 rpm
+// for FAN_STALL_MS gets full-duty kick-starts, including one that has not
+// turned since boot; after FAN_STALL_MAX_KICKS it is flagged as stalled and
+// retried every FAN_STALL_RETRY_MS. Without a tach
+// nothing here runs. All integer math; the host build closes the loop
+// through a simulated fan (native/sim_fan.h).
+constexpr int      FAN_RPM_MAX            = 18000;  // stock 4028 fan at 100 % duty
+constexpr uint8_t  TACH_PULSES_PER_REV    = 2;      // standard for 4-wire fans
+constexpr uint32_t FAN_CONTROL_PERIOD_MS  = 100;
+constexpr uint32_t TACH_TIMEOUT_MS        = 500;    // no edge for this long reads as 0 rpm
+constexpr uint32_t FAN_STALL_MS           = 1500;   // driven at 0 rpm this long = stalled
+constexpr uint32_t FAN_KICK_MS            = 400;    // full duty per kick-start
+constexpr uint8_t  FAN_STALL_MAX_KICKS    = 3;
+constexpr uint32_t FAN_STALL_RETRY_MS     = 10000;  // kick interval once flagged as stalled
+constexpr int      FAN_RPM_REPORT_STEP    = 300;    // status is re-posted when rpm moves this far
+
+// PID gains in 1/1024ths of full duty per rpm, scaled by 1024 (I: per rpm*s,
+// D: per rpm/s), so they hold whatever PWM_RES_BITS comes out at.
+constexpr int32_t  FAN_PID_KP_Q10 = 42;
+constexpr int32_t  FAN_PID_KI_Q10 = 120;
+constexpr int32_t  FAN_PID_KD_Q10 = 0;
+constexpr int32_t  FAN_PID_I_ZONE_RPM = 1500;  // integrator runs only this close to the target
+
+// Fan task only.
+void fanSetTargetRpm(int rpm);  // enters RPM mode; <= 0 stops the fan
+void fanRpmRelease();           // back to percent mode (handleFanSpeed() calls it)
+int  fanRpmToSpeed(int rpm);    // open-loop equivalent (0.01 %) on the fan curve
+uint32_t fanRpmService();       // control tick; ms until the next one (UINT32_MAX without a tach)
+
+int  fanMeasuredRpm();   // 0 without a tach
+int  fanTargetRpm();     // 0 in percent mode
+bool fanStalled();
+void fanRpmReset();      // forgets the estimator, mode and stall state (setup / bench fixture)
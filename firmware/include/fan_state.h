@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= Fan state snapshot =========
+// The JSON that /status and /fan return, rendered once per visible change.
+// `version` increases by one per change and starts from a per-boot random
+// base, so a version (or ETag) cached before a reboot never matches after it.
+// speed and setpoint carry two decimals (fixed point, see fan_control.h).
+// Channel 0 is at the top level; boards with more than one fan channel list
+// every channel again under "fans"; a running profile adds its progress.
+constexpr size_t FAN_STATE_JSON_BYTES = 256 + (FAN_CHANNEL_COUNT > 1 ? 16 + 96 * FAN_CHANNEL_COUNT : 0);
+
+struct FanStateSnapshot {
+  uint32_t version;
+  char     etag[16];   // "\"<version>\""
+  char     json[FAN_STATE_JSON_BYTES];
+  size_t   length;
+};
+
+void fanStateBegin(uint32_t bootSeed);
+// Re-renders the snapshot if on/off, speed, setpoint, default_on, the RPM
+// fields, the target/output duty or the profile progress changed.
+// Call after anything that may have touched them.
+void fanStateRefresh();
+const FanStateSnapshot& fanStateSnapshot();
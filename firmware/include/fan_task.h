@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= Fan task =========
+// Fan actuation runs in its own high-priority task, so TCP, handleClient() or
+// OTA on the loop() side can no longer delay a PWM write or the soft-start
+// drop. MQTT, HTTP and config changes post commands into a lock-free MPSC
+// queue; after every change the fan task posts a status record back through
+// a second queue, and the network side turns those into the MQTT state
+// publish and the /status snapshot. Until fanTaskBegin() (and in the native
+// benches) commands and status records are handled inline by the caller.
+//
+// Each pass the fan task takes everything queued into a mailbox first, where
+// a setpoint replaces an earlier one of the same kind for the same channel
+// (last writer wins), so a flood of retained or replayed commands costs one
+// actuation and one state change. Anything else (off, on, a profile start or
+// stop, calibration, a batch) is applied in order, and nothing is merged
+// across it. Callers that post several commands in a row hold the wake-up
+// (fanCommandsHold) so they reach the mailbox together.
+constexpr size_t   FAN_COMMAND_QUEUE_LEN = 16;
+constexpr size_t   FAN_STATUS_QUEUE_LEN  = 32;
+constexpr uint8_t  FAN_TASK_PRIORITY     = 5;     // above loop() (1), below WiFi/lwip
+constexpr uint32_t FAN_TASK_STACK_BYTES  = 4096;
+constexpr uint32_t FAN_TASK_IDLE_MS      = 1000;  // wake-up cap with nothing pending
+
+// Speed values are in 0.01 % (fan_control.h), so they still fit the int16 slot.
+// Commands address one channel (fan_control.h); a batch carries a value for
+// every channel and is applied, and reported, as one change.
+enum class FanCommandKind : uint8_t {
+  Speed,     // handleFanSpeed(value)
+  On,        // resume the last setpoint, or `value` if there is none
+  Adjust,    // /fan?speed: new setpoint, applied only while the fan is running
+  Setpoint,  // store `value` as the setpoint without touching the fan
+  Report,    // just post a fresh status record
+  Rpm,       // fanSetTargetRpm(value) on channel 0; open-loop equivalent elsewhere or without a tach
+  Calibrate, // run the fan curve sweep (fan_curve.h)
+  Profile,   // 1-2: run the upload staged in that slot, 0: stop it (fan_profile.h)
+};
+
+constexpr uint8_t FAN_CHANNEL_ALL = 0xff;  // FanCommand::channel of a batch
+constexpr int16_t FAN_BATCH_KEEP  = -1;    // batch slot: leave that channel as it is
+
+struct FanCommand {
+  FanCommandKind kind;
+  uint8_t        channel;  // FAN_CHANNEL_ALL: `batch` holds one value per channel
+  int16_t        value;
+  int16_t        batch[FAN_CHANNEL_COUNT];
+  uint32_t       postedUs; // micros() at the post; the latency histogram in /metrics
+};
+
+struct FanChannelStatus {
+  int duty;         // active-high
+  int speed;        // 0.01 %
+  int setpoint;     // 0.01 %
+  int publishDuty;  // duty to report over MQTT (the soft-start target while kicking)
+  int outputDuty;   // on the pin when posted; differs from `duty` while ramping
+};
+
+// The fan as the network side sees it; one record per change, in order.
+struct FanStatus {
+  FanChannelStatus fans[FAN_CHANNEL_COUNT];
+  int  rpm;         // channel 0, measured; 0 without a tach
+  int  targetRpm;   // 0 in percent mode
+  bool stalled;
+  uint8_t  profileStep;   // running profile step, 1-based; 0 = no profile (fan_profile.h)
+  uint8_t  profileSteps;
+  uint32_t profileLeftS;  // until the profile ends, as of the post
+};
+
+// Any task; false (and counted) when full. Channels past FAN_CHANNEL_COUNT are ignored.
+bool fanCommandPost(FanCommandKind kind, int value, uint8_t channel = 0);
+bool fanCommandPostBatch(FanCommandKind kind, const int16_t (&values)[FAN_CHANNEL_COUNT]);
+void fanTaskBegin();      // starts the task and the network-side status drain
+void fanTaskStop();       // stops and joins the task; later commands run inline again
+// loop() side: posts in between wait for the release and then go to the fan
+// task (or run inline) together, so their setpoints can merge. Not nested.
+void fanCommandsHold();
+void fanCommandsRelease();
+uint32_t fanTaskService();  // fan side: runs queued commands, the soft-start, ramp and profile timers and the RPM control tick; ms to next deadline
+
+void fanStatusPost(const FanStatus& status);  // fan side, after each change
+bool fanStatusDrain();    // network side: publishes and re-renders; true if anything was queued
+const FanStatus& fanStatus();  // network-side view as of the last drain
+
+uint32_t fanCommandsApplied();
+uint32_t fanCommandDrops();
+uint32_t fanCommandsMerged();  // setpoints replaced by a newer one before they ran
+uint32_t fanStatusDrops();
+void fanTaskReset();      // clears queues and counters (native bench fixture)
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Hardware abstraction =========
+// Thin interfaces between the control core and the platform. The ESP32 build
+// binds them to LEDC / Preferences / PubSubClient / http_server (hal_esp32.cpp),
+// the native env binds them to in-memory fakes (native/hal_native.cpp).
+
+// Fan outputs on this board (build flag FAN_CHANNELS, e.g. intake + exhaust);
+// each has its own PwmSink. The config record always has room for the max.
+#ifndef FAN_CHANNELS
+#define FAN_CHANNELS 1
+#endif
+constexpr size_t FAN_CHANNEL_MAX   = 4;  // LEDC timers on the C3
+constexpr size_t FAN_CHANNEL_COUNT = FAN_CHANNELS;
+static_assert(FAN_CHANNEL_COUNT >= 1 && FAN_CHANNEL_COUNT <= FAN_CHANNEL_MAX, "FAN_CHANNELS must be 1..4");
+
+class PwmSink {
+public:
+  virtual ~PwmSink() {}
+  virtual void write(uint32_t duty) = 0;  // raw LEDC duty, already inverted for active-low
+  // Moves the output linearly from `from` to `to` over `ms`, stepped by a
+  // timer rather than the caller; a later write() or ramp() replaces it.
+  virtual void ramp(uint32_t from, uint32_t to, uint32_t ms) = 0;
+};
+
+// Fan tachometer: a running count of tach edges and the micros() timestamp of
+// the latest one, read as a consistent pair.
+class TachInput {
+public:
+  virtual ~TachInput() {}
+  virtual void read(uint32_t& pulses, uint32_t& lastEdgeUs) = 0;
+};
+
+class Clock {
+public:
+  virtual ~Clock() {}
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;  // wraps; only used for run-time deltas
+};
+
+class NvsStore {
+public:
+  virtual ~NvsStore() {}
+  virtual bool   begin(const char* ns, bool readOnly) = 0;
+  virtual void   end() = 0;
+  virtual bool   getBool(const char* key, bool def) = 0;
+  virtual int    getInt(const char* key, int def) = 0;
+  virtual size_t getString(const char* key, char* out, size_t maxLen) = 0;  // out is "" if missing
+  virtual void   putBool(const char* key, bool value) = 0;
+  virtual void   putInt(const char* key, int value) = 0;
+  virtual void   putString(const char* key, const char* value) = 0;
+  // Blobs: getBytes returns the stored length, or 0 if missing or longer than maxLen.
+  virtual size_t getBytes(const char* key, void* out, size_t maxLen) = 0;
+  virtual bool   putBytes(const char* key, const void* data, size_t len) = 0;
+  virtual void   remove(const char* key) = 0;
+};
+
+typedef void (*MqttMessageCallback)(char* topic, uint8_t* payload, unsigned int length);
+
+// Outcome of one non-blocking step; Pending means "call again on a later pass".
+enum class NetStep : uint8_t { Pending, Done, Failed };
+
+struct MqttConnectRequest {
+  const char* clientId;
+  const char* user;
+  const char* pass;
+  const char* willTopic;
+  uint8_t     willQos;
+  bool        willRetain;
+  const char* willMessage;
+  uint16_t    keepAliveS;
+};
+
+// Gets every publish payload as it comes off the socket, before the message
+// callback runs; the callback itself only sees what fits the client buffer.
+class MqttPayloadSink {
+public:
+  virtual ~MqttPayloadSink() {}
+  virtual void write(const uint8_t* data, size_t len) = 0;
+};
+
+class MqttClient {
+public:
+  virtual ~MqttClient() {}
+  virtual void setCallback(MqttMessageCallback cb) = 0;
+  virtual void setPayloadSink(MqttPayloadSink* sink) = 0;
+  // Connecting is split into steps that never block; each is repeated while it
+  // returns Pending. abortConnect() drops a half-finished attempt.
+  virtual NetStep resolve(const char* host, uint32_t& ip) = 0;   // IPv4, network byte order
+  virtual NetStep connectTcp(uint32_t ip, uint16_t port) = 0;
+  virtual NetStep handshake(const MqttConnectRequest& request) = 0;  // CONNECT, then waits for CONNACK
+  virtual void abortConnect() = 0;
+  virtual void disconnect() = 0;
+  virtual bool connected() = 0;
+  virtual int  state() = 0;
+  virtual bool publish(const char* topic, const char* payload, bool retained) = 0;
+  virtual bool subscribe(const char* topic, uint8_t qos) = 0;
+  virtual bool loop() = 0;
+};
+
+class HttpServer {
+public:
+  virtual ~HttpServer() {}
+  virtual bool   hasArg(const char* name) = 0;
+  virtual size_t arg(const char* name, char* out, size_t maxLen) = 0;  // out is "" if missing
+  virtual size_t header(const char* name, char* out, size_t maxLen) = 0;  // request header, "" if missing
+  virtual void   sendHeader(const char* name, const char* value) = 0;   // adds to the next send()
+  // A large body may be written after the handler returns: keep it in flash or static memory.
+  virtual void   send(int code, const char* contentType, const char* body, size_t len) = 0;
+};
+
+class Network {
+public:
+  virtual ~Network() {}
+  virtual bool     linkUp() = 0;
+  virtual uint64_t efuseMac() = 0;
+};
+
+struct HeapStats {
+  uint32_t freeBytes;
+  uint32_t minFreeBytes;   // low-water mark since boot
+  uint32_t largestBlock;   // biggest single allocation that would succeed now
+};
+
+class SystemInfo {
+public:
+  virtual ~SystemInfo() {}
+  virtual void heap(HeapStats& out) = 0;
+};
+
+class LogSink {
+public:
+  virtual ~LogSink() {}
+  virtual void write(const char* text) = 0;
+};
+
+struct Hal {
+  PwmSink*    pwm[FAN_CHANNEL_COUNT];
+  TachInput*  tach;   // channel 0's; nullptr without a tach wire: no RPM readout or control
+  Clock*      clock;
+  NvsStore*   nvs;
+  MqttClient* mqtt;
+  HttpServer* http;
+  Network*    net;
+  SystemInfo* sys;
+  LogSink*    log;
+};
+
+extern Hal hal;
+
+inline uint32_t halMillis() { return hal.clock->millis(); }
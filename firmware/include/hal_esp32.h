@@ -0,0 +1,10 @@
+#pragma once
+
+#include <PubSubClient.h>
+
+// ========= ESP32 HAL bindings =========
+extern PubSubClient mqtt;
+
+void halEsp32Begin();  // binds `hal` to the objects below; call first thing in setup()
+void setupPwm();
+void setupTach();  // binds hal.tach when FAN_TACH_PIN is set
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= Heap watchdog =========
+// Past setup() nothing on a request or control path allocates: buffers are
+// fixed and static, and the native benches fail any of those paths that
+// does. What can still eat the heap is the platform underneath (WiFi, lwip,
+// a library), and on a unit that runs for months that shows up first as a
+// shrinking largest free block. A periodic check compares the heap with the
+// figures it took once the unit had settled and warns, once per episode, when
+// free heap has dropped by HEAP_WATCH_DROP_BYTES or the largest block is
+// below HEAP_WATCH_MIN_BLOCK_BYTES. The figures are in /metrics either way.
+constexpr uint32_t HEAP_WATCH_PERIOD_MS       = 60000;  // first check sets the baseline
+constexpr uint32_t HEAP_WATCH_DROP_BYTES      = 16384;
+constexpr uint32_t HEAP_WATCH_MIN_BLOCK_BYTES = 16384;  // lwip and TLS want blocks this size
+
+struct HeapWatchStats {
+  HeapStats baseline;  // all zero until the first check
+  HeapStats last;
+  uint32_t  checks;
+  uint32_t  warnings;  // episodes: counted when a check first finds the heap low
+  bool      low;       // the last check found it low
+};
+
+void heapWatchBegin();  // end of setup(): registers the periodic check
+void heapWatchCheck();  // one check; the periodic task
+const HeapWatchStats& heapWatchStats();
+void heapWatchReset();  // no baseline, zeroed counts (native bench fixture)
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= HTTP server =========
+// Event-driven HTTP/1.1 on non-blocking sockets, stepped by the scheduler's
+// "http" task: each pass accepts what is waiting, reads what has arrived and
+// writes what the sockets take, so a slow or half-open client costs a recv()
+// per pass instead of holding up loop(). Connections stay open between
+// requests (pipelined ones are answered in order) and every connection owns
+// fixed buffers; nothing is allocated per request.
+//
+// Handlers run one at a time and talk to their request through hal.http
+// (httpServerRequest()). A body that fits the connection's response buffer is
+// copied on send(); a larger one is written from the caller's memory, so it
+// must be flash or static, and that route's next request waits until it is out.
+//
+// A client polling on keep-alive holds one slot, so up to this many pollers
+// are served without evictions. lwip's socket table is shared with the event
+// stream, MQTT and OTA (main.cpp checks the sum); build with
+// -D HTTP_MAX_CONNECTIONS=7 for the last free socket, or raise
+// CONFIG_LWIP_MAX_SOCKETS for more.
+#ifndef HTTP_MAX_CONNECTIONS
+#define HTTP_MAX_CONNECTIONS 6
+#endif
+constexpr int      HTTP_LISTEN_BACKLOG     = 8;     // clients waiting for a slot (no socket each)
+constexpr size_t   HTTP_REQUEST_BYTES      = 1024;  // request line + headers; longer gets 431
+constexpr size_t   HTTP_RESPONSE_BYTES     = 1024;  // status line, headers and copied bodies
+constexpr size_t   HTTP_MAX_ROUTES         = 16;
+constexpr uint32_t HTTP_IDLE_TIMEOUT_MS    = 5000;  // open connection between requests
+constexpr uint32_t HTTP_REQUEST_TIMEOUT_MS = 3000;  // first byte to end of headers
+constexpr uint32_t HTTP_WRITE_TIMEOUT_MS   = 5000;  // response stalled by a client not reading
+
+// All slots busy with a client waiting: the connection idle the longest is
+// closed to make room (a client reconnects as it would after a timeout).
+struct HttpServerStats {
+  uint32_t accepted;   // connections taken
+  uint32_t evicted;    // idle keep-alive connections closed for a waiting client
+  uint32_t timedOut;   // closed by one of the timeouts above
+  uint32_t rejected;   // malformed, oversized or non-GET requests answered with an error
+  uint32_t requests;   // requests dispatched to a route
+  uint8_t  open;       // connections open now
+};
+
+void httpServerOn(const char* path, void (*handler)());  // GET (and HEAD) on an exact path
+void httpServerOnNotFound(void (*handler)());
+bool httpServerBegin(uint16_t port);  // false if the listener could not be opened
+void httpServerService();             // one non-blocking pass
+void httpServerStop();                // flushes what the sockets take, then closes everything
+uint16_t httpServerPort();            // bound port (0 when stopped); begin(0) picks one
+HttpServer& httpServerRequest();      // the request being handled, for hal.http
+const HttpServerStats& httpServerStats();
+
+void httpServerReset();  // stopped, no routes, zeroed stats (native bench fixture)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Streaming JSON tokenizer =========
+// Takes a document in pieces of any size, as it comes off the socket, and
+// reports keys and scalar values with their nesting depth. Only the current
+// token (cut at JSON_TOKEN_MAX - 1 chars) and one bit per nesting level are
+// kept, so a multi-KB printer report costs a few dozen bytes of RAM.
+// Bytes before the first '{' or '[' are skipped. It is lenient rather than
+// validating: whatever does not parse is passed over, never read past.
+constexpr size_t  JSON_TOKEN_MAX   = 32;
+constexpr uint8_t JSON_STREAM_DEPTH = 32;  // deeper levels are walked but not reported
+
+enum class JsonType : uint8_t { String, Number, Literal };  // literal: true, false, null
+
+class JsonHandler {
+public:
+  virtual ~JsonHandler() {}
+  // `depth` is that of the enclosing object or array; the top level is 1.
+  virtual void key(uint8_t depth, const char* name) = 0;
+  virtual void value(uint8_t depth, JsonType type, const char* text) = 0;
+};
+
+class JsonStream {
+public:
+  void reset();
+  void feed(const uint8_t* data, size_t len, JsonHandler& handler);
+  bool complete() const { return started && depth == 0 && state == State::Idle; }
+
+private:
+  enum class State : uint8_t { Idle, Value, String, Escape, Unicode, Bare };
+
+  void step(uint8_t c, JsonHandler& handler);
+  void endBare(JsonHandler& handler);
+  bool inObject() const { return depth > 0 && depth <= JSON_STREAM_DEPTH && (objects >> (depth - 1)) & 1; }
+
+  State    state = State::Idle;
+  bool     started = false;
+  bool     expectKey = false;
+  bool     isKey = false;
+  uint8_t  depth = 0;
+  uint8_t  skipHex = 0;
+  uint32_t objects = 0;  // bit d-1 set: level d is an object
+  size_t   tokenLen = 0;
+  char     token[JSON_TOKEN_MAX];
+};
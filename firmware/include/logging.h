@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Deferred logging =========
+// LOG_ERROR / LOG_WARN / LOG_INFO / LOG_DEBUG record the format pointer, the
+// time and the raw arguments into a lock-free ring (mpsc_queue.h) and return;
+// nothing is formatted and nothing touches Serial on the caller's path. The
+// "log" scheduler task formats the entries once loop() has nothing else to
+// do, writes them to hal.log and keeps the latest LOG_HISTORY_BYTES of text
+// for GET /log. A full ring drops the entry and counts it.
+//
+// The format must be a string literal (only the pointer is kept); %s
+// arguments are copied, so stack buffers are fine. Supported conversions:
+// d i u x X o c with h/l/ll/z, f e g, s, p, %%. No '*' widths.
+//
+// Entries above LOG_LEVEL are compiled out, arguments and all.
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+constexpr size_t   LOG_QUEUE_LEN      = 32;    // entries awaiting formatting
+constexpr size_t   LOG_MAX_ARGS       = 8;
+constexpr size_t   LOG_STRING_BYTES   = 80;    // copied %s text per entry
+constexpr size_t   LOG_LINE_BYTES     = 256;   // one formatted line
+constexpr size_t   LOG_HISTORY_BYTES  = 2048;  // text kept for /log
+constexpr uint32_t LOG_DRAIN_PER_PASS = 4;     // entries formatted per scheduler pass
+
+enum class LogArgType : uint8_t { Signed, Unsigned, Double, String, Pointer };
+
+struct LogEntry {
+  const char* fmt;
+  uint32_t    ms;
+  uint8_t     level;
+  uint8_t     argc;
+  uint8_t     stringLen;
+  LogArgType  types[LOG_MAX_ARGS];
+  union {
+    int64_t     i;
+    uint64_t    u;
+    double      d;
+    const void* p;
+    uint8_t     offset;  // String: into `strings`
+  } args[LOG_MAX_ARGS];
+  char        strings[LOG_STRING_BYTES];
+};
+
+void logBeginEntry(LogEntry& e, uint8_t level, const char* fmt);
+void logCommit(const LogEntry& e);
+
+inline void logPack(LogEntry& e, LogArgType type, uint64_t bits) {
+  if (e.argc == LOG_MAX_ARGS) return;
+  e.types[e.argc] = type;
+  e.args[e.argc++].u = bits;
+}
+inline void logPack(LogEntry& e, int v) { logPack(e, LogArgType::Signed, (uint64_t)(int64_t)v); }
+inline void logPack(LogEntry& e, long v) { logPack(e, LogArgType::Signed, (uint64_t)(int64_t)v); }
+inline void logPack(LogEntry& e, long long v) { logPack(e, LogArgType::Signed, (uint64_t)v); }
+inline void logPack(LogEntry& e, unsigned v) { logPack(e, LogArgType::Unsigned, v); }
+inline void logPack(LogEntry& e, unsigned long v) { logPack(e, LogArgType::Unsigned, v); }
+inline void logPack(LogEntry& e, unsigned long long v) { logPack(e, LogArgType::Unsigned, v); }
+inline void logPack(LogEntry& e, double v) {
+  if (e.argc == LOG_MAX_ARGS) return;
+  e.types[e.argc] = LogArgType::Double;
+  e.args[e.argc++].d = v;
+}
+void logPack(LogEntry& e, const char* s);
+inline void logPack(LogEntry& e, char* s) { logPack(e, (const char*)s); }
+inline void logPack(LogEntry& e, const void* p) {
+  if (e.argc == LOG_MAX_ARGS) return;
+  e.types[e.argc] = LogArgType::Pointer;
+  e.args[e.argc++].p = p;
+}
+
+template <typename... Args>
+void logDeferred(uint8_t level, const char* fmt, Args... args) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+  LogEntry e;
+  logBeginEntry(e, level, fmt);
+  int packed[] = {0, (logPack(e, args), 0)...};
+  (void)packed;
+  logCommit(e);
+}
+
+#define LOG_AT(level, ...) \
+  do { if ((level) <= LOG_LEVEL) logDeferred((level), __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+void   logBegin();        // registers the drain task
+void   logFlush();        // loop() side: formats and writes everything queued (before a restart)
+size_t logFormat(const LogEntry& e, char* out, size_t size);  // one line, no newline
+size_t logRenderHistory(char* out, size_t size);  // text for /log, oldest first
+uint32_t logDrops();
+void   logReset();        // empties the ring and history (native bench fixture)
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "hal.h"
+
+// ========= Metrics =========
+// Counters and latency histograms for GET /metrics (Prometheus text format).
+// Every update is a few relaxed 32-bit atomic ops, no mutex, so they stay on
+// in production and are safe from the fan task as well as loop() (the C3 has
+// no atomic instructions; the toolchain masks interrupts around each one).
+// Bucket counts are kept per bucket and summed when rendered; the µs sum
+// carries into a wrap counter so it never needs a 64-bit read-modify-write.
+constexpr size_t   METRICS_BUCKETS        = 9;  // incl. +Inf
+constexpr uint32_t METRICS_BOUNDS_US[METRICS_BUCKETS - 1] = {50, 100, 250, 500, 1000, 5000, 25000, 100000};
+constexpr size_t   METRICS_RENDER_BYTES   = 7168;  // /metrics body; histograms past it are left out whole
+constexpr size_t   METRICS_SUMMARY_BYTES  = 256;   // MQTT summary payload
+
+// Optional periodic MQTT publish of a JSON summary on <status topic>/metrics
+// (build with -D METRICS_PUBLISH_S=60); off by default.
+#ifndef METRICS_PUBLISH_S
+#define METRICS_PUBLISH_S 0
+#endif
+
+struct MetricsHistogram {
+  std::atomic<uint32_t> buckets[METRICS_BUCKETS];
+  std::atomic<uint32_t> sumUs;
+  std::atomic<uint32_t> sumWraps;  // sumUs overflowed this many times
+  std::atomic<uint32_t> maxUs;
+
+  void observe(uint32_t us);
+  uint32_t count() const;
+};
+
+enum class MetricHist : uint8_t {
+  Loop,          // one schedulerRunOnce() pass, sleep excluded
+  FanCommand,    // command posted -> PWM written by the fan task
+  MqttPublish,   // one publish() on a live session
+  Count
+};
+
+enum class MetricCounter : uint8_t {
+  MqttConnectAttempts,
+  MqttConnectFailures,
+  MqttPublishes,
+  MqttPublishFailures,
+  NvsWrites,     // counted by the NvsStore bindings
+  Count
+};
+
+// Routes timed by metricsTimed(); NotFound catches everything else.
+enum class HttpRoute : uint8_t {
+  Root, Fan, Status, Tasks, Nvs, Boot, Calibrate, Printer, Profile, Metrics, Log, Reconfig, NotFound, Count
+};
+
+void metricsObserve(MetricHist hist, uint32_t us);
+void metricsCount(MetricCounter counter);
+void metricsObserveHttp(HttpRoute route, uint32_t us);
+uint32_t metricsCountOf(MetricCounter counter);
+const MetricsHistogram& metricsHistogram(MetricHist hist);
+const MetricsHistogram& metricsHttpHistogram(HttpRoute route);
+
+// Route handler wrapper for server.on(): times the handler and counts the request.
+template <HttpRoute route, void (*handler)()>
+void metricsTimed() {
+  uint32_t start = hal.clock->micros();
+  handler();
+  metricsObserveHttp(route, hal.clock->micros() - start);
+}
+
+size_t metricsRender(char* out, size_t size);         // Prometheus text for /metrics
+size_t metricsRenderSummary(char* out, size_t size);  // compact JSON for the MQTT publish
+void   metricsReset();                                // zeroes everything (native bench fixture)
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Bounded lock-free queue =========
+// Multi-producer / single-consumer ring with a sequence number per cell
+// (Vyukov's bounded queue): producers claim a slot with one CAS on `head_`,
+// the consumer never writes anything producers spin on. push() fails instead
+// of blocking when the ring is full. No allocation; T must be trivially
+// copyable. On the ESP32-C3 (no RISC-V "A" extension) IDF implements the
+// atomics with a short interrupt-masked section, which is still wait-free
+// from the tasks' point of view.
+template <typename T, size_t N>
+class MpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+  MpscQueue() { reset(); }
+
+  // Not thread-safe: only while no producer or consumer is active.
+  void reset() {
+    for (size_t i = 0; i < N; i++) cells_[i].seq.store((uint32_t)i, std::memory_order_relaxed);
+    head_.store(0, std::memory_order_relaxed);
+    tail_ = 0;
+  }
+
+  bool push(const T& value) {
+    uint32_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & (N - 1)];
+      int32_t diff = (int32_t)(cell.seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer only.
+  bool pop(T& out) {
+    Cell& cell = cells_[tail_ & (N - 1)];
+    if ((int32_t)(cell.seq.load(std::memory_order_acquire) - (tail_ + 1)) < 0) return false;
+    out = cell.value;
+    cell.seq.store(tail_ + N, std::memory_order_release);
+    tail_++;
+    return true;
+  }
+
+  // Consumer only; a producer may be adding right now, so this is a hint.
+  bool empty() const {
+    return (int32_t)(cells_[tail_ & (N - 1)].seq.load(std::memory_order_acquire) - (tail_ + 1)) < 0;
+  }
+
+private:
+  struct Cell {
+    std::atomic<uint32_t> seq;
+    T value;
+  };
+
+  Cell cells_[N];
+  std::atomic<uint32_t> head_{0};
+  uint32_t tail_ = 0;
+};
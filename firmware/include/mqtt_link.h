@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= MQTT link =========
+constexpr uint32_t MQTT_BACKOFF_MIN_MS  = 1000;     // first retry after 0.5-1 s
+constexpr uint32_t MQTT_BACKOFF_MAX_MS  = 60000;    // cap on the backoff step
+constexpr uint32_t MQTT_STEP_TIMEOUT_MS = 5000;     // per resolve / connect / handshake
+constexpr uint32_t MQTT_DNS_TTL_MS      = 600000;   // cached broker address lifetime
+constexpr uint32_t MQTT_REPUBLISH_MS    = 1000;     // retry delay after a failed state publish
+constexpr size_t   MQTT_MSGS_PER_PASS   = 8;        // inbound messages; half the fan command queue
+
+// State publishes are coalesced: the first change after a quiet window goes
+// out at once, later ones inside the window only update the pending state,
+// which a timer publishes when the window ends, so the settled value is
+// always the last one sent. A payload identical to the last one delivered
+// is not sent again (a reconnect always sends it).
+constexpr uint32_t MQTT_STATE_WINDOW_MS_DEFAULT = 500;    // config mqtt_state_window_ms
+constexpr uint32_t MQTT_STATE_WINDOW_MAX_MS     = 10000;
+
+// State payload: channel 0 at the top level, plus a "fans" list on boards with
+// more than one channel and the progress of a running profile. The client
+// buffer also holds the fixed header and topic, and must fit the 256-byte
+// boot timeline and metrics summary too.
+constexpr size_t MQTT_STATE_PAYLOAD_BYTES = 224 + (FAN_CHANNEL_COUNT > 1 ? 16 + 80 * FAN_CHANNEL_COUNT : 0);
+constexpr size_t MQTT_LARGEST_PAYLOAD     = MQTT_STATE_PAYLOAD_BYTES > 256 ? MQTT_STATE_PAYLOAD_BYTES : 256;
+constexpr size_t MQTT_BUFFER_BYTES        = MQTT_LARGEST_PAYLOAD + 112;
+
+enum class MqttPhase : uint8_t { Idle, Backoff, Resolving, Connecting, Handshaking, Connected };
+
+extern bool mqttStateDirty;
+extern int pendingDutyActiveHigh;
+extern char mqttClientId[32];
+
+struct MqttStateStats {
+  uint32_t changes;     // publishStateFromDuty() calls with MQTT enabled
+  uint32_t published;   // state publishes attempted
+  uint32_t coalesced;   // changes folded into a later publish by the window
+  uint32_t suppressed;  // publishes skipped, payload unchanged
+};
+
+void mqttLinkBegin();  // registers the connect/service, retry and state-publish tasks
+void mqttLinkStop();   // publishes "offline" and drops the session (reconfig)
+MqttPhase mqttLinkPhase();
+uint32_t mqttBackoffMs(uint8_t failureCount, uint32_t random);  // capped exponential, equal jitter
+
+// Commands on the command topic drive channel 0 (or, as a batch, every
+// channel); "<command topic>/<n>" addresses channel n, and
+// "<command topic>/profile" takes a speed profile or "stop" (fan_profile.h).
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length);
+void publishStateFromDuty(int dutyActiveHigh);  // records the state; publishes now or at the window end
+const MqttStateStats& mqttStateStats();
+void publishMqttStatus(const char* status);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= MQTT 3.1.1 packets =========
+// Just what the non-blocking connect sends and checks itself; everything after
+// CONNACK goes through PubSubClient.
+constexpr uint16_t MQTT_KEEPALIVE_S = 45;
+
+// Encodes CONNECT exactly like PubSubClient::connect() (clean session, will,
+// user/pass flags). Returns the packet length, or 0 if `cap` is too small.
+size_t mqttEncodeConnect(const MqttConnectRequest& request, uint8_t* out, size_t cap);
+
+// CONNACK is 4 bytes; returns the return code (0 = accepted), or -1 if the
+// bytes are not a CONNACK.
+int mqttConnackCode(const uint8_t* packet, size_t length);
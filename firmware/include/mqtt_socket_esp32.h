@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Client.h>
+
+#include "hal.h"
+
+// ========= Non-blocking MQTT socket =========
+// Arduino Client over a raw non-blocking lwip socket, handed to PubSubClient.
+// The TCP connect and the CONNECT/CONNACK exchange are stepped by mqtt_link's
+// state machine through connectStep()/sendRaw()/readRaw(). Once CONNACK is in
+// hand, replayConnack() lets PubSubClient::connect() run without waiting: its
+// own CONNECT write is dropped (ours already went out) and its CONNACK read is
+// served from the bytes we received.
+class MqttSocket : public Client {
+public:
+  NetStep connectStep(uint32_t ip, uint16_t port);  // first call opens, later calls poll
+  bool    sendRaw(const uint8_t* data, size_t len);
+  int     readRaw(uint8_t* data, size_t len);       // bytes read, 0 if none yet, -1 if closed
+  void    replayConnack(const uint8_t* connack, size_t len);
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* host, uint16_t port) override;
+  int connect(IPAddress ip, uint16_t port, int32_t timeout);
+  int connect(const char* host, uint16_t port, int32_t timeout);
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return fd_ >= 0; }
+
+private:
+  int     fd_ = -1;
+  bool    swallowWrite_ = false;
+  uint8_t replay_[4];
+  uint8_t replayLen_ = 0;
+  uint8_t replayPos_ = 0;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= Printer reports =========
+// Optional: with a report topic configured (a Bambu printer's
+// device/<serial>/report, bridged to the broker the fan uses), the fan
+// follows the printer. Reports are multi-KB JSON, far larger than the MQTT
+// client buffer, so the payload is tokenized as it streams in (json_stream.h)
+// and only the fields below are kept. Printers send a full report now and
+// then and only the changed fields in between, so values persist across
+// reports.
+//
+// Rules map the fields to a speed, e.g.
+//   gcode_state=RUNNING|PREPARE:60;chamber_temper>=40:80
+// (<field><op><value>:<speed %>, ops = != > >= < <=, '|' separates
+// alternatives for text fields). The highest matching speed wins and is sent
+// to every channel when it changes, so manual commands stand until the
+// printer's state moves on. When no rule matches any more the fan runs on
+// for report_runon_s at report_runon_speed (0 = the last rule speed), then
+// stops. A command the full fan queue drops counts as not sent: the next
+// report sends it again, and the run-on stop is retried every
+// REPORT_RUNON_RETRY_MS.
+constexpr size_t   REPORT_RULES_MAX       = 8;
+constexpr size_t   REPORT_TEXT_MAX        = 24;    // rule text / gcode_state
+constexpr uint32_t REPORT_RUNON_S_DEFAULT = 300;
+constexpr uint32_t REPORT_RUNON_MAX_S     = 3600;
+constexpr uint32_t REPORT_RUNON_RETRY_MS  = 1000;
+#define REPORT_RULES_DEFAULT "gcode_state=RUNNING|PREPARE:60;chamber_temper>=40:80"
+
+enum class ReportField : uint8_t {
+  GcodeState,      // IDLE, PREPARE, RUNNING, PAUSE, FINISH, FAILED
+  ChamberTemper,   // numbers in 0.01 units, like speeds
+  NozzleTemper,
+  BedTemper,
+  McPercent,       // print progress, %
+  McRemainingTime, // minutes
+  Count
+};
+
+struct ReportStats {
+  uint32_t reports;   // report messages applied
+  uint32_t cut;       // report messages that did not end where the JSON did
+  uint32_t bytes;     // payload bytes tokenized
+  uint32_t commands;  // fan commands sent by the rules
+};
+
+// The mqtt_link hooks: every publish payload streams through the sink, and
+// the message callback then says whether it was a report.
+MqttPayloadSink& printerReportSink();
+void printerReportEnd(bool isReport);
+
+void printerReportBegin();   // parses report_rules, registers the run-on task
+bool printerReportEnabled(); // report topic configured
+size_t printerReportRules();  // rules in use; malformed ones are dropped
+int  printerReportTarget();  // current rule speed, 0.01 %
+const ReportStats& printerReportStats();
+size_t printerReportRender(char* out, size_t size);  // JSON for /printer
+void printerReportReset();   // forget the printer state (native bench fixture)
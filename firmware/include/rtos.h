@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// ========= Task shim =========
+// The few RTOS calls the control core needs. FreeRTOS on the device
+// (rtos_esp32.cpp), std::thread + condition variable on the host
+// (native/rtos_native.cpp) so the task model can be stress-tested there.
+constexpr uint32_t RTOS_WAIT_FOREVER = UINT32_MAX;
+
+typedef void (*RtosTaskFn)(void* ctx);
+struct RtosTask;
+
+// Tasks come from a small static pool; returns nullptr when it is exhausted.
+RtosTask* rtosTaskStart(const char* name, RtosTaskFn fn, void* ctx, uint8_t priority, uint32_t stackBytes);
+void rtosNotify(RtosTask* task);         // wakes the task's next/current rtosWaitNotify(); any context
+void rtosWaitNotify(uint32_t timeoutMs); // called by a task on itself
+void rtosTaskJoin(RtosTask* task);       // waits for fn to return, then frees the slot
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Cooperative scheduler =========
+// loop() hands control to schedulerRunOnce(), which runs three kinds of task:
+//   periodic  - fires every periodMs, rounded up to whole SCHED_TICK_MS ticks
+//               (deadlines are kept on a hashed timer wheel)
+//   one-shot  - fires once per schedulerArm(); disarmed until armed again
+//   ready     - runs on every pass whose ready() predicate returns true
+// Every run is timed, so /tasks shows which task is eating the loop, and
+// each whole pass feeds the loop histogram in /metrics.
+
+constexpr size_t   SCHED_MAX_TASKS    = 16;
+constexpr uint32_t SCHED_TICK_MS      = 4;    // timer resolution
+constexpr size_t   SCHED_WHEEL_SLOTS  = 64;   // one rotation = 256 ms
+constexpr uint32_t SCHED_MAX_IDLE_MS  = 2;    // cap on the idle sleep while ready tasks exist
+
+typedef void (*TaskFn)(void* ctx);
+typedef bool (*ReadyFn)(void* ctx);
+typedef int8_t TaskId;  // negative = invalid
+
+struct TaskStats {
+  const char* name;
+  uint32_t runs;
+  uint64_t totalUs;
+  uint32_t maxUs;
+  uint32_t maxLateMs;   // timers only: worst lateness past the deadline
+};
+
+TaskId schedulerAddPeriodic(const char* name, uint32_t periodMs, TaskFn fn, void* ctx = nullptr);
+TaskId schedulerAddOneShot(const char* name, TaskFn fn, void* ctx = nullptr);
+TaskId schedulerAddReady(const char* name, ReadyFn ready, TaskFn fn, void* ctx = nullptr);
+
+void schedulerArm(TaskId id, uint32_t delayMs);  // (re)starts a one-shot or periodic timer
+void schedulerCancel(TaskId id);
+bool schedulerArmed(TaskId id);
+
+// Runs everything that is due; returns how long the caller may sleep.
+uint32_t schedulerRunOnce();
+
+bool   schedulerStats(TaskId id, TaskStats& out);
+size_t schedulerRenderStats(char* out, size_t size);  // JSON for /tasks
+void   schedulerReset();                              // drops all tasks (native bench fixture)
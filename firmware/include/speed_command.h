@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ========= Speed command parser =========
+// Parses an MQTT speed command in place, straight from the payload span, into
+// 0.01 % units (fan_control.h):
+//   "60" / "42.75"                 percent (0-100); whole values >100 are raw duty
+//   "RAW:512" / "raw:512"          raw duty (0..DUTY_MAX), read back through the fan curve
+//   {"speed":75} / {"percent":75}  JSON, fractional values likewise
+// Digits past the second decimal round half up. Surrounding whitespace is
+// ignored. No heap, no float math.
+bool parseSpeedCommand(const uint8_t* payload, size_t length, int& outSpeed);
+
+// Batch for all fan channels (fan_task.h), tried first on the base topic:
+//   {"speed":[60,42.5]} / {"percent":[60,42.5]}
+// One entry per channel in order; `null`, or an entry past the end of the
+// list, leaves that channel as it is (FAN_BATCH_KEEP). Extra entries are
+// ignored. Values are percent with two decimals, as above.
+bool parseSpeedBatch(const uint8_t* payload, size_t length, int16_t* outSpeeds, size_t channels);
+
+// Decimal percent ("42.75") into 0.01 % units, clamped to 0..SPEED_FULL; used
+// for /fan?speed=. False unless the whole string is one number.
+bool parseSpeedValue(const char* text, int& outSpeed);
+
+// RPM command (closed-loop speed, see fan_rpm.h), tried before the above:
+//   "RPM:9000" / "rpm:9000"        target rpm, 0 stops the fan
+//   {"rpm":9000}                   JSON, whole numbers only
+bool parseRpmCommand(const uint8_t* payload, size_t length, int& outRpm);
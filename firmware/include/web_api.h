@@ -0,0 +1,16 @@
+#pragma once
+
+// ========= HTTP / UI =========
+// Route handlers; they talk to the request through hal.http.
+void handleRoot();
+void handleFanApi();
+void handleStatusApi();
+void handleTasksApi();
+void handleNvsApi();
+void handleBootApi();
+void handleCalibrateApi();
+void handlePrinterApi();
+void handleProfileApi();
+void handleMetricsApi();
+void handleLogApi();
+void notFound();
@@ -0,0 +1,136 @@
+#pragma once
+
+// Minimal Arduino surface for the native env: just what the control core uses.
+// String keeps a malloc'd buffer like the device's WString, so the benchmark
+// allocation counters see the same heap traffic the firmware would cause.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef uint8_t byte;
+
+using std::max;
+using std::min;
+using ::round;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class String {
+public:
+  String() {}
+  String(const char* s) { assign(s, s ? strlen(s) : 0); }
+  String(const String& other) { assign(other.buf_, other.len_); }
+  explicit String(int value) {
+    char tmp[16];
+    int n = snprintf(tmp, sizeof(tmp), "%d", value);
+    assign(tmp, (size_t)n);
+  }
+  ~String() { free(buf_); }
+
+  String& operator=(const String& other) {
+    if (this != &other) assign(other.buf_, other.len_);
+    return *this;
+  }
+  String& operator=(const char* s) {
+    assign(s, s ? strlen(s) : 0);
+    return *this;
+  }
+
+  bool reserve(size_t size) {
+    if (buf_ && cap_ >= size) return true;
+    char* next = static_cast<char*>(realloc(buf_, size + 1));
+    if (!next) return false;
+    if (!buf_) next[0] = '\0';
+    buf_ = next;
+    cap_ = size;
+    return true;
+  }
+
+  size_t length() const { return len_; }
+  const char* c_str() const { return buf_ ? buf_ : ""; }
+  char operator[](size_t i) const { return i < len_ ? buf_[i] : '\0'; }
+
+  String& operator+=(const String& rhs) { append(rhs.c_str(), rhs.len_); return *this; }
+  String& operator+=(const char* rhs) { append(rhs, strlen(rhs)); return *this; }
+  String& operator+=(char c) { append(&c, 1); return *this; }
+
+  friend String operator+(const String& lhs, const String& rhs) { String r(lhs); r += rhs; return r; }
+  friend String operator+(const String& lhs, const char* rhs) { String r(lhs); r += rhs; return r; }
+  friend String operator+(const char* lhs, const String& rhs) { String r(lhs); r += rhs; return r; }
+
+  bool operator==(const char* rhs) const { return strcmp(c_str(), rhs ? rhs : "") == 0; }
+  bool operator!=(const char* rhs) const { return !(*this == rhs); }
+
+  bool startsWith(const char* prefix) const {
+    size_t n = strlen(prefix);
+    return n <= len_ && strncmp(c_str(), prefix, n) == 0;
+  }
+  bool endsWith(const char* suffix) const {
+    size_t n = strlen(suffix);
+    return n <= len_ && strcmp(c_str() + len_ - n, suffix) == 0;
+  }
+
+  int indexOf(char c, size_t from = 0) const {
+    if (from >= len_) return -1;
+    const char* p = strchr(c_str() + from, c);
+    return p ? (int)(p - c_str()) : -1;
+  }
+  int indexOf(const char* needle, size_t from = 0) const {
+    if (from >= len_) return -1;
+    const char* p = strstr(c_str() + from, needle);
+    return p ? (int)(p - c_str()) : -1;
+  }
+
+  String substring(size_t from, size_t to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= len_) return String();
+    if (to > len_) to = len_;
+    String r;
+    r.assign(c_str() + from, to - from);
+    return r;
+  }
+  String substring(size_t from) const { return substring(from, len_); }
+
+  void trim() {
+    if (!buf_ || len_ == 0) return;
+    size_t begin = 0;
+    while (begin < len_ && isspace((unsigned char)buf_[begin])) begin++;
+    size_t end = len_;
+    while (end > begin && isspace((unsigned char)buf_[end - 1])) end--;
+    len_ = end - begin;
+    if (begin > 0) memmove(buf_, buf_ + begin, len_);
+    buf_[len_] = '\0';
+  }
+
+  long  toInt() const { return atol(c_str()); }
+  float toFloat() const { return (float)atof(c_str()); }
+
+private:
+  void assign(const char* s, size_t n) {
+    if (n == 0) {
+      if (buf_) buf_[0] = '\0';
+      len_ = 0;
+      return;
+    }
+    if (!reserve(n)) return;
+    memcpy(buf_, s, n);
+    buf_[n] = '\0';
+    len_ = n;
+  }
+  void append(const char* s, size_t n) {
+    if (n == 0) return;
+    if (!reserve(len_ + n)) return;
+    memcpy(buf_ + len_, s, n);
+    len_ += n;
+    buf_[len_] = '\0';
+  }
+
+  char*  buf_ = nullptr;
+  size_t len_ = 0;
+  size_t cap_ = 0;
+};
@@ -0,0 +1,335 @@
+#include "hal_native.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include "metrics.h"
+#include "mqtt_link.h"
+
+SimClock    simClock;
+NativePwm   nativePwm[FAN_CHANNEL_COUNT];
+MemNvs      memNvs;
+FakeMqtt    fakeMqtt;
+FakeHttp    fakeHttp;
+FakeNetwork fakeNetwork;
+FakeSystem  fakeSystem;
+StdoutLog   stdoutLog;
+
+static void copyTruncated(char* dest, size_t size, const char* src, size_t len) {
+  if (size == 0) return;
+  if (len >= size) len = size - 1;
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+}
+
+// ========= NativePwm =========
+void NativePwm::write(uint32_t duty) {
+  lastDuty = duty;
+  rampMs = 0;
+  writes++;
+}
+
+void NativePwm::ramp(uint32_t from, uint32_t to, uint32_t ms) {
+  rampFrom = from;
+  lastDuty = to;
+  rampStartMs = simClock.nowMs;
+  rampMs = ms;
+  ramps++;
+}
+
+uint32_t NativePwm::dutyNow() const {
+  uint32_t elapsed = simClock.nowMs - rampStartMs;
+  if (rampMs == 0 || elapsed >= rampMs) return lastDuty;
+  return (uint32_t)((int64_t)rampFrom + ((int64_t)lastDuty - rampFrom) * elapsed / rampMs);
+}
+
+// ========= MemNvs =========
+bool MemNvs::begin(const char* ns, bool readOnly) {
+  (void)ns;
+  (void)readOnly;
+  return true;
+}
+
+MemNvs::Entry* MemNvs::find(const char* key) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(entries[i].key, key) == 0) return &entries[i];
+  }
+  return nullptr;
+}
+
+MemNvs::Entry* MemNvs::findOrAdd(const char* key) {
+  Entry* e = find(key);
+  if (e || count == kMaxEntries) return e;
+  e = &entries[count++];
+  copyTruncated(e->key, sizeof(e->key), key, strlen(key));
+  e->value[0] = '\0';
+  e->length = 0;
+  e->number = 0;
+  return e;
+}
+
+bool MemNvs::writeLands(size_t& len) {
+  if (cutPower) return false;
+  if (writesBeforeCut == 0) {
+    cutPower = true;
+    len /= 2;  // torn
+    return true;
+  }
+  if (writesBeforeCut > 0) writesBeforeCut--;
+  return true;
+}
+
+bool MemNvs::getBool(const char* key, bool def) {
+  reads++;
+  Entry* e = find(key);
+  return e ? e->number != 0 : def;
+}
+
+int MemNvs::getInt(const char* key, int def) {
+  reads++;
+  Entry* e = find(key);
+  return e ? e->number : def;
+}
+
+size_t MemNvs::getString(const char* key, char* out, size_t maxLen) {
+  if (maxLen == 0) return 0;
+  out[0] = '\0';
+  reads++;
+  Entry* e = find(key);
+  if (!e) return 0;
+  copyTruncated(out, maxLen, e->value, strlen(e->value));
+  return strlen(out);
+}
+
+void MemNvs::putBool(const char* key, bool value) { putInt(key, value ? 1 : 0); }
+
+void MemNvs::putInt(const char* key, int value) {
+  size_t len = sizeof(value);
+  if (!writeLands(len) || cutPower) return;
+  Entry* e = findOrAdd(key);
+  if (!e) return;
+  e->number = value;
+  writes++;
+  metricsCount(MetricCounter::NvsWrites);
+}
+
+void MemNvs::putString(const char* key, const char* value) {
+  size_t len = strlen(value);
+  if (!writeLands(len)) return;
+  Entry* e = findOrAdd(key);
+  if (!e) return;
+  copyTruncated(e->value, sizeof(e->value), value, len);
+  writes++;
+  metricsCount(MetricCounter::NvsWrites);
+}
+
+size_t MemNvs::getBytes(const char* key, void* out, size_t maxLen) {
+  reads++;
+  Entry* e = find(key);
+  if (!e || e->length > maxLen) return 0;
+  memcpy(out, e->value, e->length);
+  return e->length;
+}
+
+bool MemNvs::putBytes(const char* key, const void* data, size_t len) {
+  if (len > kMaxValue) return false;
+  size_t landed = len;
+  if (!writeLands(landed)) return false;
+  Entry* e = findOrAdd(key);
+  if (!e) return false;
+  // A torn blob keeps its full length with the tail still holding old bytes.
+  memcpy(e->value, data, landed);
+  e->length = len;
+  writes++;
+  metricsCount(MetricCounter::NvsWrites);
+  return landed == len;
+}
+
+void MemNvs::remove(const char* key) {
+  Entry* e = find(key);
+  if (!e || cutPower) return;
+  *e = entries[--count];
+}
+
+// ========= FakeMqtt =========
+NetStep FakeMqtt::finishAfterPolls(bool success) {
+  if (polls < pendingPolls) {
+    polls++;
+    return NetStep::Pending;
+  }
+  polls = 0;
+  return success ? NetStep::Done : NetStep::Failed;
+}
+
+NetStep FakeMqtt::resolve(const char* host, uint32_t& ip) {
+  (void)host;
+  resolveCalls++;
+  ip = 0x0100007f;  // 127.0.0.1
+  return finishAfterPolls(true);
+}
+
+NetStep FakeMqtt::connectTcp(uint32_t ip, uint16_t port) {
+  (void)ip; (void)port;
+  tcpCalls++;
+  return finishAfterPolls(acceptTcp);
+}
+
+NetStep FakeMqtt::handshake(const MqttConnectRequest& request) {
+  (void)request;
+  NetStep step = finishAfterPolls(acceptConnect);
+  if (step != NetStep::Pending) connectAttempts++;
+  isConnected = step == NetStep::Done;
+  return step;
+}
+
+bool FakeMqtt::publish(const char* topic, const char* payload, bool retained) {
+  (void)retained;
+  if (!isConnected) return false;
+  copyTruncated(lastTopic, sizeof(lastTopic), topic, strlen(topic));
+  copyTruncated(lastPayload, sizeof(lastPayload), payload, strlen(payload));
+  publishes++;
+  return true;
+}
+
+bool FakeMqtt::subscribe(const char* topic, uint8_t qos) {
+  (void)qos;
+  if (!isConnected) return false;
+  subscriptions++;
+  copyTruncated(lastSubscribed, sizeof(lastSubscribed), topic, strlen(topic));
+  return true;
+}
+
+void FakeMqtt::deliver(const char* topic, const uint8_t* payload, size_t length) {
+  if (!callback) return;
+  for (size_t at = 0; sink && at < length; at += segmentBytes) {
+    sink->write(payload + at, length - at < segmentBytes ? length - at : segmentBytes);
+  }
+  char topicCopy[100];
+  uint8_t payloadCopy[MQTT_BUFFER_BYTES];
+  copyTruncated(topicCopy, sizeof(topicCopy), topic, strlen(topic));
+  if (length > sizeof(payloadCopy)) length = sizeof(payloadCopy);
+  memcpy(payloadCopy, payload, length);
+  callback(topicCopy, payloadCopy, (unsigned int)length);
+}
+
+bool FakeMqtt::publishInbound(const char* topic, const char* payload, uint32_t sentMs) {
+  if (inboxCount == kInboxLen) {
+    inboxDropped++;
+    return false;
+  }
+  Inbound& m = inbox[(inboxHead + inboxCount++) % kInboxLen];
+  copyTruncated(m.topic, sizeof(m.topic), topic, strlen(topic));
+  copyTruncated(m.payload, sizeof(m.payload), payload, strlen(payload));
+  m.sentMs = sentMs;
+  return true;
+}
+
+bool FakeMqtt::loop() {
+  if (!isConnected) return false;
+  if (inboxCount == 0) return true;
+  const Inbound& m = inbox[inboxHead];
+  inboxHead = (inboxHead + 1) % kInboxLen;
+  inboxCount--;
+  lastInboundSentMs = m.sentMs;
+  inboxDelivered++;
+  deliver(m.topic, (const uint8_t*)m.payload, strlen(m.payload));
+  return true;
+}
+
+// ========= FakeHttp =========
+bool FakeHttp::hasArg(const char* name) {
+  for (size_t i = 0; i < argCount; i++) {
+    if (strcmp(args[i].name, name) == 0) return true;
+  }
+  return false;
+}
+
+size_t FakeHttp::arg(const char* name, char* out, size_t maxLen) {
+  if (maxLen == 0) return 0;
+  out[0] = '\0';
+  for (size_t i = 0; i < argCount; i++) {
+    if (strcmp(args[i].name, name) == 0) {
+      copyTruncated(out, maxLen, args[i].value, strlen(args[i].value));
+      return strlen(out);
+    }
+  }
+  return 0;
+}
+
+size_t FakeHttp::header(const char* name, char* out, size_t maxLen) {
+  if (maxLen == 0) return 0;
+  out[0] = '\0';
+  if (strcmp(requestHeader.name, name) != 0) return 0;
+  copyTruncated(out, maxLen, requestHeader.value, strlen(requestHeader.value));
+  return strlen(out);
+}
+
+void FakeHttp::sendHeader(const char* name, const char* value) {
+  if (responseSent) {  // first header of a new response
+    responseHeaderCount = 0;
+    responseSent = false;
+  }
+  if (responseHeaderCount == kMaxArgs) return;
+  Arg& h = responseHeaders[responseHeaderCount++];
+  copyTruncated(h.name, sizeof(h.name), name, strlen(name));
+  copyTruncated(h.value, sizeof(h.value), value, strlen(value));
+}
+
+const char* FakeHttp::responseHeader(const char* name) const {
+  for (size_t i = 0; i < responseHeaderCount; i++) {
+    if (strcasecmp(responseHeaders[i].name, name) == 0) return responseHeaders[i].value;
+  }
+  return nullptr;
+}
+
+void FakeHttp::setRequestHeader(const char* name, const char* value) {
+  copyTruncated(requestHeader.name, sizeof(requestHeader.name), name, strlen(name));
+  copyTruncated(requestHeader.value, sizeof(requestHeader.value), value, strlen(value));
+}
+
+void FakeHttp::send(int code, const char* contentType, const char* body, size_t len) {
+  (void)contentType;
+  if (responseSent) responseHeaderCount = 0;  // response without extra headers
+  responseSent = true;
+  lastCode = code;
+  lastLength = len;
+  copyTruncated(lastBody, sizeof(lastBody), body, len);
+  responses++;
+}
+
+void FakeHttp::setQuery(const char* query) {
+  argCount = 0;
+  while (query && *query && argCount < kMaxArgs) {
+    const char* amp = strchr(query, '&');
+    size_t len = amp ? (size_t)(amp - query) : strlen(query);
+    const char* eq = (const char*)memchr(query, '=', len);
+    Arg& a = args[argCount++];
+    if (eq) {
+      copyTruncated(a.name, sizeof(a.name), query, (size_t)(eq - query));
+      copyTruncated(a.value, sizeof(a.value), eq + 1, len - (size_t)(eq - query) - 1);
+    } else {
+      copyTruncated(a.name, sizeof(a.name), query, len);
+      a.value[0] = '\0';
+    }
+    query = amp ? amp + 1 : nullptr;
+  }
+}
+
+// ========= StdoutLog =========
+void StdoutLog::write(const char* text) {
+  if (!muted) fputs(text, stdout);
+}
+
+void halNativeBegin() {
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) hal.pwm[i] = &nativePwm[i];
+  hal.tach  = nullptr;  // benches that close the loop bind simFan (sim_fan.h)
+  hal.clock = &simClock;
+  hal.nvs   = &memNvs;
+  hal.mqtt  = &fakeMqtt;
+  hal.http  = &fakeHttp;
+  hal.net   = &fakeNetwork;
+  hal.sys   = &fakeSystem;
+  hal.log   = &stdoutLog;
+}
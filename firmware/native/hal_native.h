@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "hal.h"
+
+// ========= Native HAL fakes =========
+// In-memory stand-ins for the ESP32 peripherals. None of them allocate after
+// construction, so whatever the benchmarks count comes from the core itself.
+
+class SimClock : public Clock {
+public:
+  uint32_t millis() override { return nowMs; }
+  uint32_t micros() override { return nowMs * 1000u; }
+  void advance(uint32_t ms) { nowMs += ms; }
+  std::atomic<uint32_t> nowMs{0};  // read by the fan task thread in the stress benches
+};
+
+// Ramps are followed on simClock, as the device's timer would step them.
+class NativePwm : public PwmSink {
+public:
+  void write(uint32_t duty) override;
+  void ramp(uint32_t from, uint32_t to, uint32_t ms) override;
+  uint32_t dutyNow() const;  // raw output at simClock, mid-ramp included
+  uint32_t lastDuty = 0;     // last value written, or the end of the last ramp
+  uint32_t writes = 0;
+  uint32_t ramps = 0;
+
+private:
+  uint32_t rampFrom = 0;
+  uint32_t rampStartMs = 0;
+  uint32_t rampMs = 0;
+};
+
+class MemNvs : public NvsStore {
+public:
+  static constexpr size_t kMaxEntries = 32;
+  static constexpr size_t kMaxKey     = 16;   // NVS keys are at most 15 chars
+  static constexpr size_t kMaxValue   = 1024; // fits the config blob
+
+  bool   begin(const char* ns, bool readOnly) override;
+  void   end() override {}
+  bool   getBool(const char* key, bool def) override;
+  int    getInt(const char* key, int def) override;
+  size_t getString(const char* key, char* out, size_t maxLen) override;
+  void   putBool(const char* key, bool value) override;
+  void   putInt(const char* key, int value) override;
+  void   putString(const char* key, const char* value) override;
+  size_t getBytes(const char* key, void* out, size_t maxLen) override;
+  bool   putBytes(const char* key, const void* data, size_t len) override;
+  void   remove(const char* key) override;
+
+  void clear() { count = 0; writes = 0; reads = 0; cutPower = false; writesBeforeCut = -1; }
+  // Power loss: the write after `writesBeforeCut` more writes stores only half
+  // its bytes, and nothing after it lands. -1 = never.
+  void cutPowerAfter(int writes) { writesBeforeCut = writes; }
+  void restorePower() { cutPower = false; writesBeforeCut = -1; }
+  bool powerCut() const { return cutPower; }
+  uint32_t writes = 0;
+  uint32_t reads = 0;
+
+private:
+  struct Entry {
+    char   key[kMaxKey];
+    char   value[kMaxValue];
+    size_t length;  // blobs
+    int    number;
+  };
+  bool   writeLands(size_t& len);
+  Entry* find(const char* key);
+  Entry* findOrAdd(const char* key);
+
+  Entry  entries[kMaxEntries];
+  size_t count = 0;
+  int    writesBeforeCut = -1;
+  bool   cutPower = false;
+};
+
+class FakeMqtt : public MqttClient {
+public:
+  void setCallback(MqttMessageCallback cb) override { callback = cb; }
+  void setPayloadSink(MqttPayloadSink* s) override { sink = s; }
+  NetStep resolve(const char* host, uint32_t& ip) override;
+  NetStep connectTcp(uint32_t ip, uint16_t port) override;
+  NetStep handshake(const MqttConnectRequest& request) override;
+  void abortConnect() override { polls = 0; }
+  void disconnect() override { isConnected = false; }
+  bool connected() override { return isConnected; }
+  int  state() override { return isConnected ? 0 : -1; }
+  bool publish(const char* topic, const char* payload, bool retained) override;
+  bool subscribe(const char* topic, uint8_t qos) override;
+  bool loop() override;
+
+  // Feeds an inbound message through the payload sink, in segmentBytes
+  // pieces like TCP segments off the socket, then through the registered
+  // callback with the part that fits the client buffer.
+  void deliver(const char* topic, const uint8_t* payload, size_t length);
+  size_t segmentBytes = 1460;
+
+  // Broker side of the load benches: a published message waits in the inbox,
+  // as it would in the socket, until loop() delivers it; one per call, like
+  // PubSubClient::loop(). False (and counted) if the inbox is full.
+  static constexpr size_t kInboxLen = 256;
+  bool publishInbound(const char* topic, const char* payload, uint32_t sentMs);
+  size_t inboxWaiting() const { return inboxCount; }
+  uint32_t inboxDelivered = 0;
+  uint32_t inboxDropped = 0;
+  uint32_t lastInboundSentMs = 0;  // sentMs of the message loop() delivered last
+
+  // Each connect step reports Pending this many times before it completes.
+  uint32_t pendingPolls = 0;
+  bool acceptConnect = true;     // broker answers CONNACK 0
+  bool acceptTcp = true;         // broker port reachable
+  bool isConnected = false;
+  uint32_t resolveCalls = 0;     // every poll counts; the state machine must not spin on the fan path
+  uint32_t tcpCalls = 0;
+  uint32_t connectAttempts = 0;  // handshakes completed or refused
+  uint32_t publishes = 0;
+  char lastTopic[100] = "";
+  char lastPayload[512] = "";  // a four-channel state payload fits
+  char lastSubscribed[100] = "";
+  uint32_t subscriptions = 0;
+  MqttMessageCallback callback = nullptr;
+  MqttPayloadSink* sink = nullptr;
+
+private:
+  struct Inbound {
+    char     topic[64];
+    char     payload[96];
+    uint32_t sentMs;
+  };
+  NetStep finishAfterPolls(bool success);
+  uint32_t polls = 0;
+  Inbound inbox[kInboxLen];
+  size_t  inboxHead = 0;
+  size_t  inboxCount = 0;
+};
+
+class FakeHttp : public HttpServer {
+public:
+  static constexpr size_t kMaxArgs = 8;
+
+  bool   hasArg(const char* name) override;
+  size_t arg(const char* name, char* out, size_t maxLen) override;
+  size_t header(const char* name, char* out, size_t maxLen) override;
+  void   sendHeader(const char* name, const char* value) override;
+  void   send(int code, const char* contentType, const char* body, size_t len) override;
+
+  // Parses "a=1&b=2" into the argument table for the next handler call.
+  void setQuery(const char* query);
+  // Single request header for the next handler call ("" clears it).
+  void setRequestHeader(const char* name, const char* value);
+
+  // Value of a header added with sendHeader() for the last response.
+  const char* responseHeader(const char* name) const;
+
+  int    lastCode = 0;
+  size_t lastLength = 0;
+  char   lastBody[512] = "";
+  uint32_t responses = 0;
+
+private:
+  struct Arg {
+    char name[24];
+    char value[64];
+  };
+  Arg    args[kMaxArgs];
+  size_t argCount = 0;
+  Arg    requestHeader = {};
+  Arg    responseHeaders[kMaxArgs];
+  size_t responseHeaderCount = 0;
+  bool   responseSent = false;
+};
+
+class FakeNetwork : public Network {
+public:
+  bool linkUp() override { return up; }
+  uint64_t efuseMac() override { return 0x0000A1B2C3D4E5F6ull; }
+  bool up = true;
+};
+
+class FakeSystem : public SystemInfo {
+public:
+  void heap(HeapStats& out) override { out = stats; }
+  HeapStats stats = {180000, 150000, 110000};  // roughly a C3 with WiFi up
+};
+
+class StdoutLog : public LogSink {
+public:
+  void write(const char* text) override;
+  bool muted = false;
+};
+
+extern SimClock    simClock;
+extern NativePwm   nativePwm[FAN_CHANNEL_COUNT];  // one per fan channel
+extern MemNvs      memNvs;
+extern FakeMqtt    fakeMqtt;
+extern FakeHttp    fakeHttp;
+extern FakeNetwork fakeNetwork;
+extern FakeSystem  fakeSystem;
+extern StdoutLog   stdoutLog;
+
+void halNativeBegin();
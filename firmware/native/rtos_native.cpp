@@ -0,0 +1,60 @@
+#include "rtos.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct RtosTask {
+  std::thread             thread;
+  std::mutex              lock;
+  std::condition_variable wake;
+  bool                    notified = false;
+  bool                    inUse = false;
+};
+
+static RtosTask taskPool[4];
+static thread_local RtosTask* currentTask = nullptr;
+
+// Priority and stack size have no host equivalent; the OS scheduler decides.
+RtosTask* rtosTaskStart(const char* name, RtosTaskFn fn, void* ctx, uint8_t priority, uint32_t stackBytes) {
+  (void)name; (void)priority; (void)stackBytes;
+  for (RtosTask& task : taskPool) {
+    if (task.inUse) continue;
+    task.inUse = true;
+    task.notified = false;
+    task.thread = std::thread([&task, fn, ctx] {
+      currentTask = &task;
+      fn(ctx);
+    });
+    return &task;
+  }
+  return nullptr;
+}
+
+void rtosNotify(RtosTask* task) {
+  if (!task) return;
+  {
+    std::lock_guard<std::mutex> guard(task->lock);
+    task->notified = true;
+  }
+  task->wake.notify_one();
+}
+
+void rtosWaitNotify(uint32_t timeoutMs) {
+  RtosTask* task = currentTask;
+  if (!task) return;
+  std::unique_lock<std::mutex> guard(task->lock);
+  if (timeoutMs == RTOS_WAIT_FOREVER) {
+    task->wake.wait(guard, [task] { return task->notified; });
+  } else {
+    task->wake.wait_for(guard, std::chrono::milliseconds(timeoutMs), [task] { return task->notified; });
+  }
+  task->notified = false;
+}
+
+void rtosTaskJoin(RtosTask* task) {
+  if (!task) return;
+  if (task->thread.joinable()) task->thread.join();
+  task->inUse = false;
+}
@@ -0,0 +1,67 @@
+#include "sim_fan.h"
+
+#include <cmath>
+
+#include "fan_control.h"
+#include "fan_rpm.h"
+#include "hal_native.h"
+
+SimFan simFan;
+
+namespace {
+
+constexpr float kDeadDuty  = 0.08f;  // below this the motor produces no torque
+constexpr float kTauUpS    = 0.35f;
+constexpr float kTauDownS  = 0.80f;
+constexpr float kTauHeldS  = 0.05f;  // a held rotor stops almost at once
+constexpr float kTurningRpm = 200.0f;
+
+float steadyRpm(float duty) {
+  if (duty <= kDeadDuty) return 0.0f;
+  return FAN_RPM_MAX * powf((duty - kDeadDuty) / (1.0f - kDeadDuty), 0.8f);
+}
+
+}  // namespace
+
+void SimFan::reset() {
+  atMs = simClock.nowMs;
+  speed = 0.0f;
+  phase = 0.0f;
+  turning = false;
+  pulses = 0;
+  lastEdgeUs = 0;
+  load = 1.0f;
+  blocked = false;
+}
+
+void SimFan::advanceTo(uint32_t nowMs) {
+  const float dt = 0.001f;
+  const float edgesPerRev = TACH_PULSES_PER_REV;
+  for (; atMs != nowMs; atMs++) {
+    float duty = (float)invertDuty((int)nativePwm[0].dutyNow()) / DUTY_MAX;  // the PWM is active-low
+    float target = steadyRpm(duty) * load;
+    if (blocked || duty < (turning ? kStallDuty : kStartDuty)) target = 0.0f;
+    float tau = blocked ? kTauHeldS : (target > speed ? kTauUpS : kTauDownS);
+    speed += (target - speed) * dt / tau;
+    if (speed < 1.0f) speed = 0.0f;
+    turning = speed > kTurningRpm;
+
+    float step = speed / 60.0f * edgesPerRev * dt;  // edges this millisecond
+    if (step <= 0.0f) continue;
+    float before = phase;
+    phase += step;
+    while (phase >= 1.0f) {
+      float into = (1.0f - before) / step;  // where in the step the edge fell
+      lastEdgeUs = atMs * 1000u + (uint32_t)(into * 1000.0f);
+      pulses++;
+      phase -= 1.0f;
+      before -= 1.0f;
+    }
+  }
+}
+
+void SimFan::read(uint32_t& outPulses, uint32_t& outLastEdgeUs) {
+  advanceTo(simClock.nowMs);
+  outPulses = pulses;
+  outLastEdgeUs = lastEdgeUs;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// ========= Simulated fan (native env) =========
+// A 4-wire fan driven by nativePwm[0] (ramps included) and read back as tach edges, so the RPM
+// estimator and the PID loop run closed-loop on the host. Speed follows a
+// nonlinear duty curve through a first-order lag; the rotor needs more duty to
+// start than to keep turning. The plant integrates in 1 ms steps up to
+// simClock whenever the tach is read.
+class SimFan : public TachInput {
+public:
+  static constexpr float kStartDuty = 0.22f;  // needed to break away from rest
+  static constexpr float kStallDuty = 0.12f;  // a turning rotor stops below this
+
+  void read(uint32_t& pulses, uint32_t& lastEdgeUs) override;
+
+  void reset();              // at rest, nominal load, synced to simClock
+  float rpm() const { return speed; }
+
+  float load = 1.0f;         // filter restriction: scales the speed a duty reaches
+  bool  blocked = false;     // rotor held (stall)
+
+private:
+  void advanceTo(uint32_t nowMs);
+
+  uint32_t atMs = 0;
+  float    speed = 0.0f;
+  float    phase = 0.0f;     // fraction of the way to the next tach edge
+  bool     turning = false;
+  uint32_t pulses = 0;
+  uint32_t lastEdgeUs = 0;
+};
+
+extern SimFan simFan;
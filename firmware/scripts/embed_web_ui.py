@@ -0,0 +1,78 @@
+"""Embed web/index.html as a minified, gzip-compressed flash constant.
+
+Runs as a PlatformIO pre-build script (see extra_scripts in platformio.ini)
+and can also be run by hand: python3 scripts/embed_web_ui.py
+
+Writes include/web_ui_gz.h with the compressed bytes and a strong ETag
+derived from them, so the page changes ETag exactly when its content does.
+The header is only rewritten when its content changes, to keep incremental
+builds incremental.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+
+try:
+    Import("env")  # noqa: F821  (injected by PlatformIO/SCons)
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(PROJECT_DIR, "web", "index.html")
+OUTPUT = os.path.join(PROJECT_DIR, "include", "web_ui_gz.h")
+
+
+def minify(html):
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+    lines = []
+    for line in html.splitlines():
+        line = line.strip()
+        # Whole-line JS comments only; inline "//" may be part of a URL or string.
+        if not line or line.startswith("//"):
+            continue
+        lines.append(line)
+    # Keep newlines so the inline script never depends on semicolon insertion.
+    return "\n".join(lines)
+
+
+def render(gz, etag):
+    rows = []
+    for i in range(0, len(gz), 16):
+        rows.append("  " + ", ".join("0x%02x" % b for b in gz[i:i + 16]) + ",")
+    return (
+        "// Generated by scripts/embed_web_ui.py from web/index.html - do not edit.\n"
+        "#pragma once\n"
+        "\n"
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "#define WEB_UI_ETAG \"\\\"%s\\\"\"\n"
+        "\n"
+        "// const data stays in flash (memory-mapped rodata) on the ESP32.\n"
+        "static const size_t WEB_UI_GZ_LEN = %d;\n"
+        "static const uint8_t WEB_UI_GZ[] = {\n"
+        "%s\n"
+        "};\n" % (etag, len(gz), "\n".join(rows))
+    )
+
+
+def main():
+    with open(SOURCE, "r", encoding="utf-8") as f:
+        html = minify(f.read())
+    # mtime=0 keeps the output byte-identical across builds of the same page.
+    gz = gzip.compress(html.encode("utf-8"), compresslevel=9, mtime=0)
+    etag = hashlib.sha1(gz).hexdigest()[:16]
+    text = render(gz, etag)
+
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT, "r", encoding="utf-8") as f:
+            if f.read() == text:
+                return
+    with open(OUTPUT, "w", encoding="utf-8", newline="\n") as f:
+        f.write(text)
+    print("embed_web_ui: %d bytes html -> %d bytes gzip, ETag %s" % (len(html), len(gz), etag))
+
+
+main()
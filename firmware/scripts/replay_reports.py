@@ -0,0 +1,56 @@
+"""Replay recorded Bambu printer reports to an MQTT broker.
+
+Publishes every file of a report directory (default: the bench corpus,
+bench/corpus/printer_report), in file name order, to the report topic of a
+local broker, so a unit configured with that topic can be watched following
+a print without a printer:
+
+    mosquitto -v &
+    python3 scripts/replay_reports.py --host 127.0.0.1 --delay 2
+
+Uses mosquitto_pub (mosquitto-clients), so no Python packages are needed.
+Reports are published at QoS 0, as the printer does.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+CORPUS = os.path.join(PROJECT_DIR, "bench", "corpus", "printer_report")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--topic", default="device/01P00A000000000/report")
+    parser.add_argument("--dir", default=CORPUS, help="one report per file")
+    parser.add_argument("--delay", type=float, default=1.0, help="seconds between reports")
+    parser.add_argument("--loop", type=int, default=1, help="replay the print this many times")
+    args = parser.parse_args()
+
+    files = sorted(f for f in os.listdir(args.dir) if not f.startswith("."))
+    if not files:
+        sys.exit("no reports in " + args.dir)
+
+    base = ["mosquitto_pub", "-h", args.host, "-p", str(args.port), "-t", args.topic, "-q", "0"]
+    if args.user:
+        base += ["-u", args.user]
+    if args.password:
+        base += ["-P", args.password]
+
+    for _ in range(args.loop):
+        for name in files:
+            path = os.path.join(args.dir, name)
+            print("%-28s %6d bytes -> %s" % (name, os.path.getsize(path), args.topic))
+            subprocess.run(base + ["-f", path], check=True)
+            time.sleep(args.delay)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+#include "boot.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include "hal.h"
+
+static uint32_t phaseMs[(size_t)BootPhase::Count];
+static std::atomic<uint8_t> reached{0};  // bit per phase; LinkUp is marked from the WiFi event task
+static const char* resetReason = "";
+static const char* wifiPath = "";
+
+static constexpr const char* kWifiCacheKey = "wifi_fast";
+static constexpr uint8_t     kWifiCacheMagic = 0xB5;
+
+static_assert((size_t)BootPhase::Count <= 8, "reached is a uint8_t bitmap");
+
+// ========= Timeline =========
+void bootMark(BootPhase phase) {
+  uint32_t now = halMillis();
+  uint8_t bit = (uint8_t)(1u << (uint8_t)phase);
+  if (reached.fetch_or(bit) & bit) return;
+  phaseMs[(size_t)phase] = now;
+}
+
+bool bootReached(BootPhase phase) {
+  return (reached.load() & (1u << (uint8_t)phase)) != 0;
+}
+
+uint32_t bootPhaseMs(BootPhase phase) {
+  return bootReached(phase) ? phaseMs[(size_t)phase] : 0;
+}
+
+void bootSetInfo(const char* reason, const char* path) {
+  if (reason) resetReason = reason;
+  if (path) wifiPath = path;
+}
+
+size_t bootRenderTimeline(char* out, size_t size) {
+  static const char* const kNames[] = {"setup", "config", "fan", "wifi_start", "http", "link", "mqtt"};
+  static_assert(sizeof(kNames) / sizeof(kNames[0]) == (size_t)BootPhase::Count, "one name per phase");
+  if (size == 0) return 0;
+  size_t len = 0;
+  auto append = [&](int n) {
+    if (n > 0) len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+  };
+  append(snprintf(out, size, "{\"reset\":\"%s\",\"wifi\":\"%s\",\"phases_ms\":{", resetReason, wifiPath));
+  bool first = true;
+  for (size_t i = 0; i < (size_t)BootPhase::Count; i++) {
+    if (!bootReached((BootPhase)i)) continue;
+    append(snprintf(out + len, size - len, "%s\"%s\":%lu", first ? "" : ",", kNames[i], (unsigned long)phaseMs[i]));
+    first = false;
+  }
+  append(snprintf(out + len, size - len, "}}"));
+  return len;
+}
+
+void bootReset() {
+  reached = 0;
+  resetReason = "";
+  wifiPath = "";
+}
+
+// ========= WiFi association cache =========
+// Stored as [magic, bssid x6, channel, check]; `check` catches a torn write.
+static uint8_t cacheCheck(const uint8_t* bytes, size_t len) {
+  uint8_t sum = 0x5A;
+  for (size_t i = 0; i < len; i++) sum = (uint8_t)((sum << 1 | sum >> 7) ^ bytes[i]);
+  return sum;
+}
+
+bool bootLoadWifiCache(WifiFastCache& out) {
+  uint8_t raw[9];
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", true);
+  size_t len = preferences.getBytes(kWifiCacheKey, raw, sizeof(raw));
+  preferences.end();
+  if (len != sizeof(raw) || raw[0] != kWifiCacheMagic || cacheCheck(raw, 8) != raw[8]) return false;
+  if (raw[7] < 1 || raw[7] > 14) return false;
+  memcpy(out.bssid, raw + 1, 6);
+  out.channel = raw[7];
+  return true;
+}
+
+void bootStoreWifiCache(const WifiFastCache& cache) {
+  WifiFastCache current;
+  if (bootLoadWifiCache(current) && memcmp(current.bssid, cache.bssid, 6) == 0 &&
+      current.channel == cache.channel) {
+    return;  // the usual case: same AP as last boot
+  }
+  uint8_t raw[9];
+  raw[0] = kWifiCacheMagic;
+  memcpy(raw + 1, cache.bssid, 6);
+  raw[7] = cache.channel;
+  raw[8] = cacheCheck(raw, 8);
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", false);
+  preferences.putBytes(kWifiCacheKey, raw, sizeof(raw));
+  preferences.end();
+}
+
+void bootClearWifiCache() {
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", false);
+  preferences.remove(kWifiCacheKey);
+  preferences.end();
+}
+
+// ========= Helpers =========
+bool parseIpv4(const char* text, uint32_t& ip) {
+  uint32_t result = 0;
+  for (int octet = 0; octet < 4; octet++) {
+    if (octet > 0 && *text++ != '.') return false;
+    uint32_t value = 0;
+    int digits = 0;
+    while (*text >= '0' && *text <= '9' && digits < 3) {
+      value = value * 10 + (uint32_t)(*text++ - '0');
+      digits++;
+    }
+    if (digits == 0 || value > 255) return false;
+    result |= value << (8 * octet);  // network order in memory
+  }
+  if (*text != '\0') return false;
+  ip = result;
+  return true;
+}
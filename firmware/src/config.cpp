@@ -0,0 +1,491 @@
+#include "config.h"
+
+#include <Arduino.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctype.h>
+
+#include "fan_control.h"
+#include "hal.h"
+#include "logging.h"
+#include "mqtt_link.h"
+#include "printer_report.h"
+#include "scheduler.h"
+
+Config currentConfig;
+
+static Config   persisted;        // what NVS holds, as of the last load/flush
+static uint32_t dirtyFields = 0;  // ConfigField bits waiting for a flush
+static const char* bootSource = "defaults";
+
+// ========= Config record =========
+// The whole Config is one NVS blob: a fixed header, then the fields in a
+// fixed order, scalars as single bytes / little-endian uint16 and strings
+// length-prefixed (so a typical record is ~100 bytes, not the ~430 of the
+// struct). Later schemas may append fields: a reader fills fields missing
+// from an older, shorter record with defaults and ignores a newer record's
+// extra tail; `version` only changes when the existing layout does. Every
+// save writes the backup key first and the primary second, so a write torn
+// by power loss leaves one valid copy.
+static constexpr const char* kRecordKey = "cfg";
+static constexpr const char* kBackupKey = "cfg_bak";
+static constexpr uint32_t    kRecordMagic = 0x31474643;  // "CFG1"
+static constexpr uint16_t    kRecordVersion = 1;
+
+struct __attribute__((packed)) RecordHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;  // payload bytes
+  uint32_t crc;     // CRC-32 of the payload
+};
+
+static constexpr size_t kRecordBytes =
+    sizeof(RecordHeader) + 1 + 2 + 1 + 1 +  // mqtt_enabled, mqtt_port, fan_default_speed (whole %), fan_default_on
+    sizeof(Config::mqtt_host) + sizeof(Config::mqtt_user) + sizeof(Config::mqtt_pass) +
+    sizeof(Config::mqtt_command_topic) + sizeof(Config::mqtt_state_topic) + sizeof(Config::mqtt_status_topic) +
+    sizeof(Config::static_ip) + sizeof(Config::static_gateway) + sizeof(Config::static_subnet) +
+    2 + 2 +  // fan_ramp_up_ms, fan_ramp_down_ms
+    1 +      // fan_default_speed[0] hundredths
+    2 * (FAN_CHANNEL_MAX - 1) +  // fan_default_speed[1..]
+    sizeof(Config::report_topic) + sizeof(Config::report_rules) +
+    2 + 2 +  // report_runon_s, report_runon_speed
+    2;       // mqtt_state_window_ms
+
+// CRC-32 (IEEE), byte-wise table built at compile time (1 KB of flash).
+struct CrcTable {
+  uint32_t entry[256];
+  constexpr CrcTable() : entry() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      entry[i] = c;
+    }
+  }
+};
+static constexpr CrcTable kCrcTable;
+
+static uint32_t crc32(const uint8_t* data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) crc = kCrcTable.entry[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+uint32_t configCrc32(const void* data, size_t len) {
+  return crc32(static_cast<const uint8_t*>(data), len);
+}
+
+namespace {
+
+struct RecordWriter {
+  uint8_t* out;
+  size_t   pos;
+  void u8(uint8_t v) { out[pos++] = v; }
+  void u16(uint16_t v) { u8((uint8_t)v); u8((uint8_t)(v >> 8)); }
+  template <size_t N>
+  void str(const char (&s)[N]) {
+    static_assert(N <= 256, "length prefix is one byte");
+    size_t len = strnlen(s, N - 1);
+    u8((uint8_t)len);
+    memcpy(out + pos, s, len);
+    pos += len;
+  }
+};
+
+// Reads stop at the end of the payload; a field past it keeps its value.
+struct RecordReader {
+  const uint8_t* in;
+  size_t         len;
+  size_t         pos;
+  bool u8(uint8_t& v) {
+    if (pos >= len) return false;
+    v = in[pos++];
+    return true;
+  }
+  bool u16(uint16_t& v) {
+    if (len - pos < 2 || pos > len) return false;
+    v = (uint16_t)(in[pos] | (in[pos + 1] << 8));
+    pos += 2;
+    return true;
+  }
+  template <size_t N>
+  bool str(char (&s)[N]) {
+    uint8_t n;
+    if (!u8(n) || n > len - pos) return false;
+    size_t copy = n < N - 1 ? n : N - 1;
+    memcpy(s, in + pos, copy);
+    s[copy] = '\0';
+    pos += n;
+    return true;
+  }
+};
+
+}  // namespace
+
+static size_t encodeRecord(const Config& config, uint8_t (&out)[kRecordBytes]) {
+  RecordWriter w = {out + sizeof(RecordHeader), 0};
+  w.u8(config.mqtt_enabled ? 1 : 0);
+  w.str(config.mqtt_host);
+  w.u16((uint16_t)config.mqtt_port);
+  w.str(config.mqtt_user);
+  w.str(config.mqtt_pass);
+  w.str(config.mqtt_command_topic);
+  w.str(config.mqtt_state_topic);
+  w.str(config.mqtt_status_topic);
+  int defaultSpeed = constrain(config.fan_default_speed[0], 0, SPEED_FULL);
+  w.u8((uint8_t)(defaultSpeed / SPEED_SCALE));
+  w.u8(config.fan_default_on ? 1 : 0);
+  w.str(config.static_ip);  // appended after the first release of the record
+  w.str(config.static_gateway);
+  w.str(config.static_subnet);
+  w.u16((uint16_t)constrain(config.fan_ramp_up_ms, 0, FAN_RAMP_MAX_MS));
+  w.u16((uint16_t)constrain(config.fan_ramp_down_ms, 0, FAN_RAMP_MAX_MS));
+  w.u8((uint8_t)(defaultSpeed % SPEED_SCALE));  // older readers keep the whole percent above
+  for (size_t i = 1; i < FAN_CHANNEL_MAX; i++) {
+    w.u16((uint16_t)constrain(config.fan_default_speed[i], 0, SPEED_FULL));
+  }
+  w.str(config.report_topic);
+  w.str(config.report_rules);
+  w.u16((uint16_t)constrain(config.report_runon_s, 0, (int)REPORT_RUNON_MAX_S));
+  w.u16((uint16_t)constrain(config.report_runon_speed, 0, SPEED_FULL));
+  w.u16((uint16_t)constrain(config.mqtt_state_window_ms, 0, (int)MQTT_STATE_WINDOW_MAX_MS));
+
+  RecordHeader header = {kRecordMagic, kRecordVersion, (uint16_t)w.pos, crc32(w.out, w.pos)};
+  memcpy(out, &header, sizeof(header));
+  return sizeof(header) + w.pos;
+}
+
+// False for a missing, torn (CRC), foreign (magic) or incompatible (version)
+// record; `config` may then be partly overwritten.
+static bool decodeRecord(const uint8_t* in, size_t len, Config& config) {
+  RecordHeader header;
+  if (len < sizeof(header)) return false;
+  memcpy(&header, in, sizeof(header));
+  if (header.magic != kRecordMagic || header.version != kRecordVersion) return false;
+  if (header.length > len - sizeof(header)) return false;
+  const uint8_t* payload = in + sizeof(header);
+  if (crc32(payload, header.length) != header.crc) return false;
+
+  config = Config{};
+  config.mqtt_port = 1883;  // defaults for fields an older record lacks
+  config.fan_default_speed[0] = 50 * SPEED_SCALE;
+  config.fan_default_on = true;
+  config.fan_ramp_up_ms = FAN_RAMP_UP_MS_DEFAULT;
+  config.fan_ramp_down_ms = FAN_RAMP_DOWN_MS_DEFAULT;
+  config.report_runon_s = REPORT_RUNON_S_DEFAULT;
+  config.mqtt_state_window_ms = MQTT_STATE_WINDOW_MS_DEFAULT;
+  RecordReader r = {payload, header.length, 0};
+  uint8_t  b;
+  uint16_t w;
+  if (r.u8(b)) config.mqtt_enabled = b != 0;
+  r.str(config.mqtt_host);
+  if (r.u16(w)) config.mqtt_port = w;
+  r.str(config.mqtt_user);
+  r.str(config.mqtt_pass);
+  r.str(config.mqtt_command_topic);
+  r.str(config.mqtt_state_topic);
+  r.str(config.mqtt_status_topic);
+  if (r.u8(b)) config.fan_default_speed[0] = b * SPEED_SCALE;
+  if (r.u8(b)) config.fan_default_on = b != 0;
+  r.str(config.static_ip);
+  r.str(config.static_gateway);
+  r.str(config.static_subnet);
+  if (r.u16(w)) config.fan_ramp_up_ms = w;
+  if (r.u16(w)) config.fan_ramp_down_ms = w;
+  if (r.u8(b) && b < SPEED_SCALE) config.fan_default_speed[0] += b;
+  for (size_t i = 1; i < FAN_CHANNEL_MAX; i++) {
+    config.fan_default_speed[i] = r.u16(w) ? w : config.fan_default_speed[0];  // older records: as channel 0
+  }
+  r.str(config.report_topic);
+  r.str(config.report_rules);
+  if (r.u16(w)) config.report_runon_s = w;
+  if (r.u16(w)) config.report_runon_speed = w;
+  if (r.u16(w)) config.mqtt_state_window_ms = w;
+  return true;
+}
+
+// Backup first, primary second; true if both landed.
+static bool writeRecord(NvsStore& preferences, const Config& config) {
+  uint8_t record[kRecordBytes];
+  size_t len = encodeRecord(config, record);
+  bool ok = preferences.putBytes(kBackupKey, record, len);
+  return preferences.putBytes(kRecordKey, record, len) && ok;
+}
+
+static void setDefault(char* field, size_t size, const char* value) {
+  if (field[0] != '\0') return;
+  strncpy(field, value, size - 1);
+  field[size - 1] = '\0';
+}
+
+static void applyDefaults(Config& config) {
+  setDefault(config.mqtt_host, sizeof(config.mqtt_host), "192.168.2.231");
+  setDefault(config.mqtt_command_topic, sizeof(config.mqtt_command_topic), "bambu/p1s/fan/cmd");
+  setDefault(config.mqtt_state_topic, sizeof(config.mqtt_state_topic), "bambu/p1s/fan/state");
+  setDefault(config.mqtt_status_topic, sizeof(config.mqtt_status_topic), "bambu/p1s/fan/status");
+  for (int& speed : config.fan_default_speed) {
+    speed = constrain(speed, 0, SPEED_FULL);
+    if (speed > 0 && speed < SPEED_MIN_RUN) speed = SPEED_MIN_RUN;
+  }
+  config.fan_ramp_up_ms = constrain(config.fan_ramp_up_ms, 0, FAN_RAMP_MAX_MS);
+  config.fan_ramp_down_ms = constrain(config.fan_ramp_down_ms, 0, FAN_RAMP_MAX_MS);
+  setDefault(config.report_rules, sizeof(config.report_rules), REPORT_RULES_DEFAULT);
+  config.report_runon_s = constrain(config.report_runon_s, 0, (int)REPORT_RUNON_MAX_S);
+  config.report_runon_speed = constrain(config.report_runon_speed, 0, SPEED_FULL);
+  config.mqtt_state_window_ms = constrain(config.mqtt_state_window_ms, 0, (int)MQTT_STATE_WINDOW_MAX_MS);
+}
+
+// ========= Config I/O =========
+// Key-per-field layout of earlier firmware; only read once, to migrate.
+static const char* const kLegacyKeys[] = {
+  "mqtt_enabled", "mqtt_host", "mqtt_port", "mqtt_user", "mqtt_pass",
+  "cmd_topic", "state_topic", "status_topic", "fan_def_spd", "fan_def_on"};
+
+void configReadLegacy(NvsStore& preferences, Config& config) {
+  config.mqtt_enabled = preferences.getBool("mqtt_enabled", false);  // default false
+  preferences.getString("mqtt_host", config.mqtt_host, sizeof(config.mqtt_host));
+  config.mqtt_port = preferences.getInt("mqtt_port", 1883);
+  preferences.getString("mqtt_user", config.mqtt_user, sizeof(config.mqtt_user));
+  preferences.getString("mqtt_pass", config.mqtt_pass, sizeof(config.mqtt_pass));
+  preferences.getString("cmd_topic",    config.mqtt_command_topic, sizeof(config.mqtt_command_topic));
+  preferences.getString("state_topic",  config.mqtt_state_topic,   sizeof(config.mqtt_state_topic));
+  preferences.getString("status_topic", config.mqtt_status_topic,  sizeof(config.mqtt_status_topic));
+  config.fan_default_speed[0]  = preferences.getInt("fan_def_spd", 50) * SPEED_SCALE;
+  config.fan_default_on        = preferences.getBool("fan_def_on", true);
+  config.static_ip[0] = config.static_gateway[0] = config.static_subnet[0] = '\0';  // not in that layout
+  config.fan_ramp_up_ms = FAN_RAMP_UP_MS_DEFAULT;
+  config.fan_ramp_down_ms = FAN_RAMP_DOWN_MS_DEFAULT;
+  for (size_t i = 1; i < FAN_CHANNEL_MAX; i++) config.fan_default_speed[i] = config.fan_default_speed[0];
+  config.report_topic[0] = config.report_rules[0] = '\0';
+  config.report_runon_s = REPORT_RUNON_S_DEFAULT;
+  config.report_runon_speed = 0;
+  config.mqtt_state_window_ms = MQTT_STATE_WINDOW_MS_DEFAULT;
+  applyDefaults(config);
+}
+
+const char* configReadRecord(NvsStore& preferences, Config& config) {
+  uint8_t record[kRecordBytes];
+  size_t len = preferences.getBytes(kRecordKey, record, sizeof(record));
+  const char* source = "record";
+  if (!decodeRecord(record, len, config)) {
+    len = preferences.getBytes(kBackupKey, record, sizeof(record));
+    if (!decodeRecord(record, len, config)) return nullptr;
+    source = "backup";
+  }
+  applyDefaults(config);
+  return source;
+}
+
+// Normally a single blob read. A bad primary falls back to the backup, and
+// no record at all migrates the legacy keys (or defaults on a blank device);
+// either way a fresh record is written so the next boot takes the fast path.
+void loadConfig() {
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", false);
+
+  bootSource = configReadRecord(preferences, currentConfig);
+  if (bootSource == nullptr || strcmp(bootSource, "backup") == 0) {
+    bool migrate = bootSource == nullptr;
+    if (migrate) {
+      bootSource = "legacy";
+      configReadLegacy(preferences, currentConfig);
+    }
+    if (writeRecord(preferences, currentConfig) && migrate) {
+      for (const char* key : kLegacyKeys) preferences.remove(key);
+    }
+  }
+  preferences.end();
+  persisted = currentConfig;
+  dirtyFields = 0;
+
+  // The password by length only: the log is readable over HTTP.
+  LOG_INFO("loadConfig: from %s, mqtt_user='%s' (len: %d), mqtt_pass len: %d", bootSource,
+           currentConfig.mqtt_user, (int)strlen(currentConfig.mqtt_user), (int)strlen(currentConfig.mqtt_pass));
+
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) fanChannels[i].lastUserSpeed = currentConfig.fan_default_speed[i];
+}
+
+const char* configBootSource() {
+  return bootSource;
+}
+
+// ========= Write-behind cache =========
+namespace {
+
+enum class FieldType : uint8_t { Bool, Int, String };
+
+struct FieldSpec {
+  const char* key;
+  FieldType   type;
+  size_t      offset;
+  bool        secret;  // log the length only
+};
+
+// Bit i of a ConfigField mask is kFields[i]; keys name the fields in the log.
+const FieldSpec kFields[] = {
+  {"mqtt_enabled", FieldType::Bool,   offsetof(Config, mqtt_enabled),          false},
+  {"mqtt_host",    FieldType::String, offsetof(Config, mqtt_host),             false},
+  {"mqtt_port",    FieldType::Int,    offsetof(Config, mqtt_port),             false},
+  {"mqtt_user",    FieldType::String, offsetof(Config, mqtt_user),             false},
+  {"mqtt_pass",    FieldType::String, offsetof(Config, mqtt_pass),             true},
+  {"cmd_topic",    FieldType::String, offsetof(Config, mqtt_command_topic),    false},
+  {"state_topic",  FieldType::String, offsetof(Config, mqtt_state_topic),      false},
+  {"status_topic", FieldType::String, offsetof(Config, mqtt_status_topic),     false},
+  {"fan_def_spd",  FieldType::Int,    offsetof(Config, fan_default_speed[0]),  false},
+  {"fan_def_on",   FieldType::Bool,   offsetof(Config, fan_default_on),        false},
+  {"static_ip",    FieldType::String, offsetof(Config, static_ip),             false},
+  {"static_gw",    FieldType::String, offsetof(Config, static_gateway),        false},
+  {"static_subnet", FieldType::String, offsetof(Config, static_subnet),        false},
+  {"ramp_up_ms",   FieldType::Int,    offsetof(Config, fan_ramp_up_ms),        false},
+  {"ramp_down_ms", FieldType::Int,    offsetof(Config, fan_ramp_down_ms),      false},
+  {"fan_def_spd1", FieldType::Int,    offsetof(Config, fan_default_speed[1]),  false},
+  {"fan_def_spd2", FieldType::Int,    offsetof(Config, fan_default_speed[2]),  false},
+  {"fan_def_spd3", FieldType::Int,    offsetof(Config, fan_default_speed[3]),  false},
+  {"report_topic", FieldType::String, offsetof(Config, report_topic),          false},
+  {"report_rules", FieldType::String, offsetof(Config, report_rules),          false},
+  {"runon_s",      FieldType::Int,    offsetof(Config, report_runon_s),        false},
+  {"runon_speed",  FieldType::Int,    offsetof(Config, report_runon_speed),    false},
+  {"state_window", FieldType::Int,    offsetof(Config, mqtt_state_window_ms),  false},
+};
+constexpr size_t kFieldCount = sizeof(kFields) / sizeof(kFields[0]);
+static_assert(CFG_ALL == (1u << kFieldCount) - 1, "ConfigField bits must match kFields");
+
+uint32_t    firstDirtyMs = 0;
+TaskId      flushTask = -1;
+ConfigStats stats = {};
+
+template <typename T>
+T& field(Config& config, const FieldSpec& spec) {
+  return *reinterpret_cast<T*>(reinterpret_cast<char*>(&config) + spec.offset);
+}
+
+bool fieldDiffers(const FieldSpec& spec) {
+  switch (spec.type) {
+    case FieldType::Bool:   return field<bool>(currentConfig, spec) != field<bool>(persisted, spec);
+    case FieldType::Int:    return field<int>(currentConfig, spec) != field<int>(persisted, spec);
+    case FieldType::String: return strcmp(&field<char>(currentConfig, spec), &field<char>(persisted, spec)) != 0;
+  }
+  return false;
+}
+
+// Logs one changed field (secrets by length only).
+void logField(const FieldSpec& spec) {
+  switch (spec.type) {
+    case FieldType::Bool:
+      LOG_DEBUG("NVS updated: %s: %s -> %s", spec.key, field<bool>(persisted, spec) ? "true" : "false",
+                field<bool>(currentConfig, spec) ? "true" : "false");
+      break;
+    case FieldType::Int:
+      LOG_DEBUG("NVS updated: %s: %d -> %d", spec.key, field<int>(persisted, spec), field<int>(currentConfig, spec));
+      break;
+    case FieldType::String: {
+      const char* old = &field<char>(persisted, spec);
+      const char* value = &field<char>(currentConfig, spec);
+      if (spec.secret) {
+        LOG_DEBUG("NVS updated: %s length: %d -> %d", spec.key, (int)strlen(old), (int)strlen(value));
+      } else {
+        LOG_DEBUG("NVS updated: %s: '%s' -> '%s'", spec.key, old, value);
+      }
+      break;
+    }
+  }
+}
+
+void flushTaskFn(void*) {
+  configFlush();
+}
+
+}  // namespace
+
+void saveConfig() {
+  configMarkDirty(CFG_ALL);
+  configFlush();
+}
+
+void configCacheBegin() {
+  stats = ConfigStats{};
+  flushTask = schedulerAddOneShot("config-save", flushTaskFn);
+}
+
+void configMarkDirty(uint32_t fields) {
+  fields &= CFG_ALL;
+  if (fields == 0) return;
+  stats.saveRequests++;
+  uint32_t now = halMillis();
+  if (dirtyFields == 0) firstDirtyMs = now;
+  dirtyFields |= fields;
+  if (flushTask < 0) {
+    configFlush();  // no scheduler (yet): write through
+    return;
+  }
+  // Every change restarts the quiet period, up to the cap measured from the
+  // first unsaved change.
+  uint32_t deferred = now - firstDirtyMs;
+  uint32_t delayMs = CONFIG_SAVE_QUIET_MS;
+  if (deferred >= CONFIG_SAVE_MAX_DEFER_MS) delayMs = 0;
+  else if (deferred + delayMs > CONFIG_SAVE_MAX_DEFER_MS) delayMs = CONFIG_SAVE_MAX_DEFER_MS - deferred;
+  schedulerArm(flushTask, delayMs);
+}
+
+bool configFlush() {
+  uint32_t pending = dirtyFields;
+  dirtyFields = 0;
+  schedulerCancel(flushTask);
+
+  uint32_t changed = 0;
+  for (size_t i = 0; i < kFieldCount; i++) {
+    if ((pending & (1u << i)) && fieldDiffers(kFields[i])) changed |= 1u << i;
+  }
+  if (changed == 0) return false;  // e.g. the slider went back to where it was
+
+  for (size_t i = 0; i < kFieldCount; i++) {
+    if (changed & (1u << i)) logField(kFields[i]);
+  }
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", false);
+  bool ok = writeRecord(preferences, currentConfig);
+  preferences.end();
+  stats.flushes++;
+  stats.nvsWrites += 2;
+  if (!ok) {
+    // Keep the fields dirty so the next save retries them.
+    dirtyFields |= changed;
+    LOG_ERROR("NVS write failed");
+    return false;
+  }
+  persisted = currentConfig;
+  return true;
+}
+
+uint32_t configDirtyFields() {
+  return dirtyFields;
+}
+
+const ConfigStats& configStats() {
+  // The old scheme rewrote all ten keys on every save request.
+  uint32_t legacyWrites = stats.saveRequests * (uint32_t)(sizeof(kLegacyKeys) / sizeof(kLegacyKeys[0]));
+  stats.nvsWritesAvoided = legacyWrites > stats.nvsWrites ? legacyWrites - stats.nvsWrites : 0;
+  return stats;
+}
+
+size_t configRenderStats(char* out, size_t size) {
+  const ConfigStats& s = configStats();
+  int n = snprintf(out, size,
+                   "{\"boot_source\":\"%s\",\"save_requests\":%lu,\"flushes\":%lu,\"nvs_writes\":%lu,"
+                   "\"nvs_writes_avoided\":%lu,\"dirty\":%lu}",
+                   bootSource, (unsigned long)s.saveRequests, (unsigned long)s.flushes,
+                   (unsigned long)s.nvsWrites, (unsigned long)s.nvsWritesAvoided, (unsigned long)dirtyFields);
+  if (n < 0) return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+bool parseBoolParam(const char* value) {
+  if (!value) return false;
+  while (*value && isspace(static_cast<unsigned char>(*value))) value++;
+  if (*value == '\0') return false;
+  char c = static_cast<char>(tolower(static_cast<unsigned char>(*value)));
+  if (c == '1' || c == 't' || c == 'y') return true;
+  if (c == '0' || c == 'f' || c == 'n') return false;
+  if (c == 'o' && value[1] && tolower(static_cast<unsigned char>(value[1])) == 'n') return true; // 'on'
+  return false;
+}
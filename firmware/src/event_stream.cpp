@@ -0,0 +1,233 @@
+#include "event_stream.h"
+
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <cstdio>
+#include <cstring>
+
+#include "fan_state.h"
+#include "hal.h"
+
+namespace {
+
+const char kStreamHeaders[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: text/event-stream\r\n"
+  "Cache-Control: no-cache\r\n"
+  "Connection: keep-alive\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "\r\n";
+const char kBusy[] =
+  "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char kHeartbeat[] = ": ping\n\n";
+
+constexpr size_t kEventBytes = FAN_STATE_JSON_BYTES + 32;  // + "id: <version>\ndata: " framing
+static_assert(sizeof(kStreamHeaders) <= kEventBytes, "stream headers go out through the event buffer");
+
+struct Subscriber {
+  int      fd;        // -1 when the slot is free
+  bool     primed;    // has been queued a state event
+  bool     pingDue;
+  uint32_t version;   // state in the last event queued
+  uint32_t lastMs;    // last byte written, or when `out` was filled
+  size_t   outLen;
+  size_t   outSent;
+  char     out[kEventBytes];
+};
+
+Subscriber       subscribers[EVENT_STREAM_MAX_CLIENTS];
+int              listener = -1;
+uint16_t         boundPort = 0;
+uint32_t         lastHeartbeatMs = 0;
+EventStreamStats stats = {};
+
+// ---- sockets ----
+bool wouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void makeNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Bytes the socket took (0 while its send buffer is full), -1 if it failed.
+int writeSome(int fd, const char* buf, size_t len) {
+  ssize_t n = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n >= 0) return (int)n;
+  return wouldBlock() ? 0 : -1;
+}
+
+// Throws away what the browser sent (the GET request; nothing in it
+// matters). False once the peer has closed or failed.
+bool drainInput(int fd) {
+  char scratch[64];
+  for (;;) {
+    ssize_t n = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+    if (n > 0) continue;
+    return n < 0 && wouldBlock();
+  }
+}
+
+// ---- subscribers ----
+void closeSubscriber(Subscriber& s) {
+  if (s.fd < 0) return;
+  close(s.fd);
+  s.fd = -1;
+  stats.open--;
+}
+
+void queue(Subscriber& s, const char* data, size_t len, uint32_t now) {
+  memcpy(s.out, data, len);
+  s.outLen = len;
+  s.outSent = 0;
+  s.lastMs = now;
+}
+
+// Next thing to write once `out` has gone: the newest state if this
+// subscriber has not had it, else a heartbeat if one is due.
+bool refill(Subscriber& s, uint32_t now) {
+  const FanStateSnapshot& state = fanStateSnapshot();
+  if (!s.primed || s.version != state.version) {
+    int n = snprintf(s.out, sizeof(s.out), "id: %lu\ndata: %s\n\n", (unsigned long)state.version, state.json);
+    s.outLen = n < (int)sizeof(s.out) ? (size_t)n : sizeof(s.out) - 1;
+    s.outSent = 0;
+    s.lastMs = now;
+    s.primed = true;
+    s.pingDue = false;
+    s.version = state.version;
+    stats.events++;
+    return true;
+  }
+  if (s.pingDue) {
+    s.pingDue = false;
+    queue(s, kHeartbeat, sizeof(kHeartbeat) - 1, now);
+    return true;
+  }
+  return false;
+}
+
+// False if the socket failed.
+bool flush(Subscriber& s, uint32_t now) {
+  for (;;) {
+    if (s.outSent == s.outLen && !refill(s, now)) return true;
+    int n = writeSome(s.fd, s.out + s.outSent, s.outLen - s.outSent);
+    if (n < 0) return false;
+    if (n == 0) return true;
+    s.outSent += (size_t)n;
+    s.lastMs = now;
+  }
+}
+
+void serviceSubscriber(Subscriber& s, uint32_t now) {
+  if (!drainInput(s.fd) || !flush(s, now)) {
+    closeSubscriber(s);
+    return;
+  }
+  if (s.outSent < s.outLen && now - s.lastMs >= EVENT_STREAM_WRITE_TIMEOUT_MS) {
+    stats.timedOut++;
+    closeSubscriber(s);
+  }
+}
+
+// A free slot, or the one whose pending bytes have waited the longest, if
+// that is past the stall threshold. Anything accepted this pass has
+// lastMs == now, so it is never picked.
+static_assert(EVENT_STREAM_STALL_MS > 0 && EVENT_STREAM_STALL_MS < EVENT_STREAM_WRITE_TIMEOUT_MS,
+              "stalled subscribers are evicted before the write timeout closes them");
+Subscriber* slotFor(uint32_t now) {
+  Subscriber* stalled = nullptr;
+  for (Subscriber& s : subscribers) {
+    if (s.fd < 0) return &s;
+    if (s.outSent == s.outLen || now - s.lastMs < EVENT_STREAM_STALL_MS) continue;
+    if (!stalled || (int32_t)(s.lastMs - stalled->lastMs) < 0) stalled = &s;
+  }
+  return stalled;
+}
+
+void acceptWaiting(uint32_t now) {
+  for (;;) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) return;
+    makeNonBlocking(fd);
+    Subscriber* slot = slotFor(now);
+    if (!slot) {
+      writeSome(fd, kBusy, sizeof(kBusy) - 1);  // a fresh socket takes this much; if not, the close says enough
+      close(fd);
+      stats.refused++;
+      continue;
+    }
+    if (slot->fd >= 0) {
+      closeSubscriber(*slot);
+      stats.evicted++;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    slot->fd = fd;
+    slot->primed = false;
+    slot->pingDue = false;
+    queue(*slot, kStreamHeaders, sizeof(kStreamHeaders) - 1, now);
+    stats.accepted++;
+    stats.open++;
+  }
+}
+
+}  // namespace
+
+bool eventStreamBegin(uint16_t port) {
+  if (listener >= 0) return true;
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return false;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, (int)EVENT_STREAM_MAX_CLIENTS) < 0 ||
+      getsockname(fd, (sockaddr*)&addr, &addrLen) < 0) {
+    close(fd);
+    return false;
+  }
+  makeNonBlocking(fd);
+  listener = fd;
+  boundPort = ntohs(addr.sin_port);
+  for (Subscriber& s : subscribers) s.fd = -1;
+  lastHeartbeatMs = halMillis();
+  return true;
+}
+
+void eventStreamService() {
+  if (listener < 0) return;
+  uint32_t now = halMillis();
+  acceptWaiting(now);
+  bool ping = now - lastHeartbeatMs >= EVENT_STREAM_HEARTBEAT_MS;
+  if (ping) lastHeartbeatMs = now;
+  for (Subscriber& s : subscribers) {
+    if (s.fd < 0) continue;
+    s.pingDue = s.pingDue || ping;
+    serviceSubscriber(s, now);
+  }
+}
+
+void eventStreamStop() {
+  if (listener < 0) return;  // slots are only set up by begin()
+  for (Subscriber& s : subscribers) closeSubscriber(s);
+  close(listener);
+  listener = -1;
+  boundPort = 0;
+}
+
+uint16_t eventStreamPort() {
+  return boundPort;
+}
+
+const EventStreamStats& eventStreamStats() {
+  return stats;
+}
+
+void eventStreamReset() {
+  eventStreamStop();
+  stats = EventStreamStats{};
+}
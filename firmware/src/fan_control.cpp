@@ -0,0 +1,199 @@
+#include "fan_control.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "fan_curve.h"
+#include "fan_profile.h"
+#include "fan_rpm.h"
+#include "fan_task.h"
+#include "hal.h"
+
+FanChannel fanChannels[FAN_CHANNEL_COUNT];
+
+static std::atomic<int> rampUpMs{FAN_RAMP_UP_MS_DEFAULT};
+static std::atomic<int> rampDownMs{FAN_RAMP_DOWN_MS_DEFAULT};
+static bool reportHeld = false;
+static bool reportWanted = false;
+
+// ========= PWM helpers =========
+// Speeds are a share of the top speed, mapped through the fan curve
+// (fan_curve.h) and never below its run threshold.
+int speedToDuty(int speed) {
+  speed = constrain(speed, 0, SPEED_FULL);
+  if (speed == 0) return 0;
+  if (speed < SPEED_MIN_RUN) speed = SPEED_MIN_RUN;
+  const FanCurve& curve = fanCurve();
+  int32_t top = curve.rpm[FAN_CURVE_POINTS - 1];
+  int duty = speed == SPEED_FULL ? DUTY_MAX : fanCurveDutyForRpm((top * speed + SPEED_FULL / 2) / SPEED_FULL);
+  return max(duty, (int)curve.minRunDuty);
+}
+
+int dutyToSpeed(int duty) {
+  if (duty <= 0) return 0;
+  int32_t top = fanCurve().rpm[FAN_CURVE_POINTS - 1];
+  int32_t speed = (fanCurveRpmForDuty(min(duty, DUTY_MAX)) * SPEED_FULL + top / 2) / top;
+  return constrain((int)speed, 1, SPEED_FULL);  // a driven fan never reads as off
+}
+
+int invertDuty(int duty) {
+  return DUTY_MAX - constrain(duty, 0, DUTY_MAX);
+}
+
+void writeDutyActiveLow(FanChannel& ch, int dutyActiveHigh) {
+  int dutyActiveLow = invertDuty(dutyActiveHigh);
+  hal.pwm[fanChannelIndex(ch)]->write(dutyActiveLow);
+  ch.duty = dutyActiveHigh;
+  ch.rampMs = 0;
+}
+
+// ========= Ramp =========
+// The PWM sink steps the output along the same line from its timer; this side
+// only keeps the line to know where the output is and when it arrives.
+int fanOutputDuty(const FanChannel& ch) {
+  if (ch.rampMs == 0) return ch.duty;
+  uint32_t elapsed = halMillis() - ch.rampStartMs;
+  if (elapsed >= ch.rampMs) return ch.duty;
+  return ch.rampFrom + (int)((int64_t)(ch.duty - ch.rampFrom) * (int64_t)elapsed / (int64_t)ch.rampMs);
+}
+
+void rampDutyActiveLow(FanChannel& ch, int dutyActiveHigh, int rampMs) {
+  int target = constrain(dutyActiveHigh, 0, DUTY_MAX);
+  int from = fanOutputDuty(ch);  // a retarget continues from where the output is
+  int fullSwingMs = (target > from ? rampUpMs : rampDownMs).load(std::memory_order_relaxed);
+  uint32_t ms = rampMs >= 0 ? (uint32_t)min(rampMs, FAN_RAMP_MAX_MS)
+                            : (uint32_t)abs(target - from) * (uint32_t)fullSwingMs / DUTY_MAX;
+  if (ms < FAN_RAMP_STEP_MS) {
+    writeDutyActiveLow(ch, target);
+    return;
+  }
+  hal.pwm[fanChannelIndex(ch)]->ramp(invertDuty(from), invertDuty(target), ms);
+  ch.rampFrom = from;
+  ch.rampStartMs = halMillis();
+  ch.rampMs = ms;
+  ch.duty = target;
+}
+
+void fanSetRampTimes(int upMs, int downMs) {
+  rampUpMs.store(constrain(upMs, 0, FAN_RAMP_MAX_MS), std::memory_order_relaxed);
+  rampDownMs.store(constrain(downMs, 0, FAN_RAMP_MAX_MS), std::memory_order_relaxed);
+}
+
+uint32_t fanRampService() {
+  uint32_t wait = UINT32_MAX;
+  bool arrived = false;
+  for (FanChannel& ch : fanChannels) {
+    if (ch.rampMs == 0) continue;
+    uint32_t elapsed = halMillis() - ch.rampStartMs;
+    if (elapsed < ch.rampMs) {
+      wait = min(wait, ch.rampMs - elapsed);
+      continue;
+    }
+    ch.rampMs = 0;
+    arrived = true;
+  }
+  if (arrived) fanReportStatus();
+  return wait;
+}
+
+// ========= Fan control =========
+void handleFanSpeed(FanChannel& ch, int speed, int rampMs) {
+  if (fanChannelIndex(ch) == 0) {
+    fanCalibrationCancel();
+    fanRpmRelease();
+  }
+  int requested = constrain(speed, 0, SPEED_FULL);
+  int effective = requested;
+  if (effective > 0 && effective < SPEED_MIN_RUN) effective = SPEED_MIN_RUN;
+  int duty = speedToDuty(effective);
+
+  bool softStart = false;
+  int startDuty = fanCurve().minStartDuty;
+  if (fanOutputDuty(ch) == 0 && duty > 0 && duty < startDuty) {
+    softStart = true;
+    ch.pendingSpeedAfterStart = max(requested, SPEED_MIN_RUN);
+    duty = startDuty;
+  }
+  ch.softStartArmed = softStart;
+
+  rampDutyActiveLow(ch, duty, rampMs);
+  if (softStart) ch.softStartAtMs = halMillis() + ch.rampMs;  // settle once the kick duty is reached
+
+  ch.speed = softStart ? dutyToSpeed(duty) : effective;
+  if (requested > 0) {
+    int stored = max(requested, SPEED_MIN_RUN);
+    ch.lastUserSpeed = stored;
+  }
+
+  if (requested == 0) {
+    ch.pendingSpeedAfterStart = 0;
+  }
+
+  fanReportStatus();
+}
+
+int fanPublishDuty(const FanChannel& ch) {
+  return ch.softStartArmed ? speedToDuty(ch.pendingSpeedAfterStart) : ch.duty;
+}
+
+void fanReportStatus() {
+  if (reportHeld) {
+    reportWanted = true;
+    return;
+  }
+  FanStatus status;
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+    const FanChannel& ch = fanChannels[i];
+    status.fans[i] = FanChannelStatus{ch.duty, ch.speed, constrain(ch.lastUserSpeed, 0, SPEED_FULL),
+                                      fanPublishDuty(ch), fanOutputDuty(ch)};
+  }
+  status.rpm = fanMeasuredRpm();
+  status.targetRpm = fanTargetRpm();
+  status.stalled = fanStalled();
+  fanProfileProgress(status.profileStep, status.profileSteps, status.profileLeftS);
+  fanStatusPost(status);
+}
+
+void fanReportHold() {
+  reportHeld = true;
+  reportWanted = false;
+}
+
+void fanReportRelease() {
+  reportHeld = false;
+  if (reportWanted) fanReportStatus();
+  reportWanted = false;
+}
+
+void fanChannelsReset() {
+  for (FanChannel& ch : fanChannels) ch = FanChannel{};
+  reportHeld = false;
+  reportWanted = false;
+}
+
+// ========= Soft-start =========
+// Armed by handleFanSpeed(): drops from the kick-start duty to the requested
+// target once the fan has had SOFT_START_SETTLE_MS to spin up.
+uint32_t fanSoftStartService() {
+  uint32_t wait = UINT32_MAX;
+  for (FanChannel& ch : fanChannels) {
+    if (!ch.softStartArmed) continue;
+    int32_t elapsed = (int32_t)(halMillis() - ch.softStartAtMs);  // negative while still ramping up
+    if (elapsed < (int32_t)SOFT_START_SETTLE_MS) {
+      wait = min(wait, (uint32_t)((int32_t)SOFT_START_SETTLE_MS - elapsed));
+      continue;
+    }
+    ch.softStartArmed = false;
+    if (ch.pendingSpeedAfterStart > 0 && ch.duty > speedToDuty(ch.pendingSpeedAfterStart)) {
+      int target = ch.pendingSpeedAfterStart;
+      ch.pendingSpeedAfterStart = 0;
+      handleFanSpeed(ch, target);
+    }
+  }
+  return wait;
+}
+
+void fanSoftStartCancel(FanChannel& ch) {
+  ch.pendingSpeedAfterStart = 0;
+  ch.softStartArmed = false;
+}
@@ -0,0 +1,326 @@
+#include "fan_curve.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstdio>
+
+#include "config.h"
+#include "fan_control.h"
+#include "fan_rpm.h"
+#include "hal.h"
+#include "logging.h"
+#include "scheduler.h"
+
+// ========= Stock table =========
+// The stock fan makes no torque below ~8 % duty; above that its speed rises
+// steeply and flattens towards the top, close to 1 - (1 - x)^2 over the live
+// range. Thresholds are the long-standing PCT_MIN_RUN / PCT_MIN_START.
+static constexpr int64_t kStockDeadQ10 = 82;  // 8 % of full duty, x1024
+
+static constexpr FanCurve makeStockCurve() {
+  FanCurve c = {};
+  for (size_t i = 0; i < FAN_CURVE_POINTS; i++) {
+    int64_t duty = (int64_t)i * 1024 / (FAN_CURVE_POINTS - 1);
+    int64_t x = duty > kStockDeadQ10 ? (duty - kStockDeadQ10) * 1024 / (1024 - kStockDeadQ10) : 0;
+    c.rpm[i] = (uint16_t)(FAN_RPM_MAX - FAN_RPM_MAX * (1024 - x) * (1024 - x) / (1024 * 1024));
+  }
+  c.minRunDuty = (uint16_t)((PCT_MIN_RUN * DUTY_MAX + 50) / 100);
+  c.minStartDuty = (uint16_t)((PCT_MIN_START * DUTY_MAX + 50) / 100);
+  return c;
+}
+
+static constexpr FanCurve kStockFanCurve = makeStockCurve();
+static_assert(kStockFanCurve.rpm[0] == 0 && kStockFanCurve.rpm[FAN_CURVE_POINTS - 1] == FAN_RPM_MAX,
+              "stock curve must span 0 .. FAN_RPM_MAX");
+
+// ========= Active table =========
+// Two slots behind an atomic pointer: the fan task fills the idle slot and
+// swaps, so speedToDuty() on any task sees either the old or the new table.
+static FanCurve                      slots[2];
+static std::atomic<const FanCurve*>  active{&kStockFanCurve};
+static std::atomic<const char*>      source{"stock"};
+static std::atomic<bool>             saveWanted{false};
+
+static constexpr const char* kCurveKey = "fan_cal";
+static constexpr uint32_t kCurveMagic = 0x31565246;  // "FRV1"
+static constexpr size_t kCurveBytes = 4 + FAN_CURVE_POINTS * 2 + 2 + 2 + 4;
+
+static void install(const FanCurve& curve, const char* from) {
+  FanCurve* slot = active.load(std::memory_order_relaxed) == &slots[0] ? &slots[1] : &slots[0];
+  *slot = curve;
+  active.store(slot, std::memory_order_release);
+  source.store(from, std::memory_order_relaxed);
+}
+
+const FanCurve& fanCurve() { return *active.load(std::memory_order_acquire); }
+const char* fanCurveSource() { return source.load(std::memory_order_relaxed); }
+
+int fanCurveDuty(size_t point) {
+  return (int)((point * DUTY_MAX + (FAN_CURVE_POINTS - 1) / 2) / (FAN_CURVE_POINTS - 1));
+}
+
+int fanCurveDutyForRpm(int rpm) {
+  const FanCurve& c = fanCurve();
+  if (rpm <= 0) return 0;
+  if (rpm >= c.rpm[FAN_CURVE_POINTS - 1]) return DUTY_MAX;
+  size_t i = 1;
+  while (c.rpm[i] < rpm) i++;  // first point at or above; the one below is strictly lower
+  int d0 = fanCurveDuty(i - 1);
+  int d1 = fanCurveDuty(i);
+  return d0 + (rpm - c.rpm[i - 1]) * (d1 - d0) / (c.rpm[i] - c.rpm[i - 1]);
+}
+
+int fanCurveRpmForDuty(int duty) {
+  const FanCurve& c = fanCurve();
+  if (duty <= 0) return 0;
+  if (duty >= DUTY_MAX) return c.rpm[FAN_CURVE_POINTS - 1];
+  size_t i = (size_t)duty * (FAN_CURVE_POINTS - 1) / DUTY_MAX;
+  while (i + 1 < FAN_CURVE_POINTS && fanCurveDuty(i + 1) <= duty) i++;
+  int d0 = fanCurveDuty(i);
+  int d1 = fanCurveDuty(i + 1);
+  return c.rpm[i] + (duty - d0) * (c.rpm[i + 1] - c.rpm[i]) / (d1 - d0);
+}
+
+bool fanCurveValid(const FanCurve& curve) {
+  if (curve.rpm[0] != 0 || curve.rpm[FAN_CURVE_POINTS - 1] < 1000) return false;
+  for (size_t i = 1; i < FAN_CURVE_POINTS; i++) {
+    if (curve.rpm[i] < curve.rpm[i - 1]) return false;
+  }
+  return curve.minRunDuty > 0 && curve.minRunDuty <= curve.minStartDuty && curve.minStartDuty <= DUTY_MAX;
+}
+
+// ========= NVS =========
+// [magic, rpm x17, min run, min start, crc] little-endian; the thresholds are
+// stored as a share of full duty (x65535) so a table survives a change of
+// PWM resolution.
+static void putU16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static uint16_t getU16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static void putU32(uint8_t* p, uint32_t v) { putU16(p, (uint16_t)v); putU16(p + 2, (uint16_t)(v >> 16)); }
+static uint32_t getU32(const uint8_t* p) { return getU16(p) | (uint32_t)getU16(p + 2) << 16; }
+
+static uint16_t dutyToShare(int duty) { return (uint16_t)(((uint32_t)duty * 65535u + DUTY_MAX / 2) / DUTY_MAX); }
+static uint16_t shareToDuty(uint16_t share) { return (uint16_t)(((uint32_t)share * DUTY_MAX + 32767u) / 65535u); }
+
+static bool loadCurve(FanCurve& out) {
+  uint8_t raw[kCurveBytes];
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", true);
+  size_t len = preferences.getBytes(kCurveKey, raw, sizeof(raw));
+  preferences.end();
+  if (len != sizeof(raw) || getU32(raw) != kCurveMagic) return false;
+  if (configCrc32(raw, kCurveBytes - 4) != getU32(raw + kCurveBytes - 4)) return false;
+  const uint8_t* p = raw + 4;
+  for (size_t i = 0; i < FAN_CURVE_POINTS; i++, p += 2) out.rpm[i] = getU16(p);
+  out.minRunDuty = shareToDuty(getU16(p));
+  out.minStartDuty = shareToDuty(getU16(p + 2));
+  return fanCurveValid(out);
+}
+
+static void storeCurve(void*) {
+  if (!saveWanted.exchange(false, std::memory_order_acq_rel)) return;
+  const FanCurve& curve = fanCurve();
+  uint8_t raw[kCurveBytes];
+  putU32(raw, kCurveMagic);
+  uint8_t* p = raw + 4;
+  for (size_t i = 0; i < FAN_CURVE_POINTS; i++, p += 2) putU16(p, curve.rpm[i]);
+  putU16(p, dutyToShare(curve.minRunDuty));
+  putU16(p + 2, dutyToShare(curve.minStartDuty));
+  putU32(raw + kCurveBytes - 4, configCrc32(raw, kCurveBytes - 4));
+  NvsStore& preferences = *hal.nvs;
+  preferences.begin("fan-control", false);
+  preferences.putBytes(kCurveKey, raw, sizeof(raw));
+  preferences.end();
+  LOG_INFO("Fan curve saved (top %u rpm, run %u, start %u)", curve.rpm[FAN_CURVE_POINTS - 1], curve.minRunDuty,
+           curve.minStartDuty);
+}
+
+static bool saveReady(void*) { return saveWanted.load(std::memory_order_relaxed); }
+
+void fanCurveBegin() {
+  FanCurve stored;
+  if (loadCurve(stored)) install(stored, "nvs");
+  // NVS is written from the loop() side, like the config; the fan task only asks.
+  schedulerAddReady("fan-curve", saveReady, storeCurve);
+}
+
+// ========= Calibration sweep =========
+// 1. Sweep: every table point from full duty down, settled and averaged.
+// 2. Stall threshold: binary search between the lowest point that still
+//    turned and the one below it; each probe kicks the rotor, lets it settle
+//    at the turning point, then holds the probe duty.
+// 3. Start threshold: binary search from rest between the stall threshold
+//    and full duty; the rotor is let stop completely before every probe.
+// Both thresholds get a small margin before they are stored.
+namespace {
+
+enum class Phase : uint8_t { Sweep, StallKick, StallSettle, StallProbe, StartStop, StartProbe };
+
+constexpr int kSearchResolution = DUTY_MAX / 128 > 0 ? DUTY_MAX / 128 : 1;
+constexpr uint32_t kStallKickMs = 500;
+constexpr uint32_t kStallSettleMs = 1500;
+constexpr uint32_t kStopQuietMs = 500;
+
+std::atomic<FanCalState> calState{FanCalState::Idle};
+Phase    phase = Phase::Sweep;
+uint32_t phaseStartMs = 0;
+size_t   point = 0;
+int32_t  sampleSum = 0;
+int32_t  samples = 0;
+int      lo = 0, hi = 0, probe = 0;
+int      runThreshold = 0;
+int      restoreSpeed = 0;
+int      restoreRpm = 0;
+FanCurve result = {};
+
+void enter(Phase next, int duty) {
+  phase = next;
+  phaseStartMs = halMillis();
+  writeDutyActiveLow(fanChannels[0], duty);
+}
+
+void finish(bool ok) {
+  if (ok) {
+    install(result, "calibrated");
+    saveWanted.store(true, std::memory_order_release);
+  }
+  calState.store(ok ? FanCalState::Done : FanCalState::Failed, std::memory_order_release);
+  if (ok) LOG_INFO("Fan calibration done");
+  else LOG_WARN("Fan calibration failed");
+  if (restoreRpm > 0) fanSetTargetRpm(restoreRpm);
+  else handleFanSpeed(fanChannels[0], restoreSpeed);
+}
+
+void finishCurve(int startThreshold) {
+  for (size_t i = 1; i < FAN_CURVE_POINTS; i++) {
+    if (fanCurveDuty(i) < runThreshold) result.rpm[i] = 0;  // coasting, not driven
+    if (result.rpm[i] < result.rpm[i - 1]) result.rpm[i] = result.rpm[i - 1];
+  }
+  result.minRunDuty = (uint16_t)min(runThreshold + DUTY_MAX / 64, DUTY_MAX);
+  result.minStartDuty = (uint16_t)min(max(startThreshold, runThreshold) + DUTY_MAX / 32, DUTY_MAX);
+  finish(fanCurveValid(result));
+}
+
+void startSweepPoint(size_t p) {
+  point = p;
+  sampleSum = 0;
+  samples = 0;
+  enter(Phase::Sweep, fanCurveDuty(p));
+}
+
+void sweepDone() {
+  result.rpm[0] = 0;
+  if (result.rpm[FAN_CURVE_POINTS - 1] < FAN_CAL_TURNING_RPM) {
+    finish(false);  // no rotation even at full duty
+    return;
+  }
+  size_t lowest = FAN_CURVE_POINTS - 1;
+  while (lowest > 1 && result.rpm[lowest - 1] >= FAN_CAL_TURNING_RPM) lowest--;
+  lo = fanCurveDuty(lowest - 1);
+  hi = fanCurveDuty(lowest);
+  point = lowest;
+  enter(Phase::StallKick, DUTY_MAX);
+}
+
+}  // namespace
+
+bool fanCalibrationStart() {
+  if (!hal.tach) {
+    calState.store(FanCalState::Failed, std::memory_order_release);
+    return false;
+  }
+  restoreRpm = fanTargetRpm();
+  restoreSpeed = fanChannels[0].duty > 0 ? fanChannels[0].speed : 0;
+  fanSoftStartCancel(fanChannels[0]);
+  fanRpmRelease();
+  result = FanCurve{};
+  calState.store(FanCalState::Running, std::memory_order_release);
+  LOG_INFO("Fan calibration started");
+  startSweepPoint(FAN_CURVE_POINTS - 1);
+  return true;
+}
+
+void fanCalibrationCancel() {
+  FanCalState running = FanCalState::Running;
+  calState.compare_exchange_strong(running, FanCalState::Idle, std::memory_order_acq_rel);
+}
+
+bool fanCalibrationStep(int rpm) {
+  if (calState.load(std::memory_order_relaxed) != FanCalState::Running) return false;
+  uint32_t elapsed = halMillis() - phaseStartMs;
+  bool turning = rpm >= FAN_CAL_TURNING_RPM;
+
+  switch (phase) {
+    case Phase::Sweep:
+      if (elapsed + FAN_CAL_SAMPLE_MS >= FAN_CAL_SETTLE_MS) {
+        sampleSum += rpm;
+        samples++;
+      }
+      if (elapsed < FAN_CAL_SETTLE_MS) break;
+      result.rpm[point] = (uint16_t)(sampleSum / samples);
+      if (point > 1) startSweepPoint(point - 1);
+      else sweepDone();
+      break;
+
+    case Phase::StallKick:
+      if (elapsed >= kStallKickMs) enter(Phase::StallSettle, hi);
+      break;
+
+    case Phase::StallSettle:
+      if (elapsed < kStallSettleMs) break;
+      probe = (lo + hi) / 2;
+      enter(Phase::StallProbe, probe);
+      break;
+
+    case Phase::StallProbe:
+      if (elapsed < FAN_CAL_STALL_HOLD_MS) break;
+      (turning ? hi : lo) = probe;
+      if (hi - lo > kSearchResolution) {
+        enter(Phase::StallKick, DUTY_MAX);
+        break;
+      }
+      runThreshold = hi;
+      lo = runThreshold - 1;
+      hi = DUTY_MAX;
+      enter(Phase::StartStop, 0);
+      break;
+
+    case Phase::StartStop:
+      if ((rpm > 0 || elapsed < kStopQuietMs) && elapsed < FAN_CAL_STOP_MAX_MS) break;
+      probe = (lo + hi) / 2;
+      enter(Phase::StartProbe, probe);
+      break;
+
+    case Phase::StartProbe:
+      if (elapsed < FAN_CAL_START_HOLD_MS) break;
+      (turning ? hi : lo) = probe;
+      if (hi - lo > kSearchResolution) enter(Phase::StartStop, 0);
+      else finishCurve(hi);
+      break;
+  }
+  return true;
+}
+
+FanCalState fanCalibrationState() { return calState.load(std::memory_order_acquire); }
+
+size_t fanCurveRender(char* out, size_t size) {
+  static const char* const kStates[] = {"idle", "running", "done", "failed"};
+  const FanCurve& c = fanCurve();
+  size_t len = 0;
+  auto append = [&](int n) {
+    if (n > 0) len = len + (size_t)n < size ? len + (size_t)n : size - 1;
+  };
+  append(snprintf(out, size, "{\"state\":\"%s\",\"source\":\"%s\",\"min_run_duty\":%u,\"min_start_duty\":%u,\"rpm\":[",
+                  kStates[(int)fanCalibrationState()], fanCurveSource(), c.minRunDuty, c.minStartDuty));
+  for (size_t i = 0; i < FAN_CURVE_POINTS; i++) {
+    append(snprintf(out + len, size - len, i ? ",%u" : "%u", c.rpm[i]));
+  }
+  append(snprintf(out + len, size - len, "]}"));
+  return len;
+}
+
+void fanCurveReset() {
+  active.store(&kStockFanCurve, std::memory_order_release);
+  source.store("stock", std::memory_order_relaxed);
+  saveWanted.store(false, std::memory_order_relaxed);
+  calState.store(FanCalState::Idle, std::memory_order_relaxed);
+}
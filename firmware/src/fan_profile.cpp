@@ -0,0 +1,191 @@
+#include "fan_profile.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include "fan_control.h"
+#include "fan_task.h"
+#include "hal.h"
+#include "logging.h"
+#include "speed_command.h"
+
+namespace {
+
+// Uploads on their way to the fan task: the network side fills a free slot
+// and posts its number; the fan task copies it out and frees it. Nothing
+// stays behind when the post fails.
+FanProfile        staged[2];
+std::atomic<bool> stagedBusy[2];
+uint8_t           nextSlot = 0;  // network side
+
+// Fan task.
+FanProfile running = {};
+bool       active = false;
+uint8_t    current = 0;
+uint32_t   stepStartMs = 0;  // when `current` began, on the schedule (not when it was serviced)
+
+// Network side: the last accepted upload, for /profile.
+FanProfile uploaded = {};
+
+// Whole number of at most 9 digits, no sign or blanks.
+bool parseUnsigned(const char* s, size_t n, uint32_t max, uint32_t& out) {
+  if (n == 0 || n > 9) return false;
+  uint32_t v = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] < '0' || s[i] > '9') return false;
+    v = v * 10 + (uint32_t)(s[i] - '0');
+  }
+  if (v > max) return false;
+  out = v;
+  return true;
+}
+
+// "<hold s>:<speed %>[:<ramp ms>]"; false if any part is malformed.
+bool parseStep(const char* s, size_t len, FanProfileStep& step) {
+  const char* end = s + len;
+  const char* colon = (const char*)memchr(s, ':', len);
+  if (!colon || !parseUnsigned(s, (size_t)(colon - s), FAN_PROFILE_MAX_HOLD_S, step.holdS)) return false;
+
+  const char* speedStart = colon + 1;
+  const char* rampColon = (const char*)memchr(speedStart, ':', (size_t)(end - speedStart));
+  const char* speedEnd = rampColon ? rampColon : end;
+  char speed[12];
+  size_t n = (size_t)(speedEnd - speedStart);
+  if (n == 0 || n >= sizeof(speed)) return false;
+  memcpy(speed, speedStart, n);
+  speed[n] = '\0';
+  int value;
+  if (!parseSpeedValue(speed, value)) return false;
+  step.speed = (int16_t)value;
+
+  step.rampMs = FAN_PROFILE_RAMP_RATE;
+  if (!rampColon) return true;
+  uint32_t ramp;
+  if (!parseUnsigned(rampColon + 1, (size_t)(end - rampColon - 1), FAN_RAMP_MAX_MS, ramp)) return false;
+  step.rampMs = (int32_t)ramp;
+  return true;
+}
+
+void enterStep(uint8_t i) {
+  current = i;
+  const FanProfileStep& step = running.steps[i];
+  fanReportHold();  // one status record for all channels
+  for (FanChannel& ch : fanChannels) handleFanSpeed(ch, step.speed, step.rampMs);
+  fanReportRelease();
+}
+
+}  // namespace
+
+bool fanProfileParse(const char* text, size_t length, FanProfile& out) {
+  out.count = 0;
+  const char* p = text;
+  const char* stop = text + length;
+  while (p < stop) {
+    const char* end = p;
+    while (end < stop && *end != ';' && *end != '\n') end++;
+    const char* s = p;
+    while (s < end && *s == ' ') s++;
+    const char* e = end;
+    while (e > s && (e[-1] == ' ' || e[-1] == '\r')) e--;
+    if (e > s) {
+      if (out.count == FAN_PROFILE_MAX_STEPS || !parseStep(s, (size_t)(e - s), out.steps[out.count])) return false;
+      out.count++;
+    }
+    p = end < stop ? end + 1 : end;
+  }
+  return out.count > 0;
+}
+
+bool fanProfileStart(const FanProfile& profile) {
+  uint8_t slot = nextSlot;
+  if (stagedBusy[slot].load(std::memory_order_acquire)) slot ^= 1;
+  if (stagedBusy[slot].load(std::memory_order_acquire)) return false;
+  staged[slot] = profile;
+  stagedBusy[slot].store(true, std::memory_order_release);
+  if (!fanCommandPost(FanCommandKind::Profile, slot + 1)) {
+    stagedBusy[slot].store(false, std::memory_order_release);
+    return false;
+  }
+  uploaded = profile;
+  nextSlot = slot ^ 1;
+  return true;
+}
+
+bool fanProfileStop() {
+  return fanCommandPost(FanCommandKind::Profile, 0);
+}
+
+void fanProfileRun(int slot) {
+  if (slot < 1 || slot > 2) return;
+  running = staged[slot - 1];
+  stagedBusy[slot - 1].store(false, std::memory_order_release);
+  active = true;
+  stepStartMs = halMillis();
+  LOG_INFO("profile started: %u steps", (unsigned)running.count);
+  enterStep(0);
+}
+
+void fanProfileCancel() {
+  if (!active) return;
+  active = false;
+  LOG_INFO("profile stopped at step %u of %u", (unsigned)current + 1, (unsigned)running.count);
+}
+
+uint32_t fanProfileService() {
+  while (active) {
+    uint32_t holdMs = running.steps[current].holdS * 1000;
+    uint32_t elapsed = halMillis() - stepStartMs;
+    if (elapsed < holdMs) return holdMs - elapsed;
+    stepStartMs += holdMs;  // a late pass does not stretch the schedule
+    if (current + 1 < running.count) {
+      enterStep(current + 1);
+      continue;
+    }
+    active = false;
+    LOG_INFO("profile done");
+    fanReportStatus();
+  }
+  return UINT32_MAX;
+}
+
+void fanProfileProgress(uint8_t& step, uint8_t& steps, uint32_t& leftS) {
+  step = steps = 0;
+  leftS = 0;
+  if (!active) return;
+  step = (uint8_t)(current + 1);
+  steps = running.count;
+  uint32_t elapsed = halMillis() - stepStartMs;
+  uint32_t holdMs = running.steps[current].holdS * 1000;
+  if (elapsed < holdMs) leftS = (holdMs - elapsed + 999) / 1000;
+  for (uint8_t i = (uint8_t)(current + 1); i < running.count; i++) leftS += running.steps[i].holdS;
+}
+
+size_t fanProfileRender(char* out, size_t size) {
+  size_t len = 0;
+  auto append = [&](int n) {
+    if (n > 0) len = len + (size_t)n < size ? len + (size_t)n : size - 1;
+  };
+  const FanStatus& fan = fanStatus();
+  append(snprintf(out, size, "{\"running\":%s,\"step\":%u,\"steps\":%u,\"left_s\":%lu,\"uploaded\":\"",
+                  fan.profileStep ? "true" : "false", (unsigned)fan.profileStep, (unsigned)fan.profileSteps,
+                  (unsigned long)fan.profileLeftS));
+  for (uint8_t i = 0; i < uploaded.count; i++) {
+    const FanProfileStep& step = uploaded.steps[i];
+    append(snprintf(out + len, size - len, "%s%lu:%d.%02d", i ? ";" : "", (unsigned long)step.holdS,
+                    step.speed / SPEED_SCALE, step.speed % SPEED_SCALE));
+    if (step.rampMs != FAN_PROFILE_RAMP_RATE) append(snprintf(out + len, size - len, ":%ld", (long)step.rampMs));
+  }
+  append(snprintf(out + len, size - len, "\"}"));
+  return len;
+}
+
+void fanProfileReset() {
+  for (std::atomic<bool>& busy : stagedBusy) busy.store(false, std::memory_order_relaxed);
+  nextSlot = 0;
+  running = FanProfile{};
+  uploaded = FanProfile{};
+  active = false;
+  current = 0;
+}
@@ -0,0 +1,229 @@
+#include "fan_rpm.h"
+
+#include <Arduino.h>
+
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "hal.h"
+
+namespace {
+
+// ========= RPM estimator =========
+// Pulses over the time between the first and the last edge of the window,
+// so the estimate does not depend on where the tick falls between edges.
+// While edges are overdue the estimate is capped by the rpm they imply, and
+// after TACH_TIMEOUT_MS it drops to 0.
+struct Estimator {
+  uint32_t pulses = 0;
+  uint32_t edgeUs = 0;
+  bool     haveEdge = false;
+  int32_t  rpm = 0;
+
+  int32_t update(uint32_t nowPulses, uint32_t nowEdgeUs, uint32_t nowUs) {
+    uint32_t n = nowPulses - pulses;
+    int32_t raw = rpm;
+    if (n > 0) {
+      uint32_t span = nowEdgeUs - edgeUs;
+      if (haveEdge && span > 0) {
+        raw = (int32_t)((uint64_t)n * 60000000u / ((uint64_t)TACH_PULSES_PER_REV * span));
+      }
+      pulses = nowPulses;
+      edgeUs = nowEdgeUs;
+      haveEdge = true;
+    } else if (haveEdge) {
+      int32_t since = (int32_t)(nowUs - edgeUs);  // < 0: edge landed after nowUs was taken
+      if (since >= (int32_t)(TACH_TIMEOUT_MS * 1000u)) {
+        raw = 0;
+        haveEdge = false;
+      } else if (since > 0) {
+        int32_t ceiling = (int32_t)(60000000u / ((uint32_t)TACH_PULSES_PER_REV * (uint32_t)since));
+        if (ceiling < raw) raw = ceiling;
+      }
+    }
+    rpm = raw;  // the edge-span estimate is already a window average
+    return rpm;
+  }
+};
+
+Estimator estimator;
+uint32_t  lastTickMs = 0;
+bool      ticking = false;
+
+// ========= PID =========
+int32_t targetRpm = 0;     // 0 = percent mode
+int32_t integralQ10 = 0;
+int32_t prevRpm = 0;
+
+// ========= Stall handling =========
+uint32_t zeroSinceMs = 0;
+bool     zeroTiming = false;
+uint8_t  kicks = 0;
+bool     stalled = false;
+bool     kicking = false;
+uint32_t kickEndMs = 0;
+int      dutyBeforeKick = 0;
+int      reportedRpm = 0;
+bool     reportedStalled = false;
+
+// The tach belongs to channel 0, so RPM control and the stall kick drive that one.
+FanChannel& tachFan() { return fanChannels[0]; }
+
+int32_t feedForward(int32_t rpm) {
+  return fanCurveDutyForRpm(rpm);
+}
+
+int32_t clampDuty(int32_t duty) {
+  int32_t floor = fanCurve().minRunDuty;
+  return duty < floor ? floor : (duty > DUTY_MAX ? DUTY_MAX : duty);
+}
+
+void writeControlledDuty(int32_t duty) {
+  writeDutyActiveLow(tachFan(), duty);
+  tachFan().speed = dutyToSpeed(tachFan().duty);
+}
+
+void pidStep(int32_t rpm) {
+  int32_t error = targetRpm - rpm;
+  // Integrate only near the target, so the spin-up does not wind it up.
+  bool near = error < FAN_PID_I_ZONE_RPM && error > -FAN_PID_I_ZONE_RPM;
+  int32_t step = near ? error * FAN_PID_KI_Q10 * (int32_t)FAN_CONTROL_PERIOD_MS / 1000 : 0;
+  int32_t derivative = -(rpm - prevRpm) * FAN_PID_KD_Q10 * 1000 / (int32_t)FAN_CONTROL_PERIOD_MS;
+  prevRpm = rpm;
+
+  int32_t integral = integralQ10 + step;
+  int64_t correction = (int64_t)(error * FAN_PID_KP_Q10 + integral + derivative) * (DUTY_MAX + 1) / (1024 * 1024);
+  int32_t out = feedForward(targetRpm) + (int32_t)correction;
+  int32_t limited = clampDuty(out);
+  // Anti-windup: only integrate while the output is not pinned in that direction.
+  if (limited == out || (out > limited) != (step > 0)) integralQ10 = integral;
+  writeControlledDuty(limited);
+}
+
+void startKick(uint32_t now) {
+  kicks++;
+  kicking = true;
+  kickEndMs = now + FAN_KICK_MS;
+  dutyBeforeKick = tachFan().duty;
+  writeDutyActiveLow(tachFan(), DUTY_MAX);
+}
+
+// Tracks how long the fan has been driven without turning.
+void checkStall(int32_t rpm, uint32_t now) {
+  bool driven = tachFan().duty > 0;
+  if (!driven || rpm > 0) {
+    zeroTiming = false;
+    if (rpm > 0) {
+      kicks = 0;
+      stalled = false;
+    }
+    return;
+  }
+  if (!zeroTiming) {
+    zeroTiming = true;
+    zeroSinceMs = now;
+    return;
+  }
+  if (now - zeroSinceMs < FAN_STALL_MS) return;
+  if (kicks >= FAN_STALL_MAX_KICKS) {
+    stalled = true;
+    if (now - zeroSinceMs < FAN_STALL_RETRY_MS) return;
+  }
+  zeroSinceMs = now;
+  startKick(now);
+}
+
+void reportIfChanged(int32_t rpm) {
+  int delta = rpm - reportedRpm;
+  if (delta < 0) delta = -delta;
+  if (delta < FAN_RPM_REPORT_STEP && stalled == reportedStalled) return;
+  reportedRpm = rpm;
+  reportedStalled = stalled;
+  fanReportStatus();
+}
+
+}  // namespace
+
+int fanRpmToSpeed(int rpm) {
+  int32_t top = fanCurve().rpm[FAN_CURVE_POINTS - 1];
+  int32_t speed = ((int32_t)constrain(rpm, 0, (int)top) * SPEED_FULL + top / 2) / top;
+  return (int)speed;
+}
+
+void fanSetTargetRpm(int rpm) {
+  fanCalibrationCancel();
+  if (rpm <= 0) {
+    handleFanSpeed(tachFan(), 0);
+    return;
+  }
+  if (!hal.tach) {
+    handleFanSpeed(tachFan(), fanRpmToSpeed(rpm));  // no feedback: open-loop equivalent
+    return;
+  }
+  targetRpm = rpm > FAN_RPM_MAX ? FAN_RPM_MAX : rpm;
+  integralQ10 = 0;
+  prevRpm = estimator.rpm;
+  fanSoftStartCancel(tachFan());
+  int32_t duty = clampDuty(feedForward(targetRpm));
+  if (fanOutputDuty(tachFan()) == 0 && duty < fanCurve().minStartDuty) duty = fanCurve().minStartDuty;
+  if (!kicking) writeControlledDuty(duty);
+  fanReportStatus();
+}
+
+void fanRpmRelease() {
+  targetRpm = 0;
+  integralQ10 = 0;
+  if (kicking) kicking = false;  // the caller writes the new duty
+}
+
+uint32_t fanRpmService() {
+  if (!hal.tach) return UINT32_MAX;
+  uint32_t now = halMillis();
+  if (!ticking) {
+    ticking = true;
+    lastTickMs = now;
+  }
+  uint32_t elapsed = now - lastTickMs;
+  if (elapsed < FAN_CONTROL_PERIOD_MS) return FAN_CONTROL_PERIOD_MS - elapsed;
+  lastTickMs = elapsed < 2 * FAN_CONTROL_PERIOD_MS ? lastTickMs + FAN_CONTROL_PERIOD_MS : now;
+
+  uint32_t nowUs = hal.clock->micros();
+  uint32_t pulses, edgeUs;
+  hal.tach->read(pulses, edgeUs);
+  int32_t rpm = estimator.update(pulses, edgeUs, nowUs);
+
+  if (fanCalibrationStep(rpm)) {  // the sweep owns the fan
+    reportIfChanged(rpm);
+    return FAN_CONTROL_PERIOD_MS - (now - lastTickMs);
+  }
+
+  if (kicking) {
+    if ((int32_t)(now - kickEndMs) >= 0) {
+      kicking = false;
+      writeDutyActiveLow(tachFan(), dutyBeforeKick);
+      integralQ10 = 0;
+    }
+  } else {
+    checkStall(rpm, now);
+    if (!kicking && targetRpm > 0) pidStep(rpm);
+  }
+  reportIfChanged(rpm);
+  return FAN_CONTROL_PERIOD_MS - (now - lastTickMs);
+}
+
+int fanMeasuredRpm() { return estimator.rpm; }
+int fanTargetRpm() { return targetRpm; }
+bool fanStalled() { return stalled; }
+
+void fanRpmReset() {
+  estimator = Estimator();
+  ticking = false;
+  targetRpm = 0;
+  integralQ10 = 0;
+  prevRpm = 0;
+  zeroTiming = false;
+  kicks = 0;
+  stalled = false;
+  kicking = false;
+  reportedRpm = 0;
+  reportedStalled = false;
+}
@@ -0,0 +1,115 @@
+#include "fan_state.h"
+
+#include <cstdio>
+
+#include "config.h"
+#include "fan_control.h"
+#include "fan_task.h"
+
+namespace {
+
+struct ChannelFields {
+  int speed;
+  int setpoint;
+  int duty;
+  int outputDuty;
+};
+
+struct Fields {
+  ChannelFields fans[FAN_CHANNEL_COUNT];
+  bool defaultOn;
+  int  rpm;
+  int  targetRpm;
+  bool stalled;
+  uint8_t  profileStep;
+  uint8_t  profileSteps;
+  uint32_t profileLeftS;
+};
+
+FanStateSnapshot snapshot = {};
+Fields rendered = {};
+
+Fields currentFields() {
+  const FanStatus& fan = fanStatus();
+  Fields f = {};
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+    const FanChannelStatus& ch = fan.fans[i];
+    f.fans[i] = ChannelFields{ch.speed, ch.setpoint, ch.duty, ch.outputDuty};
+  }
+  f.defaultOn = currentConfig.fan_default_on;
+  f.rpm = fan.rpm;
+  f.targetRpm = fan.targetRpm;
+  f.stalled = fan.stalled;
+  f.profileStep = fan.profileStep;
+  f.profileSteps = fan.profileSteps;
+  f.profileLeftS = fan.profileLeftS;
+  return f;
+}
+
+bool sameFields(const Fields& a, const Fields& b) {
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+    const ChannelFields& x = a.fans[i];
+    const ChannelFields& y = b.fans[i];
+    if (x.speed != y.speed || x.setpoint != y.setpoint || x.duty != y.duty || x.outputDuty != y.outputDuty) {
+      return false;
+    }
+  }
+  return a.defaultOn == b.defaultOn && a.rpm == b.rpm && a.targetRpm == b.targetRpm && a.stalled == b.stalled &&
+         a.profileStep == b.profileStep && a.profileSteps == b.profileSteps && a.profileLeftS == b.profileLeftS;
+}
+
+size_t clampLength(int n, size_t size) {
+  if (n < 0) return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+// Channel 0 at the top level, as before; with more than one channel every
+// channel again under "fans", in order.
+void render(const Fields& f) {
+  rendered = f;
+  snapshot.version++;
+  snprintf(snapshot.etag, sizeof(snapshot.etag), "\"%lu\"", (unsigned long)snapshot.version);
+  const ChannelFields& c0 = f.fans[0];
+  char* out = snapshot.json;
+  size_t size = sizeof(snapshot.json);
+  size_t len = clampLength(snprintf(out, size,
+                   "{\"status\":\"%s\",\"speed\":%d.%02d,\"setpoint\":%d.%02d,\"default_on\":%s,"
+                   "\"rpm\":%d,\"target_rpm\":%d,\"stalled\":%s,\"duty\":%d,\"output_duty\":%d,",
+                   c0.speed > 0 ? "on" : "off", c0.speed / SPEED_SCALE, c0.speed % SPEED_SCALE,
+                   c0.setpoint / SPEED_SCALE, c0.setpoint % SPEED_SCALE, f.defaultOn ? "true" : "false",
+                   f.rpm, f.targetRpm, f.stalled ? "true" : "false", c0.duty, c0.outputDuty), size);
+  if (FAN_CHANNEL_COUNT > 1) {
+    len += clampLength(snprintf(out + len, size - len, "\"fans\":["), size - len);
+    for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+      const ChannelFields& c = f.fans[i];
+      len += clampLength(snprintf(out + len, size - len,
+                                  "%s{\"status\":\"%s\",\"speed\":%d.%02d,\"setpoint\":%d.%02d,\"duty\":%d,\"output_duty\":%d}",
+                                  i ? "," : "", c.speed > 0 ? "on" : "off", c.speed / SPEED_SCALE, c.speed % SPEED_SCALE,
+                                  c.setpoint / SPEED_SCALE, c.setpoint % SPEED_SCALE, c.duty, c.outputDuty),
+                         size - len);
+    }
+    len += clampLength(snprintf(out + len, size - len, "],"), size - len);
+  }
+  if (f.profileStep) {
+    len += clampLength(snprintf(out + len, size - len, "\"profile\":{\"step\":%u,\"steps\":%u,\"left_s\":%lu},",
+                                (unsigned)f.profileStep, (unsigned)f.profileSteps, (unsigned long)f.profileLeftS),
+                       size - len);
+  }
+  len += clampLength(snprintf(out + len, size - len, "\"version\":%lu}", (unsigned long)snapshot.version), size - len);
+  snapshot.length = len;
+}
+
+}  // namespace
+
+void fanStateBegin(uint32_t bootSeed) {
+  snapshot.version = bootSeed & 0x3fffffff;  // leaves decades of headroom before wrapping
+  render(currentFields());
+}
+
+void fanStateRefresh() {
+  Fields f = currentFields();
+  if (sameFields(f, rendered)) return;
+  render(f);
+}
+
+const FanStateSnapshot& fanStateSnapshot() { return snapshot; }
@@ -0,0 +1,289 @@
+#include "fan_task.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstring>
+
+#include "config.h"
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "fan_profile.h"
+#include "fan_rpm.h"
+#include "fan_state.h"
+#include "metrics.h"
+#include "mpsc_queue.h"
+#include "mqtt_link.h"
+#include "rtos.h"
+#include "scheduler.h"
+
+namespace {
+
+MpscQueue<FanCommand, FAN_COMMAND_QUEUE_LEN> commands;
+MpscQueue<FanStatus, FAN_STATUS_QUEUE_LEN>   statuses;  // single producer: the fan task
+
+RtosTask*             fanTask = nullptr;
+std::atomic<bool>     stopping{false};
+std::atomic<uint32_t> applied{0};
+std::atomic<uint32_t> commandDrops{0};
+std::atomic<uint32_t> merged{0};
+std::atomic<bool>     held{false};
+std::atomic<bool>     heldPosts{false};
+std::atomic<uint32_t> statusDrops{0};
+std::atomic<bool>     statusLost{false};
+std::atomic<bool>     reportWanted{false};
+FanStatus             mirror = {};
+FanCommand            mailbox[FAN_COMMAND_QUEUE_LEN];  // fan task only
+size_t                mailboxLen = 0;
+
+void applyTo(FanCommandKind kind, FanChannel& ch, int value) {
+  switch (kind) {
+    case FanCommandKind::Speed:
+      handleFanSpeed(ch, value);
+      break;
+    case FanCommandKind::On:
+      handleFanSpeed(ch, ch.lastUserSpeed > 0 ? ch.lastUserSpeed : value);
+      break;
+    case FanCommandKind::Adjust: {
+      int requested = constrain(value, 0, SPEED_FULL);
+      if (requested > 0) ch.lastUserSpeed = max(requested, SPEED_MIN_RUN);
+      if (ch.duty == 0 && ch.speed == 0) {
+        fanSoftStartCancel(ch);
+        fanReportStatus();  // just report the setpoint while stopped
+      } else {
+        handleFanSpeed(ch, requested);
+      }
+      break;
+    }
+    case FanCommandKind::Setpoint:
+      ch.lastUserSpeed = value;
+      fanReportStatus();
+      break;
+    case FanCommandKind::Report:
+      fanReportStatus();
+      break;
+    case FanCommandKind::Rpm:
+      if (fanChannelIndex(ch) == 0) fanSetTargetRpm(value);
+      else handleFanSpeed(ch, fanRpmToSpeed(value));  // no tach on the other channels
+      break;
+    case FanCommandKind::Calibrate:
+      fanCalibrationStart();
+      break;
+    case FanCommandKind::Profile:
+      break;  // not per channel, see apply()
+  }
+}
+
+// Commands that take the fan over from a running profile.
+bool preempts(FanCommandKind kind) {
+  return kind == FanCommandKind::Speed || kind == FanCommandKind::On || kind == FanCommandKind::Adjust ||
+         kind == FanCommandKind::Rpm || kind == FanCommandKind::Calibrate;
+}
+
+void apply(const FanCommand& cmd) {
+  if (preempts(cmd.kind)) fanProfileCancel();
+  if (cmd.kind == FanCommandKind::Profile) {
+    if (cmd.value) {
+      fanProfileRun(cmd.value);
+    } else {
+      fanProfileCancel();
+      fanReportStatus();
+    }
+  } else if (cmd.channel == FAN_CHANNEL_ALL) {
+    fanReportHold();
+    for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+      if (cmd.batch[i] != FAN_BATCH_KEEP) applyTo(cmd.kind, fanChannels[i], cmd.batch[i]);
+    }
+    fanReportRelease();
+  } else if (cmd.channel < FAN_CHANNEL_COUNT) {
+    applyTo(cmd.kind, fanChannels[cmd.channel], cmd.value);
+  }
+  applied.fetch_add(1, std::memory_order_relaxed);
+  // The kinds that end in a PWM write (or ramp start) by now.
+  if (cmd.kind == FanCommandKind::Speed || cmd.kind == FanCommandKind::On ||
+      cmd.kind == FanCommandKind::Adjust || cmd.kind == FanCommandKind::Rpm) {
+    metricsObserve(MetricHist::FanCommand, hal.clock->micros() - cmd.postedUs);
+  }
+}
+
+void applyMailbox() {
+  for (size_t i = 0; i < mailboxLen; i++) apply(mailbox[i]);
+  mailboxLen = 0;
+}
+
+// Setpoints: only the newest of a kind for a channel matters. Off stays
+// where it was sent, and a batch is applied as one change.
+bool mergeable(const FanCommand& cmd) {
+  if (cmd.channel == FAN_CHANNEL_ALL) return false;
+  switch (cmd.kind) {
+    case FanCommandKind::Speed:
+    case FanCommandKind::Adjust:
+    case FanCommandKind::Rpm:
+      return cmd.value > 0;
+    case FanCommandKind::Setpoint:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool touches(const FanCommand& cmd, uint8_t channel) {
+  return cmd.channel == channel || cmd.channel == FAN_CHANNEL_ALL || cmd.kind == FanCommandKind::Profile ||
+         cmd.kind == FanCommandKind::Calibrate;
+}
+
+// Queues `cmd` in the mailbox. The last command there for its channel is
+// dropped if `cmd` supersedes it; anything else for that channel in between
+// keeps both.
+void collect(const FanCommand& cmd) {
+  if (mergeable(cmd)) {
+    for (size_t i = mailboxLen; i-- > 0;) {
+      if (!touches(mailbox[i], cmd.channel)) continue;
+      if (mailbox[i].kind == cmd.kind && mergeable(mailbox[i])) {
+        memmove(&mailbox[i], &mailbox[i + 1], (mailboxLen - i - 1) * sizeof(FanCommand));
+        mailboxLen--;
+        merged.fetch_add(1, std::memory_order_relaxed);
+      }
+      break;
+    }
+  }
+  if (mailboxLen == FAN_COMMAND_QUEUE_LEN) applyMailbox();
+  mailbox[mailboxLen++] = cmd;
+}
+
+void wake() {
+  if (fanTask) {
+    rtosNotify(fanTask);
+  } else {
+    fanTaskService();
+  }
+}
+
+bool post(const FanCommand& cmd) {
+  if (!commands.push(cmd)) {
+    commandDrops.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (held.load(std::memory_order_acquire)) {
+    heldPosts.store(true, std::memory_order_relaxed);
+  } else {
+    wake();
+  }
+  return true;
+}
+
+void fanTaskMain(void*) {
+  while (!stopping.load(std::memory_order_acquire)) {
+    rtosWaitNotify(fanTaskService());
+  }
+}
+
+bool statusPending(void*) {
+  return !statuses.empty() || statusLost.load(std::memory_order_relaxed);
+}
+
+void statusDrainTask(void*) {
+  fanStatusDrain();
+}
+
+}  // namespace
+
+bool fanCommandPost(FanCommandKind kind, int value, uint8_t channel) {
+  FanCommand cmd = {kind, channel, (int16_t)value, {}, hal.clock->micros()};
+  return post(cmd);
+}
+
+bool fanCommandPostBatch(FanCommandKind kind, const int16_t (&values)[FAN_CHANNEL_COUNT]) {
+  FanCommand cmd = {kind, FAN_CHANNEL_ALL, 0, {}, hal.clock->micros()};
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) cmd.batch[i] = values[i];
+  return post(cmd);
+}
+
+void fanCommandsHold() {
+  held.store(true, std::memory_order_release);
+}
+
+void fanCommandsRelease() {
+  held.store(false, std::memory_order_release);
+  if (heldPosts.exchange(false, std::memory_order_relaxed)) wake();
+}
+
+uint32_t fanTaskService() {
+  FanCommand cmd;
+  while (commands.pop(cmd)) collect(cmd);
+  applyMailbox();
+  if (reportWanted.exchange(false, std::memory_order_acq_rel)) fanReportStatus();
+  uint32_t wait = fanProfileService();  // first: a new step may start a kick or a ramp
+  uint32_t start = fanSoftStartService();
+  if (start < wait) wait = start;
+  uint32_t ramp = fanRampService();
+  if (ramp < wait) wait = ramp;
+  uint32_t control = fanRpmService();
+  if (control < wait) wait = control;
+  return wait < FAN_TASK_IDLE_MS ? wait : FAN_TASK_IDLE_MS;
+}
+
+void fanTaskBegin() {
+  if (fanTask) return;
+  schedulerAddReady("fan-status", statusPending, statusDrainTask);
+  stopping.store(false, std::memory_order_release);
+  fanTask = rtosTaskStart("fan", fanTaskMain, nullptr, FAN_TASK_PRIORITY, FAN_TASK_STACK_BYTES);
+}
+
+void fanTaskStop() {
+  if (!fanTask) return;
+  stopping.store(true, std::memory_order_release);
+  rtosNotify(fanTask);
+  rtosTaskJoin(fanTask);
+  fanTask = nullptr;
+  fanTaskService();  // whatever was posted after the last wake-up
+}
+
+// A full status queue means the network side has stalled; rather than block
+// the fan task the record is dropped and a fresh one requested on the next drain.
+void fanStatusPost(const FanStatus& status) {
+  if (!statuses.push(status)) {
+    statusDrops.fetch_add(1, std::memory_order_relaxed);
+    statusLost.store(true, std::memory_order_relaxed);
+  }
+  if (!fanTask) fanStatusDrain();
+}
+
+bool fanStatusDrain() {
+  bool any = false;
+  FanStatus status;
+  while (statuses.pop(status)) {
+    mirror = status;
+    publishStateFromDuty(status.fans[0].publishDuty);
+    any = true;
+  }
+  if (statusLost.exchange(false, std::memory_order_relaxed)) {
+    // Bypasses the command queue so the resync can never be dropped itself.
+    reportWanted.store(true, std::memory_order_release);
+    if (fanTask) rtosNotify(fanTask);
+    else fanTaskService();
+  }
+  if (any) fanStateRefresh();
+  return any;
+}
+
+const FanStatus& fanStatus() { return mirror; }
+
+uint32_t fanCommandsApplied() { return applied.load(std::memory_order_relaxed); }
+uint32_t fanCommandDrops() { return commandDrops.load(std::memory_order_relaxed); }
+uint32_t fanCommandsMerged() { return merged.load(std::memory_order_relaxed); }
+uint32_t fanStatusDrops() { return statusDrops.load(std::memory_order_relaxed); }
+
+void fanTaskReset() {
+  commands.reset();
+  statuses.reset();
+  applied = 0;
+  commandDrops = 0;
+  merged = 0;
+  held = false;
+  heldPosts = false;
+  mailboxLen = 0;
+  statusDrops = 0;
+  statusLost = false;
+  reportWanted = false;
+  mirror = FanStatus{};
+}
@@ -0,0 +1,4 @@
+#include "hal.h"
+
+// Bound by halEsp32Begin() on the device and halNativeBegin() on the host.
+Hal hal = {};
@@ -0,0 +1,390 @@
+#include "hal_esp32.h"
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <lwip/dns.h>
+#include <lwip/tcpip.h>
+#include <cstring>
+
+#include "fan_control.h"
+#include "hal.h"
+#include "http_server.h"
+#include "metrics.h"
+#include "mqtt_packet.h"
+#include "mqtt_socket_esp32.h"
+
+// ========= Globals =========
+MqttSocket mqttSocket;
+PubSubClient mqtt(mqttSocket);
+
+// ========= PWM pins =========
+// static const int  FAN_PWM_PIN = 18;
+#if defined(ARDUINO_ESP32C3_DEV)
+  static const int  FAN_PWM_PIN = 10;
+#else
+  static const int  FAN_PWM_PIN = 18;
+#endif
+
+// Further fan channels (build with -D FAN_CHANNELS=n); each needs its pin.
+#ifndef FAN_PWM_PIN_1
+#define FAN_PWM_PIN_1 -1
+#endif
+#ifndef FAN_PWM_PIN_2
+#define FAN_PWM_PIN_2 -1
+#endif
+#ifndef FAN_PWM_PIN_3
+#define FAN_PWM_PIN_3 -1
+#endif
+static const int FAN_PWM_PINS[FAN_CHANNEL_MAX] = {FAN_PWM_PIN, FAN_PWM_PIN_1, FAN_PWM_PIN_2, FAN_PWM_PIN_3};
+static_assert(FAN_CHANNEL_COUNT < 2 || FAN_PWM_PIN_1 >= 0, "FAN_CHANNELS >= 2 needs FAN_PWM_PIN_1");
+static_assert(FAN_CHANNEL_COUNT < 3 || FAN_PWM_PIN_2 >= 0, "FAN_CHANNELS >= 3 needs FAN_PWM_PIN_2");
+static_assert(FAN_CHANNEL_COUNT < 4 || FAN_PWM_PIN_3 >= 0, "FAN_CHANNELS >= 4 needs FAN_PWM_PIN_3");
+
+// Tach input (open collector, pulled up): -1 leaves RPM readout and control off.
+// The C3 has no PCNT unit, so edges are counted by a GPIO interrupt.
+#ifndef FAN_TACH_PIN
+#define FAN_TACH_PIN -1
+#endif
+static const uint32_t TACH_GLITCH_US = 200;  // 18000 rpm at 2 ppr is one edge per 1.67 ms
+
+// Channel i runs on LEDC channel 2*i: channels share a timer in pairs, so
+// spacing them out gives every fan its own timer.
+static int ledcChannelFor(size_t fan) { return (int)(2 * fan); }
+
+namespace {
+
+// ========= PWM ramp =========
+// Stepped every FAN_RAMP_STEP_MS by an esp_timer (hardware timer, dispatched
+// from the high-priority timer task), so neither loop() nor the fan task
+// stretches a ramp. Each step recomputes the duty from the start time rather
+// than adding increments, so a late step catches up instead of drifting.
+// Writes happen under the lock, so a write() can never be overtaken by a
+// step of the ramp it replaced. (The LEDC fade unit is not used: on the
+// 2.x core retargeting a running fade blocks until it ends.)
+// Every channel owns its lock, timer and ramp.
+class LedcPwm : public PwmSink {
+public:
+  void bind(int pin, int channel) {
+    this->pin = pin;
+    this->channel = channel;
+  }
+
+  void write(uint32_t duty) override {
+    portENTER_CRITICAL(&mux);
+    rampActive = false;
+    out(duty);
+    portEXIT_CRITICAL(&mux);
+  }
+
+  void ramp(uint32_t from, uint32_t to, uint32_t ms) override {
+    if (!timer) {
+      esp_timer_create_args_t args = {};
+      args.callback = onRampStep;
+      args.arg = this;
+      args.name = "fan-ramp";
+      if (esp_timer_create(&args, &timer) != ESP_OK) {
+        write(to);
+        return;
+      }
+    }
+    esp_timer_stop(timer);  // fails harmlessly if not armed
+    portENTER_CRITICAL(&mux);
+    rampFrom = from;
+    rampTo = to;
+    rampStartUs = esp_timer_get_time();
+    rampUs = (int64_t)ms * 1000;
+    rampActive = true;
+    out(from);
+    portEXIT_CRITICAL(&mux);
+    esp_timer_start_once(timer, FAN_RAMP_STEP_MS * 1000);
+  }
+
+private:
+  static void onRampStep(void* arg) {
+    LedcPwm& self = *static_cast<LedcPwm*>(arg);
+    bool more;
+    portENTER_CRITICAL(&self.mux);
+    if (self.rampActive) {
+      int64_t elapsed = esp_timer_get_time() - self.rampStartUs;
+      bool done = elapsed >= self.rampUs;
+      self.out(done ? self.rampTo
+                    : (uint32_t)(self.rampFrom + ((int64_t)self.rampTo - self.rampFrom) * elapsed / self.rampUs));
+      if (done) self.rampActive = false;
+    }
+    more = self.rampActive;
+    portEXIT_CRITICAL(&self.mux);
+    if (more) esp_timer_start_once(self.timer, FAN_RAMP_STEP_MS * 1000);
+  }
+
+  void out(uint32_t duty) {
+#if defined(ARDUINO_ESP32C3_DEV)
+    ledcWrite(channel, duty);      // C3 舊 API：用 channel
+#else
+    ledcWrite(pin, duty);          // C6 新 API：用 pin
+#endif
+  }
+
+  int                pin = -1;
+  int                channel = 0;
+  portMUX_TYPE       mux = portMUX_INITIALIZER_UNLOCKED;
+  esp_timer_handle_t timer = nullptr;
+  bool               rampActive = false;
+  uint32_t           rampFrom = 0, rampTo = 0;
+  int64_t            rampStartUs = 0, rampUs = 0;
+};
+
+portMUX_TYPE      tachMux = portMUX_INITIALIZER_UNLOCKED;
+volatile uint32_t tachPulses = 0;
+volatile uint32_t tachLastEdgeUs = 0;
+
+void IRAM_ATTR onTachEdge() {
+  uint32_t now = micros();
+  portENTER_CRITICAL_ISR(&tachMux);
+  if (now - tachLastEdgeUs >= TACH_GLITCH_US) {  // ringing on the slow pull-up edge
+    tachLastEdgeUs = now;
+    tachPulses = tachPulses + 1;
+  }
+  portEXIT_CRITICAL_ISR(&tachMux);
+}
+
+class GpioTach : public TachInput {
+public:
+  void read(uint32_t& pulses, uint32_t& lastEdgeUs) override {
+    portENTER_CRITICAL(&tachMux);
+    pulses = tachPulses;
+    lastEdgeUs = tachLastEdgeUs;
+    portEXIT_CRITICAL(&tachMux);
+  }
+};
+
+class ArduinoClock : public Clock {
+public:
+  uint32_t millis() override { return ::millis(); }
+  uint32_t micros() override { return ::micros(); }
+};
+
+class PreferencesStore : public NvsStore {
+public:
+  bool begin(const char* ns, bool readOnly) override { return prefs.begin(ns, readOnly); }
+  void end() override { prefs.end(); }
+  bool getBool(const char* key, bool def) override { return prefs.getBool(key, def); }
+  int  getInt(const char* key, int def) override { return prefs.getInt(key, def); }
+  size_t getString(const char* key, char* out, size_t maxLen) override {
+    if (maxLen == 0) return 0;
+    out[0] = '\0';
+    return prefs.getString(key, out, maxLen);
+  }
+  void putBool(const char* key, bool value) override { counted(prefs.putBool(key, value)); }
+  void putInt(const char* key, int value) override { counted(prefs.putInt(key, value)); }
+  void putString(const char* key, const char* value) override { counted(prefs.putString(key, value)); }
+  size_t getBytes(const char* key, void* out, size_t maxLen) override { return prefs.getBytes(key, out, maxLen); }
+  bool putBytes(const char* key, const void* data, size_t len) override { return counted(prefs.putBytes(key, data, len)) == len; }
+  void remove(const char* key) override { prefs.remove(key); }
+
+private:
+  static size_t counted(size_t written) {
+    if (written) metricsCount(MetricCounter::NvsWrites);
+    return written;
+  }
+  Preferences prefs;
+};
+
+// ========= Async DNS =========
+// dns_gethostbyname() must run on the lwip thread; the answer comes back on
+// it too and is picked up by the next resolve() poll. A bumped generation
+// makes a late answer for an abandoned query land nowhere.
+char              dnsHost[64];
+volatile NetStep  dnsResult = NetStep::Failed;
+volatile uint32_t dnsIp = 0;
+volatile uint32_t dnsGeneration = 0;
+bool              dnsInFlight = false;
+
+void dnsFound(const char*, const ip_addr_t* addr, void* arg) {
+  if ((uint32_t)(uintptr_t)arg != dnsGeneration) return;
+  if (addr && IP_IS_V4(addr)) {
+    dnsIp = ip_2_ip4(addr)->addr;
+    dnsResult = NetStep::Done;
+  } else {
+    dnsResult = NetStep::Failed;
+  }
+}
+
+void dnsStart(void* arg) {
+  ip_addr_t addr;
+  err_t err = dns_gethostbyname(dnsHost, &addr, dnsFound, arg);
+  if (err == ERR_OK) dnsFound(dnsHost, &addr, arg);
+  else if (err != ERR_INPROGRESS) dnsFound(dnsHost, nullptr, arg);
+}
+
+// PubSubClient writes each publish payload byte to a Stream, if one is set,
+// as it reads the packet; messages longer than its buffer are then passed
+// to the callback cut short instead of being dropped.
+class SinkStream : public Stream {
+public:
+  size_t write(uint8_t c) override {
+    if (sink) sink->write(&c, 1);
+    return 1;
+  }
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+  MqttPayloadSink* sink = nullptr;
+};
+
+SinkStream payloadStream;
+
+class PubSubMqtt : public MqttClient {
+public:
+  void setCallback(MqttMessageCallback cb) override { mqtt.setCallback(cb); }
+  void setPayloadSink(MqttPayloadSink* sink) override {
+    payloadStream.sink = sink;
+    mqtt.setStream(payloadStream);
+  }
+
+  NetStep resolve(const char* host, uint32_t& ip) override {
+    if (!dnsInFlight) {
+      strncpy(dnsHost, host, sizeof(dnsHost) - 1);
+      dnsHost[sizeof(dnsHost) - 1] = '\0';
+      dnsResult = NetStep::Pending;
+      uint32_t generation = dnsGeneration + 1;
+      dnsGeneration = generation;
+      if (tcpip_callback(dnsStart, (void*)(uintptr_t)generation) != ERR_OK) return NetStep::Failed;
+      dnsInFlight = true;
+      return NetStep::Pending;
+    }
+    NetStep result = dnsResult;
+    if (result == NetStep::Pending) return result;
+    dnsInFlight = false;
+    if (result == NetStep::Done) ip = dnsIp;
+    return result;
+  }
+
+  NetStep connectTcp(uint32_t ip, uint16_t port) override {
+    return mqttSocket.connectStep(ip, port);
+  }
+
+  NetStep handshake(const MqttConnectRequest& request) override {
+    if (!connectSent) {
+      uint8_t packet[384];
+      size_t len = mqttEncodeConnect(request, packet, sizeof(packet));
+      refusedRc = 0;
+      if (len == 0 || !mqttSocket.sendRaw(packet, len)) return NetStep::Failed;
+      connectSent = true;
+      connackLen = 0;
+      return NetStep::Pending;
+    }
+    int n = mqttSocket.readRaw(connack + connackLen, sizeof(connack) - connackLen);
+    if (n < 0) {
+      connectSent = false;
+      return NetStep::Failed;
+    }
+    connackLen += (size_t)n;
+    if (connackLen < sizeof(connack)) return NetStep::Pending;
+
+    connectSent = false;
+    int rc = mqttConnackCode(connack, connackLen);
+    if (rc != 0) {
+      refusedRc = rc < 0 ? MQTT_CONNECT_FAILED : rc;
+      mqttSocket.stop();
+      return NetStep::Failed;
+    }
+    mqttSocket.replayConnack(connack, connackLen);
+    bool ok = mqtt.connect(request.clientId, request.user, request.pass,
+                           request.willTopic, request.willQos, request.willRetain, request.willMessage);
+    return ok ? NetStep::Done : NetStep::Failed;
+  }
+
+  void abortConnect() override {
+    connectSent = false;
+    if (dnsInFlight) {
+      dnsInFlight = false;
+      dnsGeneration = dnsGeneration + 1;
+    }
+    mqttSocket.stop();
+  }
+
+  void disconnect() override { mqtt.disconnect(); }
+  bool connected() override { return mqtt.connected(); }
+  int  state() override { return refusedRc ? refusedRc : mqtt.state(); }
+  bool publish(const char* topic, const char* payload, bool retained) override {
+    return mqtt.publish(topic, payload, retained);
+  }
+  bool subscribe(const char* topic, uint8_t qos) override { return mqtt.subscribe(topic, qos); }
+  bool loop() override { return mqtt.loop(); }
+
+private:
+  bool    connectSent = false;
+  uint8_t connack[4];
+  size_t  connackLen = 0;
+  int     refusedRc = 0;
+};
+
+class WiFiNetwork : public Network {
+public:
+  bool linkUp() override { return WiFi.status() == WL_CONNECTED; }
+  uint64_t efuseMac() override { return ESP.getEfuseMac(); }
+};
+
+class EspSystem : public SystemInfo {
+public:
+  void heap(HeapStats& out) override {
+    out.freeBytes    = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    out.minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    out.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  }
+};
+
+class SerialLog : public LogSink {
+public:
+  void write(const char* text) override { Serial.print(text); }
+};
+
+LedcPwm          ledcPwm[FAN_CHANNEL_COUNT];
+GpioTach         gpioTach;
+ArduinoClock     arduinoClock;
+PreferencesStore preferencesStore;
+PubSubMqtt       pubSubMqtt;
+WiFiNetwork      wifiNetwork;
+EspSystem        espSystem;
+SerialLog        serialLog;
+
+}  // namespace
+
+void halEsp32Begin() {
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) hal.pwm[i] = &ledcPwm[i];
+  hal.clock = &arduinoClock;
+  hal.nvs   = &preferencesStore;
+  hal.mqtt  = &pubSubMqtt;
+  hal.http  = &httpServerRequest();
+  hal.net   = &wifiNetwork;
+  hal.sys   = &espSystem;
+  hal.log   = &serialLog;
+}
+
+void setupPwm() {
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+    int pin = FAN_PWM_PINS[i];
+    int channel = ledcChannelFor(i);
+#if defined(ARDUINO_ESP32C3_DEV)
+    ledcAttachPin(pin, channel);
+    ledcSetup(channel, PWM_FREQ_HZ, PWM_RES_BITS);
+#else
+    ledcAttachChannel(pin, PWM_FREQ_HZ, PWM_RES_BITS, channel);
+#endif
+    ledcPwm[i].bind(pin, channel);
+    writeDutyActiveLow(fanChannels[i], 0);
+  }
+}
+
+void setupTach() {
+  if (FAN_TACH_PIN < 0) return;
+  pinMode(FAN_TACH_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(FAN_TACH_PIN), onTachEdge, FALLING);
+  hal.tach = &gpioTach;
+}
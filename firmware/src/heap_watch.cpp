@@ -0,0 +1,38 @@
+#include "heap_watch.h"
+
+#include "logging.h"
+#include "scheduler.h"
+
+static HeapWatchStats stats = {};
+
+void heapWatchBegin() {
+  schedulerAddPeriodic("heap", HEAP_WATCH_PERIOD_MS, [](void*) { heapWatchCheck(); });
+}
+
+void heapWatchCheck() {
+  HeapStats now = {};
+  hal.sys->heap(now);
+  stats.last = now;
+  if (stats.checks++ == 0) {
+    stats.baseline = now;
+    LOG_INFO("Heap baseline: %lu free, largest block %lu", (unsigned long)now.freeBytes,
+             (unsigned long)now.largestBlock);
+    return;
+  }
+  bool low = now.largestBlock < HEAP_WATCH_MIN_BLOCK_BYTES ||
+             now.freeBytes + HEAP_WATCH_DROP_BYTES <= stats.baseline.freeBytes;
+  if (low && !stats.low) {
+    stats.warnings++;
+    LOG_WARN("Heap low: %lu free (%lu at baseline), largest block %lu", (unsigned long)now.freeBytes,
+             (unsigned long)stats.baseline.freeBytes, (unsigned long)now.largestBlock);
+  }
+  stats.low = low;
+}
+
+const HeapWatchStats& heapWatchStats() {
+  return stats;
+}
+
+void heapWatchReset() {
+  stats = HeapWatchStats{};
+}
@@ -0,0 +1,597 @@
+#include "http_server.h"
+
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <cstdio>
+#include <cstring>
+
+#include "logging.h"
+
+namespace {
+
+enum class ConnState : uint8_t { Free, Reading, Writing };
+
+struct Connection {
+  int         fd;
+  ConnState   state;
+  bool        closeAfter;  // the response being written ends the connection
+  uint32_t    lastMs;      // last byte in or out
+  uint32_t    requestMs;   // first byte of the request being read
+  size_t      inLen;
+  size_t      scanned;     // bytes of `in` already searched for the end of the headers
+  size_t      headLen;     // bytes of `in` taken by the request being answered
+  size_t      outLen;
+  size_t      outSent;
+  const char* body;        // borrowed body, written after `out`
+  void (*handler)();       // route that produced the response
+  size_t      bodyLen;
+  size_t      bodySent;
+  char        in[HTTP_REQUEST_BYTES];
+  char        out[HTTP_RESPONSE_BYTES];
+};
+
+struct Route {
+  const char* path;
+  void (*handler)();
+};
+
+// The request a handler is running for; views into its connection's `in`.
+struct Request {
+  Connection* conn;
+  const char* query;
+  size_t      queryLen;
+  const char* headers;  // header lines, CRLF separated, without the blank line
+  size_t      headersLen;
+  bool        headOnly;
+  bool        responded;
+};
+
+Connection  conns[HTTP_MAX_CONNECTIONS];
+Route       routes[HTTP_MAX_ROUTES];
+size_t      routeCount = 0;
+void (*notFoundHandler)() = nullptr;
+int         listener = -1;
+uint16_t    boundPort = 0;
+Request     current = {};
+char        extraHeaders[256];    // sendHeader() lines for the next send()
+size_t      extraLen = 0;
+HttpServerStats stats = {};
+
+// ---- sockets ----
+bool wouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void makeNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Bytes read, 0 if nothing has arrived, -1 if the peer closed or failed.
+int readSome(int fd, char* buf, size_t len) {
+  ssize_t n = recv(fd, buf, len, MSG_DONTWAIT);
+  if (n > 0) return (int)n;
+  if (n < 0 && wouldBlock()) return 0;
+  return -1;
+}
+
+// Bytes the socket took (0 while its send buffer is full), -1 if it failed.
+int writeSome(int fd, const char* buf, size_t len) {
+  ssize_t n = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n >= 0) return (int)n;
+  return wouldBlock() ? 0 : -1;
+}
+
+// ---- text ----
+char lower(char c) {
+  return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+bool sameText(const char* a, size_t n, const char* b) {
+  for (size_t i = 0; i < n; i++) {
+    if (b[i] == '\0' || lower(a[i]) != lower(b[i])) return false;
+  }
+  return b[n] == '\0';
+}
+
+bool containsText(const char* s, size_t n, const char* word) {
+  size_t w = strlen(word);
+  for (size_t i = 0; i + w <= n; i++) {
+    size_t j = 0;
+    while (j < w && lower(s[i + j]) == lower(word[j])) j++;
+    if (j == w) return true;
+  }
+  return false;
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = lower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// Value of header `name` (trimmed) in the request's header lines.
+bool findHeader(const Request& r, const char* name, const char*& value, size_t& valueLen) {
+  const char* p = r.headers;
+  const char* stop = r.headers + r.headersLen;
+  while (p < stop) {
+    const char* end = p;
+    while (end < stop && *end != '\r') end++;
+    const char* colon = (const char*)memchr(p, ':', (size_t)(end - p));
+    if (colon && sameText(p, (size_t)(colon - p), name)) {
+      const char* v = colon + 1;
+      while (v < end && (*v == ' ' || *v == '\t')) v++;
+      const char* e = end;
+      while (e > v && (e[-1] == ' ' || e[-1] == '\t')) e--;
+      value = v;
+      valueLen = (size_t)(e - v);
+      return true;
+    }
+    p = end + 2;  // past CRLF
+  }
+  return false;
+}
+
+// Raw (still percent-encoded) value of query argument `name`; "" for "?name".
+bool findArg(const Request& r, const char* name, const char*& value, size_t& valueLen) {
+  size_t nameLen = strlen(name);
+  const char* p = r.query;
+  const char* stop = r.query + r.queryLen;
+  while (p < stop) {
+    const char* end = (const char*)memchr(p, '&', (size_t)(stop - p));
+    if (!end) end = stop;
+    const char* eq = (const char*)memchr(p, '=', (size_t)(end - p));
+    const char* keyEnd = eq ? eq : end;
+    if ((size_t)(keyEnd - p) == nameLen && memcmp(p, name, nameLen) == 0) {
+      value = eq ? eq + 1 : end;
+      valueLen = (size_t)(end - value);
+      return true;
+    }
+    p = end + 1;
+  }
+  return false;
+}
+
+const char* reasonPhrase(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    default:  return "";
+  }
+}
+
+// ---- connections ----
+void closeConn(Connection& c) {
+  if (c.state == ConnState::Free) return;
+  close(c.fd);
+  c.fd = -1;
+  c.state = ConnState::Free;
+  stats.open--;
+}
+
+void startReading(Connection& c, uint32_t now) {
+  c.state = ConnState::Reading;
+  c.closeAfter = false;
+  c.inLen = c.scanned = c.headLen = 0;
+  c.outLen = c.outSent = 0;
+  c.body = nullptr;
+  c.bodyLen = c.bodySent = 0;
+  c.handler = nullptr;
+  c.lastMs = c.requestMs = now;
+}
+
+// Status line, headers and (when it fits) the body go into `out`; the socket
+// is written by flush() from the service pass.
+void respond(Connection& c, int code, const char* contentType, const char* body, size_t len, bool headOnly) {
+  size_t size = sizeof(c.out);
+  size_t n = 0;
+  auto append = [&](int w) {
+    if (w > 0) n = n + (size_t)w < size ? n + (size_t)w : size - 1;
+  };
+  append(snprintf(c.out, size, "HTTP/1.1 %d %s\r\n", code, reasonPhrase(code)));
+  bool hasBody = code != 204 && code != 304;
+  if (hasBody) {
+    append(snprintf(c.out + n, size - n, "Content-Type: %s\r\nContent-Length: %u\r\n", contentType,
+                    (unsigned)len));
+  }
+  if (extraLen < size - n) {
+    memcpy(c.out + n, extraHeaders, extraLen);
+    n += extraLen;
+  }
+  extraLen = 0;
+  append(snprintf(c.out + n, size - n, "Connection: %s\r\n\r\n", c.closeAfter ? "close" : "keep-alive"));
+  c.outLen = n;
+  c.outSent = 0;
+  c.body = nullptr;
+  c.bodyLen = c.bodySent = 0;
+  if (hasBody && !headOnly && len > 0) {
+    if (len <= size - n) {
+      memcpy(c.out + n, body, len);
+      c.outLen += len;
+    } else {
+      c.body = body;
+      c.bodyLen = len;
+    }
+  }
+  c.state = ConnState::Writing;
+}
+
+// Server-made errors; these do not reach a route or its metrics.
+void reject(Connection& c, int code, bool closeAfter) {
+  static const char kAllow[] = "Allow: GET, HEAD\r\n";
+  extraLen = 0;
+  if (code == 405) {
+    memcpy(extraHeaders, kAllow, sizeof(kAllow) - 1);
+    extraLen = sizeof(kAllow) - 1;
+  }
+  c.closeAfter = c.closeAfter || closeAfter;
+  const char* reason = reasonPhrase(code);
+  respond(c, code, "text/plain", reason, strlen(reason), false);
+  stats.rejected++;
+}
+
+// Response written: close, or keep the connection and move any pipelined
+// bytes to the front.
+void finishResponse(Connection& c, uint32_t now) {
+  if (c.closeAfter) {
+    closeConn(c);
+    return;
+  }
+  size_t left = c.inLen - c.headLen;
+  memmove(c.in, c.in + c.headLen, left);
+  startReading(c, now);
+  c.inLen = left;
+}
+
+// False if the socket failed.
+bool flush(Connection& c, uint32_t now) {
+  while (c.outSent < c.outLen) {
+    int n = writeSome(c.fd, c.out + c.outSent, c.outLen - c.outSent);
+    if (n < 0) return false;
+    if (n == 0) return true;
+    c.outSent += (size_t)n;
+    c.lastMs = now;
+  }
+  while (c.bodySent < c.bodyLen) {
+    int n = writeSome(c.fd, c.body + c.bodySent, c.bodyLen - c.bodySent);
+    if (n < 0) return false;
+    if (n == 0) return true;
+    c.bodySent += (size_t)n;
+    c.lastMs = now;
+  }
+  finishResponse(c, now);
+  return true;
+}
+
+// A handler with a large body hands out its own buffer, so it is not run
+// again while an earlier response of its is still being written.
+bool routeBusy(const Connection& c, void (*handler)()) {
+  for (const Connection& o : conns) {
+    if (&o != &c && o.state == ConnState::Writing && o.body && o.handler == handler) return true;
+  }
+  return false;
+}
+
+// Parses the complete request in `in` and runs its route; false if the route
+// is busy and the request has to wait for a later pass.
+bool dispatch(Connection& c, size_t headEnd) {
+  c.headLen = headEnd + 4;
+  const char* line = c.in;
+  const char* lineEnd = (const char*)memchr(line, '\r', headEnd + 1);
+  const char* sp1 = (const char*)memchr(line, ' ', (size_t)(lineEnd - line));
+  const char* sp2 = sp1 ? (const char*)memchr(sp1 + 1, ' ', (size_t)(lineEnd - sp1 - 1)) : nullptr;
+  const char* version = sp2 ? sp2 + 1 : nullptr;
+  if (!sp2 || (size_t)(lineEnd - version) != 8 || memcmp(version, "HTTP/1.", 7) != 0) {
+    reject(c, 400, true);
+    return true;
+  }
+
+  Request r = {};
+  r.conn = &c;
+  r.headers = lineEnd + 2;
+  r.headersLen = headEnd > (size_t)(r.headers - c.in) ? headEnd - (size_t)(r.headers - c.in) : 0;
+
+  const char* value;
+  size_t valueLen;
+  bool http10 = version[7] == '0';
+  bool hasConnection = findHeader(r, "Connection", value, valueLen);
+  c.closeAfter = http10 ? !(hasConnection && containsText(value, valueLen, "keep-alive"))
+                        : hasConnection && containsText(value, valueLen, "close");
+
+  // Nothing here takes a body; one would be read as the next request.
+  if ((findHeader(r, "Content-Length", value, valueLen) && !(valueLen == 1 && value[0] == '0')) ||
+      findHeader(r, "Transfer-Encoding", value, valueLen)) {
+    reject(c, 413, true);
+    return true;
+  }
+  size_t methodLen = (size_t)(sp1 - line);
+  bool get = methodLen == 3 && memcmp(line, "GET", 3) == 0;
+  r.headOnly = methodLen == 4 && memcmp(line, "HEAD", 4) == 0;
+  if (!get && !r.headOnly) {
+    reject(c, 405, false);
+    return true;
+  }
+
+  const char* target = sp1 + 1;
+  size_t targetLen = (size_t)(sp2 - target);
+  const char* mark = (const char*)memchr(target, '?', targetLen);
+  size_t pathLen = mark ? (size_t)(mark - target) : targetLen;
+  if (mark) {
+    r.query = mark + 1;
+    r.queryLen = targetLen - pathLen - 1;
+  }
+
+  void (*handler)() = notFoundHandler;
+  for (size_t i = 0; i < routeCount; i++) {
+    if (strlen(routes[i].path) == pathLen && memcmp(routes[i].path, target, pathLen) == 0) {
+      handler = routes[i].handler;
+      break;
+    }
+  }
+  if (handler && routeBusy(c, handler)) return false;
+
+  stats.requests++;
+  extraLen = 0;
+  current = r;
+  if (handler) handler();
+  if (c.state == ConnState::Reading && !current.responded) {  // no handler, or one that never answered
+    static const char kBody[] = "Not found";
+    respond(c, handler ? 500 : 404, "text/plain", handler ? "" : kBody, handler ? 0 : sizeof(kBody) - 1,
+            r.headOnly);
+  }
+  if (c.state == ConnState::Writing) c.handler = handler;
+  current = Request{};
+  return true;
+}
+
+// Runs the next complete request, if one has arrived.
+void tryDispatch(Connection& c) {
+  if (c.state != ConnState::Reading) return;
+  size_t from = c.scanned > 3 ? c.scanned - 3 : 0;
+  for (size_t i = from; i + 4 <= c.inLen; i++) {
+    if (memcmp(c.in + i, "\r\n\r\n", 4) == 0) {
+      if (!dispatch(c, i)) c.scanned = i;  // found again next pass
+      return;
+    }
+  }
+  c.scanned = c.inLen;
+  if (c.inLen == sizeof(c.in)) {
+    c.headLen = c.inLen;
+    reject(c, 431, true);
+  }
+}
+
+void serviceConn(Connection& c, uint32_t now) {
+  if (c.state == ConnState::Writing) {
+    if (!flush(c, now)) {
+      closeConn(c);
+      return;
+    }
+    if (c.state == ConnState::Writing) {
+      if (now - c.lastMs >= HTTP_WRITE_TIMEOUT_MS) {
+        stats.timedOut++;
+        closeConn(c);
+      }
+      return;
+    }
+    if (c.state == ConnState::Free) return;
+  }
+
+  if (c.inLen < sizeof(c.in)) {
+    int n = readSome(c.fd, c.in + c.inLen, sizeof(c.in) - c.inLen);
+    if (n < 0) {
+      closeConn(c);
+      return;
+    }
+    if (n > 0) {
+      if (c.inLen == 0) c.requestMs = now;
+      c.inLen += (size_t)n;
+      c.lastMs = now;
+    }
+  }
+  tryDispatch(c);
+  if (c.state == ConnState::Writing) {
+    if (!flush(c, now)) closeConn(c);  // most responses go out in the pass that made them
+    return;
+  }
+
+  bool timedOut = c.inLen > 0 ? now - c.requestMs >= HTTP_REQUEST_TIMEOUT_MS
+                              : now - c.lastMs >= HTTP_IDLE_TIMEOUT_MS;
+  if (timedOut) {
+    stats.timedOut++;
+    closeConn(c);
+  }
+}
+
+Connection* freeSlot() {
+  for (Connection& c : conns) {
+    if (c.state == ConnState::Free) return &c;
+  }
+  return nullptr;
+}
+
+// Open between requests for the longest time, or null. A candidate is read
+// first: one whose next request is already waiting in the socket is busy.
+Connection* idlest(uint32_t now) {
+  for (;;) {
+    Connection* best = nullptr;
+    for (Connection& c : conns) {
+      if (c.state != ConnState::Reading || c.inLen > 0) continue;
+      if (!best || (int32_t)(c.lastMs - best->lastMs) < 0) best = &c;
+    }
+    if (!best) return nullptr;
+    int n = readSome(best->fd, best->in, sizeof(best->in));
+    if (n == 0) return best;
+    if (n < 0) {
+      closeConn(*best);  // the peer had gone; the slot is free
+      return best;
+    }
+    best->inLen = (size_t)n;
+    best->requestMs = best->lastMs = now;
+  }
+}
+
+// With every slot taken and none idle, clients wait in the listen backlog.
+void acceptWaiting(uint32_t now) {
+  for (;;) {
+    Connection* slot = freeSlot();
+    if (!slot) slot = idlest(now);
+    if (!slot) return;
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) return;
+    if (slot->state != ConnState::Free) {
+      closeConn(*slot);
+      stats.evicted++;
+    }
+    makeNonBlocking(fd);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    slot->fd = fd;
+    startReading(*slot, now);
+    stats.accepted++;
+    stats.open++;
+  }
+}
+
+class ActiveRequest : public HttpServer {
+public:
+  bool hasArg(const char* name) override {
+    const char* value;
+    size_t len;
+    return current.conn && findArg(current, name, value, len);
+  }
+
+  // Percent-decoded, '+' as space.
+  size_t arg(const char* name, char* out, size_t maxLen) override {
+    if (maxLen == 0) return 0;
+    const char* value;
+    size_t len;
+    size_t n = 0;
+    if (current.conn && findArg(current, name, value, len)) {
+      for (size_t i = 0; i < len && n + 1 < maxLen; i++) {
+        char ch = value[i];
+        if (ch == '+') {
+          ch = ' ';
+        } else if (ch == '%' && i + 2 < len && hexValue(value[i + 1]) >= 0 && hexValue(value[i + 2]) >= 0) {
+          ch = (char)(hexValue(value[i + 1]) * 16 + hexValue(value[i + 2]));
+          i += 2;
+        }
+        out[n++] = ch;
+      }
+    }
+    out[n] = '\0';
+    return n;
+  }
+
+  size_t header(const char* name, char* out, size_t maxLen) override {
+    if (maxLen == 0) return 0;
+    const char* value;
+    size_t len = 0;
+    if (!current.conn || !findHeader(current, name, value, len)) len = 0;
+    if (len >= maxLen) len = maxLen - 1;
+    if (len) memcpy(out, value, len);
+    out[len] = '\0';
+    return len;
+  }
+
+  void sendHeader(const char* name, const char* value) override {
+    int n = snprintf(extraHeaders + extraLen, sizeof(extraHeaders) - extraLen, "%s: %s\r\n", name, value);
+    if (n > 0 && (size_t)n < sizeof(extraHeaders) - extraLen) extraLen += (size_t)n;  // else dropped whole
+    else extraHeaders[extraLen] = '\0';
+  }
+
+  void send(int code, const char* contentType, const char* body, size_t len) override {
+    if (!current.conn || current.responded || current.conn->state != ConnState::Reading) return;
+    current.responded = true;
+    respond(*current.conn, code, contentType, body, len, current.headOnly);
+  }
+};
+
+ActiveRequest activeRequest;
+
+}  // namespace
+
+void httpServerOn(const char* path, void (*handler)()) {
+  if (routeCount == HTTP_MAX_ROUTES) {
+    LOG_ERROR("HTTP route table full, %s not served", path);
+    return;
+  }
+  routes[routeCount++] = Route{path, handler};
+}
+
+void httpServerOnNotFound(void (*handler)()) {
+  notFoundHandler = handler;
+}
+
+bool httpServerBegin(uint16_t port) {
+  if (listener >= 0) return true;
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) return false;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, HTTP_LISTEN_BACKLOG) < 0 ||
+      getsockname(fd, (sockaddr*)&addr, &addrLen) < 0) {
+    close(fd);
+    return false;
+  }
+  makeNonBlocking(fd);
+  listener = fd;
+  boundPort = ntohs(addr.sin_port);
+  for (Connection& c : conns) {
+    c.fd = -1;
+    c.state = ConnState::Free;
+  }
+  return true;
+}
+
+void httpServerService() {
+  if (listener < 0) return;
+  uint32_t now = halMillis();
+  acceptWaiting(now);
+  for (Connection& c : conns) {
+    if (c.state != ConnState::Free) serviceConn(c, now);
+  }
+}
+
+void httpServerStop() {
+  uint32_t now = halMillis();
+  for (Connection& c : conns) {
+    if (c.state == ConnState::Writing) flush(c, now);  // the reply to /reconfig, say
+    closeConn(c);
+  }
+  if (listener >= 0) close(listener);
+  listener = -1;
+  boundPort = 0;
+}
+
+uint16_t httpServerPort() {
+  return boundPort;
+}
+
+HttpServer& httpServerRequest() {
+  return activeRequest;
+}
+
+const HttpServerStats& httpServerStats() {
+  return stats;
+}
+
+void httpServerReset() {
+  httpServerStop();
+  routeCount = 0;
+  notFoundHandler = nullptr;
+  stats = HttpServerStats{};
+}
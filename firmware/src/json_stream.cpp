@@ -0,0 +1,118 @@
+#include "json_stream.h"
+
+namespace {
+
+bool isSpace(uint8_t c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+bool isBare(uint8_t c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         c == '-' || c == '+' || c == '.';
+}
+
+}  // namespace
+
+void JsonStream::reset() {
+  *this = JsonStream();
+}
+
+void JsonStream::feed(const uint8_t* data, size_t len, JsonHandler& handler) {
+  for (size_t i = 0; i < len; i++) step(data[i], handler);
+}
+
+// Numbers and literals have no closing delimiter; they end at the first byte
+// that cannot belong to them, which is then handled as usual.
+void JsonStream::endBare(JsonHandler& handler) {
+  token[tokenLen] = '\0';
+  if (depth <= JSON_STREAM_DEPTH) {
+    bool number = (token[0] >= '0' && token[0] <= '9') || token[0] == '-';
+    handler.value(depth, number ? JsonType::Number : JsonType::Literal, token);
+  }
+  state = State::Value;
+}
+
+void JsonStream::step(uint8_t c, JsonHandler& handler) {
+  switch (state) {
+    case State::Idle:
+      if (started || (c != '{' && c != '[')) return;  // leading junk, or past the end
+      started = true;
+      break;
+    case State::String:
+      if (c == '\\') {
+        state = State::Escape;
+      } else if (c == '"') {
+        token[tokenLen] = '\0';
+        if (depth <= JSON_STREAM_DEPTH) {
+          if (isKey) handler.key(depth, token);
+          else handler.value(depth, JsonType::String, token);
+        }
+        state = State::Value;
+      } else if (tokenLen < JSON_TOKEN_MAX - 1) {
+        token[tokenLen++] = (char)c;
+      }
+      return;
+    case State::Escape:
+      if (c == 'u') {
+        skipHex = 4;
+        c = '?';  // keys and values of interest are ASCII
+        state = State::Unicode;
+      } else {
+        if (c == 'n') c = '\n';
+        else if (c == 't') c = '\t';
+        else if (c == 'r') c = '\r';
+        state = State::String;
+      }
+      if (tokenLen < JSON_TOKEN_MAX - 1) token[tokenLen++] = (char)c;
+      return;
+    case State::Unicode:
+      if (--skipHex == 0) state = State::String;
+      return;
+    case State::Bare:
+      if (isBare(c)) {
+        if (tokenLen < JSON_TOKEN_MAX - 1) token[tokenLen++] = (char)c;
+        return;
+      }
+      endBare(handler);
+      break;
+    case State::Value:
+      break;
+  }
+
+  // Between tokens.
+  if (isSpace(c)) return;
+  switch (c) {
+    case '{':
+    case '[':
+      if (depth == UINT8_MAX) return;
+      depth++;
+      if (depth <= JSON_STREAM_DEPTH) {
+        uint32_t bit = 1u << (depth - 1);
+        objects = c == '{' ? objects | bit : objects & ~bit;
+      }
+      expectKey = c == '{';
+      state = State::Value;
+      return;
+    case '}':
+    case ']':
+      if (depth > 0) depth--;
+      expectKey = false;
+      state = depth == 0 ? State::Idle : State::Value;
+      return;
+    case ',':
+      expectKey = inObject();
+      return;
+    case ':':
+      expectKey = false;
+      return;
+    case '"':
+      isKey = expectKey && inObject();
+      expectKey = false;
+      tokenLen = 0;
+      state = State::String;
+      return;
+    default:
+      tokenLen = 0;
+      token[tokenLen++] = (char)c;
+      state = State::Bare;
+      return;
+  }
+}
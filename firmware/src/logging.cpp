@@ -0,0 +1,220 @@
+#include "logging.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include "hal.h"
+#include "mpsc_queue.h"
+#include "scheduler.h"
+
+namespace {
+
+MpscQueue<LogEntry, LOG_QUEUE_LEN> entries;
+std::atomic<uint32_t> drops{0};
+uint32_t reportedDrops = 0;  // drain side: drops already announced
+
+// The latest formatted text, as a byte ring; `historyLen` caps at its size.
+char   history[LOG_HISTORY_BYTES];
+size_t historyHead = 0;  // next byte to write
+size_t historyLen = 0;
+
+const char kLevelTags[] = "?EWID";
+
+void remember(const char* text, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    history[historyHead] = text[i];
+    historyHead = (historyHead + 1) % sizeof(history);
+  }
+  historyLen = historyLen + len < sizeof(history) ? historyLen + len : sizeof(history);
+}
+
+void emit(const char* line, size_t len) {
+  hal.log->write(line);
+  remember(line, len);
+}
+
+// Formats one conversion (`spec` .. `end`, e.g. "%-5lu") with one argument.
+// The length modifier picks the C type the value is narrowed to, as
+// vsnprintf would have read it from the va_list.
+int formatOne(char* out, size_t size, const char* spec, size_t specLen, const LogEntry& e, uint8_t arg) {
+  char f[16];
+  if (specLen >= sizeof(f)) return 0;
+  memcpy(f, spec, specLen);
+  f[specLen] = '\0';
+  char conv = f[specLen - 1];
+  if (arg >= e.argc) return snprintf(out, size, "<?>");
+
+  size_t longs = 0;
+  bool sizeT = false;
+  for (size_t i = 1; i + 1 < specLen; i++) {
+    if (f[i] == 'l') longs++;
+    if (f[i] == 'z') sizeT = true;
+  }
+
+  const LogArgType type = e.types[arg];
+  switch (conv) {
+    case 'd':
+    case 'i': {
+      int64_t v = type == LogArgType::Double ? (int64_t)e.args[arg].d : e.args[arg].i;
+      if (longs >= 2) return snprintf(out, size, f, (long long)v);
+      if (longs == 1) return snprintf(out, size, f, (long)v);
+      if (sizeT) return snprintf(out, size, f, (size_t)v);
+      return snprintf(out, size, f, (int)v);
+    }
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c': {
+      uint64_t v = type == LogArgType::Double ? (uint64_t)e.args[arg].d : e.args[arg].u;
+      if (conv == 'c') return snprintf(out, size, f, (int)v);
+      if (longs >= 2) return snprintf(out, size, f, (unsigned long long)v);
+      if (longs == 1) return snprintf(out, size, f, (unsigned long)v);
+      if (sizeT) return snprintf(out, size, f, (size_t)v);
+      return snprintf(out, size, f, (unsigned)v);
+    }
+    case 'f':
+    case 'e':
+    case 'g': {
+      double v = type == LogArgType::Double     ? e.args[arg].d
+                 : type == LogArgType::Signed   ? (double)e.args[arg].i
+                                                : (double)e.args[arg].u;
+      return snprintf(out, size, f, v);
+    }
+    case 's':
+      if (type != LogArgType::String) return snprintf(out, size, "<?>");
+      return snprintf(out, size, f, e.strings + e.args[arg].offset);
+    case 'p':
+      return snprintf(out, size, f, type == LogArgType::Pointer ? e.args[arg].p : nullptr);
+    default:
+      return snprintf(out, size, "<?>");
+  }
+}
+
+void drainOne(const LogEntry& e) {
+  char line[LOG_LINE_BYTES + 1];
+  size_t len = logFormat(e, line, sizeof(line) - 1);
+  line[len++] = '\n';
+  line[len] = '\0';
+  emit(line, len);
+}
+
+void drain(uint32_t max) {
+  uint32_t dropped = drops.load(std::memory_order_relaxed);
+  if (dropped != reportedDrops) {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "[%lu ms] W (%lu log entries dropped)\n", (unsigned long)halMillis(),
+                     (unsigned long)(dropped - reportedDrops));
+    if (n > 0) emit(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+    reportedDrops = dropped;
+  }
+  LogEntry e;
+  for (uint32_t i = 0; i < max && entries.pop(e); i++) drainOne(e);
+}
+
+bool logPending(void*) {
+  return !entries.empty() || drops.load(std::memory_order_relaxed) != reportedDrops;
+}
+
+void logDrainTask(void*) {
+  drain(LOG_DRAIN_PER_PASS);
+}
+
+}  // namespace
+
+void logBeginEntry(LogEntry& e, uint8_t level, const char* fmt) {
+  e.fmt = fmt;
+  e.ms = halMillis();
+  e.level = level;
+  e.argc = 0;
+  e.stringLen = 0;
+}
+
+void logPack(LogEntry& e, const char* s) {
+  if (e.argc == LOG_MAX_ARGS) return;
+  if (!s) s = "(null)";
+  size_t room = sizeof(e.strings) - e.stringLen;
+  size_t n = strlen(s);
+  if (room == 0) {  // out of room: point at the last string's terminator, ""
+    e.types[e.argc] = LogArgType::String;
+    e.args[e.argc++].offset = (uint8_t)(sizeof(e.strings) - 1);
+    return;
+  }
+  if (n >= room) n = room - 1;
+  memcpy(e.strings + e.stringLen, s, n);
+  e.strings[e.stringLen + n] = '\0';
+  e.types[e.argc] = LogArgType::String;
+  e.args[e.argc++].offset = e.stringLen;
+  e.stringLen = (uint8_t)(e.stringLen + n + 1);
+}
+
+void logCommit(const LogEntry& e) {
+  if (!entries.push(e)) drops.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t logFormat(const LogEntry& e, char* out, size_t size) {
+  if (size == 0) return 0;
+  size_t len = 0;
+  auto append = [&](int n) {
+    if (n > 0) len = len + (size_t)n < size ? len + (size_t)n : size - 1;
+  };
+  append(snprintf(out, size, "[%lu ms] %c ", (unsigned long)e.ms, kLevelTags[e.level < 5 ? e.level : 0]));
+  uint8_t arg = 0;
+  for (const char* p = e.fmt; *p && len + 1 < size; p++) {
+    if (*p != '%') {
+      if (*p != '\n' || p[1] != '\0') out[len++] = *p;  // the line end is added by the drain
+      continue;
+    }
+    if (p[1] == '%') {
+      out[len++] = '%';
+      p++;
+      continue;
+    }
+    const char* spec = p++;
+    while (*p && strchr("-+ #0123456789.hlzjt", *p)) p++;
+    if (!*p) break;
+    append(formatOne(out + len, size - len, spec, (size_t)(p - spec + 1), e, arg++));
+  }
+  out[len] = '\0';
+  return len;
+}
+
+void logBegin() {
+  schedulerAddReady("log", logPending, logDrainTask);
+}
+
+void logFlush() {
+  drain(UINT32_MAX);
+}
+
+size_t logRenderHistory(char* out, size_t size) {
+  if (size == 0) return 0;
+  size_t start = (historyHead + sizeof(history) - historyLen) % sizeof(history);
+  size_t skip = 0;
+  if (historyLen > size - 1) skip = historyLen - (size - 1);  // keep the newest
+  size_t len = 0;
+  bool lineStart = skip == 0 && historyLen < sizeof(history);
+  for (size_t i = skip; i < historyLen; i++) {
+    char c = history[(start + i) % sizeof(history)];
+    if (!lineStart) {  // the oldest line was overwritten part-way; start at the next
+      if (c == '\n') lineStart = true;
+      continue;
+    }
+    out[len++] = c;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+uint32_t logDrops() {
+  return drops.load(std::memory_order_relaxed);
+}
+
+void logReset() {
+  entries.reset();
+  drops = 0;
+  reportedDrops = 0;
+  historyHead = 0;
+  historyLen = 0;
+}
@@ -1,96 +1,74 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
 #include <ArduinoOTA.h>
 #include <DNSServer.h>
-#include <WebServer.h>
 #include <WiFiManager.h>
-#include <Preferences.h>
 #include <cstring>
 #include <ctype.h>
 #include <esp_system.h>
-#include <cstdarg>
+#include <esp_wifi.h>
 
 #include <cstdio>
 
+#include "boot.h"
+#include "config.h"
+#include "event_stream.h"
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "fan_state.h"
+#include "fan_task.h"
+#include "hal.h"
+#include "hal_esp32.h"
+#include "heap_watch.h"
+#include "http_server.h"
+#include "logging.h"
+#include "metrics.h"
+#include "mqtt_link.h"
+#include "mqtt_packet.h"
+#include "printer_report.h"
+#include "scheduler.h"
+#include "speed_command.h"
+#include "web_api.h"
+
 // ========= Globals =========
-WiFiClient espClient;
-PubSubClient mqtt(espClient);
-WebServer server(80);
 WiFiManager wifiManager;
 
-bool mqttWasConnected = false;
-unsigned long lastMqttAttemptMs = 0;
-constexpr unsigned long MQTT_RETRY_INTERVAL_MS = 5000;
 wl_status_t lastWifiStatus = WL_IDLE_STATUS;
-bool mqttStateDirty = false;
-int pendingDutyActiveHigh = 0;
-char mqttClientId[32] = "";
-int pendingPercentAfterStart = 0;
-unsigned long pendingPercentApplyMs = 0;
-constexpr uint32_t SOFT_START_SETTLE_MS = 800;
+bool        wifiFastPending = false;  // cached-BSSID association still in flight
+uint32_t    wifiStartMs = 0;
+bool        otaStarted = false;
+
+constexpr uint32_t WIFI_WATCH_MS = 250;
+constexpr uint32_t OTA_POLL_MS   = 20;
+
+// lwip's socket table: the HTTP and event-stream listeners, MQTT, OTA's UDP
+// listener and upload, the subscribers, then the HTTP slots.
+static_assert(5 + EVENT_STREAM_MAX_CLIENTS + HTTP_MAX_CONNECTIONS <= CONFIG_LWIP_MAX_SOCKETS,
+              "HTTP_MAX_CONNECTIONS does not fit in lwip's socket table");
 
 // ========= FWD declarations =========
-void loadConfig();
-void saveConfig();
 void applyConfigToParameters();
 bool updateConfigFromParameters();
-bool parseBoolParam(const char* value);
-int  percentToDuty(int pct);
-int  invertDuty(int duty);
-void ensureMqtt();
-void setupPwm();
-void handleRoot();
-void handleFanApi();
-void handleStatusApi();
 void handleReconfig();
-void notFound();
 void configModeCallback(WiFiManager *myWiFiManager);
 void saveConfigCallback();
 void applyPowerOnPolicy();
-void writeDutyActiveLow(int dutyActiveHigh);
-void publishStateFromDuty(int dutyActiveHigh);
-void publishMqttStatus(const char* status);
-void handleFanSpeed(int percent);
-
-// ===== Serial logging helpers =====
-template <typename T>
-void logPrint(const T& value) { Serial.print(value); }
-
-template <typename T>
-void logPrintln(const T& value) { Serial.println(value); }
-
-void logPrintf(const char* fmt, ...) {
-  char buffer[256];
-  va_list args;
-  va_start(args, fmt);
-  vsnprintf(buffer, sizeof(buffer), fmt, args);
-  va_end(args);
-  Serial.print(buffer);
-}
+void scheduleTasks();
 
 // ========= Config & Parameters =========
-Preferences preferences;
-struct Config {
-  bool mqtt_enabled;                 // NEW: master toggle (default false)
-  char mqtt_host[40];
-  int  mqtt_port;
-  char mqtt_user[40];
-  char mqtt_pass[40];
-  char mqtt_command_topic[100];
-  char mqtt_state_topic[100];
-  char mqtt_status_topic[100];
-  int  fan_default_speed_pct;
-  bool fan_default_on;
-} currentConfig;
-
 constexpr int MQTT_HOST_PARAM_LEN   = 40;
 constexpr int MQTT_PORT_PARAM_LEN   = 6;
 constexpr int MQTT_USER_PARAM_LEN   = 40;
 constexpr int MQTT_PASS_PARAM_LEN   = 40;
 constexpr int MQTT_TOPIC_PARAM_LEN  = 100;
-constexpr int FAN_DEFAULT_SPEED_PARAM_LEN = 4;
+constexpr int FAN_DEFAULT_SPEED_PARAM_LEN = 7;   // "100.00"
 constexpr int FAN_DEFAULT_ON_PARAM_LEN    = 6;
+constexpr int STATIC_IP_PARAM_LEN         = 16;
+constexpr int FAN_RAMP_PARAM_LEN          = 6;
+constexpr int REPORT_TOPIC_PARAM_LEN      = 64;
+constexpr int REPORT_RULES_PARAM_LEN      = 128;
+constexpr int REPORT_RUNON_PARAM_LEN      = 7;
+constexpr int STATE_WINDOW_PARAM_LEN      = 6;
 
 // NEW: robust checkbox implementation using a hidden field + UI checkbox synced via JS
 // Hidden field actually submitted to WiFiManager (value '1' or '0')
@@ -104,6 +82,11 @@ WiFiManagerParameter custom_mqtt_enable_ui(
 // Non‑MQTT parameters first (so MQTT block can be placed at the very bottom of the portal)
 WiFiManagerParameter custom_fan_def_spd("fspd", "Fan Default Speed (15-100)", "", FAN_DEFAULT_SPEED_PARAM_LEN);
 WiFiManagerParameter custom_fan_def_on ("fdon", "Fan Default ON (true/false)", "", FAN_DEFAULT_ON_PARAM_LEN);
+WiFiManagerParameter custom_fan_ramp_up  ("rup",  "Ramp up time, ms for 0-100 % (0 = instant)", "", FAN_RAMP_PARAM_LEN);
+WiFiManagerParameter custom_fan_ramp_down("rdn",  "Ramp down time, ms for 100-0 %", "", FAN_RAMP_PARAM_LEN);
+WiFiManagerParameter custom_static_ip    ("sip",  "Static IP (blank = DHCP, faster boot)", "", STATIC_IP_PARAM_LEN);
+WiFiManagerParameter custom_static_gw    ("sgw",  "Gateway",     "", STATIC_IP_PARAM_LEN);
+WiFiManagerParameter custom_static_subnet("ssn",  "Subnet mask", "", STATIC_IP_PARAM_LEN);
 
 // MQTT parameters (grouped together, added last in setup so they appear at the bottom)
 WiFiManagerParameter custom_mqtt_header("<hr><h3>MQTT Settings</h3>");
@@ -114,164 +97,32 @@ WiFiManagerParameter custom_mqtt_pass("mqtt_pass", "MQTT Pass", "", MQTT_PASS_PA
 WiFiManagerParameter custom_mqtt_cmd_topic   ("cmdtopic",    "MQTT Command Topic (max 100)", "", MQTT_TOPIC_PARAM_LEN);
 WiFiManagerParameter custom_mqtt_state_topic ("statetopic",  "MQTT State Topic (max 100)",   "", MQTT_TOPIC_PARAM_LEN);
 WiFiManagerParameter custom_mqtt_status_topic("statustopic", "MQTT Status Topic (max 100)",  "", MQTT_TOPIC_PARAM_LEN);
-
-// ========= PWM / Fan runtime =========
-// static const int  FAN_PWM_PIN = 18;
-#if defined(ARDUINO_ESP32C3_DEV)
-  static const int  FAN_PWM_PIN = 10;
-#else
-  static const int  FAN_PWM_PIN = 18;
-#endif
-
-static const int  LEDC_CHANNEL   = 0;
-// int pwmChannel = -1;
-static const int  LEDC_TIMER     = 0;
-static const uint32_t PWM_FREQ_HZ = 25000;
-// static const uint32_t PWM_FREQ_HZ = 200;
-static const uint8_t  PWM_RES_BITS = 10;
-
-static const int PCT_MIN_START = 25;
-static const int PCT_MIN_RUN   = 15;
-
-int currentDuty = 0;
-int currentPercent = 0;
-int lastUserPercent = 0;
-
-// ========= Config I/O =========
-void loadConfig() {
-  preferences.begin("fan-control", false);
-  currentConfig.mqtt_enabled = preferences.getBool("mqtt_enabled", false);  // default false
-
-  preferences.getString("mqtt_host", currentConfig.mqtt_host, sizeof(currentConfig.mqtt_host));
-  currentConfig.mqtt_port = preferences.getInt("mqtt_port", 1883);
-  preferences.getString("mqtt_user", currentConfig.mqtt_user, sizeof(currentConfig.mqtt_user));
-  preferences.getString("mqtt_pass", currentConfig.mqtt_pass, sizeof(currentConfig.mqtt_pass));
-
-  logPrintf("[%.3f ms] loadConfig: loaded mqtt_user='%s' (len: %d), mqtt_pass='%s' (len: %d)\n",
-            millis() / 1000.0f,
-            currentConfig.mqtt_user, strlen(currentConfig.mqtt_user),
-            currentConfig.mqtt_pass, strlen(currentConfig.mqtt_pass));
-
-  preferences.getString("cmd_topic",    currentConfig.mqtt_command_topic, sizeof(currentConfig.mqtt_command_topic));
-  preferences.getString("state_topic",  currentConfig.mqtt_state_topic,   sizeof(currentConfig.mqtt_state_topic));
-  preferences.getString("status_topic", currentConfig.mqtt_status_topic,  sizeof(currentConfig.mqtt_status_topic));
-  currentConfig.fan_default_speed_pct = preferences.getInt("fan_def_spd", 50);
-  currentConfig.fan_default_on        = preferences.getBool("fan_def_on", true);
-  preferences.end();
-
-  if (strlen(currentConfig.mqtt_host) == 0) {
-    strncpy(currentConfig.mqtt_host, "192.168.2.231", sizeof(currentConfig.mqtt_host));
-    currentConfig.mqtt_host[sizeof(currentConfig.mqtt_host) - 1] = '\0';
-  }
-  if (strlen(currentConfig.mqtt_command_topic) == 0) {
-    strncpy(currentConfig.mqtt_command_topic, "bambu/p1s/fan/cmd", sizeof(currentConfig.mqtt_command_topic));
-    currentConfig.mqtt_command_topic[sizeof(currentConfig.mqtt_command_topic) - 1] = '\0';
-  }
-  if (strlen(currentConfig.mqtt_state_topic) == 0) {
-    strncpy(currentConfig.mqtt_state_topic, "bambu/p1s/fan/state", sizeof(currentConfig.mqtt_state_topic));
-    currentConfig.mqtt_state_topic[sizeof(currentConfig.mqtt_state_topic) - 1] = '\0';
-  }
-  if (strlen(currentConfig.mqtt_status_topic) == 0) {
-    strncpy(currentConfig.mqtt_status_topic, "bambu/p1s/fan/status", sizeof(currentConfig.mqtt_status_topic));
-    currentConfig.mqtt_status_topic[sizeof(currentConfig.mqtt_status_topic) - 1] = '\0';
-  }
-  if (strlen(currentConfig.mqtt_user) == 0) currentConfig.mqtt_user[0] = '\0';
-  if (strlen(currentConfig.mqtt_pass) == 0) currentConfig.mqtt_pass[0] = '\0';
-
-  currentConfig.fan_default_speed_pct = constrain(currentConfig.fan_default_speed_pct, 0, 100);
-  if (currentConfig.fan_default_speed_pct > 0 && currentConfig.fan_default_speed_pct < PCT_MIN_RUN) {
-    currentConfig.fan_default_speed_pct = PCT_MIN_RUN;
-  }
-
-  lastUserPercent = currentConfig.fan_default_speed_pct;
-  applyConfigToParameters();
-}
-
-void saveConfig() {
-  float t = millis() / 1000.0f;
-  preferences.begin("fan-control", false);
-
-  // Snapshot old values
-  bool   old_mqtt_enabled = preferences.getBool("mqtt_enabled", false);
-  String old_mqtt_host    = preferences.getString("mqtt_host", "");
-  int    old_mqtt_port    = preferences.getInt("mqtt_port", 1883);
-  String old_mqtt_user    = preferences.getString("mqtt_user", "");
-  String old_mqtt_pass    = preferences.getString("mqtt_pass", "");
-  String old_cmd_topic    = preferences.getString("cmd_topic", "");
-  String old_state_topic  = preferences.getString("state_topic", "");
-  String old_status_topic = preferences.getString("status_topic", "");
-  int    old_def_spd      = preferences.getInt("fan_def_spd", 50);
-  bool   old_def_on       = preferences.getBool("fan_def_on", true);
-
-  // Write new values
-  preferences.putBool  ("mqtt_enabled", currentConfig.mqtt_enabled);
-  preferences.putString("mqtt_host",    currentConfig.mqtt_host);
-  preferences.putInt   ("mqtt_port",    currentConfig.mqtt_port);
-  preferences.putString("mqtt_user",    currentConfig.mqtt_user);
-  preferences.putString("mqtt_pass",    currentConfig.mqtt_pass);
-  preferences.putString("cmd_topic",    currentConfig.mqtt_command_topic);
-  preferences.putString("state_topic",  currentConfig.mqtt_state_topic);
-  preferences.putString("status_topic", currentConfig.mqtt_status_topic);
-  preferences.putInt   ("fan_def_spd", currentConfig.fan_default_speed_pct);
-  preferences.putBool  ("fan_def_on",  currentConfig.fan_default_on);
-
-  // Log only what changed (mask secrets)
-  if (old_mqtt_enabled != currentConfig.mqtt_enabled)
-    logPrintf("[%.3f s] NVS updated: mqtt_enabled: %s -> %s\n", t,
-              old_mqtt_enabled ? "true" : "false",
-              currentConfig.mqtt_enabled ? "true" : "false");
-
-  if (old_mqtt_host != currentConfig.mqtt_host)
-    logPrintf("[%.3f s] NVS updated: mqtt_host: '%s' -> '%s'\n", t,
-              old_mqtt_host.c_str(), currentConfig.mqtt_host);
-
-  if (old_mqtt_port != currentConfig.mqtt_port)
-    logPrintf("[%.3f s] NVS updated: mqtt_port: %d -> %d\n", t,
-              old_mqtt_port, currentConfig.mqtt_port);
-
-  if (old_mqtt_user != currentConfig.mqtt_user)
-    logPrintf("[%.3f s] NVS updated: mqtt_user: '%s' -> '%s'\n", t,
-              old_mqtt_user.c_str(), currentConfig.mqtt_user);
-
-  if ((int)old_mqtt_pass.length() != (int)strlen(currentConfig.mqtt_pass))
-    logPrintf("[%.3f s] NVS updated: mqtt_pass length: %d -> %d\n", t,
-              (int)old_mqtt_pass.length(), (int)strlen(currentConfig.mqtt_pass));
-
-  if (old_cmd_topic != currentConfig.mqtt_command_topic)
-    logPrintf("[%.3f s] NVS updated: cmd_topic: '%s' -> '%s'\n", t,
-              old_cmd_topic.c_str(), currentConfig.mqtt_command_topic);
-
-  if (old_state_topic != currentConfig.mqtt_state_topic)
-    logPrintf("[%.3f s] NVS updated: state_topic: '%s' -> '%s'\n", t,
-              old_state_topic.c_str(), currentConfig.mqtt_state_topic);
-
-  if (old_status_topic != currentConfig.mqtt_status_topic)
-    logPrintf("[%.3f s] NVS updated: status_topic: '%s' -> '%s'\n", t,
-              old_status_topic.c_str(), currentConfig.mqtt_status_topic);
-
-  if (old_def_spd != currentConfig.fan_default_speed_pct)
-    logPrintf("[%.3f s] NVS updated: fan_def_spd: %d -> %d\n", t,
-              old_def_spd, currentConfig.fan_default_speed_pct);
-
-  if (old_def_on != currentConfig.fan_default_on)
-    logPrintf("[%.3f s] NVS updated: fan_def_on: %s -> %s\n", t,
-              old_def_on ? "true" : "false",
-              currentConfig.fan_default_on ? "true" : "false");
-
-  preferences.end();
-}
+WiFiManagerParameter custom_state_window("swin", "State publish window, ms (0 = every change)", "", STATE_WINDOW_PARAM_LEN);
+WiFiManagerParameter custom_report_topic("rtopic", "Printer report topic, e.g. device/&lt;serial&gt;/report (blank = off)", "", REPORT_TOPIC_PARAM_LEN);
+WiFiManagerParameter custom_report_rules("rrules", "Report rules (field op value : speed, ';' separated)", "", REPORT_RULES_PARAM_LEN);
+WiFiManagerParameter custom_runon_s    ("rruns",  "Run-on after the print (s)", "", REPORT_RUNON_PARAM_LEN);
+WiFiManagerParameter custom_runon_speed("rrunp",  "Run-on speed (%, 0 = keep)", "", REPORT_RUNON_PARAM_LEN);
 
 void applyConfigToParameters() {
   // Reflect mqtt_enabled into the hidden field (UI checkbox is synced by JS)
   custom_mqtt_enable_hidden.setValue(currentConfig.mqtt_enabled ? "1" : "0", 2);
 
   // Non‑MQTT first
-  int safePct = constrain(currentConfig.fan_default_speed_pct, 0, 100);
-  if (safePct > 0 && safePct < PCT_MIN_RUN) safePct = PCT_MIN_RUN;
+  int safeSpeed = constrain(currentConfig.fan_default_speed[0], 0, SPEED_FULL);
+  if (safeSpeed > 0 && safeSpeed < SPEED_MIN_RUN) safeSpeed = SPEED_MIN_RUN;
   char speedBuffer[FAN_DEFAULT_SPEED_PARAM_LEN];
-  snprintf(speedBuffer, sizeof(speedBuffer), "%d", safePct);
+  if (safeSpeed % SPEED_SCALE == 0) snprintf(speedBuffer, sizeof(speedBuffer), "%d", safeSpeed / SPEED_SCALE);
+  else snprintf(speedBuffer, sizeof(speedBuffer), "%d.%02d", safeSpeed / SPEED_SCALE, safeSpeed % SPEED_SCALE);
   custom_fan_def_spd.setValue(speedBuffer, FAN_DEFAULT_SPEED_PARAM_LEN);
   custom_fan_def_on.setValue(currentConfig.fan_default_on ? "true" : "false", FAN_DEFAULT_ON_PARAM_LEN);
+  char rampBuffer[FAN_RAMP_PARAM_LEN];
+  snprintf(rampBuffer, sizeof(rampBuffer), "%d", currentConfig.fan_ramp_up_ms);
+  custom_fan_ramp_up.setValue(rampBuffer, FAN_RAMP_PARAM_LEN);
+  snprintf(rampBuffer, sizeof(rampBuffer), "%d", currentConfig.fan_ramp_down_ms);
+  custom_fan_ramp_down.setValue(rampBuffer, FAN_RAMP_PARAM_LEN);
+  custom_static_ip.setValue(currentConfig.static_ip, STATIC_IP_PARAM_LEN);
+  custom_static_gw.setValue(currentConfig.static_gateway, STATIC_IP_PARAM_LEN);
+  custom_static_subnet.setValue(currentConfig.static_subnet, STATIC_IP_PARAM_LEN);
 
   // MQTT block
   custom_mqtt_host.setValue(currentConfig.mqtt_host, MQTT_HOST_PARAM_LEN);
@@ -283,21 +134,21 @@ void applyConfigToParameters() {
   char portBuffer[MQTT_PORT_PARAM_LEN];
   snprintf(portBuffer, sizeof(portBuffer), "%d", currentConfig.mqtt_port);
   custom_mqtt_port.setValue(portBuffer, MQTT_PORT_PARAM_LEN);
-}
-
-bool parseBoolParam(const char* value) {
-  if (!value) return false;
-  while (*value && isspace(static_cast<unsigned char>(*value))) value++;
-  if (*value == '\0') return false;
-  char c = static_cast<char>(tolower(static_cast<unsigned char>(*value)));
-  if (c == '1' || c == 't' || c == 'y') return true;
-  if (c == '0' || c == 'f' || c == 'n') return false;
-  if (c == 'o' && value[1] && tolower(static_cast<unsigned char>(value[1])) == 'n') return true; // 'on'
-  return false;
+  char windowBuffer[STATE_WINDOW_PARAM_LEN];
+  snprintf(windowBuffer, sizeof(windowBuffer), "%d", currentConfig.mqtt_state_window_ms);
+  custom_state_window.setValue(windowBuffer, STATE_WINDOW_PARAM_LEN);
+  custom_report_topic.setValue(currentConfig.report_topic, REPORT_TOPIC_PARAM_LEN);
+  custom_report_rules.setValue(currentConfig.report_rules, REPORT_RULES_PARAM_LEN);
+  char runonBuffer[REPORT_RUNON_PARAM_LEN];
+  snprintf(runonBuffer, sizeof(runonBuffer), "%d", currentConfig.report_runon_s);
+  custom_runon_s.setValue(runonBuffer, REPORT_RUNON_PARAM_LEN);
+  snprintf(runonBuffer, sizeof(runonBuffer), "%d.%02d", currentConfig.report_runon_speed / SPEED_SCALE,
+           currentConfig.report_runon_speed % SPEED_SCALE);
+  custom_runon_speed.setValue(runonBuffer, REPORT_RUNON_PARAM_LEN);
 }
 
 bool updateConfigFromParameters() {
-  logPrintf("[%.3f ms] Entering updateConfigFromParameters()\n", millis() / 1000.0f);
+  LOG_DEBUG("Entering updateConfigFromParameters()");
   Config newConfig = currentConfig;
 
   auto safeCopy = [](char* dest, size_t size, const char* src) {
@@ -324,16 +175,41 @@ bool updateConfigFromParameters() {
   } else {
     newConfig.mqtt_port = 1883;
   }
+  const char* windowValue = custom_state_window.getValue();
+  if (windowValue && strlen(windowValue) > 0) {
+    newConfig.mqtt_state_window_ms = constrain(atoi(windowValue), 0, (int)MQTT_STATE_WINDOW_MAX_MS);
+  }
 
   // Non‑MQTT: default speed and ON flag
   const char* speedValue = custom_fan_def_spd.getValue();
-  if (speedValue && strlen(speedValue) > 0) {
-    newConfig.fan_default_speed_pct = constrain(atoi(speedValue), 0, 100);
+  int speed;
+  if (speedValue && parseSpeedValue(speedValue, speed)) {
+    newConfig.fan_default_speed[0] = speed;
   }
-  if (newConfig.fan_default_speed_pct > 0 && newConfig.fan_default_speed_pct < PCT_MIN_RUN) {
-    newConfig.fan_default_speed_pct = PCT_MIN_RUN;
+  if (newConfig.fan_default_speed[0] > 0 && newConfig.fan_default_speed[0] < SPEED_MIN_RUN) {
+    newConfig.fan_default_speed[0] = SPEED_MIN_RUN;
   }
   newConfig.fan_default_on = parseBoolParam(custom_fan_def_on.getValue());
+  const char* rampUpValue = custom_fan_ramp_up.getValue();
+  if (rampUpValue && strlen(rampUpValue) > 0) {
+    newConfig.fan_ramp_up_ms = constrain(atoi(rampUpValue), 0, FAN_RAMP_MAX_MS);
+  }
+  const char* rampDownValue = custom_fan_ramp_down.getValue();
+  if (rampDownValue && strlen(rampDownValue) > 0) {
+    newConfig.fan_ramp_down_ms = constrain(atoi(rampDownValue), 0, FAN_RAMP_MAX_MS);
+  }
+  safeCopy(newConfig.static_ip,      sizeof(newConfig.static_ip),      custom_static_ip.getValue());
+  safeCopy(newConfig.static_gateway, sizeof(newConfig.static_gateway), custom_static_gw.getValue());
+  safeCopy(newConfig.static_subnet,  sizeof(newConfig.static_subnet),  custom_static_subnet.getValue());
+  safeCopy(newConfig.report_topic, sizeof(newConfig.report_topic), custom_report_topic.getValue());
+  safeCopy(newConfig.report_rules, sizeof(newConfig.report_rules), custom_report_rules.getValue());
+  if (newConfig.report_rules[0] == '\0') safeCopy(newConfig.report_rules, sizeof(newConfig.report_rules), REPORT_RULES_DEFAULT);
+  const char* runonValue = custom_runon_s.getValue();
+  if (runonValue && strlen(runonValue) > 0) {
+    newConfig.report_runon_s = constrain(atoi(runonValue), 0, (int)REPORT_RUNON_MAX_S);
+  }
+  const char* runonSpeedValue = custom_runon_speed.getValue();
+  if (runonSpeedValue) parseSpeedValue(runonSpeedValue, newConfig.report_runon_speed);
 
   bool changed =
     newConfig.mqtt_enabled != currentConfig.mqtt_enabled ||
@@ -344,470 +220,38 @@ bool updateConfigFromParameters() {
     strcmp(newConfig.mqtt_state_topic,   currentConfig.mqtt_state_topic)   != 0 ||
     strcmp(newConfig.mqtt_status_topic,  currentConfig.mqtt_status_topic)  != 0 ||
     newConfig.mqtt_port != currentConfig.mqtt_port ||
-    newConfig.fan_default_speed_pct != currentConfig.fan_default_speed_pct ||
-    newConfig.fan_default_on != currentConfig.fan_default_on;
+    newConfig.mqtt_state_window_ms != currentConfig.mqtt_state_window_ms ||
+    newConfig.fan_default_speed[0] != currentConfig.fan_default_speed[0] ||
+    newConfig.fan_default_on != currentConfig.fan_default_on ||
+    newConfig.fan_ramp_up_ms != currentConfig.fan_ramp_up_ms ||
+    newConfig.fan_ramp_down_ms != currentConfig.fan_ramp_down_ms ||
+    strcmp(newConfig.static_ip,      currentConfig.static_ip)      != 0 ||
+    strcmp(newConfig.static_gateway, currentConfig.static_gateway) != 0 ||
+    strcmp(newConfig.static_subnet,  currentConfig.static_subnet)  != 0 ||
+    strcmp(newConfig.report_topic, currentConfig.report_topic) != 0 ||
+    strcmp(newConfig.report_rules, currentConfig.report_rules) != 0 ||
+    newConfig.report_runon_s != currentConfig.report_runon_s ||
+    newConfig.report_runon_speed != currentConfig.report_runon_speed;
 
   if (changed) {
     currentConfig = newConfig;
-    lastUserPercent = newConfig.fan_default_speed_pct > 0 ? newConfig.fan_default_speed_pct : 0;
+    fanSetRampTimes(newConfig.fan_ramp_up_ms, newConfig.fan_ramp_down_ms);
+    printerReportBegin();  // re-reads the rules
+    fanCommandPost(FanCommandKind::Setpoint, newConfig.fan_default_speed[0] > 0 ? newConfig.fan_default_speed[0] : 0);
+    fanStateRefresh();
   }
 
   applyConfigToParameters();
   return changed;
 }
 
-// ========= PWM helpers =========
-int percentToDuty(int pct) {
-  pct = constrain(pct, 0, 100);
-  if (pct > 0 && pct < PCT_MIN_RUN) pct = PCT_MIN_RUN;
-  int duty = (int)round((pct / 100.0f) * ((1 << PWM_RES_BITS) - 1));
-  return constrain(duty, 0, (1 << PWM_RES_BITS) - 1);
-}
-
-int invertDuty(int duty) {
-  const int DUTY_MAX = (1 << PWM_RES_BITS) - 1;
-  return DUTY_MAX - constrain(duty, 0, DUTY_MAX);
-}
-
-// void writeDutyActiveLow(int dutyActiveHigh) {
-//   int dutyActiveLow = invertDuty(dutyActiveHigh);
-//   ledcWrite(pwmChannel, dutyActiveLow);
-//   currentDuty = dutyActiveHigh;
-// }
-
-void writeDutyActiveLow(int dutyActiveHigh) {
-  int dutyActiveLow = invertDuty(dutyActiveHigh);
-#if defined(ARDUINO_ESP32C3_DEV)
-  ledcWrite(LEDC_CHANNEL, dutyActiveLow);      // C3 舊 API：用 channel
-#else
-  ledcWrite(FAN_PWM_PIN, dutyActiveLow);     // C6 新 API：用 pin
-#endif
-  currentDuty = dutyActiveHigh;
-}
- 
-// ========= MQTT‑aware publishers =========
-void publishStateFromDuty(int dutyActiveHigh) {
-  if (!currentConfig.mqtt_enabled) return; // MQTT disabled => no publish
-
-  if (!mqtt.connected()) {
-    pendingDutyActiveHigh = dutyActiveHigh;
-    mqttStateDirty = true;
-    ensureMqtt();
-    if (!mqtt.connected()) {
-      return;
-    }
-  }
-
-  const int DUTY_MAX = (1 << PWM_RES_BITS) - 1;
-  float percent = 100.0f * dutyActiveHigh / DUTY_MAX;
-  int setpoint = constrain(lastUserPercent, 0, 100);
-  char payload[160];
-  snprintf(payload, sizeof(payload), "{\"duty\":%d,\"percent\":%.1f,\"setpoint\":%d}", dutyActiveHigh, percent, setpoint);
-
-  if (!mqtt.publish(currentConfig.mqtt_state_topic, payload, true)) {
-    pendingDutyActiveHigh = dutyActiveHigh;
-    mqttStateDirty = true;
-    return;
-  }
-  mqttStateDirty = false;
-  mqtt.loop();
-}
-
-void publishMqttStatus(const char* status) {
-  if (!currentConfig.mqtt_enabled) return;
-  if (!mqtt.connected() || status == nullptr) return;
-  mqtt.publish(currentConfig.mqtt_status_topic, status, true);
-  mqtt.loop();
-}
-
-// ========= Fan control =========
-bool tryParseInt(const char* s, int& out) {
-  char* endp = nullptr;
-  long v = strtol(s, &endp, 10);
-  if (endp == s || *endp != '\0') return false;
-  out = (int)v;
-  return true;
-}
-
-bool tryParseJsonPercent(const String& s, int& outPercent) {
-  int idx = s.indexOf("speed");
-  if (idx < 0) idx = s.indexOf("percent");
-  if (idx < 0) return false;
-  int colon = s.indexOf(':', idx);
-  if (colon < 0) return false;
-  int j = colon + 1;
-  while (j < (int)s.length() && isspace((unsigned char)s[j])) j++;
-  int start = j;
-  while (j < (int)s.length() && (isdigit((unsigned char)s[j]) || s[j] == '.')) j++;
-  String numStr = s.substring(start, j);
-  outPercent = (int)round(numStr.toFloat());
-  return true;
-}
-
-bool parseSpeedCommand(const char* payload, int& outPercent) {
-  String s = String(payload);
-  s.trim();
-
-  if (s.startsWith("RAW:") || s.startsWith("raw:")) {
-    int v;
-    if (tryParseInt(s.substring(4).c_str(), v)) {
-      const int DUTY_MAX = (1 << PWM_RES_BITS) - 1;
-      outPercent = (int)round(100.0f * v / DUTY_MAX);
-      return true;
-    }
-    return false;
-  }
-
-  if (s.startsWith("{") && s.endsWith("}")) {
-    int pct;
-    if (tryParseJsonPercent(s, pct)) {
-      outPercent = constrain(pct, 0, 100);
-      return true;
-    }
-    return false;
-  }
-
-  int val;
-  if (tryParseInt(s.c_str(), val)) {
-    if (val <= 100) {
-      outPercent = constrain(val, 0, 100);
-    } else {
-      const int DUTY_MAX = (1 << PWM_RES_BITS) - 1;
-      outPercent = (int)round(100.0f * constrain(val, 0, DUTY_MAX) / DUTY_MAX);
-    }
-    return true;
-  }
-
-  return false;
-}
-
-void mqttCallback(char* topic, byte* payload, unsigned int length) {
-  if (!currentConfig.mqtt_enabled) return;
-  String msg;
-  msg.reserve(length + 1);
-  for (unsigned int i = 0; i < length; i++) msg += (char)payload[i];
-
-  int percent;
-  if (parseSpeedCommand(msg.c_str(), percent)) {
-    handleFanSpeed(percent);
-  }
-}
-
-void ensureMqtt() {
-  if (!currentConfig.mqtt_enabled) return; // respect the toggle
-
-  if (mqtt.connected()) {
-    if (!mqttWasConnected) {
-      mqttWasConnected = true;
-      logPrintf("[%lu ms] MQTT connected & subscribed.\n", millis());
-    }
-    return;
-  }
-
-  unsigned long now = millis();
-  if (now - lastMqttAttemptMs < MQTT_RETRY_INTERVAL_MS) return;
-  lastMqttAttemptMs = now;
-
-  wl_status_t wifiStatus = WiFi.status();
-  logPrintf("[%lu ms] ensureMqtt: wifi=%d, mqtt.connected=%d\n", now, wifiStatus, mqtt.connected());
-
-  if (wifiStatus != WL_CONNECTED) {
-    logPrintf("[%lu ms] WiFi not connected, skipping MQTT reconnect\n", now);
-    mqttWasConnected = false;
-    return;
-  }
-
-  if (mqttWasConnected) {
-    logPrintf("[%lu ms] MQTT disconnected, retrying...\n", now);
-    mqttWasConnected = false;
-  }
-
-  if (mqttClientId[0] == '\0') {
-    uint64_t mac = ESP.getEfuseMac();
-    snprintf(mqttClientId, sizeof(mqttClientId), "xiao-%02X%02X%02X%02X%02X%02X",
-             (uint8_t)(mac >> 40), (uint8_t)(mac >> 32), (uint8_t)(mac >> 24),
-             (uint8_t)(mac >> 16), (uint8_t)(mac >> 8), (uint8_t)mac);
-  }
-
-  mqtt.setServer(currentConfig.mqtt_host, currentConfig.mqtt_port);
-  mqtt.setCallback(mqttCallback);
-
-  logPrintf("[%lu ms] Attempting MQTT connect. Host: %s, Port: %d, User: '%s' (len: %d), Pass: '%s' (len: %d)\n",
-            now, currentConfig.mqtt_host, currentConfig.mqtt_port,
-            currentConfig.mqtt_user, strlen(currentConfig.mqtt_user),
-            currentConfig.mqtt_pass, strlen(currentConfig.mqtt_pass));
-
-  bool connect_success = mqtt.connect(
-    mqttClientId,
-    currentConfig.mqtt_user,
-    currentConfig.mqtt_pass,
-    currentConfig.mqtt_status_topic, 1, true, "offline");
-
-  if (!connect_success) {
-    logPrintf("[%lu ms] MQTT connection failed, rc=%d\n", now, mqtt.state());
-    return;
-  }
-
-  mqttWasConnected = true;
-  publishMqttStatus("online");
-  mqtt.subscribe(currentConfig.mqtt_command_topic, 1);
-  if (mqttStateDirty) {
-    publishStateFromDuty(pendingDutyActiveHigh);
-  } else {
-    publishStateFromDuty(currentDuty);
-  }
-  logPrintf("[%lu ms] MQTT connected & subscribed.\n", millis());
-}
-
-void handleFanSpeed(int percent) {
-  int requested = constrain(percent, 0, 100);
-  int effective = requested;
-  if (effective > 0 && effective < PCT_MIN_RUN) effective = PCT_MIN_RUN;
-
-  if (currentConfig.mqtt_enabled && !mqtt.connected()) {
-    ensureMqtt();
-  }
-
-  bool softStart = false;
-  if (currentDuty == 0 && effective > 0 && effective < PCT_MIN_START) {
-    softStart = true;
-    pendingPercentAfterStart = max(requested, PCT_MIN_RUN);
-    pendingPercentApplyMs = millis() + SOFT_START_SETTLE_MS;
-    effective = PCT_MIN_START;
-  } else {
-    pendingPercentApplyMs = 0;
-  }
-
-  writeDutyActiveLow(percentToDuty(effective));
-
-  const int DUTY_MAX = (1 << PWM_RES_BITS) - 1;
-  currentPercent = (effective == 0) ? 0 : (int)round((100.0f * currentDuty) / DUTY_MAX);
-  if (requested > 0) {
-    int stored = max(requested, PCT_MIN_RUN);
-    lastUserPercent = stored;
-  }
-
-  if (requested == 0) {
-    pendingPercentAfterStart = 0;
-  }
-
-  if (softStart) {
-    publishStateFromDuty(percentToDuty(pendingPercentAfterStart));
-  } else {
-    publishStateFromDuty(currentDuty);
-  }
-}
-
 // ========= HTTP / UI =========
-String getFanStateJson() {
-  String json = "{";
-  bool isOn = currentPercent > 0;
-  json += "\"status\":\"" + String(isOn ? "on" : "off") + "\",";
-  json += "\"speed\":" + String(currentPercent);
-  json += ",\"setpoint\":" + String(constrain(lastUserPercent, 0, 100));
-  json += ",\"default_on\":" + String(currentConfig.fan_default_on ? "true" : "false");
-  json += "}";
-  return json;
-}
-
-void handleRoot() {
-  String html = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-  <title>Bambu Fan Control</title>
-  <meta name="viewport" content="width=device-width, initial-scale=1">
-  <style>
-    body { font-family: Arial, sans-serif; text-align: center; margin: 20px; }
-    .container { max-width: 400px; margin: auto; padding: 20px; border: 1px solid #ccc; border-radius: 8px; box-shadow: 0 0 10px rgba(0,0,0,0.1); }
-    button { padding: 10px 20px; margin: 10px; font-size: 16px; cursor: pointer; border: none; border-radius: 5px; transition: background-color 0.2s ease; }
-    #fanStatus { font-size: 20px; margin: 15px 0; }
-    #speedSlider { width: 80%; margin: 15px 0; }
-    .btn-on { background-color: #4CAF50; color: white; }
-    .btn-off { background-color: #f44336; color: white; }
-    .btn-on.active { background-color: #2e7d32; }
-    .btn-on.inactive { background-color: #a5d6a7; }
-    .btn-off.active { background-color: #c62828; }
-    .btn-off.inactive { background-color: #ef9a9a; }
-    .btn-reconfig { background-color: #008CBA; color: white; }
-    button:disabled { cursor: default; }
-  </style>
-</head>
-<body>
-  <div class="container">
-    <h1>Bambu Fan Control</h1>
-    <div id="fanStatus">Fan Status: -- Speed: --%</div>
-
-    <!-- New: power-on default toggle -->
-    <div style="margin:10px 0;">
-      <label><input type="checkbox" id="defaultOnToggle"> Default ON at power-up</label>
-    </div>
-
-    <button id="btnOn" class="btn-on inactive" onclick="setFanState(true)">Turn On</button>
-    <button id="btnOff" class="btn-off inactive" onclick="setFanState(false)">Turn Off</button>
-
-    <p>Fan Speed:</p>
-    <input type="range" min="0" max="100" value="0" class="slider" id="speedSlider">
-    <p><span id="speedValue">0</span>%</p>
-
-    <button class="btn-reconfig" onclick="reconfigure()">Reconfigure WiFi/MQTT</button>
-  </div>
-
-  <script>
-    var fanStateElement = document.getElementById('fanStatus');
-    var speedSlider = document.getElementById('speedSlider');
-    var speedValueElement = document.getElementById('speedValue');
-    var btnOn = document.getElementById('btnOn');
-    var btnOff = document.getElementById('btnOff');
-    var sliderDebounce = null;
-    var lastSetpoint = 0;
-    var defaultOnToggle = document.getElementById('defaultOnToggle');
-
-    function clampPercent(value) {
-      var n = parseInt(value, 10);
-      if (isNaN(n) || !isFinite(n)) { return 0; }
-      if (n < 0) return 0; if (n > 100) return 100; return n;
-    }
-
-    function applyButtonState(isOn) {
-      if (isOn) {
-        btnOn.disabled = true;  btnOn.classList.add('inactive'); btnOn.classList.remove('active');
-        btnOff.disabled = false; btnOff.classList.add('active');  btnOff.classList.remove('inactive');
-      } else {
-        btnOn.disabled = false; btnOn.classList.add('active');  btnOn.classList.remove('inactive');
-        btnOff.disabled = true;  btnOff.classList.add('inactive'); btnOff.classList.remove('active');
-      }
-    }
-
-    function statusText(isOn, speed, setpoint) {
-      var text = "Fan Status: " + (isOn ? "On" : "Off") + " Speed: " + speed + "%";
-      if (!isOn && setpoint !== speed) { text += " (Set: " + setpoint + "%)"; }
-      return text;
-    }
-
-    function applyUiState(response) {
-      var isOn = response.status === "on";
-      var speed = clampPercent(response.speed);
-      var setpoint = response.setpoint !== undefined ? clampPercent(response.setpoint) : speed;
-      if (isOn) { lastSetpoint = speed; } else { lastSetpoint = setpoint; }
-      fanStateElement.textContent = statusText(isOn, speed, setpoint);
-      if (isOn) { speedSlider.value = speed; speedValueElement.textContent = speed; }
-      else { speedSlider.value = setpoint; speedValueElement.textContent = setpoint; }
-      applyButtonState(isOn);
-      // reflect default_on flag
-      if (defaultOnToggle) { defaultOnToggle.checked = !!response.default_on; }
-    }
-
-    function fetchStatus() {
-      var xhr = new XMLHttpRequest();
-      xhr.onreadystatechange = function() {
-        if (this.readyState === 4 && this.status === 200) {
-          try { var response = JSON.parse(this.responseText); applyUiState(response); }
-          catch (e) { console.error('Invalid status payload', e); }
-        }
-      };
-      xhr.open('GET', '/status', true); xhr.send();
-    }
-
-    function setFanState(isOn) {
-      if ((isOn && btnOn.disabled) || (!isOn && btnOff.disabled)) return;
-      var state = isOn ? 'on' : 'off';
-      applyButtonState(isOn);
-      var value = clampPercent(lastSetpoint);
-      speedSlider.value = value; speedValueElement.textContent = value;
-      var xhr = new XMLHttpRequest();
-      xhr.onreadystatechange = function() { if (this.readyState === 4) { fetchStatus(); } };
-      xhr.open('GET', '/fan?state=' + state, true); xhr.send();
-    }
-
-    function sendFanSpeed(speed) {
-      var value = clampPercent(speed); lastSetpoint = value;
-      var xhr = new XMLHttpRequest();
-      xhr.onreadystatechange = function() { if (this.readyState === 4) { fetchStatus(); } };
-      xhr.open('GET', '/fan?speed=' + value, true); xhr.send();
-    }
-
-    speedSlider.addEventListener('input', function() {
-      var value = clampPercent(this.value); speedValueElement.textContent = value;
-      if (sliderDebounce) { clearTimeout(sliderDebounce); }
-      sliderDebounce = setTimeout(function() { sendFanSpeed(value); }, 80);
-    });
-    speedSlider.addEventListener('change', function() { var value = clampPercent(this.value); sendFanSpeed(value); });
-
-    function reconfigure() {
-      if (confirm('Reconfigure WiFi/MQTT? The ESP32 will restart into configuration mode.')) {
-        var xhr = new XMLHttpRequest(); xhr.open('GET', '/reconfig', true); xhr.send();
-      }
-    }
-
-    // New: toggle handler to persist default power-on behavior
-    if (defaultOnToggle) {
-      defaultOnToggle.addEventListener('change', function(){
-        var xhr = new XMLHttpRequest();
-        xhr.onreadystatechange = function(){ if (this.readyState===4) { fetchStatus(); } };
-        xhr.open('GET', '/fan?default_on=' + (defaultOnToggle.checked ? 'true':'false'), true);
-        xhr.send();
-      });
-    }
-
-    setInterval(fetchStatus, 1500);
-    fetchStatus();
-  </script>
-</body>
-</html>
-)rawliteral";
-  server.send(200, "text/html", html);
-}
-
-void handleFanApi() {
-  // New: allow toggling power-on default via UI
-  if (server.hasArg("default_on")) {
-    bool v = parseBoolParam(server.arg("default_on").c_str());
-    currentConfig.fan_default_on = v;
-    saveConfig();
-  }
-
-  if (server.hasArg("state")) {
-    String state = server.arg("state");
-    if (state == "on") {
-      int target = lastUserPercent > 0 ? lastUserPercent : currentConfig.fan_default_speed_pct;
-      handleFanSpeed(target);
-    } else if (state == "off") {
-      handleFanSpeed(0);
-    }
-  } else if (server.hasArg("speed")) {
-    int requested = constrain(server.arg("speed").toInt(), 0, 100);
-    int stored = requested > 0 ? max(requested, PCT_MIN_RUN) : 0;
-    if (stored > 0) {
-      lastUserPercent = stored;
-      currentConfig.fan_default_speed_pct = lastUserPercent; // persist last setpoint
-      saveConfig();
-    }
-
-    if (currentDuty == 0 && currentPercent == 0) {
-      pendingPercentAfterStart = 0;
-      pendingPercentApplyMs = 0;
-      publishStateFromDuty(currentDuty); // just report setpoint if stopped
-    } else {
-      handleFanSpeed(requested);
-    }
-  }
-  server.send(200, "application/json", getFanStateJson());
-}
-
-void handleStatusApi() {
-  server.send(200, "application/json", getFanStateJson());
-}
-
 void handleReconfig() {
-  server.send(200, "text/plain", "ESP32 restarting to enter config mode...");
-  server.stop();
-  if (mqtt.connected()) {
-    publishMqttStatus("offline");
-    mqtt.disconnect();
-    mqttWasConnected = false;
-  }
-  lastMqttAttemptMs = millis();
+  configFlush();  // nothing pending may be lost to the restart
+  static const char kBody[] = "ESP32 restarting to enter config mode...";
+  hal.http->send(200, "text/plain", kBody, sizeof(kBody) - 1);
+  httpServerStop();  // writes the reply above first
+  mqttLinkStop();
   delay(50);
 
   WiFi.disconnect(true, true);
@@ -818,69 +262,176 @@ void handleReconfig() {
   applyConfigToParameters();
 
   bool portalResult = wifiManager.startConfigPortal("BambuFanAP", "password");
-  logPrintf("[%.3f ms] handleReconfig(): portalResult = %d\n", millis() / 1000.0f, portalResult);
+  LOG_INFO("handleReconfig(): portalResult = %d", portalResult);
   if (!portalResult) {
-    logPrintln("Config portal closed without station connection.");
+    LOG_WARN("Config portal closed without station connection.");
   }
 
+  logFlush();
   delay(200);
   ESP.restart();
 }
 
-void notFound() { server.send(404, "text/plain", "Not found"); }
-
 void configModeCallback(WiFiManager *myWiFiManager) {
-  logPrintln("Entered config mode");
-  logPrint("AP SSID: "); logPrintln(myWiFiManager->getConfigPortalSSID());
-  logPrint("AP IP address: "); logPrintln(WiFi.softAPIP());
+  IPAddress ip = WiFi.softAPIP();
+  LOG_INFO("Entered config mode, AP SSID: %s, AP IP address: %u.%u.%u.%u",
+           myWiFiManager->getConfigPortalSSID().c_str(), ip[0], ip[1], ip[2], ip[3]);
+  logFlush();
 }
 
 void saveConfigCallback() {
-  logPrintf("[%.3f ms] Entering saveConfigCallback()\n", millis() / 1000.0f);
+  LOG_DEBUG("Entering saveConfigCallback()");
   bool configUpdated = updateConfigFromParameters();
   saveConfig();
-  logPrintf("[%.3f ms] saveConfigCallback(): updateConfigFromParameters=%d, saved to NVS\n",
-            millis() / 1000.0f, configUpdated);
+  LOG_INFO("saveConfigCallback(): updateConfigFromParameters=%d, saved to NVS", configUpdated);
+  logFlush();
 }
 
 void applyPowerOnPolicy() {
-  lastUserPercent = constrain(currentConfig.fan_default_speed_pct, 0, 100);
-  if (lastUserPercent > 0 && lastUserPercent < PCT_MIN_RUN) lastUserPercent = PCT_MIN_RUN;
-  if (currentConfig.fan_default_on) {
-    handleFanSpeed(lastUserPercent);
+  fanReportHold();
+  for (FanChannel& ch : fanChannels) {
+    handleFanSpeed(ch, currentConfig.fan_default_on ? ch.lastUserSpeed : 0);
+  }
+  fanReportRelease();
+}
+
+// ========= Boot / WiFi bring-up =========
+static const char* resetReasonName() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:  return "power-on";
+    case ESP_RST_SW:       return "software";
+    case ESP_RST_PANIC:    return "panic";
+    case ESP_RST_BROWNOUT: return "brownout";
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:      return "watchdog";
+    default:               return "other";
+  }
+}
+
+// Static addressing skips DHCP, the slowest step of a reconnect. Used by
+// both the cached and the WiFiManager path; nothing happens if no IP is set.
+static void applyStaticIp() {
+  uint32_t ip, gateway, subnet;
+  if (!parseIpv4(currentConfig.static_ip, ip)) return;
+  if (!parseIpv4(currentConfig.static_gateway, gateway)) gateway = 0;
+  if (!parseIpv4(currentConfig.static_subnet, subnet)) subnet = 0x00FFFFFF;  // 255.255.255.0
+  WiFi.config(IPAddress(ip), IPAddress(gateway), IPAddress(subnet), IPAddress(gateway));
+  wifiManager.setSTAStaticIPConfig(IPAddress(ip), IPAddress(gateway), IPAddress(subnet), IPAddress(gateway));
+}
+
+// Joins the AP of the last good connection on its channel, without a scan.
+// Returns false when there is no cache or no stored credentials.
+static bool wifiFastBegin() {
+  WifiFastCache cache;
+  if (!bootLoadWifiCache(cache)) return false;
+  WiFi.mode(WIFI_STA);
+  wifi_config_t stored;
+  if (esp_wifi_get_config(WIFI_IF_STA, &stored) != ESP_OK || stored.sta.ssid[0] == 0) return false;
+  char ssid[sizeof(stored.sta.ssid) + 1];
+  char pass[sizeof(stored.sta.password) + 1];
+  memcpy(ssid, stored.sta.ssid, sizeof(stored.sta.ssid));
+  ssid[sizeof(stored.sta.ssid)] = '\0';
+  memcpy(pass, stored.sta.password, sizeof(stored.sta.password));
+  pass[sizeof(stored.sta.password)] = '\0';
+  applyStaticIp();
+  WiFi.begin(ssid, pass, cache.channel, cache.bssid, true);
+  return true;
+}
+
+// The original boot path: scan and connect, or run the portal; blocks.
+static void wifiPortalConnect() {
+  logFlush();  // the portal blocks loop(), so nothing would drain the log meanwhile
+  applyStaticIp();
+  if (!wifiManager.autoConnect("BambuFanAP", "password")) {
+    LOG_ERROR("Failed to connect and timed out.");
+    configFlush();
+    logFlush();
+    delay(3000);
+    ESP.restart();
+  }
+  // After portal/connection, force back to STA-only to avoid AP lingering
+  WiFi.softAPdisconnect(true);
+  WiFi.mode(WIFI_STA);
+}
+
+// Listening before the link is up costs nothing, and the first request can
+// be served the moment an address is assigned. Every route is timed for /metrics.
+static void startHttp() {
+  httpServerOn("/",         metricsTimed<HttpRoute::Root, handleRoot>);
+  httpServerOn("/fan",      metricsTimed<HttpRoute::Fan, handleFanApi>);
+  httpServerOn("/status",   metricsTimed<HttpRoute::Status, handleStatusApi>);
+  httpServerOn("/tasks",    metricsTimed<HttpRoute::Tasks, handleTasksApi>);
+  httpServerOn("/nvs",      metricsTimed<HttpRoute::Nvs, handleNvsApi>);
+  httpServerOn("/boot",     metricsTimed<HttpRoute::Boot, handleBootApi>);
+  httpServerOn("/calibrate", metricsTimed<HttpRoute::Calibrate, handleCalibrateApi>);
+  httpServerOn("/printer",  metricsTimed<HttpRoute::Printer, handlePrinterApi>);
+  httpServerOn("/profile",  metricsTimed<HttpRoute::Profile, handleProfileApi>);
+  httpServerOn("/metrics",  metricsTimed<HttpRoute::Metrics, handleMetricsApi>);
+  httpServerOn("/log",      metricsTimed<HttpRoute::Log, handleLogApi>);
+  httpServerOn("/reconfig", metricsTimed<HttpRoute::Reconfig, handleReconfig>);
+  httpServerOnNotFound(metricsTimed<HttpRoute::NotFound, notFound>);
+  if (httpServerBegin(80)) {
+    LOG_INFO("HTTP server started");
+  } else {
+    LOG_ERROR("HTTP server could not listen on port 80");
+  }
+  if (eventStreamBegin(EVENT_STREAM_PORT)) {
+    LOG_INFO("Event stream listening on :%u/events", (unsigned)EVENT_STREAM_PORT);
   } else {
-    handleFanSpeed(0);
+    LOG_ERROR("Event stream could not listen on port %u", (unsigned)EVENT_STREAM_PORT);
   }
+  bootMark(BootPhase::HttpUp);
 }
 
-void setupPwm() {
-#if defined(ARDUINO_ESP32C3_DEV)
-  ledcAttachPin(FAN_PWM_PIN, LEDC_CHANNEL);
-  ledcSetup(LEDC_CHANNEL, PWM_FREQ_HZ, PWM_RES_BITS);
-#else
-  ledcAttach(FAN_PWM_PIN, PWM_FREQ_HZ, PWM_RES_BITS);
-#endif
-  writeDutyActiveLow(0);
+static void onLinkUp() {
+  IPAddress ip = WiFi.localIP();
+  LOG_INFO("WiFi connected, IP: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  const uint8_t* bssid = WiFi.BSSID();
+  if (bssid) {
+    WifiFastCache cache;
+    memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+    cache.channel = (uint8_t)WiFi.channel();
+    bootStoreWifiCache(cache);
+  }
+  if (!otaStarted) {
+    ArduinoOTA.setHostname("esp32c3-fan");
+    ArduinoOTA.onStart([]() { configFlush(); });  // the update ends in a reboot
+    ArduinoOTA.begin();
+    otaStarted = true;
+  }
 }
 
 void setup() {
   Serial.begin(115200);
-  delay(5000);
+  halEsp32Begin();
+  bootMark(BootPhase::Setup);
+  bootSetInfo(resetReasonName(), nullptr);
+#if BOOT_SERIAL_WAIT_MS > 0
+  delay(BOOT_SERIAL_WAIT_MS);
+#endif
   loadConfig();
+  configCacheBegin();
+  fanCurveBegin();
+  fanSetRampTimes(currentConfig.fan_ramp_up_ms, currentConfig.fan_ramp_down_ms);
   applyConfigToParameters();
-
-  lastUserPercent = constrain(currentConfig.fan_default_speed_pct, 0, 100);
-  if (lastUserPercent > 0 && lastUserPercent < PCT_MIN_RUN) lastUserPercent = PCT_MIN_RUN;
+  bootMark(BootPhase::ConfigLoaded);
 
   WiFi.setAutoReconnect(true);
   WiFi.persistent(true);
-  mqtt.setBufferSize(256);
-  mqtt.setKeepAlive(45);
+  mqtt.setBufferSize(MQTT_BUFFER_BYTES);
+  mqtt.setKeepAlive(MQTT_KEEPALIVE_S);
   mqtt.setSocketTimeout(5);
   setupPwm();
+  setupTach();
+  fanStateBegin(esp_random());
+  printerReportBegin();
+  mqttLinkBegin();
 
-  // Start fan policy immediately (no network dependency)
+  // Start fan policy immediately (no network dependency); the only power-on command
   applyPowerOnPolicy();
+  fanTaskBegin();  // from here on the fan is driven only through fanCommandPost()
+  bootMark(BootPhase::FanApplied);
 
   wifiManager.setDebugOutput(true);
   wifiManager.setAPCallback(configModeCallback);
@@ -890,6 +441,11 @@ void setup() {
   // --- Parameter order: non‑MQTT first ---
   wifiManager.addParameter(&custom_fan_def_spd);
   wifiManager.addParameter(&custom_fan_def_on);
+  wifiManager.addParameter(&custom_fan_ramp_up);
+  wifiManager.addParameter(&custom_fan_ramp_down);
+  wifiManager.addParameter(&custom_static_ip);
+  wifiManager.addParameter(&custom_static_gw);
+  wifiManager.addParameter(&custom_static_subnet);
 
   // --- MQTT block at the very bottom of the portal ---
   wifiManager.addParameter(&custom_mqtt_header);
@@ -903,80 +459,69 @@ void setup() {
   wifiManager.addParameter(&custom_mqtt_cmd_topic);
   wifiManager.addParameter(&custom_mqtt_state_topic);
   wifiManager.addParameter(&custom_mqtt_status_topic);
+  wifiManager.addParameter(&custom_state_window);
+  wifiManager.addParameter(&custom_report_topic);
+  wifiManager.addParameter(&custom_report_rules);
+  wifiManager.addParameter(&custom_runon_s);
+  wifiManager.addParameter(&custom_runon_speed);
 
   wifiManager.setShowPassword(true);
 
-  if (!wifiManager.autoConnect("BambuFanAP", "password")) {
-    logPrintln("Failed to connect and timed out.");
-    delay(3000);
-    ESP.restart();
-  }
-
-  if (WiFi.status() == WL_CONNECTED) {
-    logPrint("WiFi connected, IP: ");
-    logPrintln(WiFi.localIP());
-
-    if (currentConfig.mqtt_enabled) {
-      ensureMqtt();
-    }
-
-    ArduinoOTA.setHostname("esp32c3-fan");
-    ArduinoOTA.begin();
-
-    server.on("/",        HTTP_GET, handleRoot);
-    server.on("/fan",     HTTP_GET, handleFanApi);
-    server.on("/status",  HTTP_GET, handleStatusApi);
-    server.on("/reconfig",HTTP_GET, handleReconfig);
-    server.onNotFound(notFound);
-    server.begin();
-    logPrintln("HTTP server started");
-
-    // After portal/connection, force back to STA-only to avoid AP lingering
-    WiFi.softAPdisconnect(true);
-    WiFi.mode(WIFI_STA);
-  }
-
-  if (currentConfig.fan_default_on) {
-    handleFanSpeed(currentConfig.fan_default_speed_pct);
+  // Stamped from the WiFi event task, so the timeline is not off by a watch period.
+  WiFi.onEvent([](arduino_event_id_t) { bootMark(BootPhase::LinkUp); }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  bootMark(BootPhase::WifiStart);
+  if (wifiFastBegin()) {
+    wifiFastPending = true;
+    wifiStartMs = millis();
+    bootSetInfo(nullptr, "cached");
   } else {
-    handleFanSpeed(0);
+    bootSetInfo(nullptr, "scan");
+    wifiPortalConnect();
   }
+  startHttp();
+  scheduleTasks();
+}
 
+// ========= Scheduled tasks =========
+// Asks the driver rather than lastWifiStatus so HTTP is served from the first
+// pass after association, not from the next WiFi watch.
+static bool wifiUp(void*) {
+  return WiFi.status() == WL_CONNECTED;
 }
 
-void loop() {
+static void wifiWatch(void*) {
   wl_status_t currentStatus = WiFi.status();
   if (currentStatus != lastWifiStatus) {
     lastWifiStatus = currentStatus;
-    logPrintf("[%lu ms] WiFi status changed: %d\n", millis(), currentStatus);
-    if (currentStatus != WL_CONNECTED) {
-      mqttWasConnected = false;
+    LOG_INFO("WiFi status changed: %d", (int)currentStatus);
+    if (currentStatus == WL_CONNECTED) {
+      wifiFastPending = false;
+      onLinkUp();
     }
   }
-
-  if (currentStatus == WL_CONNECTED) {
-    if (currentConfig.mqtt_enabled) {
-      if (!mqtt.connected()) ensureMqtt();
-      mqtt.loop();
-    } else {
-      if (mqtt.connected()) {
-        // Respect new toggle: disconnect if previously connected
-        mqtt.disconnect();
-        mqttWasConnected = false;
-      }
-    }
-    server.handleClient();
-
-    if (pendingPercentAfterStart > 0 && millis() >= pendingPercentApplyMs && currentPercent > pendingPercentAfterStart) {
-      int target = pendingPercentAfterStart;
-      pendingPercentAfterStart = 0;
-      pendingPercentApplyMs = 0;
-      handleFanSpeed(target);
-    }
-  } else {
-    WiFi.reconnect();
+  if (currentStatus == WL_CONNECTED) return;
+  if (wifiFastPending) {
+    // Leave the cached association alone until it has had its chance.
+    if (millis() - wifiStartMs < BOOT_FAST_CONNECT_TIMEOUT_MS) return;
+    wifiFastPending = false;
+    LOG_WARN("Cached WiFi association failed, scanning");
+    bootClearWifiCache();
+    bootSetInfo(nullptr, "fallback");
+    wifiPortalConnect();  // blocks like the old boot path; the fan task keeps running
+    return;
   }
-  ArduinoOTA.handle();
-  delay(2);
+  WiFi.reconnect();
+}
 
+void scheduleTasks() {
+  schedulerAddPeriodic("wifi", WIFI_WATCH_MS, wifiWatch);
+  schedulerAddReady("http", wifiUp, [](void*) { httpServerService(); });
+  schedulerAddReady("events", wifiUp, [](void*) { eventStreamService(); });  // after MQTT/HTTP so their changes go out in this same pass
+  schedulerAddPeriodic("ota", OTA_POLL_MS, [](void*) { if (otaStarted) ArduinoOTA.handle(); });
+  heapWatchBegin();
+  logBegin();  // last: formats the log once everything else in the pass has run
+}
+
+void loop() {
+  delay(schedulerRunOnce());
 }
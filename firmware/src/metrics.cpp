@@ -0,0 +1,267 @@
+#include "metrics.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "event_stream.h"
+#include "fan_task.h"
+#include "heap_watch.h"
+#include "http_server.h"
+#include "mqtt_link.h"
+
+namespace {
+
+constexpr size_t kHistCount  = (size_t)MetricHist::Count;
+constexpr size_t kRouteCount = (size_t)HttpRoute::Count;
+constexpr std::memory_order kRelaxed = std::memory_order_relaxed;
+
+MetricsHistogram      histograms[kHistCount];
+MetricsHistogram      http[kRouteCount];
+std::atomic<uint32_t> counters[(size_t)MetricCounter::Count];
+
+struct MetricInfo {
+  const char* name;
+  const char* help;
+};
+
+const MetricInfo kMetricInfo[kHistCount] = {
+  {"bambufilter_loop_seconds", "One scheduler pass, idle sleep excluded."},
+  {"bambufilter_fan_command_seconds", "Fan command posted to PWM written."},
+  {"bambufilter_mqtt_publish_seconds", "One MQTT publish on a live session."},
+};
+
+const MetricInfo kCounterInfo[(size_t)MetricCounter::Count] = {
+  {"bambufilter_mqtt_connect_attempts_total", "MQTT connect attempts started."},
+  {"bambufilter_mqtt_connect_failures_total", "MQTT connect attempts that failed or timed out."},
+  {"bambufilter_mqtt_publishes_total", "MQTT publishes on a live session."},
+  {"bambufilter_mqtt_publish_failures_total", "MQTT publishes the client refused."},
+  {"bambufilter_nvs_writes_total", "NVS writes."},
+};
+
+const char* const kRouteNames[kRouteCount] = {
+  "/", "/fan", "/status", "/tasks", "/nvs", "/boot", "/calibrate", "/printer", "/profile", "/metrics", "/log", "/reconfig",
+  "other"};
+
+// Appends whole lines: a line that does not fit ends the output instead of
+// being cut. Histograms are rolled back to their start if they did not fit
+// whole, so a full buffer still scrapes.
+struct TextOut {
+  char*  out;
+  size_t size;
+  size_t len;
+  bool   full;
+
+  void line(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+  void keepWhole(size_t mark) {
+    if (!full) return;
+    len = mark;
+    out[len] = '\0';
+  }
+};
+
+void TextOut::line(const char* fmt, ...) {
+  if (full) return;
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(out + len, size - len, fmt, args);
+  va_end(args);
+  if (n < 0 || (size_t)n >= size - len) {
+    full = true;
+    out[len] = '\0';
+    return;
+  }
+  len += (size_t)n;
+}
+
+// Seconds with µs resolution, as Prometheus expects.
+struct Seconds {
+  char text[24];
+  explicit Seconds(uint64_t us) {
+    snprintf(text, sizeof(text), "%llu.%06llu", (unsigned long long)(us / 1000000),
+             (unsigned long long)(us % 1000000));
+  }
+};
+
+uint64_t totalUs(const MetricsHistogram& h) {
+  return ((uint64_t)h.sumWraps.load(kRelaxed) << 32) | h.sumUs.load(kRelaxed);
+}
+
+// `labels` is either "" or `route="/fan",` (with the trailing comma).
+void renderBuckets(TextOut& t, const char* name, const char* labels, const MetricsHistogram& h) {
+  uint32_t cumulative = 0;
+  for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+    cumulative += h.buckets[i].load(kRelaxed);
+    if (i + 1 < METRICS_BUCKETS) {
+      t.line("%s_bucket{%sle=\"%s\"} %lu\n", name, labels, Seconds(METRICS_BOUNDS_US[i]).text,
+             (unsigned long)cumulative);
+    } else {
+      t.line("%s_bucket{%sle=\"+Inf\"} %lu\n", name, labels, (unsigned long)cumulative);
+    }
+  }
+  size_t n = strlen(labels);
+  char trimmed[40] = "";  // labels without the trailing comma, for _sum / _count
+  if (n > 1 && n < sizeof(trimmed)) {
+    memcpy(trimmed, labels, n - 1);
+    trimmed[n - 1] = '\0';
+  }
+  const char* open = trimmed[0] ? "{" : "";
+  const char* close = trimmed[0] ? "}" : "";
+  t.line("%s_sum%s%s%s %s\n", name, open, trimmed, close, Seconds(totalUs(h)).text);
+  t.line("%s_count%s%s%s %lu\n", name, open, trimmed, close, (unsigned long)cumulative);
+}
+
+void renderGauge(TextOut& t, const char* name, const char* help, unsigned long value) {
+  t.line("# HELP %s %s\n# TYPE %s gauge\n%s %lu\n", name, help, name, name, value);
+}
+
+void renderCounter(TextOut& t, const char* name, const char* help, unsigned long value) {
+  t.line("# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name, name, value);
+}
+
+uint32_t averageUs(const MetricsHistogram& h) {
+  uint32_t n = h.count();
+  return n ? (uint32_t)(totalUs(h) / n) : 0;
+}
+
+}  // namespace
+
+void MetricsHistogram::observe(uint32_t us) {
+  size_t i = 0;
+  while (i < METRICS_BUCKETS - 1 && us > METRICS_BOUNDS_US[i]) i++;
+  buckets[i].fetch_add(1, kRelaxed);
+  uint32_t before = sumUs.fetch_add(us, kRelaxed);
+  if (before + us < before) sumWraps.fetch_add(1, kRelaxed);  // only the add that crossed sees it
+  uint32_t seen = maxUs.load(kRelaxed);
+  while (us > seen && !maxUs.compare_exchange_weak(seen, us, kRelaxed)) {
+  }
+}
+
+uint32_t MetricsHistogram::count() const {
+  uint32_t n = 0;
+  for (const std::atomic<uint32_t>& b : buckets) n += b.load(kRelaxed);
+  return n;
+}
+
+void metricsObserve(MetricHist hist, uint32_t us) {
+  histograms[(size_t)hist].observe(us);
+}
+
+void metricsCount(MetricCounter counter) {
+  counters[(size_t)counter].fetch_add(1, kRelaxed);
+}
+
+void metricsObserveHttp(HttpRoute route, uint32_t us) {
+  http[(size_t)route].observe(us);
+}
+
+uint32_t metricsCountOf(MetricCounter counter) {
+  return counters[(size_t)counter].load(kRelaxed);
+}
+
+const MetricsHistogram& metricsHistogram(MetricHist hist) {
+  return histograms[(size_t)hist];
+}
+
+const MetricsHistogram& metricsHttpHistogram(HttpRoute route) {
+  return http[(size_t)route];
+}
+
+size_t metricsRender(char* out, size_t size) {
+  if (size == 0) return 0;
+  TextOut t = {out, size, 0, false};
+  out[0] = '\0';
+
+  // Counters and gauges first: if anything is dropped it is the routes.
+  for (size_t c = 0; c < (size_t)MetricCounter::Count; c++) {
+    renderCounter(t, kCounterInfo[c].name, kCounterInfo[c].help, counters[c].load(kRelaxed));
+  }
+  renderCounter(t, "bambufilter_fan_commands_total", "Fan commands applied.", fanCommandsApplied());
+  renderCounter(t, "bambufilter_fan_command_drops_total", "Fan commands rejected by a full queue.",
+                fanCommandDrops());
+  renderCounter(t, "bambufilter_fan_commands_merged_total", "Fan setpoints replaced by a newer one before they ran.",
+                fanCommandsMerged());
+  const MqttStateStats& state = mqttStateStats();
+  renderCounter(t, "bambufilter_mqtt_state_changes_total", "Fan state changes handed to the MQTT publisher.",
+                state.changes);
+  renderCounter(t, "bambufilter_mqtt_state_coalesced_total", "State changes folded into a later publish.",
+                state.coalesced);
+  renderCounter(t, "bambufilter_mqtt_state_suppressed_total", "State publishes skipped as unchanged.",
+                state.suppressed);
+  const HttpServerStats& web = httpServerStats();
+  renderCounter(t, "bambufilter_http_connections_total", "HTTP connections accepted.", web.accepted);
+  renderCounter(t, "bambufilter_http_connections_evicted_total", "Idle HTTP connections closed for a waiting client.",
+                web.evicted);
+  renderGauge(t, "bambufilter_http_connections_open", "HTTP connections open.", web.open);
+  const EventStreamStats& events = eventStreamStats();
+  renderCounter(t, "bambufilter_events_dropped_total", "Event stream subscribers closed for not reading.",
+                events.evicted + events.timedOut);
+  renderGauge(t, "bambufilter_events_subscribers", "Event stream subscribers connected.", events.open);
+
+  HeapStats heap = {};
+  hal.sys->heap(heap);
+  renderGauge(t, "bambufilter_heap_free_bytes", "Free heap.", heap.freeBytes);
+  renderGauge(t, "bambufilter_heap_min_free_bytes", "Lowest free heap since boot.", heap.minFreeBytes);
+  renderGauge(t, "bambufilter_heap_largest_block_bytes", "Largest free heap block.", heap.largestBlock);
+  renderCounter(t, "bambufilter_heap_low_total", "Heap watchdog warnings: free heap dropped or largest block small.",
+                heapWatchStats().warnings);
+  renderGauge(t, "bambufilter_uptime_seconds", "Time since boot.", halMillis() / 1000);
+
+  for (size_t i = 0; i < kHistCount; i++) {
+    const MetricInfo& info = kMetricInfo[i];
+    size_t mark = t.len;
+    t.line("# HELP %s %s\n# TYPE %s histogram\n", info.name, info.help, info.name);
+    renderBuckets(t, info.name, "", histograms[i]);
+    t.keepWhole(mark);
+  }
+
+  // Routes nobody asked for are left out to keep the page short.
+  static const char kHttp[] = "bambufilter_http_request_seconds";
+  t.line("# HELP %s HTTP request handling time by route.\n# TYPE %s histogram\n", kHttp, kHttp);
+  for (size_t r = 0; r < kRouteCount; r++) {
+    if (http[r].count() == 0) continue;
+    char labels[32];
+    snprintf(labels, sizeof(labels), "route=\"%s\",", kRouteNames[r]);
+    size_t mark = t.len;
+    renderBuckets(t, kHttp, labels, http[r]);
+    t.keepWhole(mark);
+  }
+  return t.len;
+}
+
+size_t metricsRenderSummary(char* out, size_t size) {
+  if (size == 0) return 0;
+  HeapStats heap = {};
+  hal.sys->heap(heap);
+  const MetricsHistogram& loop = histograms[(size_t)MetricHist::Loop];
+  const MetricsHistogram& command = histograms[(size_t)MetricHist::FanCommand];
+  const MetricsHistogram& publish = histograms[(size_t)MetricHist::MqttPublish];
+  uint32_t requests = 0;
+  for (const MetricsHistogram& h : http) requests += h.count();
+  int n = snprintf(out, size,
+                   "{\"uptime_s\":%lu,\"heap_free\":%lu,\"heap_min\":%lu,\"heap_block\":%lu,"
+                   "\"loop_avg_us\":%lu,\"loop_max_us\":%lu,\"cmd_avg_us\":%lu,\"cmd_max_us\":%lu,"
+                   "\"pub_max_us\":%lu,\"mqtt_attempts\":%lu,\"mqtt_failures\":%lu,\"http\":%lu,\"nvs_writes\":%lu}",
+                   (unsigned long)(halMillis() / 1000), (unsigned long)heap.freeBytes,
+                   (unsigned long)heap.minFreeBytes, (unsigned long)heap.largestBlock,
+                   (unsigned long)averageUs(loop), (unsigned long)loop.maxUs.load(kRelaxed),
+                   (unsigned long)averageUs(command), (unsigned long)command.maxUs.load(kRelaxed),
+                   (unsigned long)publish.maxUs.load(kRelaxed),
+                   (unsigned long)metricsCountOf(MetricCounter::MqttConnectAttempts),
+                   (unsigned long)metricsCountOf(MetricCounter::MqttConnectFailures), (unsigned long)requests,
+                   (unsigned long)metricsCountOf(MetricCounter::NvsWrites));
+  if (n < 0) return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+void metricsReset() {
+  auto clear = [](MetricsHistogram& h) {
+    for (std::atomic<uint32_t>& b : h.buckets) b.store(0, kRelaxed);
+    h.sumUs.store(0, kRelaxed);
+    h.sumWraps.store(0, kRelaxed);
+    h.maxUs.store(0, kRelaxed);
+  };
+  for (MetricsHistogram& h : histograms) clear(h);
+  for (MetricsHistogram& h : http) clear(h);
+  for (std::atomic<uint32_t>& c : counters) c.store(0, kRelaxed);
+}
@@ -0,0 +1,465 @@
+#include "mqtt_link.h"
+
+#include <Arduino.h>
+#include <cstdio>
+#include <cstring>
+
+#include "boot.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_profile.h"
+#include "fan_task.h"
+#include "hal.h"
+#include "logging.h"
+#include "metrics.h"
+#include "mqtt_packet.h"
+#include "printer_report.h"
+#include "scheduler.h"
+#include "speed_command.h"
+
+bool mqttStateDirty = false;
+int pendingDutyActiveHigh = 0;
+char mqttClientId[32] = "";
+
+static MqttPhase phase = MqttPhase::Idle;
+static uint32_t phaseStartMs = 0;
+static uint8_t  failures = 0;        // consecutive failed attempts, drives the backoff
+static uint32_t jitterState = 1;
+static uint32_t brokerIp = 0;
+
+// Resolved broker address, reused until it expires or a TCP connect fails.
+static char     dnsCacheHost[sizeof(Config::mqtt_host)] = "";
+static uint32_t dnsCacheIp = 0;
+static uint32_t dnsCacheAtMs = 0;
+
+static TaskId retryTask = -1;
+static TaskId stateTask = -1;  // end of the coalescing window, or the retry of a failed state publish
+
+// Last state payload the broker accepted, for change-only publishing.
+static char     lastState[MQTT_STATE_PAYLOAD_BYTES] = "";
+static bool     delivered = false;
+static uint32_t lastStateMs = 0;
+static MqttStateStats stateStats = {};
+static uint32_t inbound = 0;  // messages through mqttCallback()
+
+static int dutyShare(int dutyActiveHigh) {
+  return (int)(((int32_t)constrain(dutyActiveHigh, 0, DUTY_MAX) * SPEED_FULL + DUTY_MAX / 2) / DUTY_MAX);
+}
+
+static size_t clampLength(int n, size_t size) {
+  if (n < 0) return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+// 0 for the command topic itself, n for "<command topic>/<n>", -1 otherwise.
+static int commandChannel(const char* topic) {
+  size_t n = strlen(currentConfig.mqtt_command_topic);
+  if (strncmp(topic, currentConfig.mqtt_command_topic, n) != 0) return -1;
+  if (topic[n] == '\0') return 0;
+  if (topic[n] != '/' || topic[n + 1] < '0' || topic[n + 1] > '9' || topic[n + 2] != '\0') return -1;
+  int ch = topic[n + 1] - '0';
+  return ch < (int)FAN_CHANNEL_COUNT ? ch : -1;
+}
+
+static bool isProfileTopic(const char* topic) {
+  size_t n = strlen(currentConfig.mqtt_command_topic);
+  return strncmp(topic, currentConfig.mqtt_command_topic, n) == 0 && strcmp(topic + n, "/profile") == 0;
+}
+
+// "stop", or a profile in the text form of fan_profile.h.
+static void handleProfileCommand(const uint8_t* payload, unsigned int length) {
+  if (length == 4 && memcmp(payload, "stop", 4) == 0) {
+    fanProfileStop();
+    return;
+  }
+  FanProfile profile;
+  if (fanProfileParse(reinterpret_cast<const char*>(payload), length, profile)) {
+    if (!fanProfileStart(profile)) LOG_WARN("MQTT profile dropped: fan command queue full");
+  } else {
+    LOG_WARN("MQTT profile rejected (%u bytes)", length);
+  }
+}
+
+// Every publish on a live session goes through here, for /metrics.
+static bool timedPublish(const char* topic, const char* payload, bool retained) {
+  uint32_t start = hal.clock->micros();
+  bool ok = hal.mqtt->publish(topic, payload, retained);
+  metricsObserve(MetricHist::MqttPublish, hal.clock->micros() - start);
+  metricsCount(MetricCounter::MqttPublishes);
+  if (!ok) metricsCount(MetricCounter::MqttPublishFailures);
+  return ok;
+}
+
+// ========= MQTT‑aware publishers =========
+// Never touch the network beyond a write on a live session: while the link is
+// down the state is parked in pendingDutyActiveHigh and sent on reconnect.
+// mqttStateDirty stays set until a publish of the latest state went through
+// (or was found unchanged), so neither the window nor a failed write loses it.
+static size_t renderState(int dutyActiveHigh, char* payload, size_t size) {
+  // percent is the duty share; both it and the setpoint go out as fixed point.
+  const FanStatus& fan = fanStatus();
+  const FanChannelStatus& c0 = fan.fans[0];
+  int share = dutyShare(dutyActiveHigh);
+  size_t len = clampLength(snprintf(payload, size,
+           "{\"duty\":%d,\"output_duty\":%d,\"percent\":%d.%02d,\"setpoint\":%d.%02d,\"rpm\":%d,\"target_rpm\":%d",
+           dutyActiveHigh, c0.outputDuty, share / SPEED_SCALE, share % SPEED_SCALE,
+           c0.setpoint / SPEED_SCALE, c0.setpoint % SPEED_SCALE, fan.rpm, fan.targetRpm), size);
+  if (FAN_CHANNEL_COUNT > 1) {
+    len += clampLength(snprintf(payload + len, size - len, ",\"fans\":["), size - len);
+    for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) {
+      const FanChannelStatus& c = fan.fans[i];
+      int duty = i == 0 ? dutyActiveHigh : c.publishDuty;
+      int pct = dutyShare(duty);
+      len += clampLength(snprintf(payload + len, size - len,
+                                  "%s{\"duty\":%d,\"output_duty\":%d,\"percent\":%d.%02d,\"setpoint\":%d.%02d}",
+                                  i ? "," : "", duty, c.outputDuty, pct / SPEED_SCALE, pct % SPEED_SCALE,
+                                  c.setpoint / SPEED_SCALE, c.setpoint % SPEED_SCALE),
+                         size - len);
+    }
+    len += clampLength(snprintf(payload + len, size - len, "]"), size - len);
+  }
+  if (fan.profileStep) {
+    len += clampLength(snprintf(payload + len, size - len, ",\"profile\":{\"step\":%u,\"steps\":%u,\"left_s\":%lu}",
+                                (unsigned)fan.profileStep, (unsigned)fan.profileSteps,
+                                (unsigned long)fan.profileLeftS), size - len);
+  }
+  return len + clampLength(snprintf(payload + len, size - len, "}"), size - len);
+}
+
+// Publishes the pending state; `force` sends it even if the broker already
+// holds the same payload (a new session).
+static void sendState(bool force) {
+  char payload[MQTT_STATE_PAYLOAD_BYTES];
+  renderState(pendingDutyActiveHigh, payload, sizeof(payload));
+  if (!force && delivered && strcmp(payload, lastState) == 0) {
+    mqttStateDirty = false;
+    stateStats.suppressed++;
+    return;
+  }
+  lastStateMs = halMillis();
+  stateStats.published++;
+  if (!timedPublish(currentConfig.mqtt_state_topic, payload, true)) {
+    schedulerArm(stateTask, MQTT_REPUBLISH_MS);
+    return;
+  }
+  memcpy(lastState, payload, sizeof(lastState));
+  delivered = true;
+  mqttStateDirty = false;
+}
+
+void publishStateFromDuty(int dutyActiveHigh) {
+  if (!currentConfig.mqtt_enabled) return; // MQTT disabled => no publish
+  pendingDutyActiveHigh = dutyActiveHigh;
+  mqttStateDirty = true;
+  stateStats.changes++;
+  if (!hal.mqtt->connected()) return;
+
+  // Inside the window (or behind a failed write) the timer publishes
+  // whatever is pending when it fires.
+  uint32_t window = (uint32_t)currentConfig.mqtt_state_window_ms;
+  uint32_t since = halMillis() - lastStateMs;
+  if (schedulerArmed(stateTask)) {
+    stateStats.coalesced++;
+    return;
+  }
+  if (delivered && since < window) {
+    schedulerArm(stateTask, window - since);
+    stateStats.coalesced++;
+    return;
+  }
+  sendState(false);
+}
+
+const MqttStateStats& mqttStateStats() {
+  return stateStats;
+}
+
+void publishMqttStatus(const char* status) {
+  if (!currentConfig.mqtt_enabled) return;
+  if (!hal.mqtt->connected() || status == nullptr) return;
+  timedPublish(currentConfig.mqtt_status_topic, status, true);
+  hal.mqtt->loop();
+}
+
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
+  inbound++;
+  // Every payload has already streamed through printerReportSink(); a report
+  // is dealt with there, as it would not fit `payload` anyway.
+  bool report = printerReportEnabled() && strcmp(topic, currentConfig.report_topic) == 0;
+  printerReportEnd(report);
+  if (report || !currentConfig.mqtt_enabled) return;
+  if (isProfileTopic(topic)) {
+    handleProfileCommand(payload, length);
+    return;
+  }
+  int ch = commandChannel(topic);
+  if (ch < 0) return;
+  int value;
+  int16_t batch[FAN_CHANNEL_COUNT];
+  if (parseRpmCommand(payload, length, value)) {
+    fanCommandPost(FanCommandKind::Rpm, value, (uint8_t)ch);
+  } else if (ch == 0 && parseSpeedBatch(payload, length, batch, FAN_CHANNEL_COUNT)) {
+    fanCommandPostBatch(FanCommandKind::Speed, batch);
+  } else if (parseSpeedCommand(payload, length, value)) {
+    fanCommandPost(FanCommandKind::Speed, value, (uint8_t)ch);
+  }
+}
+
+// ========= Connect state machine =========
+// Idle -> Resolving -> Connecting -> Handshaking -> Connected. Each pass of the
+// "mqtt" task advances at most one step and never waits; a failed or timed-out
+// step closes the attempt and parks in Backoff until the retry timer fires.
+uint32_t mqttBackoffMs(uint8_t failureCount, uint32_t random) {
+  uint32_t ceiling = MQTT_BACKOFF_MAX_MS;
+  if (failureCount < 16 && (MQTT_BACKOFF_MIN_MS << failureCount) < MQTT_BACKOFF_MAX_MS) {
+    ceiling = MQTT_BACKOFF_MIN_MS << failureCount;
+  }
+  // Equal jitter: never shorter than half the step, so a flapping broker is not
+  // hammered, while units that lost it together spread their retries out.
+  return ceiling / 2 + random % (ceiling / 2 + 1);
+}
+
+static uint32_t nextJitter() {
+  jitterState ^= jitterState << 13;
+  jitterState ^= jitterState >> 17;
+  jitterState ^= jitterState << 5;
+  return jitterState;
+}
+
+static bool dnsCacheLookup(const char* host, uint32_t now, uint32_t& ip) {
+  if (dnsCacheIp == 0 || strcmp(dnsCacheHost, host) != 0) return false;
+  if (now - dnsCacheAtMs >= MQTT_DNS_TTL_MS) return false;
+  ip = dnsCacheIp;
+  return true;
+}
+
+static void dnsCacheStore(const char* host, uint32_t ip, uint32_t now) {
+  strncpy(dnsCacheHost, host, sizeof(dnsCacheHost) - 1);
+  dnsCacheHost[sizeof(dnsCacheHost) - 1] = '\0';
+  dnsCacheIp = ip;
+  dnsCacheAtMs = now;
+}
+
+static void enterPhase(MqttPhase next) {
+  phase = next;
+  phaseStartMs = halMillis();
+}
+
+static void scheduleRetry() {
+  uint32_t delayMs = mqttBackoffMs(failures, nextJitter());
+  if (failures < 255) failures++;
+  enterPhase(MqttPhase::Backoff);
+  schedulerArm(retryTask, delayMs);
+  LOG_INFO("MQTT retry in %lu ms (attempt %u)", (unsigned long)delayMs, (unsigned)failures);
+}
+
+static void failAttempt(const char* step) {
+  metricsCount(MetricCounter::MqttConnectFailures);
+  LOG_WARN("MQTT %s failed, rc=%d", step, hal.mqtt->state());
+  hal.mqtt->abortConnect();
+  if (phase == MqttPhase::Connecting) dnsCacheIp = 0;  // the broker may have moved
+  scheduleRetry();
+}
+
+static void beginAttempt() {
+  unsigned long now = halMillis();
+  if (mqttClientId[0] == '\0') {
+    uint64_t mac = hal.net->efuseMac();
+    snprintf(mqttClientId, sizeof(mqttClientId), "xiao-%02X%02X%02X%02X%02X%02X",
+             (uint8_t)(mac >> 40), (uint8_t)(mac >> 32), (uint8_t)(mac >> 24),
+             (uint8_t)(mac >> 16), (uint8_t)(mac >> 8), (uint8_t)mac);
+  }
+  hal.mqtt->setCallback(mqttCallback);
+  hal.mqtt->setPayloadSink(&printerReportSink());
+  metricsCount(MetricCounter::MqttConnectAttempts);
+
+  LOG_INFO("Attempting MQTT connect. Host: %s, Port: %d, User: '%s' (len: %d), Pass len: %d",
+           currentConfig.mqtt_host, currentConfig.mqtt_port, currentConfig.mqtt_user,
+           (int)strlen(currentConfig.mqtt_user), (int)strlen(currentConfig.mqtt_pass));
+
+  // A dotted quad skips DNS; anything else goes through the cache / resolver.
+  if (parseIpv4(currentConfig.mqtt_host, brokerIp) || dnsCacheLookup(currentConfig.mqtt_host, now, brokerIp)) {
+    enterPhase(MqttPhase::Connecting);
+  } else {
+    enterPhase(MqttPhase::Resolving);
+  }
+}
+
+// Published once per boot, retained, so the last boot can be inspected later.
+static void publishBootTimeline() {
+  static bool published = false;
+  if (published) return;
+  char topic[sizeof(currentConfig.mqtt_status_topic) + 8];
+  char payload[256];
+  snprintf(topic, sizeof(topic), "%s/boot", currentConfig.mqtt_status_topic);
+  bootRenderTimeline(payload, sizeof(payload));
+  published = timedPublish(topic, payload, true);
+}
+
+static void onConnected() {
+  enterPhase(MqttPhase::Connected);
+  failures = 0;
+  bootMark(BootPhase::MqttUp);
+  publishMqttStatus("online");
+  hal.mqtt->subscribe(currentConfig.mqtt_command_topic, 1);
+  if (FAN_CHANNEL_COUNT > 1) {
+    char channels[sizeof(currentConfig.mqtt_command_topic) + 2];
+    snprintf(channels, sizeof(channels), "%s/+", currentConfig.mqtt_command_topic);
+    hal.mqtt->subscribe(channels, 1);  // covers <command topic>/profile too
+  } else {
+    char profile[sizeof(currentConfig.mqtt_command_topic) + 8];
+    snprintf(profile, sizeof(profile), "%s/profile", currentConfig.mqtt_command_topic);
+    hal.mqtt->subscribe(profile, 1);
+  }
+  if (printerReportEnabled()) hal.mqtt->subscribe(currentConfig.report_topic, 0);  // QoS 0: no packet id in the stream
+  if (!mqttStateDirty) pendingDutyActiveHigh = fanStatus().fans[0].publishDuty;
+  schedulerCancel(stateTask);
+  sendState(true);
+  publishBootTimeline();
+  LOG_INFO("MQTT connected & subscribed.");
+}
+
+static void stepConnect() {
+  MqttClient& mqtt = *hal.mqtt;
+  NetStep step = NetStep::Pending;
+  switch (phase) {
+    case MqttPhase::Resolving:
+      step = mqtt.resolve(currentConfig.mqtt_host, brokerIp);
+      if (step == NetStep::Done) {
+        dnsCacheStore(currentConfig.mqtt_host, brokerIp, halMillis());
+        enterPhase(MqttPhase::Connecting);
+        return;
+      }
+      break;
+    case MqttPhase::Connecting:
+      step = mqtt.connectTcp(brokerIp, currentConfig.mqtt_port);
+      if (step == NetStep::Done) {
+        enterPhase(MqttPhase::Handshaking);
+        return;
+      }
+      break;
+    case MqttPhase::Handshaking: {
+      MqttConnectRequest request = {
+        mqttClientId, currentConfig.mqtt_user, currentConfig.mqtt_pass,
+        currentConfig.mqtt_status_topic, 1, true, "offline", MQTT_KEEPALIVE_S};
+      step = mqtt.handshake(request);
+      if (step == NetStep::Done) {
+        onConnected();
+        return;
+      }
+      break;
+    }
+    default:
+      return;
+  }
+
+  static const char* const kStepNames[] = {"", "", "resolve", "connect", "handshake"};
+  if (step == NetStep::Failed || halMillis() - phaseStartMs >= MQTT_STEP_TIMEOUT_MS) {
+    failAttempt(kStepNames[(int)phase]);
+  }
+}
+
+// Drops whatever is in flight and goes back to Idle (link down, MQTT disabled).
+static void stopLink() {
+  if (phase == MqttPhase::Connected && hal.mqtt->connected()) {
+    hal.mqtt->disconnect();
+  } else if (phase != MqttPhase::Idle) {
+    hal.mqtt->abortConnect();
+  }
+  schedulerCancel(retryTask);
+  failures = 0;
+  enterPhase(MqttPhase::Idle);
+}
+
+// ========= Scheduled tasks =========
+// The client hands over one message per loop(); a pass takes up to
+// MQTT_MSGS_PER_PASS of them, holding the fan task's wake-up so that a
+// burst of setpoints reaches its mailbox together and merges (fan_task.h).
+static void serviceInbound() {
+  fanCommandsHold();
+  for (size_t i = 0; i < MQTT_MSGS_PER_PASS; i++) {
+    uint32_t before = inbound;
+    hal.mqtt->loop();
+    if (inbound == before) break;
+  }
+  fanCommandsRelease();
+}
+
+static bool mqttLinkReady(void*) {
+  return currentConfig.mqtt_enabled || phase != MqttPhase::Idle;
+}
+
+static void mqttService(void*) {
+  if (!currentConfig.mqtt_enabled || !hal.net->linkUp()) {
+    if (phase != MqttPhase::Idle) {
+      LOG_INFO("MQTT stopped (%s)", currentConfig.mqtt_enabled ? "WiFi down" : "disabled");
+      stopLink();
+    }
+    return;
+  }
+
+  switch (phase) {
+    case MqttPhase::Idle:
+      beginAttempt();
+      break;
+    case MqttPhase::Backoff:
+      break;  // retryTask moves us on
+    case MqttPhase::Connected:
+      if (hal.mqtt->connected()) {
+        serviceInbound();
+      } else {
+        LOG_WARN("MQTT disconnected, rc=%d", hal.mqtt->state());
+        scheduleRetry();
+      }
+      break;
+    default:
+      stepConnect();
+      break;
+  }
+}
+
+static void mqttRetry(void*) {
+  if (phase == MqttPhase::Backoff) enterPhase(MqttPhase::Idle);
+}
+
+// The coalescing window ended, or a publish failed on a live connection; a
+// reconnect republishes by itself.
+static void mqttStateFlush(void*) {
+  if (mqttStateDirty && currentConfig.mqtt_enabled && hal.mqtt->connected()) sendState(false);
+}
+
+// METRICS_PUBLISH_S builds only; skipped while the link is down, not queued.
+static void mqttPublishMetrics(void*) {
+  if (!currentConfig.mqtt_enabled || phase != MqttPhase::Connected || !hal.mqtt->connected()) return;
+  char topic[sizeof(currentConfig.mqtt_status_topic) + 8];
+  char payload[METRICS_SUMMARY_BYTES];
+  snprintf(topic, sizeof(topic), "%s/metrics", currentConfig.mqtt_status_topic);
+  metricsRenderSummary(payload, sizeof(payload));
+  timedPublish(topic, payload, false);
+}
+
+void mqttLinkBegin() {
+  phase = MqttPhase::Idle;
+  failures = 0;
+  dnsCacheIp = 0;
+  delivered = false;
+  lastState[0] = '\0';
+  stateStats = {};
+  uint64_t mac = hal.net->efuseMac();
+  jitterState = (uint32_t)(mac ^ (mac >> 32)) ^ halMillis();
+  if (jitterState == 0) jitterState = 1;
+
+  schedulerAddReady("mqtt", mqttLinkReady, mqttService);
+  retryTask = schedulerAddOneShot("mqtt-retry", mqttRetry);
+  stateTask = schedulerAddOneShot("mqtt-state", mqttStateFlush);
+  if (METRICS_PUBLISH_S > 0) schedulerAddPeriodic("mqtt-metrics", METRICS_PUBLISH_S * 1000u, mqttPublishMetrics);
+}
+
+void mqttLinkStop() {
+  publishMqttStatus("offline");
+  stopLink();
+}
+
+MqttPhase mqttLinkPhase() {
+  return phase;
+}
@@ -0,0 +1,75 @@
+#include "mqtt_packet.h"
+
+#include <cstring>
+
+namespace {
+
+struct Writer {
+  uint8_t* out;
+  size_t   cap;
+  size_t   len;
+  bool     ok;
+
+  void byte(uint8_t b) {
+    if (len < cap) out[len] = b;
+    else ok = false;
+    len++;
+  }
+  void utf8(const char* s) {
+    size_t n = strlen(s);
+    if (n > 0xFFFF) { ok = false; return; }
+    byte((uint8_t)(n >> 8));
+    byte((uint8_t)n);
+    for (size_t i = 0; i < n; i++) byte((uint8_t)s[i]);
+  }
+};
+
+size_t utf8Size(const char* s) { return 2 + strlen(s); }
+
+}  // namespace
+
+size_t mqttEncodeConnect(const MqttConnectRequest& request, uint8_t* out, size_t cap) {
+  uint8_t flags = 0x02;  // clean session
+  size_t remaining = 10 + utf8Size(request.clientId);  // "MQTT", level, flags, keep-alive
+  if (request.willTopic) {
+    flags |= 0x04 | (uint8_t)((request.willQos & 0x03) << 3) | (request.willRetain ? 0x20 : 0);
+    remaining += utf8Size(request.willTopic) + utf8Size(request.willMessage ? request.willMessage : "");
+  }
+  if (request.user) {
+    flags |= 0x80;
+    remaining += utf8Size(request.user);
+    if (request.pass) {
+      flags |= 0x40;
+      remaining += utf8Size(request.pass);
+    }
+  }
+
+  Writer w{out, cap, 0, true};
+  w.byte(0x10);
+  size_t rem = remaining;
+  do {
+    uint8_t digit = rem % 128;
+    rem /= 128;
+    w.byte(rem ? (digit | 0x80) : digit);
+  } while (rem);
+  w.utf8("MQTT");
+  w.byte(4);  // protocol level 3.1.1
+  w.byte(flags);
+  w.byte((uint8_t)(request.keepAliveS >> 8));
+  w.byte((uint8_t)request.keepAliveS);
+  w.utf8(request.clientId);
+  if (request.willTopic) {
+    w.utf8(request.willTopic);
+    w.utf8(request.willMessage ? request.willMessage : "");
+  }
+  if (request.user) {
+    w.utf8(request.user);
+    if (request.pass) w.utf8(request.pass);
+  }
+  return w.ok ? w.len : 0;
+}
+
+int mqttConnackCode(const uint8_t* packet, size_t length) {
+  if (length != 4 || packet[0] != 0x20 || packet[1] != 0x02) return -1;
+  return packet[3];
+}
@@ -0,0 +1,141 @@
+#include "mqtt_socket_esp32.h"
+
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <cstring>
+
+static bool wouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+NetStep MqttSocket::connectStep(uint32_t ip, uint16_t port) {
+  if (fd_ < 0) {
+    fd_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd_ < 0) return NetStep::Failed;
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL, 0) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = ip;
+    if (::connect(fd_, (sockaddr*)&addr, sizeof(addr)) == 0) return NetStep::Done;
+    if (errno != EINPROGRESS) {
+      stop();
+      return NetStep::Failed;
+    }
+    return NetStep::Pending;
+  }
+
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(fd_, &writable);
+  timeval poll = {0, 0};
+  int ready = select(fd_ + 1, nullptr, &writable, nullptr, &poll);
+  if (ready == 0) return NetStep::Pending;
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (ready < 0 || getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+    stop();
+    return NetStep::Failed;
+  }
+  return NetStep::Done;
+}
+
+bool MqttSocket::sendRaw(const uint8_t* data, size_t len) {
+  return fd_ >= 0 && send(fd_, data, len, MSG_DONTWAIT) == (ssize_t)len;
+}
+
+int MqttSocket::readRaw(uint8_t* data, size_t len) {
+  if (fd_ < 0) return -1;
+  ssize_t n = recv(fd_, data, len, MSG_DONTWAIT);
+  if (n > 0) return (int)n;
+  if (n < 0 && wouldBlock()) return 0;
+  return -1;
+}
+
+void MqttSocket::replayConnack(const uint8_t* connack, size_t len) {
+  if (len > sizeof(replay_)) len = sizeof(replay_);
+  memcpy(replay_, connack, len);
+  replayLen_ = (uint8_t)len;
+  replayPos_ = 0;
+  swallowWrite_ = true;
+}
+
+// PubSubClient only dials itself when the socket is down; connecting goes
+// through connectStep() instead.
+int MqttSocket::connect(IPAddress, uint16_t) { return 0; }
+int MqttSocket::connect(const char*, uint16_t) { return 0; }
+int MqttSocket::connect(IPAddress, uint16_t, int32_t) { return 0; }
+int MqttSocket::connect(const char*, uint16_t, int32_t) { return 0; }
+
+size_t MqttSocket::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+// A short write would leave half a packet on the wire, so it closes the
+// socket instead; the state machine reconnects and republishes.
+size_t MqttSocket::write(const uint8_t* buf, size_t size) {
+  if (swallowWrite_) {
+    swallowWrite_ = false;
+    return size;
+  }
+  if (fd_ < 0) return 0;
+  ssize_t n = send(fd_, buf, size, MSG_DONTWAIT);
+  if (n != (ssize_t)size) {
+    stop();
+    return 0;
+  }
+  return size;
+}
+
+int MqttSocket::available() {
+  if (replayPos_ < replayLen_) return replayLen_ - replayPos_;
+  if (fd_ < 0) return 0;
+  int count = 0;
+  if (ioctl(fd_, FIONREAD, &count) < 0) return 0;
+  return count;
+}
+
+int MqttSocket::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int MqttSocket::read(uint8_t* buf, size_t size) {
+  if (replayPos_ < replayLen_) {
+    size_t n = replayLen_ - replayPos_;
+    if (n > size) n = size;
+    memcpy(buf, replay_ + replayPos_, n);
+    replayPos_ += (uint8_t)n;
+    return (int)n;
+  }
+  int n = readRaw(buf, size);
+  return n > 0 ? n : -1;
+}
+
+int MqttSocket::peek() {
+  if (replayPos_ < replayLen_) return replay_[replayPos_];
+  uint8_t b;
+  if (fd_ < 0 || recv(fd_, &b, 1, MSG_PEEK | MSG_DONTWAIT) != 1) return -1;
+  return b;
+}
+
+void MqttSocket::stop() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+  swallowWrite_ = false;
+  replayLen_ = replayPos_ = 0;
+}
+
+uint8_t MqttSocket::connected() {
+  if (fd_ < 0) return 0;
+  if (replayPos_ < replayLen_) return 1;
+  uint8_t b;
+  ssize_t n = recv(fd_, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n > 0 || (n < 0 && wouldBlock())) return 1;
+  stop();  // orderly close (0) or socket error
+  return 0;
+}
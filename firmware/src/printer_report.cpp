@@ -0,0 +1,350 @@
+#include "printer_report.h"
+
+#include <Arduino.h>
+#include <cstdio>
+#include <cstring>
+
+#include "config.h"
+#include "fan_control.h"
+#include "fan_task.h"
+#include "json_stream.h"
+#include "logging.h"
+#include "scheduler.h"
+#include "speed_command.h"
+
+namespace {
+
+constexpr size_t kFieldCount = (size_t)ReportField::Count;
+
+// Keys inside the report's "print" object.
+const char* const kFieldNames[kFieldCount] = {
+  "gcode_state", "chamber_temper", "nozzle_temper", "bed_temper", "mc_percent", "mc_remaining_time"};
+
+enum class RuleOp : uint8_t { Eq, Ne, Gt, Ge, Lt, Le };
+
+struct Rule {
+  ReportField field;
+  RuleOp      op;
+  int32_t     number;                 // number fields, 0.01 units
+  char        text[REPORT_TEXT_MAX];  // text fields: alternatives split by '|'
+  int         speed;                  // 0.01 %
+};
+
+struct PrinterFields {
+  bool    seen[kFieldCount];
+  int32_t number[kFieldCount];
+  char    text[REPORT_TEXT_MAX];  // gcode_state
+};
+
+// Decimal text into 0.01 units; digits past the second decimal are dropped.
+bool parseCentis(const char* s, int32_t& out) {
+  bool negative = *s == '-';
+  if (*s == '-' || *s == '+') s++;
+  int32_t whole = 0;
+  int digits = 0;
+  for (; *s >= '0' && *s <= '9'; s++, digits++) {
+    if (whole < 10000000) whole = whole * 10 + (*s - '0');
+  }
+  int32_t frac = 0;
+  if (*s == '.') {
+    s++;
+    for (int i = 0; i < 2; i++) {
+      frac *= 10;
+      if (*s >= '0' && *s <= '9') {
+        frac += *s++ - '0';
+        digits++;
+      }
+    }
+  }
+  if (digits == 0) return false;
+  out = (whole * 100 + frac) * (negative ? -1 : 1);
+  return true;
+}
+
+int fieldIndex(const char* name, size_t len) {
+  for (size_t i = 0; i < kFieldCount; i++) {
+    if (strlen(kFieldNames[i]) == len && strncmp(kFieldNames[i], name, len) == 0) return (int)i;
+  }
+  return -1;
+}
+
+// Picks the fields out of {"print":{...}} as the tokenizer reports them.
+class ReportHandler : public JsonHandler {
+public:
+  void key(uint8_t depth, const char* name) override {
+    if (depth == 1) {
+      inPrint = strcmp(name, "print") == 0;
+      field = -1;
+    } else if (depth == 2 && inPrint) {
+      field = fieldIndex(name, strlen(name));
+    }
+  }
+
+  void value(uint8_t depth, JsonType type, const char* text) override {
+    if (depth != 2 || !inPrint || field < 0) return;
+    if (field == (int)ReportField::GcodeState) {
+      if (type != JsonType::String) return;
+      size_t n = 0;  // keep it safe to echo in /printer
+      for (; *text && n < sizeof(incoming.text) - 1; text++) {
+        if (*text > ' ' && *text != '"' && *text != '\\') incoming.text[n++] = *text;
+      }
+      incoming.text[n] = '\0';
+      incoming.seen[field] = true;
+    } else if (type != JsonType::Literal && parseCentis(text, incoming.number[field])) {
+      incoming.seen[field] = true;  // numbers, or numbers sent as text
+    }
+    field = -1;
+  }
+
+  void clear() {
+    inPrint = false;
+    field = -1;
+    memset(&incoming, 0, sizeof(incoming));
+  }
+
+  PrinterFields incoming = {};
+
+private:
+  bool inPrint = false;
+  int  field = -1;
+};
+
+class StreamSink : public MqttPayloadSink {
+public:
+  void write(const uint8_t* data, size_t len) override;
+};
+
+JsonStream    stream;
+ReportHandler handler;
+StreamSink    sink;
+PrinterFields printer = {};
+Rule          rules[REPORT_RULES_MAX];
+size_t        ruleCount = 0;
+size_t        ruleErrors = 0;
+int           target = 0;  // speed the rules last asked for; 0 = none matched
+bool          runningOn = false;
+TaskId        runOnTask = -1;
+ReportStats   stats = {};
+
+void StreamSink::write(const uint8_t* data, size_t len) {
+  stats.bytes += len;
+  stream.feed(data, len, handler);
+}
+
+// "<field><op><value>:<speed>"; false if any part is malformed.
+bool parseRule(const char* s, size_t len, Rule& rule) {
+  const char* end = s + len;
+  const char* name = s;
+  while (s < end && ((*s >= 'a' && *s <= 'z') || *s == '_')) s++;
+  int index = fieldIndex(name, (size_t)(s - name));
+  if (index < 0 || s == end) return false;
+  rule.field = (ReportField)index;
+
+  bool orEqual = s + 1 < end && s[1] == '=';
+  switch (*s) {
+    case '=': rule.op = RuleOp::Eq; break;
+    case '!': if (!orEqual) return false; rule.op = RuleOp::Ne; break;
+    case '>': rule.op = orEqual ? RuleOp::Ge : RuleOp::Gt; break;
+    case '<': rule.op = orEqual ? RuleOp::Le : RuleOp::Lt; break;
+    default: return false;
+  }
+  s += (*s != '=' && orEqual) ? 2 : 1;
+
+  const char* colon = (const char*)memchr(s, ':', (size_t)(end - s));
+  if (!colon || colon == s || (size_t)(colon - s) >= sizeof(rule.text)) return false;
+  memcpy(rule.text, s, (size_t)(colon - s));
+  rule.text[colon - s] = '\0';
+  if (rule.field == ReportField::GcodeState) {
+    if (rule.op != RuleOp::Eq && rule.op != RuleOp::Ne) return false;
+  } else if (!parseCentis(rule.text, rule.number)) {
+    return false;
+  }
+
+  char speed[8];
+  size_t n = (size_t)(end - colon - 1);
+  if (n == 0 || n >= sizeof(speed)) return false;
+  memcpy(speed, colon + 1, n);
+  speed[n] = '\0';
+  return parseSpeedValue(speed, rule.speed);
+}
+
+void parseRules(const char* text) {
+  ruleCount = ruleErrors = 0;
+  while (*text) {
+    const char* end = text;
+    while (*end && *end != ';' && *end != '\n') end++;
+    const char* s = text;
+    while (s < end && *s == ' ') s++;
+    const char* e = end;
+    while (e > s && (e[-1] == ' ' || e[-1] == '\r')) e--;
+    if (e > s) {
+      if (ruleCount < REPORT_RULES_MAX && parseRule(s, (size_t)(e - s), rules[ruleCount])) ruleCount++;
+      else ruleErrors++;
+    }
+    text = *end ? end + 1 : end;
+  }
+  if (ruleErrors) LOG_WARN("report rules: %u malformed, ignored", (unsigned)ruleErrors);
+}
+
+bool textMatches(const char* alternatives, const char* value) {
+  size_t len = strlen(value);
+  for (const char* p = alternatives;;) {
+    const char* bar = strchr(p, '|');
+    size_t n = bar ? (size_t)(bar - p) : strlen(p);
+    if (n == len && strncmp(p, value, n) == 0) return true;
+    if (!bar) return false;
+    p = bar + 1;
+  }
+}
+
+bool matches(const Rule& rule) {
+  size_t f = (size_t)rule.field;
+  if (!printer.seen[f]) return false;
+  if (rule.field == ReportField::GcodeState) {
+    return textMatches(rule.text, printer.text) == (rule.op == RuleOp::Eq);
+  }
+  int32_t v = printer.number[f];
+  switch (rule.op) {
+    case RuleOp::Eq: return v == rule.number;
+    case RuleOp::Ne: return v != rule.number;
+    case RuleOp::Gt: return v > rule.number;
+    case RuleOp::Ge: return v >= rule.number;
+    case RuleOp::Lt: return v < rule.number;
+    case RuleOp::Le: return v <= rule.number;
+  }
+  return false;
+}
+
+// False if the fan queue was full; the caller keeps its state so the
+// command goes out again.
+bool send(int speed) {
+  int16_t batch[FAN_CHANNEL_COUNT];
+  for (int16_t& s : batch) s = (int16_t)speed;
+  if (!fanCommandPostBatch(FanCommandKind::Speed, batch)) {
+    LOG_WARN("printer: fan %d.%02d %% dropped, queue full", speed / SPEED_SCALE, speed % SPEED_SCALE);
+    return false;
+  }
+  stats.commands++;
+  LOG_INFO("printer %s: fan %d.%02d %%", printer.seen[(size_t)ReportField::GcodeState] ? printer.text : "?",
+           speed / SPEED_SCALE, speed % SPEED_SCALE);
+  return true;
+}
+
+void runOnDone(void*) {
+  if (send(0)) {
+    runningOn = false;
+  } else {
+    schedulerArm(runOnTask, REPORT_RUNON_RETRY_MS);
+  }
+}
+
+// Edge-triggered: only a change of the rule outcome sends a command. The
+// state moves on only once the command is queued.
+void evaluate() {
+  int speed = 0;
+  for (size_t i = 0; i < ruleCount; i++) {
+    if (matches(rules[i]) && rules[i].speed > speed) speed = rules[i].speed;
+  }
+  if (speed > 0) {
+    if (speed == target || !send(speed)) return;
+    if (runningOn) {
+      schedulerCancel(runOnTask);
+      runningOn = false;
+    }
+  } else if (target > 0) {
+    bool runOn = currentConfig.report_runon_s > 0 && runOnTask >= 0;
+    int runOnSpeed = currentConfig.report_runon_speed > 0 ? currentConfig.report_runon_speed : target;
+    if (!send(runOn ? runOnSpeed : 0)) return;
+    if (runOn) {
+      runningOn = true;
+      schedulerArm(runOnTask, (uint32_t)currentConfig.report_runon_s * 1000);
+    }
+  }
+  target = speed;
+}
+
+void appendNumber(char* out, size_t size, size_t& len, const char* key, size_t f) {
+  int n;
+  if (!printer.seen[f]) {
+    n = snprintf(out + len, size - len, ",\"%s\":null", key);
+  } else {
+    int32_t v = printer.number[f];
+    uint32_t a = v < 0 ? (uint32_t)-v : (uint32_t)v;
+    n = snprintf(out + len, size - len, ",\"%s\":%s%lu.%02lu", key, v < 0 ? "-" : "",
+                 (unsigned long)(a / 100), (unsigned long)(a % 100));
+  }
+  if (n > 0) len = len + (size_t)n < size ? len + (size_t)n : size - 1;
+}
+
+}  // namespace
+
+MqttPayloadSink& printerReportSink() {
+  return sink;
+}
+
+void printerReportEnd(bool isReport) {
+  if (isReport) {
+    stats.reports++;
+    if (!stream.complete()) stats.cut++;  // tokens that did finish are still good
+    const PrinterFields& in = handler.incoming;
+    for (size_t f = 0; f < kFieldCount; f++) {
+      if (!in.seen[f]) continue;
+      printer.seen[f] = true;
+      printer.number[f] = in.number[f];
+    }
+    if (in.seen[(size_t)ReportField::GcodeState]) memcpy(printer.text, in.text, sizeof(printer.text));
+    evaluate();
+  }
+  stream.reset();
+  handler.clear();
+}
+
+void printerReportBegin() {
+  if (runOnTask < 0) runOnTask = schedulerAddOneShot("report-runon", runOnDone);
+  parseRules(currentConfig.report_rules);
+}
+
+bool printerReportEnabled() {
+  return currentConfig.report_topic[0] != '\0';
+}
+
+size_t printerReportRules() {
+  return ruleCount;
+}
+
+int printerReportTarget() {
+  return target;
+}
+
+const ReportStats& printerReportStats() {
+  return stats;
+}
+
+size_t printerReportRender(char* out, size_t size) {
+  size_t len = 0;
+  auto append = [&](int n) {
+    if (n > 0) len = len + (size_t)n < size ? len + (size_t)n : size - 1;
+  };
+  const bool state = printer.seen[(size_t)ReportField::GcodeState];
+  append(snprintf(out, size, "{\"enabled\":%s,\"topic\":\"%s\",\"gcode_state\":%s%s%s",
+                  printerReportEnabled() ? "true" : "false", currentConfig.report_topic,
+                  state ? "\"" : "", state ? printer.text : "null", state ? "\"" : ""));
+  for (size_t f = 1; f < kFieldCount; f++) appendNumber(out, size, len, kFieldNames[f], f);
+  append(snprintf(out + len, size - len,
+                  ",\"rules\":%u,\"rule_errors\":%u,\"target\":%d.%02d,\"run_on\":%s,"
+                  "\"reports\":%lu,\"cut\":%lu,\"bytes\":%lu,\"commands\":%lu}",
+                  (unsigned)ruleCount, (unsigned)ruleErrors, target / SPEED_SCALE, target % SPEED_SCALE,
+                  runningOn ? "true" : "false", (unsigned long)stats.reports, (unsigned long)stats.cut,
+                  (unsigned long)stats.bytes, (unsigned long)stats.commands));
+  return len;
+}
+
+void printerReportReset() {
+  stream.reset();
+  handler.clear();
+  printer = PrinterFields{};
+  target = 0;
+  runningOn = false;
+  runOnTask = -1;
+  stats = ReportStats{};
+}
@@ -0,0 +1,53 @@
+#include "rtos.h"
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+struct RtosTask {
+  TaskHandle_t  handle;
+  RtosTaskFn    fn;
+  void*         ctx;
+  volatile bool inUse;
+  volatile bool finished;
+};
+
+static RtosTask taskPool[2];
+
+static void trampoline(void* arg) {
+  RtosTask* task = static_cast<RtosTask*>(arg);
+  task->fn(task->ctx);
+  task->finished = true;
+  vTaskDelete(nullptr);
+}
+
+RtosTask* rtosTaskStart(const char* name, RtosTaskFn fn, void* ctx, uint8_t priority, uint32_t stackBytes) {
+  for (RtosTask& task : taskPool) {
+    if (task.inUse) continue;
+    task.fn = fn;
+    task.ctx = ctx;
+    task.finished = false;
+    task.inUse = true;
+    // IDF's FreeRTOS takes the stack depth in bytes.
+    if (xTaskCreate(trampoline, name, stackBytes, &task, priority, &task.handle) != pdPASS) {
+      task.inUse = false;
+      return nullptr;
+    }
+    return &task;
+  }
+  return nullptr;
+}
+
+void rtosNotify(RtosTask* task) {
+  if (task && !task->finished) xTaskNotifyGive(task->handle);
+}
+
+void rtosWaitNotify(uint32_t timeoutMs) {
+  ulTaskNotifyTake(pdTRUE, timeoutMs == RTOS_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs));
+}
+
+void rtosTaskJoin(RtosTask* task) {
+  if (!task) return;
+  while (!task->finished) vTaskDelay(1);
+  task->inUse = false;
+}
@@ -0,0 +1,242 @@
+#include "scheduler.h"
+
+#include <cstdio>
+
+#include "hal.h"
+#include "metrics.h"
+
+namespace {
+
+enum class Kind : uint8_t { Periodic, OneShot, Ready };
+
+constexpr int8_t kNone = -1;
+
+struct Task {
+  const char* name;
+  Kind     kind;
+  TaskFn   fn;
+  ReadyFn  ready;
+  void*    ctx;
+  uint32_t periodTicks;
+  uint32_t deadlineTick;
+  bool     armed;
+  int8_t   next;  // wheel slot chain
+  TaskStats stats;
+};
+
+Task     tasks[SCHED_MAX_TASKS];
+size_t   taskCount = 0;
+int8_t   wheel[SCHED_WHEEL_SLOTS];
+bool     wheelInit = false;
+uint32_t wheelTick = 0;   // last tick whose slot has been processed
+uint32_t tickCount = 0;   // monotonic ticks since init; survives millis() wrap
+uint32_t tickRemMs = 0;   // ms accumulated towards the next tick
+uint32_t lastMs = 0;
+size_t   armedCount = 0;
+size_t   readyCount = 0;
+
+inline uint32_t toTicksCeil(uint32_t ms) { return (ms + SCHED_TICK_MS - 1) / SCHED_TICK_MS; }
+inline bool tickDue(uint32_t deadline, uint32_t now) { return (int32_t)(deadline - now) <= 0; }
+
+uint32_t nowTick() {
+  uint32_t ms = halMillis();
+  tickRemMs += ms - lastMs;
+  lastMs = ms;
+  tickCount += tickRemMs / SCHED_TICK_MS;
+  tickRemMs %= SCHED_TICK_MS;
+  return tickCount;
+}
+
+void initWheel() {
+  if (wheelInit) return;
+  for (int8_t& head : wheel) head = kNone;
+  lastMs = halMillis();
+  tickCount = 0;
+  tickRemMs = 0;
+  wheelTick = 0;
+  wheelInit = true;
+}
+
+void unlink(int8_t id) {
+  int8_t* link = &wheel[tasks[id].deadlineTick % SCHED_WHEEL_SLOTS];
+  while (*link != kNone) {
+    if (*link == id) {
+      *link = tasks[id].next;
+      tasks[id].next = kNone;
+      return;
+    }
+    link = &tasks[*link].next;
+  }
+}
+
+void insert(int8_t id, uint32_t deadlineTick) {
+  Task& t = tasks[id];
+  t.deadlineTick = deadlineTick;
+  int8_t& head = wheel[deadlineTick % SCHED_WHEEL_SLOTS];
+  t.next = head;
+  head = id;
+}
+
+TaskId addTask(const char* name, Kind kind, TaskFn fn, ReadyFn ready, void* ctx, uint32_t periodMs) {
+  initWheel();
+  if (taskCount == SCHED_MAX_TASKS || fn == nullptr) return kNone;
+  int8_t id = (int8_t)taskCount++;
+  Task& t = tasks[id];
+  t = Task{};
+  t.name = name;
+  t.kind = kind;
+  t.fn = fn;
+  t.ready = ready;
+  t.ctx = ctx;
+  t.periodTicks = periodMs ? toTicksCeil(periodMs) : 1;
+  t.next = kNone;
+  t.stats.name = name;
+  if (kind == Kind::Ready) readyCount++;
+  return id;
+}
+
+void runTask(Task& t, uint32_t lateMs) {
+  uint32_t start = hal.clock->micros();
+  t.fn(t.ctx);
+  uint32_t elapsed = hal.clock->micros() - start;
+  t.stats.runs++;
+  t.stats.totalUs += elapsed;
+  if (elapsed > t.stats.maxUs) t.stats.maxUs = elapsed;
+  if (lateMs > t.stats.maxLateMs) t.stats.maxLateMs = lateMs;
+}
+
+// Pops every expired timer out of the slots between wheelTick and now.
+size_t collectDue(uint32_t now, int8_t* due, size_t cap) {
+  size_t count = 0;
+  uint32_t span = now - wheelTick;
+  if (span > SCHED_WHEEL_SLOTS) span = SCHED_WHEEL_SLOTS;  // a full turn visits every slot
+  for (uint32_t i = 1; i <= span && count < cap; i++) {
+    int8_t* link = &wheel[(wheelTick + i) % SCHED_WHEEL_SLOTS];
+    while (*link != kNone && count < cap) {
+      int8_t id = *link;
+      if (tickDue(tasks[id].deadlineTick, now)) {
+        *link = tasks[id].next;
+        tasks[id].next = kNone;
+        due[count++] = id;
+      } else {
+        link = &tasks[id].next;  // later rotation
+      }
+    }
+  }
+  // If `cap` cut the scan short, the rest stays linked and is picked up next pass.
+  if (count < cap) wheelTick = now;
+  return count;
+}
+
+}  // namespace
+
+TaskId schedulerAddPeriodic(const char* name, uint32_t periodMs, TaskFn fn, void* ctx) {
+  TaskId id = addTask(name, Kind::Periodic, fn, nullptr, ctx, periodMs);
+  if (id >= 0) schedulerArm(id, periodMs);
+  return id;
+}
+
+TaskId schedulerAddOneShot(const char* name, TaskFn fn, void* ctx) {
+  return addTask(name, Kind::OneShot, fn, nullptr, ctx, 0);
+}
+
+TaskId schedulerAddReady(const char* name, ReadyFn ready, TaskFn fn, void* ctx) {
+  return addTask(name, Kind::Ready, fn, ready, ctx, 0);
+}
+
+void schedulerArm(TaskId id, uint32_t delayMs) {
+  if (id < 0 || (size_t)id >= taskCount || tasks[id].kind == Kind::Ready) return;
+  Task& t = tasks[id];
+  if (t.armed) unlink(id);
+  else armedCount++;
+  t.armed = true;
+  // Round up so a timer never fires early, and never into an already processed slot.
+  uint32_t now = nowTick();
+  uint32_t deadline = now + toTicksCeil(tickRemMs + delayMs);
+  if (tickDue(deadline, wheelTick)) deadline = wheelTick + 1;
+  insert(id, deadline);
+}
+
+void schedulerCancel(TaskId id) {
+  if (id < 0 || (size_t)id >= taskCount || !tasks[id].armed) return;
+  unlink(id);
+  tasks[id].armed = false;
+  armedCount--;
+}
+
+bool schedulerArmed(TaskId id) {
+  return id >= 0 && (size_t)id < taskCount && tasks[id].armed;
+}
+
+uint32_t schedulerRunOnce() {
+  initWheel();
+  uint32_t startUs = hal.clock->micros();
+  uint32_t now = nowTick();
+
+  int8_t due[SCHED_MAX_TASKS];
+  size_t dueCount = collectDue(now, due, SCHED_MAX_TASKS);
+  for (size_t i = 0; i < dueCount; i++) {
+    Task& t = tasks[due[i]];
+    uint32_t lateMs = (now - t.deadlineTick) * SCHED_TICK_MS;
+    if (t.kind == Kind::Periodic) {
+      // Next deadline on the original grid, skipping periods we were too late for.
+      uint32_t next = t.deadlineTick + t.periodTicks;
+      if (tickDue(next, now)) next = now + t.periodTicks + (tickRemMs ? 1 : 0);
+      insert(due[i], next);
+    } else {
+      t.armed = false;
+      armedCount--;
+    }
+    runTask(t, lateMs);
+  }
+
+  for (size_t i = 0; i < taskCount; i++) {
+    Task& t = tasks[i];
+    if (t.kind == Kind::Ready && (!t.ready || t.ready(t.ctx))) runTask(t, 0);
+  }
+  metricsObserve(MetricHist::Loop, hal.clock->micros() - startUs);
+
+  if (readyCount > 0 || armedCount == 0) return SCHED_MAX_IDLE_MS;
+  // Only timers left: sleep until the nearest one.
+  uint32_t nearest = UINT32_MAX;
+  now = nowTick();
+  for (size_t i = 0; i < taskCount; i++) {
+    if (!tasks[i].armed) continue;
+    uint32_t left = tickDue(tasks[i].deadlineTick, now) ? 0 : tasks[i].deadlineTick - now;
+    if (left < nearest) nearest = left;
+  }
+  return nearest * SCHED_TICK_MS;
+}
+
+bool schedulerStats(TaskId id, TaskStats& out) {
+  if (id < 0 || (size_t)id >= taskCount) return false;
+  out = tasks[id].stats;
+  return true;
+}
+
+size_t schedulerRenderStats(char* out, size_t size) {
+  if (size == 0) return 0;
+  size_t len = 0;
+  auto append = [&](int n) {
+    if (n > 0) len += (size_t)n;
+    if (len >= size) len = size - 1;
+  };
+  append(snprintf(out, size, "{\"uptime_ms\":%lu,\"tasks\":[", (unsigned long)halMillis()));
+  for (size_t i = 0; i < taskCount; i++) {
+    const TaskStats& s = tasks[i].stats;
+    append(snprintf(out + len, size - len,
+                    "%s{\"name\":\"%s\",\"runs\":%lu,\"total_us\":%llu,\"max_us\":%lu,\"max_late_ms\":%lu}",
+                    i ? "," : "", s.name, (unsigned long)s.runs, (unsigned long long)s.totalUs,
+                    (unsigned long)s.maxUs, (unsigned long)s.maxLateMs));
+  }
+  append(snprintf(out + len, size - len, "]}"));
+  return len;
+}
+
+void schedulerReset() {
+  taskCount = 0;
+  armedCount = 0;
+  readyCount = 0;
+  wheelInit = false;
+  initWheel();
+}
@@ -0,0 +1,235 @@
+#include "speed_command.h"
+
+#include <cstring>
+
+#include "fan_control.h"
+#include "fan_task.h"
+
+namespace {
+
+// Anything above this is clamped by the callers anyway; capping keeps the
+// accumulator from overflowing on long digit runs.
+constexpr long kScanCap = 1000000;
+
+inline bool isSpace(uint8_t c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+inline bool isDigit(uint8_t c) { return c >= '0' && c <= '9'; }
+
+inline int clampSpeed(long speed) {
+  return speed < 0 ? 0 : (speed > SPEED_FULL ? SPEED_FULL : (int)speed);
+}
+
+// Raw duty as the speed share it gives on this unit's fan curve.
+inline int rawDutyToSpeed(long duty) {
+  if (duty < 0) duty = 0;
+  if (duty > DUTY_MAX) duty = DUTY_MAX;
+  return dutyToSpeed((int)duty);
+}
+
+// [+-]digits spanning exactly [p, end), like strtol with a full-match check.
+bool scanWholeInt(const uint8_t* p, const uint8_t* end, long& out) {
+  while (p < end && isSpace(*p)) p++;
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) negative = (*p++ == '-');
+  if (p == end || !isDigit(*p)) return false;
+  long v = 0;
+  while (p < end && isDigit(*p)) {
+    if (v < kScanCap) v = v * 10 + (*p - '0');
+    p++;
+  }
+  if (p != end) return false;
+  out = negative ? -v : v;
+  return true;
+}
+
+// [+-]digits[.digits] starting at p, in 0.01 units; advances p past it.
+// A third decimal rounds half up, later ones are ignored.
+bool scanFixed(const uint8_t*& p, const uint8_t* end, long& out) {
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) negative = (*p++ == '-');
+  bool sawDigit = false;
+  long whole = 0;
+  while (p < end && isDigit(*p)) {
+    if (whole < kScanCap) whole = whole * 10 + (*p - '0');
+    sawDigit = true;
+    p++;
+  }
+  long frac = 0;
+  if (p < end && *p == '.') {
+    p++;
+    int digits = 0;
+    bool roundUp = false;
+    while (p < end && isDigit(*p)) {
+      if (digits < 2) frac = frac * 10 + (*p - '0');
+      else if (digits == 2) roundUp = *p >= '5';
+      digits++;
+      sawDigit = true;
+      p++;
+    }
+    if (digits == 1) frac *= 10;
+    if (roundUp) frac++;
+  }
+  if (!sawDigit) return false;
+  long v = whole * SPEED_SCALE + frac;
+  out = negative ? -v : v;
+  return true;
+}
+
+const uint8_t* findToken(const uint8_t* p, const uint8_t* end, const char* token) {
+  size_t n = strlen(token);
+  for (; p + n <= end; p++) {
+    if (memcmp(p, token, n) == 0) return p;
+  }
+  return nullptr;
+}
+
+// Value of the first "speed" (else "percent") key: [-]digits[.digits], optionally quoted.
+bool scanJsonSpeed(const uint8_t* p, const uint8_t* end, int& outSpeed) {
+  const char* key = "speed";
+  const uint8_t* at = findToken(p, end, key);
+  if (!at) {
+    key = "percent";
+    at = findToken(p, end, key);
+  }
+  if (!at) return false;
+  p = at + strlen(key);
+  while (p < end && *p != ':') p++;
+  if (p == end) return false;
+  p++;
+  while (p < end && isSpace(*p)) p++;
+  if (p < end && *p == '"') p++;
+  long speed;
+  if (!scanFixed(p, end, speed)) return false;
+  outSpeed = clampSpeed(speed);
+  return true;
+}
+
+// Array value of the first "speed" (else "percent") key.
+bool scanJsonSpeedList(const uint8_t* p, const uint8_t* end, int16_t* out, size_t channels) {
+  const char* key = "speed";
+  const uint8_t* at = findToken(p, end, key);
+  if (!at) {
+    key = "percent";
+    at = findToken(p, end, key);
+  }
+  if (!at) return false;
+  p = at + strlen(key);
+  while (p < end && *p != ':') p++;
+  if (p == end) return false;
+  p++;
+  while (p < end && isSpace(*p)) p++;
+  if (p == end || *p++ != '[') return false;
+  for (size_t i = 0; i < channels; i++) out[i] = FAN_BATCH_KEEP;
+
+  for (size_t i = 0;; i++) {
+    while (p < end && isSpace(*p)) p++;
+    if (p < end && *p == ']' && i == 0) return false;  // empty list
+    if (end - p >= 4 && memcmp(p, "null", 4) == 0) {
+      p += 4;
+    } else {
+      bool quoted = p < end && *p == '"';
+      if (quoted) p++;
+      long speed;
+      if (!scanFixed(p, end, speed)) return false;
+      if (quoted && (p == end || *p++ != '"')) return false;
+      if (i < channels) out[i] = (int16_t)clampSpeed(speed);
+    }
+    while (p < end && isSpace(*p)) p++;
+    if (p == end) return false;
+    if (*p == ']') return true;
+    if (*p++ != ',') return false;
+  }
+}
+
+// Value of a "rpm" key: non-negative whole number, optionally quoted.
+bool scanJsonRpm(const uint8_t* p, const uint8_t* end, int& outRpm) {
+  const uint8_t* at = findToken(p, end, "\"rpm\"");
+  if (!at) return false;
+  p = at + 5;
+  while (p < end && isSpace(*p)) p++;
+  if (p == end || *p++ != ':') return false;
+  while (p < end && isSpace(*p)) p++;
+  bool quoted = p < end && *p == '"';
+  if (quoted) p++;
+  const uint8_t* digits = p;
+  while (p < end && isDigit(*p)) p++;
+  long v;
+  if (p == digits || !scanWholeInt(digits, p, v)) return false;
+  outRpm = v > 0x7fff ? 0x7fff : (int)v;
+  return true;
+}
+
+}  // namespace
+
+bool parseRpmCommand(const uint8_t* payload, size_t length, int& outRpm) {
+  if (!payload) return false;
+  const uint8_t* p = payload;
+  const uint8_t* end = payload + length;
+  while (p < end && isSpace(*p)) p++;
+  while (end > p && isSpace(end[-1])) end--;
+  size_t n = (size_t)(end - p);
+
+  if (n >= 4 && (memcmp(p, "RPM:", 4) == 0 || memcmp(p, "rpm:", 4) == 0)) {
+    long v;
+    if (!scanWholeInt(p + 4, end, v) || v < 0) return false;
+    outRpm = v > 0x7fff ? 0x7fff : (int)v;
+    return true;
+  }
+  if (n >= 2 && p[0] == '{' && end[-1] == '}') {
+    return scanJsonRpm(p + 1, end - 1, outRpm);
+  }
+  return false;
+}
+
+bool parseSpeedCommand(const uint8_t* payload, size_t length, int& outSpeed) {
+  if (!payload) return false;
+  const uint8_t* p = payload;
+  const uint8_t* end = payload + length;
+  while (p < end && isSpace(*p)) p++;
+  while (end > p && isSpace(end[-1])) end--;
+  size_t n = (size_t)(end - p);
+
+  if (n >= 4 && (memcmp(p, "RAW:", 4) == 0 || memcmp(p, "raw:", 4) == 0)) {
+    long v;
+    if (!scanWholeInt(p + 4, end, v)) return false;
+    outSpeed = rawDutyToSpeed(v);
+    return true;
+  }
+
+  if (n >= 2 && p[0] == '{' && end[-1] == '}') {
+    return scanJsonSpeed(p + 1, end - 1, outSpeed);
+  }
+
+  long val;
+  if (scanWholeInt(p, end, val)) {
+    outSpeed = val <= 100 ? clampSpeed(val * SPEED_SCALE) : rawDutyToSpeed(val);
+    return true;
+  }
+  if (!scanFixed(p, end, val) || p != end) return false;
+  outSpeed = clampSpeed(val);
+  return true;
+}
+
+bool parseSpeedBatch(const uint8_t* payload, size_t length, int16_t* outSpeeds, size_t channels) {
+  if (!payload) return false;
+  const uint8_t* p = payload;
+  const uint8_t* end = payload + length;
+  while (p < end && isSpace(*p)) p++;
+  while (end > p && isSpace(end[-1])) end--;
+  if (end - p < 2 || p[0] != '{' || end[-1] != '}') return false;
+  return scanJsonSpeedList(p + 1, end - 1, outSpeeds, channels);
+}
+
+bool parseSpeedValue(const char* text, int& outSpeed) {
+  if (!text) return false;
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(text);
+  const uint8_t* end = p + strlen(text);
+  while (p < end && isSpace(*p)) p++;
+  while (end > p && isSpace(end[-1])) end--;
+  long val;
+  if (!scanFixed(p, end, val) || p != end) return false;
+  outSpeed = clampSpeed(val);
+  return true;
+}
@@ -0,0 +1,259 @@
+#include "web_api.h"
+
+#include <Arduino.h>
+#include <cstdlib>
+#include <cstring>
+
+#include "boot.h"
+#include "config.h"
+#include "fan_control.h"
+#include "fan_curve.h"
+#include "fan_profile.h"
+#include "fan_rpm.h"
+#include "fan_state.h"
+#include "fan_task.h"
+#include "hal.h"
+#include "logging.h"
+#include "metrics.h"
+#include "mqtt_link.h"
+#include "printer_report.h"
+#include "scheduler.h"
+#include "speed_command.h"
+#include "web_ui_gz.h"
+
+// ========= HTTP / UI =========
+// The page lives in web/index.html; scripts/embed_web_ui.py gzips it into
+// flash at build time. Browsers revalidate with If-None-Match and get a
+// bodyless 304 while the firmware's page is unchanged.
+void handleRoot() {
+  HttpServer& server = *hal.http;
+  char ifNoneMatch[64];
+  server.header("If-None-Match", ifNoneMatch, sizeof(ifNoneMatch));
+  server.sendHeader("ETag", WEB_UI_ETAG);
+  server.sendHeader("Cache-Control", "no-cache");
+  if (strstr(ifNoneMatch, WEB_UI_ETAG) != nullptr) {
+    server.send(304, "text/html", "", 0);
+    return;
+  }
+  server.sendHeader("Content-Encoding", "gzip");
+  server.send(200, "text/html", reinterpret_cast<const char*>(WEB_UI_GZ), WEB_UI_GZ_LEN);
+}
+
+// Speed setpoints for one channel persist as that channel's default.
+static void rememberSpeed(size_t ch, int requested) {
+  if (requested <= 0) return;
+  currentConfig.fan_default_speed[ch] = max(requested, SPEED_MIN_RUN); // write-behind
+  configMarkDirty(configFanSpeedField(ch));
+}
+
+// "speed=60,42.5,,30": one setpoint per channel in order, blanks keep theirs.
+static void postSpeedList(const char* list) {
+  int16_t batch[FAN_CHANNEL_COUNT];
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) batch[i] = FAN_BATCH_KEEP;
+  char item[16];
+  for (size_t i = 0; i < FAN_CHANNEL_COUNT && *list; i++) {
+    const char* comma = strchr(list, ',');
+    size_t n = comma ? (size_t)(comma - list) : strlen(list);
+    if (n > 0 && n < sizeof(item)) {
+      memcpy(item, list, n);
+      item[n] = '\0';
+      int requested = 0;
+      parseSpeedValue(item, requested);
+      batch[i] = (int16_t)requested;
+      rememberSpeed(i, requested);
+    }
+    if (!comma) break;
+    list = comma + 1;
+  }
+  fanCommandPostBatch(FanCommandKind::Adjust, batch);
+}
+
+void handleFanApi() {
+  HttpServer& server = *hal.http;
+  char value[16 * FAN_CHANNEL_MAX];
+
+  // ?ch=<n> addresses one channel; without it speed/rpm go to channel 0 and
+  // on/off switches every channel in one batch. Checked before anything else
+  // so a refused request changes nothing.
+  bool addressed = server.arg("ch", value, sizeof(value)) && value[0] != '\0';
+  int ch = 0;
+  if (addressed) {
+    char* end = nullptr;
+    long n = strtol(value, &end, 10);
+    if (*end != '\0' || n < 0 || n >= (long)FAN_CHANNEL_COUNT) {
+      static const char kBody[] = "{\"error\":\"no such channel\"}";
+      server.send(400, "application/json", kBody, sizeof(kBody) - 1);
+      return;
+    }
+    ch = (int)n;
+  }
+
+  // New: allow toggling power-on default via UI
+  if (server.hasArg("default_on")) {
+    server.arg("default_on", value, sizeof(value));
+    bool v = parseBoolParam(value);
+    currentConfig.fan_default_on = v;
+    configMarkDirty(CFG_FAN_DEF_ON);
+    fanStateRefresh();
+  }
+
+  // Ramp limits: ms for a full 0 -> 100 % swing, applied to the next command.
+  if (server.hasArg("ramp_up") || server.hasArg("ramp_down")) {
+    if (server.arg("ramp_up", value, sizeof(value))) {
+      currentConfig.fan_ramp_up_ms = constrain(atoi(value), 0, FAN_RAMP_MAX_MS);
+      configMarkDirty(CFG_RAMP_UP);
+    }
+    if (server.arg("ramp_down", value, sizeof(value))) {
+      currentConfig.fan_ramp_down_ms = constrain(atoi(value), 0, FAN_RAMP_MAX_MS);
+      configMarkDirty(CFG_RAMP_DOWN);
+    }
+    fanSetRampTimes(currentConfig.fan_ramp_up_ms, currentConfig.fan_ramp_down_ms);
+  }
+
+  if (server.hasArg("state")) {
+    server.arg("state", value, sizeof(value));
+    bool on = strcmp(value, "on") == 0;
+    if (on || strcmp(value, "off") == 0) {
+      FanCommandKind kind = on ? FanCommandKind::On : FanCommandKind::Speed;
+      if (addressed) {
+        fanCommandPost(kind, on ? currentConfig.fan_default_speed[ch] : 0, (uint8_t)ch);
+      } else {
+        int16_t batch[FAN_CHANNEL_COUNT];
+        for (size_t i = 0; i < FAN_CHANNEL_COUNT; i++) batch[i] = on ? currentConfig.fan_default_speed[i] : 0;
+        fanCommandPostBatch(kind, batch);
+      }
+    }
+  } else if (server.hasArg("rpm")) {
+    server.arg("rpm", value, sizeof(value));
+    fanCommandPost(FanCommandKind::Rpm, constrain(atoi(value), 0, FAN_RPM_MAX), (uint8_t)ch);
+  } else if (server.hasArg("speed")) {
+    server.arg("speed", value, sizeof(value));
+    if (!addressed && strchr(value, ',') != nullptr) {
+      postSpeedList(value);
+    } else {
+      int requested = 0;  // percent with up to two decimals; junk reads as 0 like atoi() did
+      parseSpeedValue(value, requested);
+      rememberSpeed(ch, requested);
+      fanCommandPost(FanCommandKind::Adjust, requested, (uint8_t)ch);
+    }
+  }
+  // The fan task outranks loop(), so the command has normally run by now;
+  // pick up its status so the reply already shows the new state.
+  fanStatusDrain();
+  const FanStateSnapshot& state = fanStateSnapshot();
+  server.sendHeader("ETag", state.etag);
+  server.send(200, "application/json", state.json, state.length);
+}
+
+// Pollers that already hold the current version, either as an ETag
+// (If-None-Match) or as ?since=<version>, get a bodyless 304.
+void handleStatusApi() {
+  HttpServer& server = *hal.http;
+  const FanStateSnapshot& state = fanStateSnapshot();
+  char since[16];
+  char ifNoneMatch[64];
+  server.arg("since", since, sizeof(since));
+  server.header("If-None-Match", ifNoneMatch, sizeof(ifNoneMatch));
+  server.sendHeader("ETag", state.etag);
+  server.sendHeader("Cache-Control", "no-cache");
+
+  bool sinceCurrent = since[0] != '\0' && strtoul(since, nullptr, 10) == state.version;
+  if (sinceCurrent || strstr(ifNoneMatch, state.etag) != nullptr) {
+    server.send(304, "application/json", "", 0);
+    return;
+  }
+  server.send(200, "application/json", state.json, state.length);
+}
+
+// Per-task run counts and run times from the scheduler.
+void handleTasksApi() {
+  static char body[2048];
+  size_t len = schedulerRenderStats(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "application/json", body, len);
+}
+
+// Write-behind counters for the config cache.
+void handleNvsApi() {
+  char body[160];
+  size_t len = configRenderStats(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "application/json", body, len);
+}
+
+// Boot phase timestamps (ms since power-up) of this boot.
+void handleBootApi() {
+  char body[256];
+  size_t len = bootRenderTimeline(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "application/json", body, len);
+}
+
+// Fan curve in use and calibration progress; ?start=1 begins a sweep.
+void handleCalibrateApi() {
+  if (hal.http->hasArg("start")) fanCommandPost(FanCommandKind::Calibrate, 0);
+  char body[256];
+  size_t len = fanCurveRender(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "application/json", body, len);
+}
+
+// Speed profile: ?steps=<profile> uploads and starts one, ?stop=1 stops it;
+// either way the reply is the progress and the last upload. 503 if the fan
+// command queue cannot take the upload.
+void handleProfileApi() {
+  HttpServer& server = *hal.http;
+  if (server.hasArg("stop")) {
+    fanProfileStop();
+  } else if (server.hasArg("steps")) {
+    char text[FAN_PROFILE_TEXT_BYTES];
+    size_t n = server.arg("steps", text, sizeof(text));
+    FanProfile profile;
+    if (n + 1 >= sizeof(text) || !fanProfileParse(text, n, profile)) {
+      static const char kBody[] = "{\"error\":\"bad profile\"}";
+      server.send(400, "application/json", kBody, sizeof(kBody) - 1);
+      return;
+    }
+    if (!fanProfileStart(profile)) {
+      static const char kBody[] = "{\"error\":\"fan busy\"}";
+      server.send(503, "application/json", kBody, sizeof(kBody) - 1);
+      return;
+    }
+  }
+  fanStatusDrain();  // as /fan: the reply shows the first step
+  char body[FAN_PROFILE_TEXT_BYTES + 96];
+  size_t len = fanProfileRender(body, sizeof(body));
+  server.sendHeader("Cache-Control", "no-cache");
+  server.send(200, "application/json", body, len);
+}
+
+// Printer fields from the last reports, the rule outcome and stream counters.
+void handlePrinterApi() {
+  char body[384];
+  size_t len = printerReportRender(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "application/json", body, len);
+}
+
+// Prometheus text format; too big for the loop task's stack, and only the
+// loop task serves HTTP, so one static buffer will do.
+void handleMetricsApi() {
+  static char body[METRICS_RENDER_BYTES];
+  size_t len = metricsRender(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "text/plain; version=0.0.4", body, len);
+}
+
+// The latest formatted log lines, oldest first; what has not been drained
+// yet shows up on the next request.
+void handleLogApi() {
+  static char body[LOG_HISTORY_BYTES + 1];
+  size_t len = logRenderHistory(body, sizeof(body));
+  hal.http->sendHeader("Cache-Control", "no-cache");
+  hal.http->send(200, "text/plain", body, len);
+}
+
+void notFound() {
+  static const char kBody[] = "Not found";
+  hal.http->send(404, "text/plain", kBody, sizeof(kBody) - 1);
+}